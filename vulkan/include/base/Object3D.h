@@ -9,6 +9,8 @@
 #include <glm/gtx/matrix_decompose.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 
 namespace vkx {
 
@@ -39,6 +41,18 @@ namespace vkx {
 			glm::mat4 transfMatrix;
 			glm::mat4 viewMatrix;
 
+			// moved by something every frame (physics), static objects' shadows can be cached
+			bool dynamic = false;
+
+			// never reused, unlike the object's address, so command buffer signatures can tell a new object
+			// from the one it replaced
+			uint64_t id = nextId();
+
+			static uint64_t nextId() {
+				static std::atomic<uint64_t> next{ 0 };
+				return ++next;
+			}
+
 
 
 			/* TRANSLATION */
@@ -1,3 +1,6 @@
 #pragma once
 
-#define USE_SDL2 1
\ No newline at end of file
+#define USE_SDL2 1
+
+// upper bound for settings.framesInFlight, per frame resources are sized by this
+#define MAX_FRAMES_IN_FLIGHT 3
@@ -191,6 +191,36 @@ namespace vkx
 				vk::Semaphore textOverlayComplete;
 			} semaphores;
 
+			// per frame in flight synchronization
+			// semaphores.presentComplete / renderComplete point at the current frame's pair
+			struct FrameSync {
+				// signaled when the frame's last submit has finished on the gpu
+				vk::Fence fence;
+				vk::Semaphore presentComplete;
+				vk::Semaphore renderComplete;
+				// when input was sampled for the frame, used for the latency readout
+				std::chrono::high_resolution_clock::time_point tInput;
+				bool submitted = false;
+				// latency already recorded for the last submit
+				bool measured = false;
+			};
+			std::vector<FrameSync> frames;
+			// index into frames (and every other per frame resource), not the swap chain image
+			uint32_t currentFrame = 0;
+
+			// latency / throughput readout, averaged over the fps update interval
+			struct {
+				// input sampled -> gpu finished the frame
+				float latencyMS = 0.0f;
+				// cpu time blocked waiting for a frame slot to free up
+				float fenceWaitMS = 0.0f;
+
+				float latencyAccumMS = 0.0f;
+				float fenceWaitAccumMS = 0.0f;
+				uint32_t samples = 0;
+				uint32_t waits = 0;
+			} frameStats;
+
 			// Simple texture loader
 			vkx::TextureLoader *textureLoader{ nullptr };
 
@@ -233,10 +263,18 @@ namespace vkx
 				bool SSAO = true;
 				// enable shadow mapping
 				bool shadows = true;
+				// number of frames the cpu can record ahead of the gpu (1 - MAX_FRAMES_IN_FLIGHT, -framesinflight N)
+				uint32_t framesInFlight = 2;
+				// threads recording the shadow / g-buffer chunks, 0 = one per core minus the main thread
+				uint32_t recordingThreads = 0;
+				// stream baked (.vtex) diffuse maps through the virtual texture cache (-virtualtextures), -bakevt <image> bakes one
+				bool virtualTexturing = false;
 
 				// shadow mapping:
 				float depthBiasConstant = 1.25f;
 				float depthBiasSlope = 1.75f;
+				// time every shadow map path once the scene is up (-shadowbenchmark)
+				bool shadowBenchmark = false;
 
 
 				//struct PhysicsSettings {
@@ -579,15 +617,27 @@ namespace vkx
 			// Can be overriden in derived class to add custom text to the overlay
 			virtual void getOverlayText(vkx::TextOverlay * textOverlay);
 
+			// Wait until the current frame's resources are no longer used by the gpu
+			// - Must be called before anything per frame (uniforms, command buffers) is written
+			void beginFrame();
+
 			// Prepare the frame for workload submission
 			// - Acquires the next image from the swap chain 
 			// - Sets the default wait and signal semaphores
+			// - The frame's last submit should signal getFrameFence()
 			void prepareFrame();
 
 			// Submit the frames' workload 
 			// - Submits the text overlay (if enabled)
+			// - Advances currentFrame
 			void submitFrame();
 
+			// The current frame's fence, pass it to the frame's last queue submit
+			vk::Fence getFrameFence();
+
+			void createFrameSync();
+			void destroyFrameSync();
+
 
 		
 
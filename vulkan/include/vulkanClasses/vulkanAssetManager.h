@@ -1,7 +1,10 @@
 #pragma once
 
 
+#include <deque>
 #include <unordered_map>
+#include <map>
+#include <tuple>
 
 #include <vulkan/vulkan.hpp>
 
@@ -21,6 +24,7 @@
 #include "vulkanContext.h"
 #include "vulkanTextureLoader.h"
 #include "vulkanMeshLoader.h"
+#include "vulkanVirtualTexture.h"
 
 #include "Object3D.h"
 
@@ -45,6 +49,26 @@ namespace vkx {
 		glm::vec4 diffuse;
 		glm::vec4 specular;
 		float opacity;
+
+		// array layer of each map, 0 if the map isn't packed into an array
+		uint32_t diffuseLayer = 0;
+		uint32_t specularLayer = 0;
+		uint32_t bumpLayer = 0;
+
+		// virtual texture id + 1 of the diffuse map, 0 if it isn't virtual
+		uint32_t virtualTexture = 0;
+
+		// content hash, field by field so padding never gets into it
+		uint64_t hash(uint64_t seed = 0) const {
+			float colors[13] = {
+				ambient.r, ambient.g, ambient.b, ambient.a,
+				diffuse.r, diffuse.g, diffuse.b, diffuse.a,
+				specular.r, specular.g, specular.b, specular.a,
+				opacity
+			};
+			uint32_t indices[4] = { diffuseLayer, specularLayer, bumpLayer, virtualTexture };
+			return vkx::hash64(indices, sizeof(indices), vkx::hash64(colors, sizeof(colors), seed));
+		}
 	};
 
 	// Stores info on the materials used in the scene
@@ -164,13 +188,13 @@ namespace vkx {
 			OrderedVulkanResourceList(vk::Device &dev) : device(dev) {};
 			const T get(std::string name) {
 				if (!present(name)) {
-					throw;
+					throw std::runtime_error("Resource not found: " + name);
 				}
 				return resources[name];
 			}
 			T *getPtr(std::string name) {
 				if (!present(name)) {
-					throw;
+					throw std::runtime_error("Resource not found: " + name);
 				}
 				return &resources[name];
 			}
@@ -182,26 +206,84 @@ namespace vkx {
 
 
 
+	// index into a VulkanResourceList
+	// resolve the name once at setup, then the draw loop only indexes an array
+	template <typename T>
+	struct Handle {
+		uint32_t index = UINT32_MAX;
+		constexpr Handle() {}
+		explicit constexpr Handle(uint32_t index) : index(index) {}
+		bool valid() const {
+			return index != UINT32_MAX;
+		}
+	};
+
 	template <typename T>
 	class VulkanResourceList {
 		public:
 			vk::Device &device;
-			std::unordered_map<std::string, T> resources;
 			VulkanResourceList(vk::Device &dev) : device(dev) {};
-			const T get(std::string name) {
-				if (!present(name)) {
-					throw;
+
+			// throws if nothing has been added (or reserved) under the name
+			Handle<T> handle(const std::string &name) const {
+				auto it = indices.find(name);
+				if (it == indices.end()) {
+					throw std::runtime_error("Resource not found: " + name);
 				}
-				return resources[name];
+				return Handle<T>(it->second);
 			}
-			T *getPtr(std::string name) {
-				if (!present(name)) {
-					throw;
+			const T &get(Handle<T> handle) const {
+				assert(handle.index < items.size());
+				return items[handle.index];
+			}
+			T *getPtr(Handle<T> handle) {
+				assert(handle.index < items.size());
+				return &items[handle.index];
+			}
+			// by name, for setup code
+			const T &get(const std::string &name) const {
+				return items[handle(name).index];
+			}
+			T *getPtr(const std::string &name) {
+				return &items[handle(name).index];
+			}
+			bool present(const std::string &name) const {
+				return indices.find(name) != indices.end();
+			}
+
+			// names[i] gets handle i, so built in resources can use handles known at compile time
+			// has to be called before anything is added
+			void reserve(const std::vector<std::string> &names) {
+				if (!items.empty()) {
+					throw std::logic_error("Resources have to be reserved before any are added");
+				}
+				for (auto &name : names) {
+					if (present(name)) {
+						throw std::logic_error("Resource reserved twice: " + name);
+					}
+					set(name, T());
 				}
-				return &resources[name];
 			}
-			bool present(std::string name) {
-				return resources.find(name) != resources.end();
+
+		protected:
+			// handles index straight into these
+			// a deque, so adding never moves what's there: getPtr() pointers stay valid for the list's lifetime
+			std::deque<T> items;
+			std::vector<std::string> names;
+			std::unordered_map<std::string, uint32_t> indices;
+
+			// adding a name that's already there replaces the resource, its handle stays the same
+			Handle<T> set(const std::string &name, T resource) {
+				auto it = indices.find(name);
+				if (it != indices.end()) {
+					items[it->second] = resource;
+					return Handle<T>(it->second);
+				}
+				uint32_t index = (uint32_t)items.size();
+				items.push_back(resource);
+				names.push_back(name);
+				indices[name] = index;
+				return Handle<T>(index);
 			}
 	};
 
@@ -220,16 +302,37 @@ namespace vkx {
 			}
 
 			void destroy() {
-				for (auto &pipelineLayout : resources) {
-					device.destroyPipelineLayout(pipelineLayout.second, nullptr);
+				for (auto &pipelineLayout : items) {
+					if (pipelineLayout) {
+						device.destroyPipelineLayout(pipelineLayout, nullptr);
+					}
 				}
 			}
 
 			vk::PipelineLayout add(std::string name, vk::PipelineLayoutCreateInfo &createInfo) {
 				vk::PipelineLayout pipelineLayout = device.createPipelineLayout(createInfo, nullptr);
-				resources[name] = pipelineLayout;
+				set(name, pipelineLayout);
+
+				// kept for checking shaders against the layout
+				LayoutInfo &info = layoutInfos[(VkPipelineLayout)pipelineLayout];
+				info.setLayouts.assign(createInfo.pSetLayouts, createInfo.pSetLayouts + createInfo.setLayoutCount);
+				info.pushConstantRanges.assign(createInfo.pPushConstantRanges, createInfo.pPushConstantRanges + createInfo.pushConstantRangeCount);
 				return pipelineLayout;
 			}
+
+			struct LayoutInfo {
+				std::vector<vk::DescriptorSetLayout> setLayouts;
+				std::vector<vk::PushConstantRange> pushConstantRanges;
+			};
+
+			// what the layout was created with, nullptr if it wasn't made by this list
+			const LayoutInfo *info(vk::PipelineLayout pipelineLayout) const {
+				auto it = layoutInfos.find((VkPipelineLayout)pipelineLayout);
+				return it != layoutInfos.end() ? &it->second : nullptr;
+			}
+
+		private:
+			std::unordered_map<VkPipelineLayout, LayoutInfo> layoutInfos;
 	};
 
 
@@ -248,8 +351,10 @@ namespace vkx {
 			}
 
 			void destroy() {
-				for (auto &pipeline : resources) {
-					device.destroyPipeline(pipeline.second, nullptr);
+				for (auto &pipeline : items) {
+					if (pipeline) {
+						device.destroyPipeline(pipeline, nullptr);
+					}
 				}
 			}
 
@@ -264,7 +369,7 @@ namespace vkx {
 			//}
 
 			void add(std::string name, vk::Pipeline pipeline) {
-				resources[name] = pipeline;
+				set(name, pipeline);
 			}
 
 	};
@@ -283,14 +388,17 @@ namespace vkx {
 			}
 
 			void destroy() {
-				for (auto &descriptorSetLayout : resources) {
-					device.destroyDescriptorSetLayout(descriptorSetLayout.second, nullptr);
+				for (auto &descriptorSetLayout : items) {
+					if (descriptorSetLayout) {
+						device.destroyDescriptorSetLayout(descriptorSetLayout, nullptr);
+					}
 				}
 			}
 
 			vk::DescriptorSetLayout add(std::string name, vk::DescriptorSetLayoutCreateInfo createInfo) {
 				vk::DescriptorSetLayout descriptorSetLayout = device.createDescriptorSetLayout(createInfo, nullptr);
-				resources[name] = descriptorSetLayout;
+				set(name, descriptorSetLayout);
+				layoutBindings[(VkDescriptorSetLayout)descriptorSetLayout].assign(createInfo.pBindings, createInfo.pBindings + createInfo.bindingCount);
 				return descriptorSetLayout;
 			}
 
@@ -301,14 +409,25 @@ namespace vkx {
 				descriptorSetLayoutCreateInfo.bindingCount = descriptorSetLayoutBindings.size();
 
 				vk::DescriptorSetLayout descriptorSetLayout = device.createDescriptorSetLayout(descriptorSetLayoutCreateInfo, nullptr);
-				resources[name] = descriptorSetLayout;
+				set(name, descriptorSetLayout);
+				layoutBindings[(VkDescriptorSetLayout)descriptorSetLayout] = descriptorSetLayoutBindings;
 				return descriptorSetLayout;
 			}
 
+			// made elsewhere, its bindings aren't known
 			void add(std::string name, vk::DescriptorSetLayout descriptorSetLayout) {
-				resources[name] = descriptorSetLayout;
+				set(name, descriptorSetLayout);
+			}
+
+			// bindings the layout was created with, nullptr if it wasn't made by this list
+			const std::vector<vk::DescriptorSetLayoutBinding> *bindings(vk::DescriptorSetLayout descriptorSetLayout) const {
+				auto it = layoutBindings.find((VkDescriptorSetLayout)descriptorSetLayout);
+				return it != layoutBindings.end() ? &it->second : nullptr;
 			}
 
+		private:
+			std::unordered_map<VkDescriptorSetLayout, std::vector<vk::DescriptorSetLayoutBinding>> layoutBindings;
+
 	};
 
 
@@ -343,12 +462,12 @@ namespace vkx {
 
 			vk::DescriptorSet add(std::string name, vk::DescriptorSetAllocateInfo allocInfo) {
 				vk::DescriptorSet descriptorSet = device.allocateDescriptorSets(allocInfo)[0];
-				resources[name] = descriptorSet;
+				set(name, descriptorSet);
 				return descriptorSet;
 			}
 
 			void add(std::string name, vk::DescriptorSet descriptorSet) {
-				resources[name] = descriptorSet;
+				set(name, descriptorSet);
 			}
 
 	};
@@ -367,14 +486,16 @@ namespace vkx {
 			}
 
 			void destroy() {
-				for (auto &descriptorPool : resources) {
-					device.destroyDescriptorPool(descriptorPool.second, nullptr);
+				for (auto &descriptorPool : items) {
+					if (descriptorPool) {
+						device.destroyDescriptorPool(descriptorPool, nullptr);
+					}
 				}
 			}
 
 			vk::DescriptorPool add(std::string name, vk::DescriptorPoolCreateInfo &createInfo) {
 				vk::DescriptorPool descriptorPool = device.createDescriptorPool(createInfo, nullptr);
-				resources[name] = descriptorPool;
+				set(name, descriptorPool);
 				return descriptorPool;
 			}
 
@@ -387,7 +508,7 @@ namespace vkx {
 				descriptorPoolCreateInfo.maxSets = maxSets;
 
 				vk::DescriptorPool descriptorPool = device.createDescriptorPool(descriptorPoolCreateInfo, nullptr);
-				resources[name] = descriptorPool;
+				set(name, descriptorPool);
 				return descriptorPool;
 			}
 	};
@@ -452,6 +573,24 @@ namespace vkx {
 
 		public:
 
+			// content hash of the file -> name of the texture that owns the gpu resource
+			std::unordered_map<uint64_t, std::string> hashes;
+
+			// name -> content hash
+			std::unordered_map<std::string, uint64_t> nameHashes;
+
+			// names that resolved to an already loaded texture
+			std::unordered_map<std::string, std::string> aliases;
+
+			// name -> layer, for textures packed into an array
+			std::unordered_map<std::string, uint32_t> layers;
+
+			uint32_t arrayCount = 0;
+
+			// dedup stats
+			uint32_t duplicateCount = 0;
+			size_t duplicateBytes = 0;
+
 			~TextureList() {
 				//for (auto &texture : resources) {
 				//	texture.second.destroy();
@@ -459,32 +598,152 @@ namespace vkx {
 			}
 
 			void destroy() {
+				// aliases share the owner's handles, only destroy owners
 				for (auto &texture : resources) {
 					texture.second.destroy();
 				}
 			}
 
+			// follows aliases to the name that owns the gpu resource
+			const std::string &resolve(const std::string &name) {
+				const std::string *current = &name;
+				auto it = aliases.find(*current);
+				while (it != aliases.end()) {
+					current = &it->second;
+					it = aliases.find(*current);
+				}
+				return *current;
+			}
+
+			// array layer of a texture, 0 if it isn't packed
+			uint32_t getLayer(const std::string &name) {
+				const std::string *current = &name;
+				while (true) {
+					auto layer = layers.find(*current);
+					if (layer != layers.end()) {
+						return layer->second;
+					}
+					auto alias = aliases.find(*current);
+					if (alias == aliases.end()) {
+						return 0;
+					}
+					current = &alias->second;
+				}
+			}
+
+			bool present(const std::string &name) {
+				return resources.find(name) != resources.end() || aliases.find(name) != aliases.end();
+			}
+
 			const vkx::Texture get(std::string name) {
-				return resources[name];
+				return resources[resolve(name)];
 			}
 
 			std::shared_ptr<vkx::Texture> getSharedPtr(std::string name) {
-				auto texture = std::make_shared<vkx::Texture>(resources[name]);
+				auto texture = std::make_shared<vkx::Texture>(resources[resolve(name)]);
 
 				return texture;
 			}
 
+			// content hash of a loaded texture, 0 if unknown
+			uint64_t getHash(const std::string &name) {
+				auto it = nameHashes.find(name);
+				return it != nameHashes.end() ? it->second : 0;
+			}
+
 			std::shared_ptr<vkx::Texture> getOrLoad(std::string name, vkx::TextureLoader *textureLoader) {
+				return getOrLoad(name, name, textureLoader);
+			}
+
+			// name is the key the texture is stored under, fileName is where it's loaded from
+			// textures with identical file contents share one gpu resource
+			std::shared_ptr<vkx::Texture> getOrLoad(const std::string &name, const std::string &fileName, vkx::TextureLoader *textureLoader) {
 				if (present(name)) {
-					auto texture = std::make_shared<vkx::Texture>(resources[name]);
-					return texture;
-				} else {
-					vkx::Texture tex = textureLoader->loadTexture(name, vk::Format::eBc2UnormBlock);
-					add(name, tex);
-					auto texture = std::make_shared<vkx::Texture>(resources[name]);
-					return texture;
+					return getSharedPtr(name);
+				}
+
+				// read once, hashed and loaded from the same bytes
+				std::vector<uint8_t> bytes = vkx::readBinaryFile(vkx::TextureLoader::fileToLoad(fileName));
+				uint64_t hash = vkx::hash64(bytes);
+				nameHashes[name] = hash;
+
+				auto it = hashes.find(hash);
+				if (it != hashes.end()) {
+					aliases[name] = it->second;
+					duplicateCount++;
+					duplicateBytes += bytes.size();
+					return getSharedPtr(name);
 				}
 
+				gli::texture2d tex2D(gli::load((const char*)bytes.data(), bytes.size()));
+				vkx::Texture tex = textureLoader->loadTexture(tex2D, vk::Format::eBc2UnormBlock);
+				add(name, tex);
+				hashes[hash] = name;
+				return getSharedPtr(name);
+			}
+
+			// packs textures with the same format, size and mip count into 2D array textures
+			// files are (name, fileName) pairs like getOrLoad() takes
+			void pack(const std::vector<std::pair<std::string, std::string>> &files, vkx::TextureLoader *textureLoader) {
+
+				struct Group {
+					std::vector<std::string> names;
+					std::vector<gli::texture2d> layers;
+				};
+
+				std::map<std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>, Group> groups;
+
+				for (auto &file : files) {
+					const std::string &name = file.first;
+					if (present(name)) {
+						continue;
+					}
+
+					std::vector<uint8_t> bytes = vkx::readBinaryFile(vkx::TextureLoader::fileToLoad(file.second));
+					uint64_t hash = vkx::hash64(bytes);
+
+					auto it = hashes.find(hash);
+					if (it != hashes.end()) {
+						nameHashes[name] = hash;
+						aliases[name] = it->second;
+						duplicateCount++;
+						duplicateBytes += bytes.size();
+						continue;
+					}
+
+					gli::texture2d tex(gli::load((const char*)bytes.data(), bytes.size()));
+					if (tex.empty()) {
+						continue;
+					}
+
+					auto key = std::make_tuple((uint32_t)tex.format(), (uint32_t)tex[0].extent().x, (uint32_t)tex[0].extent().y, (uint32_t)tex.levels());
+					Group &group = groups[key];
+					group.names.push_back(name);
+					group.layers.push_back(tex);
+
+					nameHashes[name] = hash;
+					hashes[hash] = name;
+				}
+
+				for (auto &iterator : groups) {
+					Group &group = iterator.second;
+
+					// nothing to share it with, load it on its own
+					if (group.names.size() < 2) {
+						add(group.names[0], textureLoader->loadTexture(group.layers[0], vk::Format::eBc2UnormBlock));
+						continue;
+					}
+
+					std::string arrayName = "array:" + std::to_string(arrayCount++);
+					resources[arrayName] = textureLoader->loadTextureArray(group.layers, vk::Format::eBc2UnormBlock);
+
+					for (uint32_t i = 0; i < group.names.size(); ++i) {
+						aliases[group.names[i]] = arrayName;
+						layers[group.names[i]] = i;
+					}
+
+					printf("Info: Packed %u textures (%ux%u) into %s\n", (uint32_t)group.names.size(), std::get<1>(iterator.first), std::get<2>(iterator.first), arrayName.c_str());
+				}
 			}
 
 			void add(std::string name, vkx::Texture texture) {
@@ -493,70 +752,84 @@ namespace vkx {
 	};
 
 
-	//class MaterialList : public OrderedVulkanResourceList<Material> {
+	// dense, append-only material table
+	// ids are handed out at import and stay valid for the lifetime of the list,
+	// so meshes can store them instead of the material's name
+	struct MaterialList {
 
-	//	public:
-	//		~MaterialList() {
-	//			//for (auto &texture : resources) {
-	//			//	texture.second.destroy();
-	//			//}
-	//		}
+		std::vector<Material> resources;
 
-	//		void destroy() {
-	//			for (auto &material : resources) {
-	//				material.second.destroy();
-	//			}
-	//		}
+		// set when a material's properties need to be re-uploaded
+		std::vector<bool> dirty;
 
-	//		const Material get(std::string name) {
-	//			return resources[name];
-	//		}
+		// name -> id, only used at import time
+		std::unordered_map<std::string, uint32_t> ids;
 
-	//		void add(std::string name, Material material) {
-	//			resources[name] = material;
-	//			this->sync();
-	//		}
+		// content hash of properties + textures -> id
+		std::unordered_map<uint64_t, uint32_t> hashes;
 
-	//		void sync() {
+		// dedup stats
+		uint32_t duplicateCount = 0;
 
-	//			uint32_t counter = 0;
-	//			for (auto &iterator : resources) {
-	//				iterator.second.index = counter;
-	//				counter++;
-	//			}
-	//		}
-	//};
+		void destroy() {
+			for (auto &material : resources) {
+				material.destroy();
+			}
+		}
 
+		Material &get(uint32_t id) {
+			return resources[id];
+		}
 
-	struct MaterialList {
+		// returns the id of the material, adds it if it isn't present
+		// hash is the material's content hash, 0 if it shouldn't be deduplicated
+		uint32_t add(const std::string &name, const Material &material, uint64_t hash = 0) {
+			auto it = ids.find(name);
+			if (it != ids.end()) {
+				return it->second;
+			}
+			uint32_t id = static_cast<uint32_t>(resources.size());
+			resources.push_back(material);
+			resources.back().index = id;
+			dirty.push_back(true);
+			ids[name] = id;
+			if (hash != 0) {
+				hashes[hash] = id;
+			}
+			return id;
+		}
 
-		std::map<std::string, Material> resources;
+		// registers name as another name for an existing material
+		void addAlias(const std::string &name, uint32_t id) {
+			ids[name] = id;
+			duplicateCount++;
+		}
 
-		void destroy() {
-			for (auto &material : resources) {
-				material.second.destroy();
+		// returns true and sets id if a material with this content hash exists
+		bool findHash(uint64_t hash, uint32_t &id) const {
+			auto it = hashes.find(hash);
+			if (it == hashes.end()) {
+				return false;
 			}
+			id = it->second;
+			return true;
 		}
 
-		const Material get(std::string name) {
-			return resources[name];
+		bool present(const std::string &name) const {
+			return ids.find(name) != ids.end();
 		}
 
-		void add(std::string name, Material material) {
-			resources[name] = material;
-			this->sync();
+		uint32_t getId(const std::string &name) const {
+			return ids.at(name);
 		}
 
-		bool present(std::string name) {
-			return resources.find(name) != resources.end();
+		// call after changing a material's properties
+		void markDirty(uint32_t id) {
+			dirty[id] = true;
 		}
 
-		void sync() {
-			uint32_t counter = 0;
-			for (auto &iterator : resources) {
-				iterator.second.index = counter;
-				counter++;
-			}
+		size_t size() const {
+			return resources.size();
 		}
 	};
 
@@ -587,6 +860,21 @@ namespace vkx {
 			vk::DescriptorPool* materialDescriptorPoolDeferred{ nullptr };
 
 
+			// pack same sized material textures into array textures at import
+			// the g-buffer shaders must sample them as sampler2DArray using the
+			// material's layer indices
+			bool packTextures = false;
+
+			// material descriptor sets keyed by the image views they reference,
+			// materials with the same textures share one set
+			std::unordered_map<uint64_t, vk::DescriptorSet> textureSets;
+
+			// when set, diffuse maps with a baked .vtex next to them are registered here
+			vkx::VirtualTextureCache *virtualTextures{ nullptr };
+			// .vtex file -> virtual texture id
+			std::unordered_map<std::string, uint32_t> virtualTextureIds;
+
+
 
 
 
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "vulkanCulling.h"
+
+
+// cascaded shadow maps for directional lights
+// the view depth range is split with the practical split scheme (a blend of logarithmic and uniform splits),
+// each cascade is fitted to the bounding sphere of its slice of the view frustum, which is the same size
+// whichever way the camera turns, and its center is snapped to whole texels, so the shadows don't shimmer
+// when the camera moves, the depth range is fitted to the casters that can throw shadows into it
+
+namespace vkx {
+
+	// splits[0] = zNear, splits[count] = zFar, the cascade i covers [splits[i], splits[i + 1]]
+	// lambda 0 splits uniformly, 1 logarithmically
+	void practicalSplits(float zNear, float zFar, float lambda, uint32_t count, float *splits);
+
+	struct CascadeFit {
+		// world to light space, the light looks down -z
+		glm::mat4 view;
+		// light space center of the split's bounding sphere, x and y are snapped
+		glm::vec3 center;
+		float radius = 0.0f;
+		// half the width of the square the cascade covers
+		float halfSize = 0.0f;
+		// light space depth range, zMax is the end towards the light
+		float zMin = 0.0f;
+		float zMax = 0.0f;
+
+		// glm's orthographic projection flipped for vulkan (y down), depth is still gl's -1..1 from -zMax to -zMin
+		glm::mat4 projection() const;
+	};
+
+	// cameraView is the view matrix of the camera, fovy in radians
+	// the snapped center only moves in steps of snapTexels texels, the cascade is made big enough
+	// that the split stays inside it in between
+	CascadeFit fitCascade(const glm::mat4 &cameraView, float fovy, float aspect, float splitNear, float splitFar, const glm::vec3 &lightDir, uint32_t mapSize, uint32_t snapTexels);
+
+	// fits fit's depth range to the bounds (world space boxes) that overlap the cascade in light space x/y:
+	// the near end reaches the caster closest to the light, the far end stops at the sphere or the last caster
+	// both are rounded outwards to steps of depthStep, so casters moving a little don't change the range
+	// leaves the sphere's range if nothing overlaps, false then
+	bool fitCasterDepth(CascadeFit &fit, const BoundsList &bounds, float depthStep);
+
+}
@@ -4,6 +4,11 @@
 #include "vulkanDebug.h"
 #include "vulkanTools.h"
 #include "vulkanShaders.h"
+#include "vulkanShaderCache.h"
+
+
+// newer than our headers, it has no structures of its own so the name is all that's needed
+#define VKX_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME "VK_EXT_shader_viewport_index_layer"
 
 
 
@@ -30,6 +35,15 @@ namespace vkx {
         bool enableValidation = false;
         // Set to true when the debug marker extension is detected
         bool enableDebugMarkers = false;
+        // optional extensions, enabled when the device has them
+        // VK_KHR_get_physical_device_properties2 (instance), needed for multiview
+        bool physicalDeviceProperties2 = false;
+        // VK_KHX_multiview: render passes can broadcast draws to several layers (gl_ViewIndex)
+        bool multiviewSupported = false;
+        // VK_EXT_shader_viewport_index_layer: vertex shaders can write gl_Layer
+        bool vertexLayerSupported = false;
+        // VK_AMD_draw_indirect_count: indirect draws can take their count from a buffer, null without it
+        PFN_vkCmdDrawIndexedIndirectCountAMD cmdDrawIndexedIndirectCount = nullptr;
         // fps timer (one second interval)
         float fpsTimer = 0.0f;
         // Create application wide Vulkan instance
@@ -58,6 +72,9 @@ namespace vkx {
 
 		void destroyContext();
 
+		// loads pipelineCacheFile, validates its header against this device and creates pipelineCache from it
+		void createPipelineCache();
+
 		uint32_t findQueue(const vk::QueueFlags& flags, const vk::SurfaceKHR& presentSurface = vk::SurfaceKHR()) const;
 
         // Vulkan instance, stores all per-application states
@@ -75,8 +92,20 @@ namespace vkx {
         vk::Device device;
         // vk::Pipeline cache object
         vk::PipelineCache pipelineCache;
+        // file the pipeline cache is seeded from in createContext and written back to in destroyContext
+        // relative to the working directory, empty to disable
+        std::string pipelineCacheFile = "pipelinecache.bin";
+        // true if the cache was seeded from the file, pipelineCacheStatus says why if it wasn't
+        bool pipelineCacheLoaded = false;
+        std::string pipelineCacheStatus;
+        size_t pipelineCacheSavedSize = 0;
+        // writes the cache back to pipelineCacheFile if it grew since it was loaded or last saved
+        void savePipelineCache();
         // List of shader modules created (stored for cleanup)
         mutable std::vector<vk::ShaderModule> shaderModules;
+        // modules made by loadShader, deduplicated by path and content, destroyed in destroyContext
+        // shared, so copies of the context (the text overlay keeps one) load through the same cache
+        std::shared_ptr<vkx::ShaderCache> shaderCache = std::make_shared<vkx::ShaderCache>();
 
         vk::Queue queue;
         // Find a queue that supports graphics operations
@@ -228,14 +257,10 @@ namespace vkx {
 		inline vk::PipelineShaderStageCreateInfo loadShader(const std::string& fileName, vk::ShaderStageFlagBits stage) const {
 			vk::PipelineShaderStageCreateInfo shaderStage;
 			shaderStage.stage = stage;
-			#if defined(__ANDROID__)
-			shaderStage.module = loadShader(androidApp->activity->assetManager, fileName.c_str(), device, stage);
-			#else
-			shaderStage.module = vkx::loadShader(fileName.c_str(), device, stage);
-			#endif
+			// the cache owns the module, files that were already loaded don't make a new one
+			shaderStage.module = shaderCache->load(fileName, stage).module;
 			shaderStage.pName = "main"; // todo : make param
 			assert(shaderStage.module);
-			shaderModules.push_back(shaderStage.module);
 			return shaderStage;
 		}
 
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+
+// frustum culling on the cpu
+// bounds are packed structure-of-arrays and tested 8 (AVX) or 4 (SSE) at a time,
+// with a scalar fallback for everything else (android)
+
+namespace vkx {
+
+	// planes point inwards, xyz normal and w distance, normalized
+	struct Frustum {
+		glm::vec4 planes[6];
+
+		// Gribb/Hartmann, from the rows of the view projection matrix
+		// the near plane is gl's (-w..w), which holds for 0..w projections too, only a little looser
+		// without nearPlane anything behind the near plane is inside (depth clamped passes draw it anyway)
+		void extract(const glm::mat4 &viewProjection, bool nearPlane = true);
+	};
+
+	// world space aabb of an object space aabb under matrix
+	void transformBounds(const glm::mat4 &matrix, const glm::vec3 &min, const glm::vec3 &max, glm::vec3 &worldMin, glm::vec3 &worldMax);
+
+
+	// bounds, stored as center, half extent and bounding sphere radius
+	class BoundsList {
+
+		public:
+
+			void clear();
+
+			// returns its index
+			uint32_t add(const glm::vec3 &min, const glm::vec3 &max);
+			// only a sphere, only cullSpheres() gives meaningful results for it
+			uint32_t addSphere(const glm::vec3 &center, float radius);
+
+			size_t size() const {
+				return count;
+			}
+
+			// the box of bounds i (a sphere's is its enclosing cube)
+			void get(size_t i, glm::vec3 &min, glm::vec3 &max) const;
+
+			// visible[i] is 1 if bounds i intersect the frustum, 0 if they're completely outside
+			// boxes are tighter, spheres are cheaper and don't care about rotation
+			void cullBoxes(const Frustum &frustum, std::vector<uint8_t> &visible) const;
+			void cullSpheres(const Frustum &frustum, std::vector<uint8_t> &visible) const;
+
+		private:
+
+			// padded to a multiple of the widest lane count, the padding is never reported
+			std::vector<float> centerX, centerY, centerZ;
+			std::vector<float> extentX, extentY, extentZ;
+			std::vector<float> radius;
+			size_t count = 0;
+
+			void push(const glm::vec3 &center, const glm::vec3 &extent, float radius);
+	};
+
+}
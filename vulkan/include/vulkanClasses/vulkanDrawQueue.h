@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// sort keys for draw lists
+// a draw is packed into 64 bits, most significant first, so the sorted keys are in the order that needs the
+// fewest state changes, front to back where the state allows it:
+// - 4 bits: depth band, [0, 2), then [2^b, 2^(b + 1)) in view space units, the bands are drawn front to back
+// - 20 bits: material, the rank of its descriptor set
+// - 20 bits: mesh, the rank of its buffers
+// - 20 bits: depth within the band, front to back
+// far away bands are coarse, so a draw only moves to another state group when it's a lot farther away
+//
+// sorted with an lsd radix sort, 8 bits a pass, the passes where every key has the same byte are skipped
+
+#define DRAW_KEY_DEPTH_BANDS 16
+#define DRAW_KEY_FIELD_BITS 20
+// lists shorter than this are insertion sorted, the histograms would cost more
+#define DRAW_KEY_RADIX_MIN 64
+
+namespace vkx {
+
+	struct DrawKey {
+		uint64_t key;
+		// whatever the key is for, an index into a draw list
+		uint32_t index;
+	};
+
+	// material and mesh are clamped to DRAW_KEY_FIELD_BITS bits
+	uint64_t packDrawKey(float depth, uint32_t material, uint32_t mesh);
+
+	// stable, by key, scratch is resized to count
+	void radixSort(DrawKey *keys, size_t count, std::vector<DrawKey> &scratch);
+
+}
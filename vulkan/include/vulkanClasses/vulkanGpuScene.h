@@ -0,0 +1,231 @@
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "vulkanTools.h"
+#include "vulkanContext.h"
+#include "vulkanMeshLoader.h"
+#include "vulkanHiZ.h"
+
+
+// gpu driven g-buffer pass for the static meshes
+// every mesh is copied into one big vertex and index buffer when it's first seen, every frame the instances
+// (a mesh under a matrix) go to the gpu as they are, a compute shader culls them and writes their indirect draws,
+// so recording doesn't depend on how many there are: the command buffer binds the shared buffers once and does
+// one indirect draw per material, it only has to be recorded again when a material is added or a segment grows
+//
+// the draws of a material are a segment of the command buffer, with room to grow (powers of two)
+// - with VK_AMD_draw_indirect_count the visible draws are packed at the start of their segment and counted,
+//   the draw takes its count from the gpu
+// - without it every instance has its own slot in its segment (instance count 0 or 1), the draw covers the
+//   whole segment with multiDrawIndirect
+// firstInstance is the instance, the vertex shader gets its matrix with gl_InstanceIndex
+//
+// occlusion culling, with the hi-z pyramid, in two phases like vulkanHiZ.h:
+// - phase 0, before the g-buffer pass: the frustum, then the pyramid of the last frame with the view projection
+//   it was built with, the instances it hides are flagged, the rest are drawn
+// - phase 1, once the pyramid of what phase 0 drew is built: the flagged instances are tested again,
+//   the ones that turn out visible are drawn by the late pass
+//
+// gpuCull.comp: set 0, binding 0: CullUniforms, binding 1: InstanceData[], binding 2: vk::DrawIndexedIndirectCommand[]
+//   binding 3: uint counts[] (per segment, phase 0 then phase 1, then the drawn instances of both phases)
+//   binding 4: uint flags[] (per instance, 1 if phase 1 has to test it), binding 5: the pyramid (all levels)
+//   push constants: uint phase, 64 invocations, one instance each
+// the g-buffer vertex shader (mrtMeshIndirect.vert) reads InstanceData[gl_InstanceIndex] from set 1, binding 0
+
+// the smallest segment, in draws
+#define GPU_SCENE_MIN_SEGMENT 64
+// the smallest shared buffers, in vertices and indices
+#define GPU_SCENE_MIN_VERTICES (1 << 16)
+#define GPU_SCENE_MIN_INDICES (1 << 18)
+// instances the per frame buffers start with
+#define GPU_SCENE_MIN_INSTANCES 1024
+
+namespace vkx {
+
+	class GpuScene {
+
+		public:
+
+			// std430, 128 bytes
+			struct InstanceData {
+				glm::mat4 matrix;
+				// object space, w unused
+				glm::vec4 boundsMin;
+				glm::vec4 boundsMax;
+				// indexCount, firstIndex, vertexOffset, the instance's slot (without a count buffer)
+				glm::uvec4 draw;
+				// segment, its first command, unused
+				glm::uvec4 segment;
+			};
+
+			struct CullUniforms {
+				// world space, all 0 but w when the frustum isn't culled
+				glm::vec4 planes[6];
+				// phase 1 tests the new pyramid with the current one
+				glm::mat4 viewProjection;
+				// phase 0 tests the last pyramid with the one it was built with
+				glm::mat4 pyramidViewProjection;
+				glm::uvec2 depthSize;
+				// 0 without hi-z
+				uint32_t levels;
+				uint32_t count;
+				uint32_t commandCapacity;
+				uint32_t segmentCount;
+				// 1 with a count buffer
+				uint32_t compact;
+				// 1 if phase 0 tests the last pyramid, otherwise it flags nothing
+				uint32_t testLastPyramid;
+			};
+
+			// the draws of one material
+			struct Segment {
+				uint32_t materialId;
+				uint32_t first;
+				uint32_t capacity;
+				// instances this frame
+				uint32_t count;
+			};
+
+			GpuScene(const vkx::Context &context) : context(context) {}
+
+			// frames in flight, vertexSize is the static meshes' vertex size, instanceSetLayout is set 1 of the
+			// g-buffer pipeline (a vertex shader storage buffer at binding 0), hiZ the pyramid (may not be ready)
+			// false (and nothing made) without the shader or multiDrawIndirect and drawIndirectFirstInstance
+			bool prepare(uint32_t frames, uint32_t vertexSize, vk::DescriptorSetLayout instanceSetLayout, const vkx::HiZ &hiZ, const std::string &shaderPath);
+			void destroy();
+
+			bool ready() const {
+				return (bool)cullPipeline;
+			}
+
+			/* cpu, once frame's fence has been waited on */
+
+			// the instances of frame, in any order, meshes are uploaded at end() the first time they're seen
+			// meshes nothing refers to anymore are dropped at begin(), the shared buffers are compacted when
+			// more than half of them is dead
+			void begin(uint32_t frame);
+			void add(const glm::mat4 &matrix, const std::shared_ptr<vkx::MeshBuffer> &mesh);
+			void end();
+
+			// the stats of frame's last culling
+			void readback(uint32_t frame);
+
+			// changes when the draw commands would: the segments, the shared buffers or frame's instance buffer
+			uint64_t signature(uint32_t frame) const;
+
+			const std::vector<Segment> &segments() const {
+				return segmentList;
+			}
+
+			/* gpu */
+
+			// phase 0, culls frame's instances and writes their draws, outside a render pass, before the g-buffer pass
+			// viewProjection is what it's drawn with, occlusion tests the last pyramid too
+			void record(vk::CommandBuffer cmdBuffer, uint32_t frame, const glm::mat4 &viewProjection, bool frustum, bool occlusion);
+
+			// phase 1, right after the pyramid is built from what phase 0 drew
+			void recordLate(vk::CommandBuffer cmdBuffer, uint32_t frame);
+
+			// binds the shared vertex and index buffers and frame's instances (set 1 of layout)
+			void bind(vk::CommandBuffer cmdBuffer, uint32_t frame, uint32_t vertexBufferBinding, vk::PipelineLayout layout) const;
+
+			// the draws of segments()[segment], the material is bound by the caller
+			void draw(vk::CommandBuffer cmdBuffer, uint32_t frame, uint32_t phase, uint32_t segment) const;
+
+			// whether draws need a count buffer
+			bool compact() const {
+				return context.cmdDrawIndexedIndirectCount != nullptr;
+			}
+
+			// stats, as of the last readback()
+			uint32_t instances = 0;
+			uint32_t drawn = 0;
+			uint32_t drawnLate = 0;
+			uint32_t uniqueMeshes = 0;
+
+		private:
+
+			const vkx::Context &context;
+			const vkx::HiZ *hiZ = nullptr;
+
+			// where a mesh is in the shared buffers
+			struct MeshRange {
+				std::weak_ptr<vkx::MeshBuffer> mesh;
+				uint32_t indexCount;
+				uint32_t firstIndex;
+				uint32_t vertexOffset;
+				uint32_t vertexCount;
+			};
+
+			uint32_t vertexSize = 0;
+
+			// the shared buffers, in vertices and indices, and how much of them is used (dead meshes included)
+			vkx::CreateBufferResult vertices;
+			vkx::CreateBufferResult indices;
+			uint32_t vertexCapacity = 0;
+			uint32_t indexCapacity = 0;
+			uint32_t verticesUsed = 0;
+			uint32_t indicesUsed = 0;
+			uint32_t verticesLive = 0;
+			std::unordered_map<const vkx::MeshBuffer*, MeshRange> meshes;
+			// seen this frame, copied at end()
+			std::vector<const vkx::MeshBuffer*> pending;
+
+			std::vector<Segment> segmentList;
+			std::unordered_map<uint32_t, uint32_t> segmentIndices;
+			uint32_t commandCapacity = 0;
+			// changes with the segments and the shared buffers
+			uint64_t layoutVersion = 0;
+
+			uint32_t frame = 0;
+			std::vector<InstanceData> instanceData;
+
+			vk::DescriptorSetLayout instanceSetLayout;
+			vk::DescriptorSetLayout cullSetLayout;
+			vk::PipelineLayout cullLayout;
+			vk::Pipeline cullPipeline;
+			vk::DescriptorPool descriptorPool;
+
+			// stands in for the pyramid when there's none
+			vkx::CreateImageResult emptyPyramid;
+
+			// per frame in flight, the instances, uniforms and counts host visible
+			struct FrameResources {
+				vkx::CreateBufferResult instances;
+				vkx::CreateBufferResult uniforms;
+				vkx::CreateBufferResult commands;
+				vkx::CreateBufferResult counts;
+				vkx::CreateBufferResult flags;
+				uint32_t instanceCapacity = 0;
+				uint32_t commandCapacity = 0;
+				uint32_t countCapacity = 0;
+				uint32_t instanceCount = 0;
+				uint32_t segmentCount = 0;
+				vk::DescriptorSet cullSet;
+				vk::DescriptorSet instanceSet;
+				// changes whenever the buffers are made again, the handles of destroyed ones can come back
+				uint64_t version = 0;
+				// whether the counts have a culling in them that hasn't been read back
+				bool culled = false;
+			};
+			std::vector<FrameResources> frameResources;
+
+			// the pyramid phase 0 tests, built with pyramidViewProjection, invalid once a frame goes without one
+			glm::mat4 pyramidViewProjection;
+			glm::mat4 viewProjection;
+			bool pyramidValid = false;
+
+			MeshRange &addMesh(const std::shared_ptr<vkx::MeshBuffer> &mesh);
+			void dropDeadMeshes();
+			void reserveGeometry(bool compactDead);
+			void layoutSegments();
+			void reserveFrame(FrameResources &resources);
+			void updateDescriptorSets(FrameResources &resources);
+	};
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+#include "vulkanTools.h"
+#include "vulkanContext.h"
+
+
+// hierarchical z occlusion culling
+// after the g-buffer pass a compute shader builds a max depth pyramid from the depth attachment,
+// texel t of level l is the farthest depth of the pixels [t * 2^(l+1), (t+1) * 2^(l+1)), so a box
+// whose nearest depth is behind every texel its screen rect touches is hidden
+//
+// two phases, so nothing pops in:
+// - the cpu tests the bounds against the coarse levels of a pyramid read back from an earlier frame,
+//   with the view projection that frame was drawn with, what it finds hidden isn't drawn by the g-buffer pass
+// - those candidates are tested again on the gpu, against the pyramid of what the g-buffer pass just drew,
+//   the test writes their indirect draws (instance count 0 or 1), a second pass draws them on top
+//
+// only core features (compute, an r32 storage image, one draw per indirect call), so it runs on lavapipe
+//
+// hizBuild.comp: set 0, binding 0: source (the depth, or the level before) binding 1: destination level (r32f storage image)
+//   16x16 invocations, destination texel = max of the 2x2 source texels under it, clamped to the source's size
+// hizTest.comp: set 0, binding 0: the pyramid (all levels), binding 1: Candidate[], binding 2: vk::DrawIndexedIndirectCommand[]
+//   push constants: RetestConstants, 64 invocations, one candidate each, writes instanceCount
+
+// the levels the cpu reads back start at the first one that's at most this wide
+#define HIZ_READBACK_WIDTH 256
+// candidates the gpu tests per frame, what doesn't fit is drawn in the first phase
+#define HIZ_MAX_CANDIDATES 4096
+
+namespace vkx {
+
+	class HiZ {
+
+		public:
+
+			// a box the first phase found hidden, world space
+			struct Candidate {
+				glm::vec4 min;
+				glm::vec4 max;
+			};
+
+			struct RetestConstants {
+				glm::mat4 viewProjection;
+				glm::uvec2 depthSize;
+				uint32_t levels;
+				uint32_t count;
+			};
+
+			HiZ(const vkx::Context &context) : context(context) {}
+
+			// depth is the g-buffer depth, sampled in depthLayout, frames is the number of frames in flight
+			// false (and nothing made) if the shaders aren't in shaderPath, occlusion culling is off then
+			bool prepare(vk::ImageView depth, vk::ImageLayout depthLayout, glm::uvec2 depthSize, uint32_t frames, const std::string &shaderPath);
+			void destroy();
+
+			bool ready() const {
+				return (bool)buildPipeline;
+			}
+
+			/* cpu */
+
+			// true if the box is hidden in the last pyramid that was read back, false if there's none
+			bool occluded(const glm::vec3 &min, const glm::vec3 &max) const;
+
+			// frame's candidates for the second phase, and the draws they stand for (only indexCount and
+			// firstIndex are used), at most HIZ_MAX_CANDIDATES, call once frame's fence has been waited on
+			void setCandidates(uint32_t frame, const std::vector<Candidate> &candidates, const std::vector<vk::DrawIndexedIndirectCommand> &draws);
+
+			// once frame's fence has been waited on: what its last build left becomes the pyramid occluded() tests
+			void readback(uint32_t frame);
+
+			/* gpu */
+
+			// builds the pyramid from the depth, tests frame's candidates against it with viewProjection
+			// (the one the g-buffer pass drew with) and copies the coarse levels for readback()
+			// outside a render pass, after the g-buffer pass
+			void record(vk::CommandBuffer cmdBuffer, uint32_t frame, const glm::mat4 &viewProjection);
+
+			// the pyramid (all levels, general layout) and the size of the depth it's built from, for tests on the gpu
+			vk::DescriptorImageInfo pyramidDescriptor() const {
+				return vkx::descriptorImageInfo(sampler, pyramid.view, vk::ImageLayout::eGeneral);
+			}
+			glm::uvec2 size() const {
+				return depthSize;
+			}
+			uint32_t levelCount() const {
+				return levels;
+			}
+
+			// the indirect draws of frame's candidates, in the order they were set
+			vk::Buffer drawBuffer(uint32_t frame) const {
+				return drawBuffers[frame].buffer;
+			}
+
+			// stats, as of the last readback()
+			uint32_t candidates = 0;// tested again on the gpu
+			uint32_t drawnLate = 0;// of those, the ones that turned out visible
+
+		private:
+
+			const vkx::Context &context;
+
+			glm::uvec2 depthSize;
+			uint32_t levels = 0;
+
+			// r32 max depth, half the depth's size at level 0, kept in the general layout
+			vkx::CreateImageResult pyramid;
+			std::vector<vk::ImageView> levelViews;
+			vk::Sampler sampler;
+
+			vk::DescriptorSetLayout buildSetLayout;
+			vk::DescriptorSetLayout testSetLayout;
+			vk::PipelineLayout buildLayout;
+			vk::PipelineLayout testLayout;
+			vk::Pipeline buildPipeline;
+			vk::Pipeline testPipeline;
+			vk::DescriptorPool descriptorPool;
+			// one per level, one per frame in flight
+			std::vector<vk::DescriptorSet> buildSets;
+			std::vector<vk::DescriptorSet> testSets;
+
+			// per frame in flight, host visible
+			std::vector<vkx::CreateBufferResult> candidateBuffers;
+			std::vector<vkx::CreateBufferResult> drawBuffers;
+			std::vector<vkx::CreateBufferResult> readbacks;
+			std::vector<uint32_t> candidateCounts;
+			std::vector<glm::mat4> viewProjections;
+			// whether frame's buffers have a build in them that hasn't been read back
+			std::vector<uint8_t> built;
+
+			// the levels that are read back, and where they start in the readback buffer (in floats)
+			uint32_t firstReadbackLevel = 0;
+			std::vector<glm::uvec2> levelSizes;
+			std::vector<uint32_t> readbackOffsets;
+			uint32_t readbackFloats = 0;
+
+			// the cpu copy of the last readback
+			std::vector<float> cpuLevels;
+			glm::mat4 cpuViewProjection;
+			bool cpuValid = false;
+	};
+
+}
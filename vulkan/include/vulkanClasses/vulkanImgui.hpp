@@ -13,6 +13,7 @@
 #include "vulkanContext.h"
 #include "imgui.h"
 //#include "vulkanApp.h"
+#include "main/global.h"
 
 
 //// Options and values to display/toggle from the UI
@@ -41,11 +42,14 @@ class ImGUI {
 	private:
 	// Vulkan resources for rendering the UI
 	vk::Sampler sampler;
-	vkx::CreateBufferResult vertexBuffer;
-	vkx::CreateBufferResult indexBuffer;
-
-	int32_t vertexCount = 0;
-	int32_t indexCount = 0;
+	// one set of buffers per frame in flight, the gpu may still be drawing the previous frame's
+	struct {
+		vkx::CreateBufferResult vertexBuffer;
+		vkx::CreateBufferResult indexBuffer;
+
+		int32_t vertexCount = 0;
+		int32_t indexCount = 0;
+	} frameBuffers[MAX_FRAMES_IN_FLIGHT];
 	vk::DeviceMemory fontMemory;// = VK_NULL_HANDLE;
 	vk::Image fontImage;// = VK_NULL_HANDLE;
 	vk::ImageView fontView;// = VK_NULL_HANDLE;
@@ -71,8 +75,10 @@ class ImGUI {
 	void destroy() {
 
 		// Release all Vulkan resources required for rendering imGui
-		vertexBuffer.destroy();
-		indexBuffer.destroy();
+		for (auto &buffers : frameBuffers) {
+			buffers.vertexBuffer.destroy();
+			buffers.indexBuffer.destroy();
+		}
 		context->device.destroyImage(fontImage, nullptr);
 		context->device.destroyImageView(fontView, nullptr);
 		context->device.freeMemory(fontMemory, nullptr);
@@ -399,9 +405,14 @@ class ImGUI {
 	//}
 
 	// Update vertex and index buffer containing the imGui elements when required
-	void updateBuffers() {
+	void updateBuffers(uint32_t frame = 0) {
 		ImDrawData* imDrawData = ImGui::GetDrawData();
 
+		vkx::CreateBufferResult &vertexBuffer = frameBuffers[frame].vertexBuffer;
+		vkx::CreateBufferResult &indexBuffer = frameBuffers[frame].indexBuffer;
+		int32_t &vertexCount = frameBuffers[frame].vertexCount;
+		int32_t &indexCount = frameBuffers[frame].indexCount;
+
 		// Note: Alignment is done inside buffer creation
 		vk::DeviceSize vertexBufferSize = imDrawData->TotalVtxCount * sizeof(ImDrawVert);
 		vk::DeviceSize indexBufferSize = imDrawData->TotalIdxCount * sizeof(ImDrawIdx);
@@ -452,9 +463,12 @@ class ImGUI {
 	}
 
 	// Draw current imGui frame into a command buffer
-	void drawFrame(vk::CommandBuffer commandBuffer) {
+	void drawFrame(vk::CommandBuffer commandBuffer, uint32_t frame = 0) {
 		ImGuiIO& io = ImGui::GetIO();
 
+		vkx::CreateBufferResult &vertexBuffer = frameBuffers[frame].vertexBuffer;
+		vkx::CreateBufferResult &indexBuffer = frameBuffers[frame].indexBuffer;
+
 		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
 		commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
 
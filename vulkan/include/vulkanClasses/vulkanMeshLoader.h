@@ -43,6 +43,7 @@
 #include "vulkanContext.h"
 #include "vulkanTextureLoader.h"
 #include "vulkanAssetManager.h"
+#include "vulkanOcclusionRasterizer.h"
 #include "Object3D.h"
 
 
@@ -118,10 +119,17 @@ namespace vkx {
 		// dimensions of the mesh?
 		glm::vec3 dim;
 
+		// object space bounds, in the same space as the vertices (scale applied), for culling
+		glm::vec3 boundsMin = glm::vec3(0.0f);
+		glm::vec3 boundsMax = glm::vec3(0.0f);
+
+		// low poly stand-in for the software occlusion culling, same space, empty if the mesh is too small
+		vkx::OccluderProxy occluder;
+
 		uint32_t indexCount{ 0 };
-		uint32_t materialIndex{ 0 };
 
-		std::string materialName;
+		// id into the asset manager's material table
+		uint32_t materialId{ 0 };
 
 		void destroy() {
 			vertices.destroy();
@@ -174,8 +182,7 @@ namespace vkx {
 		uint32_t numIndices;
 		uint32_t vertexBase;// offset (for indexed draw)? p sure
 
-		uint32_t materialIndex;
-		std::string materialName;
+		uint32_t materialId{ 0 };
 
 		std::vector<Vertex> Vertices;
 		std::vector<uint32_t> Indices;
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "vulkanThreadPool.h"
+
+
+// software occlusion culling on the cpu, no readback latency
+// the big static meshes get a low poly proxy when they're imported, every frame the proxies of the ones
+// in view are rasterized into a small depth buffer, and the bounds of everything else are tested against it
+//
+// the triangles are set up and binned into screen tiles on the calling thread, the worker threads
+// rasterize whole bins, so no two threads touch the same pixels
+// the pixels are shaded 8 (AVX) or 4 (SSE) at a time: the edge functions give a coverage mask and the
+// depth is only written under it, with a scalar fallback for everything else (android)
+//
+// both sides are conservative: an occluder only covers the pixels whose center is inside it, with the
+// farthest depth it has in the pixel, a box is tested against every pixel its screen rect touches
+
+// the depth buffer, multiples of the bin size
+#define OCCLUSION_WIDTH 320
+#define OCCLUSION_HEIGHT 192
+// bins, multiples of 8 (the tiles the tests skip with)
+#define OCCLUSION_BIN_WIDTH 64
+#define OCCLUSION_BIN_HEIGHT 48
+// occluder triangles rasterized per frame, the rest of the occluders are skipped
+#define OCCLUSION_MAX_TRIANGLES 65536
+
+// meshes this big (on at least two axes, object space) get a proxy
+#define OCCLUDER_MIN_SIZE 2.0f
+// proxies are simplified until they have at most this many triangles
+#define OCCLUDER_PROXY_TRIANGLES 256
+// the masks a simplified proxy's outline is checked against the mesh's with, a side
+#define OCCLUDER_PROXY_COVERAGE 64
+
+namespace vkx {
+
+	// object space triangle list standing in for a mesh in the occlusion buffer
+	struct OccluderProxy {
+		std::vector<glm::vec3> vertices;
+		std::vector<uint32_t> indices;
+
+		bool empty() const {
+			return indices.empty();
+		}
+	};
+
+	// the proxy of a mesh (triangle list, object space), false and no proxy if the mesh is too small to hide much
+	// small meshes are used as they are, bigger ones are simplified by vertex clustering: the vertices in a grid
+	// cell are merged into their mean, which stays inside what they span, so walls and floors keep their shape
+	// a clustering can still close windows and doors, so it's only kept if, seen along each axis, it covers
+	// nothing the mesh doesn't, the mesh isn't an occluder if no grid is both small enough and inside it
+	bool buildOccluderProxy(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, OccluderProxy &proxy);
+
+
+	class OcclusionRasterizer {
+
+		public:
+
+			OcclusionRasterizer();
+
+			// starts a frame, drops the last one's occluders
+			void begin(const glm::mat4 &viewProjection);
+
+			// sets up and bins the proxy's triangles under matrix (object to world)
+			// false once OCCLUSION_MAX_TRIANGLES are in, nothing of the proxy is added then
+			bool addOccluder(const glm::mat4 &matrix, const OccluderProxy &proxy);
+
+			// clears and rasterizes the bins on threads (on this thread if there are none), returns once they're done
+			void rasterize(vkx::ThreadPool &threads);
+
+			// true if the world space box is behind the occluders everywhere it's on screen
+			bool occluded(const glm::vec3 &min, const glm::vec3 &max) const;
+
+			// stats, as of the last rasterize()
+			uint32_t occluders = 0;
+			uint32_t triangles = 0;
+
+		private:
+
+			// a screen space triangle, ready to rasterize
+			struct Triangle {
+				// edge functions, a * x + b * y + c >= 0 inside
+				float edges[3][3];
+				// depth plane, at the pixel center, moved to the farthest depth in the pixel
+				float z[3];
+				float zMax;
+				// pixel bounds, inclusive
+				int32_t minX, minY, maxX, maxY;
+			};
+
+			glm::mat4 viewProjection;
+
+			std::vector<float> depth;
+			// farthest depth of each 8x8 tile
+			std::vector<float> tileMax;
+
+			std::vector<Triangle> setup;
+			// indices into setup, one list per bin
+			std::vector<std::vector<uint32_t>> bins;
+
+			// scratch for addOccluder()
+			std::vector<glm::vec4> clip;
+
+			void addTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c);
+			void addScreenTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2);
+			void rasterizeBin(uint32_t bin);
+	};
+
+}
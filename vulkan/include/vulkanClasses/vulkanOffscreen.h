@@ -2,6 +2,7 @@
 
 #include "vulkanContext.h"
 #include "vulkanFramebuffer.h"
+#include "vulkanRenderGraph.h"
 
 #define SHADOW_MAP_DIM 2048// 2048
 #define NUM_LIGHTS_TOTAL 6
@@ -21,6 +22,8 @@ namespace vkx {
 		// options
 
 		glm::uvec2 size;
+		// shadow map layers a multiview shadow pass renders, 0 for no multiview render pass
+		uint32_t shadowViewMask = 0;
 		//std::vector<vk::Format> colorFormats = std::vector<vk::Format>{ {
 		//		vk::Format::eR16G16B16A16Sfloat,
 		//		vk::Format::eR16G16B16A16Sfloat,
@@ -35,9 +38,13 @@ namespace vkx {
 		//vk::ImageLayout depthFinalLayout{ vk::ImageLayout::eUndefined };
 
 
-		std::vector<vkx::Framebuffer> framebuffers;
+		// attachments, render passes and framebuffers of the offscreen passes
+		vkx::RenderGraph graph;
 
-		Offscreen(const vkx::Context &context) : context(context) {}
+		vk::Sampler colorSampler;
+		vk::Sampler shadowSampler;
+
+		Offscreen(const vkx::Context &context) : context(context), graph(context) {}
 
 		void prepare() {
 			//assert(!colorFormats.empty());
@@ -51,29 +58,12 @@ namespace vkx {
 
 			cmdBuffer = context.device.allocateCommandBuffers(vkx::commandBufferAllocateInfo(context.getCommandPool(), vk::CommandBufferLevel::ePrimary, 1))[0];
 			renderComplete = context.device.createSemaphore(vk::SemaphoreCreateInfo());
-			//if (!renderPass) {
-				//prepareRenderPass();
-			//}
-
-			//prepareRenderPasses();
-			
-			//addDeferredFramebuffer();
-			addDeferredFramebuffer2();
-			addSSAOGenerateFramebuffer();
-			addSSAOBlurFramebuffer();
-
-			addShadowPassFramebuffer();
-
-
-
-			////prepareOffscreenFramebuffers();
 
-			//framebuffers[0].create(context, size, colorFormats, depthFormat, renderPass, attachmentUsage, depthAttachmentUsage);
+			declarePasses();
+			graph.compile();
 
-			////for (auto &framebuffer : framebuffers) {
-			////	framebuffer.create(context, size, colorFormats, depthFormat, renderPass, attachmentUsage, depthAttachmentUsage);
-			////}
-			//prepareSampler();
+			colorSampler = createSampler(vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerAddressMode::eClampToEdge);
+			shadowSampler = createSampler(vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerAddressMode::eClampToEdge);
 		}
 
 
@@ -82,10 +72,9 @@ namespace vkx {
 		}
 
 		void destroy() {
-			for (auto &framebuffer : framebuffers) {
-				framebuffer.destroy();
-			}
-			framebuffers.clear();
+			graph.destroy();
+			context.device.destroySampler(colorSampler);
+			context.device.destroySampler(shadowSampler);
 			context.device.freeCommandBuffers(context.getCommandPool(), cmdBuffer);
 
 			//context.device.destroyRenderPass(renderPass);
@@ -229,218 +218,75 @@ namespace vkx {
 
 
 
-		void addDeferredFramebuffer2() {
-
-			vkx::Framebuffer deferredFramebuffer;
-			deferredFramebuffer.device = context.device;
-			deferredFramebuffer.context = &context;
-			deferredFramebuffer.width = this->size.x;
-			deferredFramebuffer.height = this->size.y;
-
-			// Offscreen framebuffer, Color attachments
-
-			// Attachment 0: World space positions
-			deferredFramebuffer.createAttachment(vk::Format::eR32G32B32A32Sfloat, vk::ImageUsageFlagBits::eColorAttachment, this->size.x, this->size.y);
-
-			// Attachment 1: World space normal
-			deferredFramebuffer.createAttachment(vk::Format::eR8G8B8A8Unorm, vk::ImageUsageFlagBits::eColorAttachment, this->size.x, this->size.y);
-
-
-			// Attachment 2: Packed colors, specular
-			deferredFramebuffer.createAttachment(vk::Format::eR32G32B32A32Uint, vk::ImageUsageFlagBits::eColorAttachment, this->size.x, this->size.y);
+		// the offscreen passes, in the order they run
+		// composition samples the g-buffer colors, the shadow map and the blurred ssao, so those are outputs
+		// the depth is only read by the hi-z and depth reduction passes and the raw ssao term by the blur,
+		// they're transient and don't overlap, so the ssao term takes the depth's memory (if their memory types allow)
+		void declarePasses() {
 
-
-
-			// Offscreen depth attachment:
-
-			// Find a suitable depth format
-			
 			vk::Format depthFormat = vkx::getSupportedDepthFormat(context.physicalDevice);
-			//vk::Format depthFormat = vk::Format::eD32SfloatS8Uint;
-			//vk::Format depthFormat = vk::Format::eD32Sfloat;
-			deferredFramebuffer.createAttachment(depthFormat, vk::ImageUsageFlagBits::eDepthStencilAttachment, this->size.x, this->size.y);
-
-			//VulkanExampleBase::flushCommandBuffer(layoutCmd, queue, true);
-
-			// todo: fix:
-			//deferredFramebuffer.createRenderPass();
-
-			// G-Buffer creation
-			{
-				std::array<vk::AttachmentDescription, 4> attachmentDescs = {};
-
-				// Init attachment properties
-				for (uint32_t i = 0; i < static_cast<uint32_t>(attachmentDescs.size()); i++) {
-					attachmentDescs[i].samples = vk::SampleCountFlagBits::e1;
-					attachmentDescs[i].loadOp = vk::AttachmentLoadOp::eClear;
-					attachmentDescs[i].storeOp = vk::AttachmentStoreOp::eStore;
-					attachmentDescs[i].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
-					attachmentDescs[i].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
-					// all but 3rd are eShaderReadOnlyOptimal, 3rd is eDepthStencilAttachmentOptimal 
-					attachmentDescs[i].finalLayout = (i == 3) ? vk::ImageLayout::eDepthStencilAttachmentOptimal : vk::ImageLayout::eShaderReadOnlyOptimal;
-				}
-
-
-
-
-
-
-				// Formats
-				attachmentDescs[0].format = deferredFramebuffer.attachments[0].format;
-				attachmentDescs[1].format = deferredFramebuffer.attachments[1].format;
-				attachmentDescs[2].format = deferredFramebuffer.attachments[2].format;
-				//attachmentDescs[3].format = deferredFramebuffer.depthAttachment.format;
-				attachmentDescs[3].format = deferredFramebuffer.attachments[3].format;
-
-				// color attachment references
-				std::vector<vk::AttachmentReference> colorReferences;
-				colorReferences.push_back({ 0, vk::ImageLayout::eColorAttachmentOptimal });
-				colorReferences.push_back({ 1, vk::ImageLayout::eColorAttachmentOptimal });
-				colorReferences.push_back({ 2, vk::ImageLayout::eColorAttachmentOptimal });
-
-				// depth reference
-				vk::AttachmentReference depthReference;
-				depthReference.attachment = 3;
-				depthReference.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
-
-				vk::SubpassDescription subpass;
-				subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
-				subpass.pColorAttachments = colorReferences.data();
-				subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
-				subpass.pDepthStencilAttachment = &depthReference;
-
-
-				// Use subpass dependencies for attachment layout transitions
-				std::vector<vk::SubpassDependency> dependencies;
-				dependencies.resize(2);
-
-				dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-				dependencies[0].dstSubpass = 0;
-				dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;
-				dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-				//dependencies[0].srcAccessMask = vk::AccessFlagBits::eMemoryRead;// replaced 6/21/17
-				dependencies[0].srcAccessMask = vk::AccessFlagBits::eShaderRead;
-				dependencies[0].dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
-				dependencies[0].dependencyFlags = vk::DependencyFlagBits::eByRegion;
-
-				dependencies[1].srcSubpass = 0;
-				dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-				dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-				//dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;// replaced 6/21/17
-				dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eFragmentShader;
-				dependencies[1].srcAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
-				//dependencies[1].dstAccessMask = vk::AccessFlagBits::eMemoryRead;// replaced 6/21/17
-				dependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
-				dependencies[1].dependencyFlags = vk::DependencyFlagBits::eByRegion;
-
-				// create offscreen render pass subpass?
-				vk::RenderPassCreateInfo renderPassInfo;
-				renderPassInfo.pAttachments = attachmentDescs.data();
-				renderPassInfo.attachmentCount = static_cast<uint32_t>(attachmentDescs.size());
-				renderPassInfo.subpassCount = 1;
-				renderPassInfo.pSubpasses = &subpass;
-				renderPassInfo.dependencyCount = 2;
-				renderPassInfo.pDependencies = dependencies.data();
-				deferredFramebuffer.renderPass = context.device.createRenderPass(renderPassInfo, nullptr);
-
-				std::vector<vk::ImageView> attachments;
-				attachments.resize(3);
-				for (size_t i = 0; i < 3; ++i) {
-					attachments[i] = deferredFramebuffer.attachments[i].view;// color attachments
-				}
-				//attachments.push_back(deferredFramebuffer.depthAttachment.view);// depth attachment
-				attachments.push_back(deferredFramebuffer.attachments[3].view);// depth attachment
-
-				vk::FramebufferCreateInfo fbufCreateInfo;
-				fbufCreateInfo.renderPass = deferredFramebuffer.renderPass;
-				fbufCreateInfo.pAttachments = attachments.data();
-				fbufCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-				fbufCreateInfo.width = this->size.x;
-				fbufCreateInfo.height = this->size.y;
-				fbufCreateInfo.layers = 1;
-				// create framebuffer
-				deferredFramebuffer.framebuffer = context.device.createFramebuffer(fbufCreateInfo, nullptr);
-			}
-
-
-
-			// SHARED!:
-			deferredFramebuffer.attachments[0].sampler = createSampler(vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerAddressMode::eClampToEdge);
-			
-			framebuffers.push_back(deferredFramebuffer);
-		}
-
-
-
-		// add SSAO frame buffer
-		void addSSAOGenerateFramebuffer() {
-
-			vkx::Framebuffer SSAOGenerateFramebuffer;
-			SSAOGenerateFramebuffer.device = context.device;
-			SSAOGenerateFramebuffer.context = &context;
-			SSAOGenerateFramebuffer.width = this->size.x;
-			SSAOGenerateFramebuffer.height = this->size.y;
-
-			SSAOGenerateFramebuffer.createAttachment(vk::Format::eR8Unorm, vk::ImageUsageFlagBits::eColorAttachment, this->size.x, this->size.y);
-			SSAOGenerateFramebuffer.createRenderPass();
-			framebuffers.push_back(SSAOGenerateFramebuffer);
-		}
-
-
-
-		void addSSAOBlurFramebuffer() {
-
-			vkx::Framebuffer SSAOBlurFramebuffer;
-			SSAOBlurFramebuffer.device = context.device;
-			SSAOBlurFramebuffer.context = &context;
-			SSAOBlurFramebuffer.width = this->size.x;
-			SSAOBlurFramebuffer.height = this->size.y;
-
-			SSAOBlurFramebuffer.createAttachment(vk::Format::eR8Unorm, vk::ImageUsageFlagBits::eColorAttachment, this->size.x, this->size.y);
-			SSAOBlurFramebuffer.createRenderPass();
-
-			framebuffers.push_back(SSAOBlurFramebuffer);
-		}
-
-
-
-
-
-
-		void addShadowPassFramebuffer() {
-			//int SHADOW_MAP_DIM = 2048;
 
-			vkx::Framebuffer shadowFramebuffer;
-			shadowFramebuffer.device = context.device;
-			shadowFramebuffer.context = &context;
-			shadowFramebuffer.width = SHADOW_MAP_DIM;
-			shadowFramebuffer.height = SHADOW_MAP_DIM;
-			//shadowFramebuffer.width = this->size.x;
-			//shadowFramebuffer.height = this->size.y;
-
-			vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled;
-
-			//vk::Format shadowMapFormat = vk::Format::eD32SfloatS8Uint;
-			vk::Format shadowMapFormat = vk::Format::eD32Sfloat;
-
-			//shadowFramebuffer.createAttachment(vk::Format::eR8Unorm, vk::ImageUsageFlagBits::eColorAttachment, this->size.x, this->size.y, 1);
-			// depth stencil attachment:
-			shadowFramebuffer.createAttachment(shadowMapFormat, usage, SHADOW_MAP_DIM, SHADOW_MAP_DIM, NUM_LIGHTS_TOTAL);
-			//shadowFramebuffer.createAttachment(shadowMapFormat, usage, this->size.x, this->size.y, 3);
-
-			shadowFramebuffer.attachments[0].sampler = createSampler(vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerAddressMode::eClampToEdge);
-
-			shadowFramebuffer.createRenderPass();
-
-
-
-			framebuffers.push_back(shadowFramebuffer);
+			// the static casters' shadows, kept across frames, the static pass only runs when a layer has to be drawn again
+			graph.addAttachment("shadow.static", vk::Format::eD32Sfloat, glm::uvec2(SHADOW_MAP_DIM), NUM_LIGHTS_TOTAL);
+			graph.setPersistent("shadow.static");
+			graph.addPass("shadow.static");
+			graph.writeDepth("shadow.static", "shadow.static");
+
+			// shadow map, one layer per light, a copy of the static one with the dynamic casters drawn on top
+			graph.addAttachment("shadow.map", vk::Format::eD32Sfloat, glm::uvec2(SHADOW_MAP_DIM), NUM_LIGHTS_TOTAL);
+			graph.addPass("shadow");
+			graph.writeDepth("shadow", "shadow.map");
+			graph.copy("shadow", "shadow.static", "shadow.map");
+			graph.addOutput("shadow.map");
+			if (shadowViewMask) {
+				graph.setViewMask("shadow", shadowViewMask);
+			}
 
+			// gpu driven culling of the static meshes, writes the g-buffer pass' indirect draws
+			graph.addPass("gpu.cull");
+
+			// g-buffer: world space positions, world space normals, packed colors + specular
+			graph.addAttachment("gbuffer.position", vk::Format::eR32G32B32A32Sfloat, size);
+			graph.addAttachment("gbuffer.normal", vk::Format::eR8G8B8A8Unorm, size);
+			graph.addAttachment("gbuffer.albedo", vk::Format::eR32G32B32A32Uint, size);
+			graph.addAttachment("gbuffer.depth", depthFormat, size);
+			graph.addPass("gbuffer");
+			graph.writeColor("gbuffer", "gbuffer.position");
+			graph.writeColor("gbuffer", "gbuffer.normal");
+			graph.writeColor("gbuffer", "gbuffer.albedo");
+			graph.writeDepth("gbuffer", "gbuffer.depth");
+			graph.addOutput("gbuffer.position");
+			graph.addOutput("gbuffer.normal");
+			graph.addOutput("gbuffer.albedo");
+
+			// hi-z occlusion: the depth pyramid of what the g-buffer pass drew, and the re-test of what it skipped
+			graph.addPass("hiz");
+			graph.read("hiz", "gbuffer.depth");
+			// the skipped draws that turned out visible, on top of the g-buffer
+			graph.addPass("gbuffer.late");
+			graph.appendTo("gbuffer.late", "gbuffer");
+
+			// min and max of the g-buffer depth for the cascades, a compute dispatch and a readback
+			graph.addPass("depth.reduce");
+			graph.read("depth.reduce", "gbuffer.depth");
+
+			// virtual texture feedback, has its own target and a readback
+			graph.addPass("vt.feedback");
+
+			// ssao
+			vk::ClearColorValue noOcclusion(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 1.0f });
+			graph.addAttachment("ssao.generate", vk::Format::eR8Unorm, size);
+			graph.addPass("ssao.generate");
+			graph.read("ssao.generate", "gbuffer.position");
+			graph.read("ssao.generate", "gbuffer.normal");
+			graph.writeColor("ssao.generate", "ssao.generate", noOcclusion);
+
+			graph.addAttachment("ssao.blur", vk::Format::eR8Unorm, size);
+			graph.addPass("ssao.blur");
+			graph.read("ssao.blur", "ssao.generate");
+			graph.writeColor("ssao.blur", "ssao.blur", noOcclusion);
+			graph.addOutput("ssao.blur");
 		}
 
-
-
-
-
 	};
 }
\ No newline at end of file
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include <vulkan/vulkan.hpp>
+
+#include "vulkanTools.h"
+#include "vulkanContext.h"
+#include "vulkanThreadPool.h"
+
+
+namespace vkx {
+
+	// what differs between the engine's graphics pipelines, everything else is shared:
+	// triangle lists, one sample, dynamic viewport and scissor, depth test and write (less or equal),
+	// and no blending on any color attachment
+	struct GraphicsPipelineDesc {
+		std::string name;
+		// shader file and stage
+		std::vector<std::pair<std::string, vk::ShaderStageFlagBits>> shaders;
+		vk::PipelineLayout layout;
+		vk::RenderPass renderPass;
+		// leave empty for full screen passes that make their own vertices
+		vk::PipelineVertexInputStateCreateInfo vertexInput;
+		vk::CullModeFlags cullMode = vk::CullModeFlagBits::eBack;
+		uint32_t colorAttachments = 1;
+		// depth bias enabled and set dynamically
+		bool depthBias = false;
+		// specialization constants, given to every stage: constant_id i is specialization[i]
+		// all 32 bit, floats are passed as their bits (see specializationFloat)
+		std::vector<uint32_t> specialization;
+	};
+
+	inline uint32_t specializationFloat(float value) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	// creates the pipelines in parallel on the pool's threads, results are in the same order as descs
+	// shaders are loaded up front on the calling thread, through the context's shader cache
+	// the pipeline cache is internally synchronized, so all threads share context.pipelineCache
+	// rethrows the first error once every thread is done
+	std::vector<vk::Pipeline> createGraphicsPipelines(const vkx::Context &context, vkx::ThreadPool &threads, const std::vector<GraphicsPipelineDesc> &descs);
+
+
+
+	// specialized versions of a pipeline, keyed by the values of their specialization constants
+	// a variant that doesn't exist yet is compiled in the background, on its own thread (the pool's threads
+	// are busy recording every frame), and until it's ready get() keeps returning the variant it returned last
+	// so settings can change at runtime without a hitch, the new variant just shows up a few frames later
+	class PipelineVariants {
+
+		public:
+
+			PipelineVariants(const vkx::Context &context) : context(context) {}
+
+			// the desc the variants of desc.name are made from, only the specialization differs between them
+			// pipeline was already created from desc, it's the first variant and stays owned by the caller
+			void addBase(const GraphicsPipelineDesc &desc, vk::Pipeline pipeline);
+
+			// thread safe, throws if name has no base
+			vk::Pipeline get(const std::string &name, const std::vector<uint32_t> &specialization);
+
+			// waits for the background compiles, then destroys every variant made here
+			void destroy();
+
+			// stats
+			uint32_t compiledCount() const;
+			uint32_t pendingCount() const;
+
+		private:
+
+			struct Variant {
+				vk::Pipeline pipeline;
+				bool owned = true;
+			};
+
+			struct Base {
+				GraphicsPipelineDesc desc;
+				// what get() returned last
+				vk::Pipeline current;
+			};
+
+			const vkx::Context &context;
+			vkx::Thread compileThread;
+
+			mutable std::mutex mutex;
+			std::unordered_map<std::string, Base> bases;
+			// keyed by name and specialization, a null pipeline is still compiling (or failed to)
+			std::unordered_map<uint64_t, Variant> variants;
+			uint32_t compiled = 0;
+			uint32_t pending = 0;
+
+			static uint64_t key(const std::string &name, const std::vector<uint32_t> &specialization);
+	};
+
+}
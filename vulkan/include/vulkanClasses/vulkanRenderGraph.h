@@ -0,0 +1,213 @@
+#pragma once
+
+#include <functional>
+#include <unordered_map>
+
+#include <vulkan/vulkan.hpp>
+
+#include "vulkanTools.h"
+#include "vulkanContext.h"
+
+
+// render graph for the offscreen passes
+// passes declare the attachments they write and the ones they sample, the graph works out
+// the rest: render passes, load/store ops, layout transitions and the dependencies between passes,
+// which passes can be skipped, and which attachments can share memory
+// attachments can also be kept across frames and copied into another pass' attachment,
+// and a pass can draw on top of what an earlier pass wrote
+
+// usage:
+//   graph.addAttachment("ssao.generate", vk::Format::eR8Unorm, size);
+//   graph.addPass("ssao.generate");
+//   graph.read("ssao.generate", "gbuffer.normal");
+//   graph.writeColor("ssao.generate", "ssao.generate");
+//   graph.addOutput("ssao.blur");// sampled by composition
+//   graph.compile();
+//   ...
+//   graph.setRecord("ssao.generate", [&](vk::CommandBuffer cmdBuffer) { cmdBuffer.executeCommands(...); });
+//   graph.execute(primary);
+
+namespace vkx {
+
+	class RenderGraph {
+
+		public:
+
+			struct Attachment {
+				std::string name;
+				vk::Format format;
+				glm::uvec2 size;
+				uint32_t layers = 1;
+				bool depth = false;
+
+				// sampled outside the graph (by composition), lives until the end of the frame and is never aliased
+				bool output = false;
+				// outputs can be switched off at runtime, the passes only they need get culled
+				bool outputEnabled = true;
+				// kept from frame to frame, see setPersistent()
+				bool persistent = false;
+				// some pass copies from / into it
+				bool copySource = false;
+				bool copyDestination = false;
+
+				// passes, by index in declaration order
+				int32_t writer = -1;
+				std::vector<uint32_t> readers;
+				vk::ClearValue clearValue;
+
+				// lifetime, first and last pass that touch it
+				uint32_t firstUse = 0;
+				uint32_t lastUse = 0;
+				// memory block the image is bound to, transient attachments with lifetimes that don't overlap share one
+				uint32_t memoryBlock = 0;
+
+				vk::Image image;
+				vk::ImageView view;
+				vk::ImageSubresourceRange subresourceRange;
+				// layout it's left in for the passes (and descriptors) that sample it
+				vk::ImageLayout readLayout;
+			};
+
+			struct Pass {
+				std::string name;
+
+				std::vector<uint32_t> colorWrites;
+				int32_t depthWrite = -1;
+				std::vector<uint32_t> reads;
+				// see copy(), -1 if the pass clears its attachments
+				int32_t copySource = -1;
+				int32_t copyDestination = -1;
+				// see appendTo(), -1 if the pass writes its own attachments
+				int32_t appendsTo = -1;
+
+				// passes without attachments (readbacks, passes with their own render pass) always run when enabled
+				bool enabled = true;
+				// result of the last cull
+				bool live = false;
+
+				// records the pass, called inside the render pass (contents are secondary command buffers)
+				// or on its own for passes without attachments
+				std::function<void(vk::CommandBuffer)> record;
+
+				vk::RenderPass renderPass;
+				vk::Framebuffer framebuffer;
+				glm::uvec2 size;
+				std::vector<vk::ClearValue> clearValues;
+
+				// VK_KHX_multiview, see setViewMask(): a second render pass that broadcasts every draw
+				// to the layers in viewMask (gl_ViewIndex), used instead of the first while multiview is set
+				uint32_t viewMask = 0;
+				bool multiview = false;
+				vk::RenderPass multiviewRenderPass;
+				vk::Framebuffer multiviewFramebuffer;
+
+				// what execute() begins, secondaries have to inherit these
+				vk::RenderPass currentRenderPass() const {
+					return multiview ? multiviewRenderPass : renderPass;
+				}
+				vk::Framebuffer currentFramebuffer() const {
+					return multiview ? multiviewFramebuffer : framebuffer;
+				}
+
+				// gpu time between the start and end of the pass, as of the last readTimings()
+				float gpuMS = 0.0f;
+			};
+
+			RenderGraph(const vkx::Context &context) : context(context) {}
+
+			// declaration, before compile()
+			// attachment and pass names don't clash, a pass can be named after what it writes
+			void addAttachment(const std::string &name, vk::Format format, glm::uvec2 size, uint32_t layers = 1);
+			void addOutput(const std::string &attachment);
+			void addPass(const std::string &name);
+			// passes are executed in the order they were added, so a pass can only read what an earlier pass wrote
+			// every attachment is written by exactly one pass, which clears it (unless it's persistent or copied into)
+			void writeColor(const std::string &pass, const std::string &attachment, vk::ClearColorValue clear = vk::ClearColorValue(std::array<float, 4>{ 0.0f, 0.0f, 0.0f, 0.0f }));
+			void writeDepth(const std::string &pass, const std::string &attachment, vk::ClearDepthStencilValue clear = vk::ClearDepthStencilValue(1.0f, 0));
+			void read(const std::string &pass, const std::string &attachment);
+			// the attachment keeps its contents from frame to frame: it's cleared once by compile(),
+			// after that its writer loads it instead of clearing it, and it's never aliased
+			// the writer can be disabled for as long as the contents are still good
+			void setPersistent(const std::string &attachment);
+			// before its render pass, the pass copies source into destination (one of its writes, same format,
+			// size and layers) and loads it instead of clearing it, source counts as read by the pass
+			void copy(const std::string &pass, const std::string &source, const std::string &destination);
+			// the pass draws on top of everything previous (an earlier pass) wrote: it loads previous' attachments
+			// and renders into them, the passes after it that sample them see both, it writes nothing else
+			// the attachments stay previous' (its clear values, its writes), this is the one exception to the above
+			void appendTo(const std::string &pass, const std::string &previous);
+			// also make a multiview render pass for the pass, only if the device has VK_KHX_multiview
+			void setViewMask(const std::string &pass, uint32_t viewMask);
+
+			// creates images, memory, render passes and framebuffers
+			// throws if a pass reads an attachment no earlier pass writes
+			void compile();
+
+			// timestamps around every pass, frames is how many executes can be in flight at once
+			// does nothing if the graphics queue can't write timestamps
+			void enableTimings(uint32_t frames);
+
+			void destroy();
+
+			// runtime
+			void setRecord(const std::string &pass, std::function<void(vk::CommandBuffer)> record);
+			void setEnabled(const std::string &pass, bool enabled);
+			void setOutputEnabled(const std::string &attachment, bool enabled);
+			// switch a pass with a view mask between its multiview and normal render pass
+			// the pipelines and secondaries it records have to be made for the one in use
+			void setMultiview(const std::string &pass, bool multiview);
+
+			// culls, then begins/ends the render pass of every live pass around its record callback
+			// frame picks the timestamp queries, if timings are enabled
+			void execute(vk::CommandBuffer cmdBuffer, uint32_t frame = 0);
+
+			// updates the passes' gpuMS from frame's last execute, once its command buffer has finished
+			void readTimings(uint32_t frame);
+			bool timingsEnabled() const {
+				return (bool)queryPool;
+			}
+
+			const Attachment &attachment(const std::string &name) const;
+			const Pass &pass(const std::string &name) const;
+
+			// for sampling an attachment, in the layout the graph leaves it in
+			vk::DescriptorImageInfo descriptor(const std::string &attachment, vk::Sampler sampler) const;
+
+			// stats
+			vk::DeviceSize requiredBytes = 0;// sum of all attachments' memory requirements
+			vk::DeviceSize allocatedBytes = 0;// what was actually allocated after aliasing
+			uint32_t livePasses = 0;
+			uint32_t culledPasses = 0;
+
+		private:
+
+			const vkx::Context &context;
+
+			std::vector<Attachment> attachments;
+			std::vector<Pass> passes;
+			std::unordered_map<std::string, uint32_t> attachmentIndices;
+			std::unordered_map<std::string, uint32_t> passIndices;
+
+			std::vector<vk::DeviceMemory> memoryBlocks;
+
+			// two timestamps per pass per frame
+			vk::QueryPool queryPool;
+			uint32_t timingFrames = 0;
+			// which passes frame's last execute wrote timestamps for, [frame * passes + pass]
+			std::vector<uint8_t> timed;
+
+			// scratch for cull()
+			std::vector<bool> needed;
+
+			uint32_t attachmentIndex(const std::string &name) const;
+			uint32_t passIndex(const std::string &name) const;
+
+			void computeLifetimes();
+			void createImages();
+			void createRenderPass(Pass &pass);
+			void clearPersistent();
+			void recordCopy(vk::CommandBuffer cmdBuffer, const Pass &pass);
+			void cull();
+	};
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+
+// shader module cache
+// modules are looked up by path first, then by a hash of the SPIR-V, so a file that's loaded
+// twice (or two files with the same code) only ever makes one module
+// files are memory mapped instead of read into a buffer, and every module is reflected once
+// when it's created, so pipeline layouts can be checked against what the shaders actually use
+
+namespace vkx {
+
+	struct ShaderReflection {
+
+		struct Binding {
+			uint32_t set;
+			uint32_t binding;
+			vk::DescriptorType type;
+			// 0 for runtime sized arrays
+			uint32_t count = 1;
+		};
+
+		std::vector<Binding> bindings;
+		// bytes of push constants the shader declares, 0 if it has none
+		uint32_t pushConstantSize = 0;
+
+		// compares the shader against a pipeline layout, returns what doesn't match (empty if it's fine)
+		// setLayouts holds the bindings of each set in the pipeline layout, nullptr for sets that aren't known,
+		// those are skipped
+		std::vector<std::string> validate(
+			vk::ShaderStageFlagBits stage,
+			const std::vector<const std::vector<vk::DescriptorSetLayoutBinding>*> &setLayouts,
+			const std::vector<vk::PushConstantRange> &pushConstantRanges) const;
+	};
+
+	// pulls descriptor bindings and the push constant block size out of SPIR-V
+	// returns false if the code isn't valid SPIR-V
+	bool reflectSpirv(const uint32_t *code, size_t wordCount, ShaderReflection &reflection);
+
+
+	struct CachedShader {
+		std::string path;
+		vk::ShaderStageFlagBits stage;
+		vk::ShaderModule module;
+		uint64_t hash = 0;
+		size_t size = 0;
+		ShaderReflection reflection;
+	};
+
+
+	class ShaderCache {
+
+		public:
+
+			// set by the context once the device exists
+			vk::Device device;
+
+			// thread safe, the returned reference stays valid until destroy()
+			// throws if the file can't be opened or isn't SPIR-V
+			const CachedShader &load(const std::string &path, vk::ShaderStageFlagBits stage);
+
+			// nullptr if path hasn't been loaded
+			const CachedShader *find(const std::string &path) const;
+
+			void destroy();
+
+			// stats
+			uint32_t pathHits = 0;// path already loaded
+			uint32_t contentHits = 0;// new path, but the code matched a module that already exists
+			size_t bytesMapped = 0;
+
+			size_t moduleCount() const {
+				return shaders.size();
+			}
+
+		private:
+
+			mutable std::mutex mutex;
+			// deque so references handed out stay valid as it grows
+			std::deque<CachedShader> shaders;
+			std::unordered_map<std::string, CachedShader*> byPath;
+			std::unordered_map<uint64_t, CachedShader*> byHash;
+	};
+
+}
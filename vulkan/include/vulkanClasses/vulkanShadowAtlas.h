@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+
+// shadow map atlas
+// square power of two tiles are handed out of square pages (the layers of a shadow map array),
+// each page is a quadtree: a tile is a node, a bigger free node is split into four to make one
+// tiles that are released merge back with their free siblings
+
+namespace vkx {
+
+	class ShadowAtlas {
+
+		public:
+
+			struct Tile {
+				uint32_t page = 0;
+				glm::uvec2 offset;
+				// 0 if it isn't allocated
+				uint32_t size = 0;
+			};
+
+			// pageSize and minTileSize are powers of two, anything allocated before is dropped
+			void init(uint32_t pageSize, uint32_t pageCount, uint32_t minTileSize);
+
+			// size is rounded up to a power of two and clamped to [minTileSize, pageSize]
+			// page -1 takes the first page with room, false if there's none
+			bool allocate(uint32_t size, int32_t page, Tile &tile);
+			void release(Tile &tile);
+
+			uint32_t pageSize() const {
+				return rootSize;
+			}
+			uint32_t pageCount() const {
+				return (uint32_t)pages.size();
+			}
+
+			// texels of every page that are in allocated tiles
+			uint64_t usedTexels = 0;
+
+		private:
+
+			enum NodeState : uint8_t {
+				nodeFree,
+				nodeSplit,
+				nodeUsed
+			};
+
+			// every page is a complete quadtree stored level by level, node i's children are 4i + 1 .. 4i + 4
+			std::vector<std::vector<NodeState>> pages;
+			uint32_t rootSize = 0;
+			uint32_t levels = 0;
+
+			int32_t find(std::vector<NodeState> &nodes, uint32_t node, uint32_t level, uint32_t targetLevel, glm::uvec2 offset, bool split, glm::uvec2 &found);
+	};
+
+}
@@ -92,12 +92,22 @@ namespace vkx {
 			// Load a 2D texture
 			Texture loadTexture(const std::string& filename, vk::Format format, bool forceLinear = false, vk::ImageUsageFlags imageUsageFlags = vk::ImageUsageFlagBits::eSampled);
 
+			// Create a 2D texture from one that has already been loaded from its file
+			Texture loadTexture(const gli::texture2d& tex2D, vk::Format format, bool forceLinear = false, vk::ImageUsageFlags imageUsageFlags = vk::ImageUsageFlagBits::eSampled);
+
+			// The file loadTexture() actually reads for filename, pngs are loaded from the ktx next to them
+			static std::string fileToLoad(const std::string& filename);
+
 			// Load a cubemap texture (single file)
 			Texture loadCubemap(const std::string& filename, vk::Format format);
 
 			// Load an array texture (single file)
 			Texture loadTextureArray(const std::string& filename, vk::Format format);
 
+			// Create an array texture from separate 2D textures, one layer each
+			// All layers must have the same extent and mip count
+			Texture loadTextureArray(const std::vector<gli::texture2d>& layers, vk::Format format);
+
 			void createTexture(void * buffer, vk::DeviceSize bufferSize, vk::Format format, uint32_t width, uint32_t height, vkx::Texture * texture, vk::Filter filter = vk::Filter::eLinear, vk::ImageUsageFlags imageUsageFlags = vk::ImageUsageFlagBits::eSampled);
 			
 			//void createTexture(void * buffer, VkDeviceSize bufferSize, VkFormat format, uint32_t width, uint32_t height, vkx::Texture * texture, VkFilter filter, VkImageUsageFlags imageUsageFlags);
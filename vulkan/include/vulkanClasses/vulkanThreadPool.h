@@ -0,0 +1,106 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+
+namespace vkx {
+
+	// worker thread with its own job queue
+	// jobs added to the same thread run in order, so anything that has to stay on one
+	// thread (like its thread_local command pool) can be pinned to it
+	class Thread {
+
+		public:
+
+			Thread() {
+				worker = std::thread(&Thread::queueLoop, this);
+			}
+
+			~Thread() {
+				if (worker.joinable()) {
+					wait();
+					{
+						std::lock_guard<std::mutex> lock(queueMutex);
+						destroying = true;
+					}
+					condition.notify_all();
+					worker.join();
+				}
+			}
+
+			void addJob(std::function<void()> function) {
+				{
+					std::lock_guard<std::mutex> lock(queueMutex);
+					jobQueue.push(std::move(function));
+				}
+				// the worker and wait() share the condition
+				condition.notify_all();
+			}
+
+			// wait until all queued jobs have finished
+			void wait() {
+				std::unique_lock<std::mutex> lock(queueMutex);
+				condition.wait(lock, [this]() { return jobQueue.empty(); });
+			}
+
+		private:
+
+			std::thread worker;
+			std::queue<std::function<void()>> jobQueue;
+			std::mutex queueMutex;
+			std::condition_variable condition;
+			bool destroying = false;
+
+			void queueLoop() {
+				while (true) {
+					std::function<void()> job;
+					{
+						std::unique_lock<std::mutex> lock(queueMutex);
+						condition.wait(lock, [this] { return !jobQueue.empty() || destroying; });
+						if (destroying) {
+							break;
+						}
+						job = jobQueue.front();
+					}
+
+					job();
+
+					// only pop once it's done, wait() checks for an empty queue
+					{
+						std::lock_guard<std::mutex> lock(queueMutex);
+						jobQueue.pop();
+					}
+					condition.notify_all();
+				}
+			}
+	};
+
+
+	class ThreadPool {
+
+		public:
+
+			std::vector<std::unique_ptr<Thread>> threads;
+
+			void setThreadCount(uint32_t count) {
+				threads.clear();
+				for (uint32_t i = 0; i < count; ++i) {
+					threads.push_back(std::unique_ptr<Thread>(new Thread()));
+				}
+			}
+
+			// wait until every thread is idle
+			void wait() {
+				for (auto &thread : threads) {
+					thread->wait();
+				}
+			}
+	};
+
+}
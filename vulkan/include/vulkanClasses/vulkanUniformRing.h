@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include "vulkanTools.h"
+#include "vulkanContext.h"
+
+
+// per frame linear allocator for transient uniform data (and per instance vertex data)
+// one host visible, persistently mapped buffer split into one region per frame in flight
+// every frame bump allocates from the start of its own region, so the data
+// can grow from frame to frame without reallocating the buffer or rewriting descriptor sets
+
+namespace vkx {
+
+	class UniformRing {
+
+		public:
+
+			struct Allocation {
+				// mapped pointer to write the data to
+				void *data = nullptr;
+				// offset from the start of the frame's region, use as the dynamic offset
+				uint32_t offset = 0;
+				vk::DeviceSize size = 0;
+			};
+
+			UniformRing(const vkx::Context &context) : context(context) {}
+
+			// frameSize is rounded up to the uniform buffer offset alignment
+			void prepare(vk::DeviceSize frameSize, uint32_t frameCount);
+
+			void destroy();
+
+			// reset the frame's region, everything allocated from it the last time around is gone
+			// only call once the frame's fence has been waited on (vulkanApp::beginFrame does this)
+			void beginFrame(uint32_t frame);
+
+			// aligned to minUniformBufferOffsetAlignment
+			// throws if the frame's region is full
+			Allocation allocate(vk::DeviceSize size);
+
+			template<typename T>
+			Allocation push(const T &data) {
+				Allocation allocation = allocate(sizeof(T));
+				memcpy(allocation.data, &data, sizeof(T));
+				return allocation;
+			}
+
+			// descriptor covering range bytes starting at offset inside a frame's region
+			// for dynamic uniform buffers, range is the size of one element
+			vk::DescriptorBufferInfo descriptor(uint32_t frame, vk::DeviceSize range, vk::DeviceSize offset = 0) const;
+
+			vkx::CreateBufferResult buffer;
+
+			vk::DeviceSize frameSize = 0;
+			vk::DeviceSize alignment = 0;
+			uint32_t frameCount = 0;
+
+			// stats
+			vk::DeviceSize used = 0;// bytes allocated by the current frame
+			vk::DeviceSize peak = 0;// most bytes a frame has allocated
+
+		private:
+
+			const vkx::Context &context;
+
+			uint32_t frame = 0;
+			vk::DeviceSize head = 0;
+	};
+
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <vulkan/vulkan.hpp>
+
+#include "vulkanTools.h"
+#include "vulkanContext.h"
+
+
+// software virtual texturing
+// textures are baked into fixed size pages on disk, only the pages the
+// feedback pass asks for are streamed into a fixed size physical cache
+
+// page size in texels, without the border
+#define VT_PAGE_SIZE 128
+// border on each side of a page so bilinear/aniso filtering doesn't bleed
+// one bc block, so pages can be copied as whole blocks
+#define VT_PAGE_BORDER 4
+// physical cache size in pages per side (32 * 136 = 4352 texels, ~18mb of bc2)
+#define VT_CACHE_PAGES 32
+// the feedback buffer is rendered at 1/VT_FEEDBACK_SCALE of the offscreen size
+#define VT_FEEDBACK_SCALE 8
+// max pages copied into the cache per frame
+#define VT_MAX_UPLOADS_PER_FRAME 16
+// max new page requests handed to the loader per frame
+#define VT_MAX_REQUESTS_PER_FRAME 64
+// max number of virtual textures (ids are stored in 8 bits of the feedback)
+#define VT_MAX_TEXTURES 255
+
+#define VT_FILE_MAGIC 0x58455456// "VTEX"
+#define VT_FILE_VERSION 1
+
+namespace vkx {
+
+	// on disk page format (.vtex):
+	//   VirtualTextureHeader
+	//   VirtualTexturePageEntry[pageCount], mip 0 first, pages row major within a mip
+	//   page data, each page is (VT_PAGE_SIZE + 2 * VT_PAGE_BORDER)^2 texels of bc2 blocks
+	struct VirtualTextureHeader {
+		uint32_t magic = VT_FILE_MAGIC;
+		uint32_t version = VT_FILE_VERSION;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t pageSize = VT_PAGE_SIZE;
+		uint32_t pageBorder = VT_PAGE_BORDER;
+		// only levels that need more than one page, plus the first one that fits in a single page
+		uint32_t mipLevels = 0;
+		uint32_t pageCount = 0;
+	};
+
+	struct VirtualTexturePageEntry {
+		uint64_t offset;
+		uint32_t size;
+		uint32_t reserved;
+	};
+
+	// texture baker: splits a bc2 dds/ktx into the tiled page format
+	// returns false if the source can't be loaded or isn't bc2
+	bool bakeVirtualTexture(const std::string &srcFileName, const std::string &dstFileName);
+
+
+	// feedback encoding, written by the feedback fragment shader as one uint per pixel:
+	//   bits 24..31: texture id + 1 (0 = no request)
+	//   bits 20..23: mip level
+	//   bits 10..19: page y
+	//   bits  0..9:  page x
+	inline uint32_t encodeVirtualPage(uint32_t textureId, uint32_t mip, uint32_t x, uint32_t y) {
+		return ((textureId + 1) << 24) | (mip << 20) | (y << 10) | x;
+	}
+
+	// indirection entry, one uint per virtual page, read by the g-buffer shaders:
+	//   bits  0..7:  cache page x
+	//   bits  8..15: cache page y
+	//   bits 16..19: mip level of the resident page (can be coarser than requested)
+	//   bit  31:     valid
+	inline uint32_t encodeIndirection(uint32_t cacheX, uint32_t cacheY, uint32_t mip) {
+		return 0x80000000 | (mip << 16) | (cacheY << 8) | cacheX;
+	}
+
+
+	// per texture info read by the shaders, indexed by texture id
+	struct VirtualTextureInfo {
+		uint32_t indirectionOffset;
+		uint32_t mipLevels;
+		uint32_t width;
+		uint32_t height;
+	};
+
+	struct VirtualTexture {
+		uint32_t id = 0;
+		std::string fileName;
+
+		VirtualTextureHeader header;
+		std::vector<VirtualTexturePageEntry> pages;
+
+		// per mip: index of the first page and page counts
+		std::vector<uint32_t> mipOffsets;
+		std::vector<uint32_t> mipPagesX;
+		std::vector<uint32_t> mipPagesY;
+
+		// offset (in entries) of this texture's table inside the indirection buffer
+		uint32_t indirectionOffset = 0;
+		std::vector<uint32_t> indirection;
+		bool indirectionDirty = true;
+
+		uint32_t pageIndex(uint32_t mip, uint32_t x, uint32_t y) const {
+			return mipOffsets[mip] + y * mipPagesX[mip] + x;
+		}
+	};
+
+
+	class VirtualTextureCache {
+
+		public:
+
+			VirtualTextureCache(const vkx::Context &context) : context(context) {}
+
+			// creates the physical cache, indirection buffer, descriptor set and feedback target
+			// the feedback target is offscreenSize / VT_FEEDBACK_SCALE
+			void prepare(glm::uvec2 offscreenSize, uint32_t maxIndirectionEntries = 1 << 20);
+
+			void destroy();
+
+			// register a baked texture, returns its id
+			// the coarsest mip is loaded right away and never evicted, so there's always something to sample
+			uint32_t add(const std::string &fileName);
+
+			// copy the feedback target into the readback buffer
+			// record after the feedback pass
+			void recordFeedbackReadback(vk::CommandBuffer cmdBuffer);
+
+			// reads back the last frame's feedback, queues missing pages,
+			// uploads pages the loader finished and updates the indirection tables
+			// call at the start of a frame, before its command buffers are submitted
+			// uploads flush the queue, so rewriting the indirection tables is safe with frames in flight
+			void update();
+
+			std::vector<VirtualTexture> textures;
+
+			// physical page cache
+			vkx::CreateImageResult cacheImage;
+			vk::Sampler cacheSampler;
+			vk::DescriptorImageInfo cacheDescriptor;
+
+			// VirtualTextureInfo of all textures
+			vkx::CreateBufferResult infoBuffer;
+
+			// indirection tables of all textures, host visible, one uint per virtual page
+			vkx::CreateBufferResult indirectionBuffer;
+			uint32_t indirectionEntries = 0;
+
+			// binding 0: info buffer, binding 1: indirection buffer, binding 2: physical cache
+			vk::DescriptorSetLayout descriptorSetLayout;
+			vk::DescriptorPool descriptorPool;
+			vk::DescriptorSet descriptorSet;
+
+			// feedback target
+			glm::uvec2 feedbackSize;
+			vk::RenderPass feedbackRenderPass;
+			vk::Framebuffer feedbackFramebuffer;
+			vkx::CreateImageResult feedbackImage;
+			vkx::CreateImageResult feedbackDepth;
+			vkx::CreateBufferResult feedbackReadback;
+
+			// stats
+			uint32_t residentPages = 0;
+			uint32_t requestedPages = 0;// pages requested last frame
+			uint32_t uploadedPages = 0;// pages uploaded last frame
+			uint32_t evictedPages = 0;// total
+
+		private:
+
+			const vkx::Context &context;
+
+			uint32_t pageBytes = 0;
+			uint32_t indirectionCapacity = 0;
+
+			// cache slots, lru order, most recently used first
+			struct Slot {
+				uint64_t key = UINT64_MAX;
+				bool pinned = false;
+			};
+			std::vector<Slot> slots;
+			std::list<uint32_t> lru;
+			std::vector<std::list<uint32_t>::iterator> lruPositions;
+
+			// key -> slot
+			std::unordered_map<uint64_t, uint32_t> resident;
+			// keys handed to the loader that haven't come back yet
+			std::unordered_set<uint64_t> inFlight;
+
+			vkx::CreateBufferResult staging;
+
+			// loader thread
+			struct LoadedPage {
+				uint64_t key;
+				std::vector<uint8_t> data;
+			};
+			std::thread loader;
+			std::mutex loaderMutex;
+			std::condition_variable loaderCondition;
+			std::deque<uint64_t> loadQueue;
+			std::deque<LoadedPage> loadedPages;
+			std::atomic<bool> loaderRunning{ false };
+
+			void loaderMain();
+
+			static uint64_t pageKey(uint32_t textureId, uint32_t mip, uint32_t x, uint32_t y) {
+				return ((uint64_t)textureId << 48) | ((uint64_t)mip << 40) | ((uint64_t)y << 20) | x;
+			}
+
+			static void decodeKey(uint64_t key, uint32_t &textureId, uint32_t &mip, uint32_t &x, uint32_t &y) {
+				textureId = (uint32_t)(key >> 48);
+				mip = (uint32_t)(key >> 40) & 0xFF;
+				y = (uint32_t)(key >> 20) & 0xFFFFF;
+				x = (uint32_t)key & 0xFFFFF;
+			}
+
+			void touch(uint32_t slot);
+			uint32_t allocateSlot();
+			static void readPage(std::ifstream &file, const VirtualTexturePageEntry &entry, std::vector<uint8_t> &data);
+			void uploadPages(std::vector<LoadedPage> &pages, bool pin);
+			void updateIndirection(VirtualTexture &texture);
+	};
+
+}
@@ -153,6 +153,14 @@ namespace vkx {
 	// Load a binary file into a buffer (e.g. SPIR-V)
 	std::vector<uint8_t> readBinaryFile(const std::string& filename);
 
+	// 64 bit content hash (xxHash64), used for deduplicating assets
+	uint64_t hash64(const void* data, size_t size, uint64_t seed = 0);
+
+	template<typename T>
+	inline uint64_t hash64(const std::vector<T>& data, uint64_t seed = 0) {
+		return hash64(data.data(), data.size() * sizeof(T), seed);
+	}
+
 	// Load a SPIR-V shader
 	#if defined(__ANDROID__)
 	vk::ShaderModule loadShader(AAssetManager* assetManager, const char *fileName, vk::Device device, vk::ShaderStageFlagBits stage);
@@ -48,6 +48,7 @@ namespace vkx {
 		// if the mass is not 0, the body is dynamic, calculate local inertia
 		if (rbMass != 0.f) {
 			collisionShape->calculateLocalInertia(rbMass, localInertia);
+			this->object3D->dynamic = true;
 		}
 
 		//using motionstate is optional, it provides interpolation capabilities, and only synchronizes 'active' objects
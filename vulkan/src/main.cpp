@@ -8,6 +8,16 @@
 */
 
 #include "vulkanApp.h"
+#include "vulkanUniformRing.h"
+#include "vulkanThreadPool.h"
+#include "vulkanPipelines.h"
+#include "vulkanCulling.h"
+#include "vulkanShadowAtlas.h"
+#include "vulkanCascades.h"
+#include "vulkanHiZ.h"
+#include "vulkanOcclusionRasterizer.h"
+#include "vulkanGpuScene.h"
+#include "vulkanDrawQueue.h"
 
 
 
@@ -18,11 +28,36 @@
 #define MAX_BONES_PER_VERTEX 4
 // Maximum number of skinned meshes (by 65k uniform limit)
 #define MAX_SKINNED_MESHES 10
+// Bytes of transient uniform data (bones, matrices) each frame in flight can allocate
+#define TRANSIENT_UNIFORM_FRAME_SIZE (4 * 1024 * 1024)
+// Models per g-buffer secondary command buffer, a draw list change only re-records the chunks it touches
+#define GEOMETRY_CHUNK_SIZE 64
+// Skinned mesh bounds are from the bind pose, animation can move vertices this much further out
+#define SKINNED_BOUNDS_PADDING 1.5f
+// Seconds between pipeline cache writes, so pipelines created after startup survive a crash
+#define PIPELINE_CACHE_SAVE_INTERVAL 60.0f
+// Frames the shadow benchmark times each shadow path for, after skipping the frames still in flight from the last one
+#define SHADOW_BENCHMARK_FRAMES 200
+#define SHADOW_BENCHMARK_WARMUP 10
+// Times the occlusion rasterizer benchmark draws and tests each occluder count, the results are averaged
+#define OCCLUSION_BENCHMARK_RUNS 20
+// Cached cascades follow the camera in steps of this many shadow map texels, they're only re-rendered when they step
+#define CASCADE_SCROLL_TEXELS 64
+// Cascade depth ranges are rounded out to steps of this, so casters moving a little don't change them
+#define CASCADE_DEPTH_STEP 4.0f
+// The reduced depth range is rounded out to steps of this many octaves, so the splits don't change every frame
+#define CASCADE_RANGE_STEPS_PER_OCTAVE 4.0f
+// Smallest shadow map tile a light gets, and how far below its tile's size a light's wanted size has to drop
+// before the tile shrinks (it grows as soon as it's too small)
+#define SHADOW_ATLAS_MIN_TILE 256
+#define SHADOW_ATLAS_SHRINK 0.35f
 // Texture properties
 #define TEX_DIM 1024
 
 #define PI 3.14159265359
 
+// maximums, the uniform buffers are sized for them
+// the shaders are specialized on how many are actually used (see shaderQuality)
 #define SSAO_KERNEL_SIZE 64
 #define SSAO_RADIUS 2.0f
 #define SSAO_NOISE_DIM 4
@@ -192,13 +227,19 @@ class VulkanExample : public vkx::vulkanApp {
 	} meshBuffers;
 
 
+	// buffers rewritten every frame have one copy per frame in flight, indexed by currentFrame
 	struct {
 		vkx::CreateBufferResult sceneVS;		// scene data
-		vkx::CreateBufferResult matrixVS;		// matrix data
 		vkx::CreateBufferResult materialVS;		// material data
-		vkx::CreateBufferResult bonesVS;		// bone data for all skinned meshes // max of 1000 skinned meshes w/64 bones/mesh
 	} uniformData;
 
+	// matrix and bone data are bump allocated from the frame's region every frame
+	vkx::UniformRing uniformRing;
+
+	// offset of this frame's matrix nodes inside its ring region
+	// the offscreen command buffers bake it into their dynamic offsets
+	uint32_t matrixBase[MAX_FRAMES_IN_FLIGHT] = {};
+
 
 	// static scene uniform buffer
 	struct {
@@ -233,7 +274,6 @@ class VulkanExample : public vkx::vulkanApp {
 
 	struct TestingVariables {
 		std::vector<std::shared_ptr<vkx::Model>> modelsDeferred;
-		float splitDepths[4] = { 0.1f, 5.0f, 20.0f, 256.0f };
 	} temporary;
 
 
@@ -265,6 +305,11 @@ class VulkanExample : public vkx::vulkanApp {
 		vk::PipelineVertexInputStateCreateInfo inputState;
 		std::vector<vk::VertexInputBindingDescription> bindingDescriptions;
 		std::vector<vk::VertexInputAttributeDescription> attributeDescriptions;
+
+		// the same, plus the instance stream
+		vk::PipelineVertexInputStateCreateInfo instancedInputState;
+		std::vector<vk::VertexInputBindingDescription> instancedBindingDescriptions;
+		std::vector<vk::VertexInputAttributeDescription> instancedAttributeDescriptions;
 	} vertices;
 
 
@@ -369,24 +414,23 @@ class VulkanExample : public vkx::vulkanApp {
 	} uboSSAOKernel;
 
 	// This UBO stores the shadow matrices for all of the light sources
-	// The matrices are indexed using geometry shader instancing
+	// The matrices are indexed using geometry shader instancing, or by the pushed layer (spot lights first, then the cascades)
 	struct {
 		glm::mat4 spotlightMVP[NUM_SPOT_LIGHTS];
 		glm::mat4 dirlightMVP[NUM_DIR_LIGHTS];
 	} uboShadowGS;
 
+	// per frame in flight like uniformData
 	struct {
-		vkx::UniformData vsFullScreen;
-		vkx::UniformData vsOffscreen;
-		vkx::UniformData fsLights;
-
-		vkx::UniformData matrixVS;
+		vkx::UniformData vsFullScreen[MAX_FRAMES_IN_FLIGHT];
+		vkx::UniformData vsOffscreen[MAX_FRAMES_IN_FLIGHT];
+		vkx::UniformData fsLights[MAX_FRAMES_IN_FLIGHT];
 
 
 		vkx::UniformData ssaoKernel;
-		vkx::UniformData ssaoParams;
+		vkx::UniformData ssaoParams[MAX_FRAMES_IN_FLIGHT];
 
-		vkx::UniformData gsShadow;
+		vkx::UniformData gsShadow[MAX_FRAMES_IN_FLIGHT];
 
 	} uniformDataDeferred;
 
@@ -407,6 +451,58 @@ class VulkanExample : public vkx::vulkanApp {
 
 	} rscs;
 
+	// built in pipelines, reserved in this order so their handles are known at compile time
+	enum BuiltinPipeline : uint32_t {
+		pipelineShadow,
+		pipelineMeshes,
+		pipelineMeshesSSAO,
+		pipelineSkinnedMeshes,
+		pipelineSkinnedMeshesSSAO,
+		pipelineFeedback,
+		pipelineSSAOGenerate,
+		pipelineSSAOBlur,
+		pipelineComposition,
+		pipelineCompositionSSAO,
+		pipelineDebug,
+		pipelineDebugSSAO,
+		pipelineShadowLayer,
+		pipelineShadowMultiview,
+		pipelineShadowVertexLayer,
+		pipelineMeshesIndirect,
+		pipelineMeshesIndirectSSAO,
+		pipelineMeshesInstanced,
+		pipelineMeshesInstancedSSAO,
+		pipelineShadowInstanced,
+		pipelineShadowLayerInstanced,
+		pipelineShadowMultiviewInstanced,
+		pipelineShadowVertexLayerInstanced,
+	};
+
+	vk::Pipeline pipeline(BuiltinPipeline id) const {
+		return rscs.pipelines->get(vkx::Handle<vk::Pipeline>(id));
+	}
+
+	// layouts and sets bound while recording, resolved once after they're created
+	struct DrawHandles {
+		vkx::Handle<vk::PipelineLayout> offscreenLayout;
+		vkx::Handle<vk::PipelineLayout> offscreenIndirectLayout;
+		vkx::Handle<vk::PipelineLayout> shadowLayout;
+		vkx::Handle<vk::PipelineLayout> feedbackLayout;
+		vkx::Handle<vk::PipelineLayout> ssaoGenerateLayout;
+		vkx::Handle<vk::PipelineLayout> ssaoBlurLayout;
+		vkx::Handle<vk::PipelineLayout> deferredLayout;
+		vkx::Handle<vk::PipelineLayout> depthReduceLayout;
+
+		vkx::Handle<vk::DescriptorSet> offscreenScene[MAX_FRAMES_IN_FLIGHT];
+		vkx::Handle<vk::DescriptorSet> offscreenMatrix[MAX_FRAMES_IN_FLIGHT];
+		vkx::Handle<vk::DescriptorSet> shadowScene[MAX_FRAMES_IN_FLIGHT];
+		vkx::Handle<vk::DescriptorSet> shadowMatrix[MAX_FRAMES_IN_FLIGHT];
+		vkx::Handle<vk::DescriptorSet> ssaoGenerate[MAX_FRAMES_IN_FLIGHT];
+		vkx::Handle<vk::DescriptorSet> ssaoBlur;
+		vkx::Handle<vk::DescriptorSet> deferred[MAX_FRAMES_IN_FLIGHT];
+		vkx::Handle<vk::DescriptorSet> depthReduce[MAX_FRAMES_IN_FLIGHT];
+	} handles;
+
 	struct {
 		size_t models = 0;
 		size_t skinnedMeshes = 0;
@@ -415,15 +511,362 @@ class VulkanExample : public vkx::vulkanApp {
 	bool updateDraw = true;
 	bool updateOffscreen = true;
 
+	// a visible mesh of modelsDeferred
+	struct DrawItem {
+		uint32_t model;
+		uint32_t mesh;
+	};
+
+	// camera frustum culling for the g-buffer pass, done on the main thread every frame in updateWorld()
+	// (shadows see more than the camera, their layers are culled separately, see shadowCulling)
+	struct {
+		bool enabled = true;
+		vkx::Frustum frustum;
+		// every mesh of the models that are ready, in order
+		vkx::BoundsList meshBounds;
+		std::vector<uint8_t> meshVisible;
+		// 1 for the meshes of dynamic models, same order
+		std::vector<uint8_t> meshDynamic;
+		// one sphere per skinned mesh
+		vkx::BoundsList skinnedBounds;
+		std::vector<uint8_t> skinnedVisible;
+
+		// compact list of what's left, the draws of modelsDeferred[i] are [modelFirstDraw[i], modelFirstDraw[i + 1])
+		std::vector<DrawItem> draws;
+		std::vector<uint32_t> modelFirstDraw;
+
+		// stats, meshes
+		uint32_t visible = 0;
+		uint32_t culled = 0;
+	} culling;
+
+	// the order the g-buffer pass draws culling.draws in, see vulkanDrawQueue.h
+	// every chunk's draws are sorted by key on their own, on the recording threads, the chunks stay where they are
+	// so they're still recorded separately, the recorders only bind what changes from one draw to the next
+	// switched off, the draws are in list order (modelsDeferred's)
+	struct {
+		bool enabled = true;
+		// indices into culling.draws, chunk by chunk
+		std::vector<uint32_t> order;
+		// the rank of every material's descriptor set, and of every static mesh buffer, in the order they first show up
+		std::vector<uint32_t> materialRank;
+		std::unordered_map<const vkx::MeshBuffer*, uint32_t> meshRank;
+		// what the ranks were made for: modelsDeferred, their meshes, the materials
+		size_t rankedSizes[3] = {};
+		// the bounds of modelsDeferred[i]'s first mesh in culling.meshBounds
+		std::vector<uint32_t> modelFirstBounds;
+		// per recording thread, plus one for the main thread
+		std::vector<std::vector<vkx::DrawKey>> keys;
+		std::vector<std::vector<vkx::DrawKey>> scratch;
+		// per chunk, the binds the g-buffer pass needs in list order and in sorted order
+		std::vector<uint32_t> chunkBinds[2];
+
+		// stats, summed over the chunks
+		uint32_t bindsUnsorted = 0;
+		uint32_t bindsSorted = 0;
+	} drawQueue;
+
+	// a static mesh with an occluder proxy, size is how big its bounds look from the camera (radius over distance)
+	struct OccluderItem {
+		uint32_t model;
+		uint32_t mesh;
+		uint32_t bounds;
+		float size;
+	};
+
+	// software occlusion culling, see vulkanOcclusionRasterizer.h
+	// the proxies of the static meshes in view are rasterized on the recording threads, biggest on screen first,
+	// before anything is recorded, what they hide isn't drawn at all, the hi-z candidates are picked from the rest
+	struct {
+		bool enabled = true;
+		vkx::OcclusionRasterizer rasterizer;
+		std::vector<OccluderItem> occluders;
+		// culling.meshVisible without what the occluders hide
+		std::vector<uint8_t> visible;
+
+		// stats
+		uint32_t culled = 0;
+		float rasterizeMS = 0.0f;
+		float testMS = 0.0f;
+		std::string benchmark;
+	} softwareOcclusion;
+
+	// hi-z occlusion culling of the static meshes in the g-buffer pass, see vulkanHiZ.h
+	// the meshes the frustum leaves that are hidden in the last pyramid read back are the candidates:
+	// the g-buffer pass skips them, the gpu tests them again and gbuffer.late draws the ones that are visible
+	struct {
+		bool enabled = true;
+		// what's visible without the candidates, meshVisible itself is left to the frustum
+		std::vector<uint8_t> firstPhase;
+		std::vector<uint8_t> hidden;
+		// the candidates, in the order of their indirect draws
+		std::vector<DrawItem> draws;
+		std::vector<uint32_t> modelFirstDraw;
+		std::vector<vkx::HiZ::Candidate> candidates;
+		std::vector<vk::DrawIndexedIndirectCommand> commands;
+	} occlusion;
+
+	// gpu driven g-buffer pass, see vulkanGpuScene.h
+	// every static mesh goes to gpuScene as an instance every frame, gpu.cull culls them (the frustum, and the
+	// hi-z pyramid when the occlusion culling is on), the g-buffer pass draws them with one indirect draw per
+	// material from a command buffer that's only recorded again when the materials or the segments change
+	// the cpu culling above is left to the skinned meshes and the shadows then
+	struct {
+		bool enabled = true;
+	} gpuDriven;
+
+	// per instance vertex data at INSTANCE_BUFFER_BIND_ID, locations 7 - 10 the matrix, 11 the shadow layer
+	// (gl_InstanceIndex is the instance now, not the layer) and the material
+	struct InstanceData {
+		glm::mat4 model;
+		glm::uvec4 params;
+	};
+
+	// instanceCount instances of modelsDeferred[model]->meshBuffers[mesh], from firstInstance on in the stream
+	struct InstancedDraw {
+		uint32_t model;
+		uint32_t mesh;
+		uint32_t firstInstance;
+		uint32_t instanceCount;
+	};
+
+	// a draw list grouped by mesh buffer, chunk by chunk, the draws of chunk c are [chunkFirstDraw[c], chunkFirstDraw[c + 1])
+	// chunk c's instances start at base + the index of its first mesh, so they stay put when another chunk's change
+	struct InstancedList {
+		std::vector<InstancedDraw> draws;
+		std::vector<uint32_t> chunkFirstDraw;
+		// the model of every instance, from base on
+		std::vector<uint32_t> instanceModels;
+		uint32_t base = 0;
+		uint32_t layer = 0;
+	};
+
+	// hardware instancing of the static meshes: the draws of a list that share a mesh buffer (so its material, and
+	// the pipeline) become one drawIndexed, their matrices go to the instance stream, allocated from the frame's
+	// region of the uniform ring every frame
+	// the grouping only changes with the draw lists, the chunks aren't recorded again any more often than without it
+	// needs the instanced pipelines, the passes without one draw mesh by mesh
+	struct {
+		bool enabled = true;
+		InstancedList geometry;
+		InstancedList shadow[NUM_LIGHTS_TOTAL];
+		InstancedList shadowAnyLayer;
+		InstancedList cache[NUM_LIGHTS_TOTAL];
+		InstancedList cacheAnyLayer;
+		// the first mesh of every chunk, the mesh count at the end
+		std::vector<uint32_t> chunkFirstMesh;
+		// where frame's stream is in the ring buffer
+		vk::DeviceSize offset[MAX_FRAMES_IN_FLIGHT] = {};
+
+		// stats, of the last frame
+		uint32_t draws = 0;
+		uint32_t instances = 0;
+	} instancing;
+
+	// shadow caster culling, one draw list per shadow map layer: the spot lights, then the cascades
+	// a layer's casters are the meshes inside its light's frustum, the cascades are fitted to the
+	// receivers the camera sees in their depth range first
+	struct {
+		bool enabled = true;
+
+		// the draws of modelsDeferred[i] into layer l are [modelFirstDraw[l][i], modelFirstDraw[l][i + 1])
+		std::vector<DrawItem> draws[NUM_LIGHTS_TOTAL];
+		std::vector<uint32_t> modelFirstDraw[NUM_LIGHTS_TOTAL];
+		// casters of any layer, for the geometry shader that draws into all of them at once
+		std::vector<DrawItem> anyLayer;
+		std::vector<uint32_t> anyLayerFirstDraw;
+
+		// a cascade without receivers doesn't need casters either
+		bool cascadeEmpty[NUM_DIR_LIGHTS] = {};
+
+		std::vector<uint8_t> visible;
+		std::vector<uint8_t> visibleAny;
+		std::vector<uint8_t> split;
+
+		// stats, mesh draws summed over the layers
+		uint32_t layerDraws = 0;
+		uint32_t layerCulled = 0;
+	} shadowCulling;
+
+	// ways of getting the casters into the shadow map layers, each has its own pipeline
+	// the paths whose pipeline couldn't be made (no extension or no shader) aren't available
+	enum ShadowPath : int {
+		// shadow.geom, geometry shader invocations copy every caster of any layer to all of them
+		shadowPathGeometry,
+		// shadowLayer.geom, each layer's casters are drawn on their own, the layer is pushed
+		shadowPathGeometryLayer,
+		// VK_KHX_multiview, the render pass broadcasts every caster of any layer to all of them (gl_ViewIndex)
+		shadowPathMultiview,
+		// VK_EXT_shader_viewport_index_layer, each layer's casters are drawn on their own, the vertex shader
+		// writes gl_Layer from the instance index, which is the layer
+		shadowPathVertexLayer,
+		shadowPathCount
+	};
+
+	const char *shadowPathNames[shadowPathCount] = { "geometry shader", "geometry shader per layer", "multiview", "vertex shader layer" };
+
+	// the best available one is picked at startup, can be changed in the settings window
+	int shadowPath = shadowPathGeometry;
+
+	// times the shadow pass with every available path, see runShadowBenchmark()
+	struct {
+		bool running = false;
+		int path = 0;
+		uint32_t frame = 0;
+		int previousPath = shadowPathGeometry;
+		float gpuMS[shadowPathCount] = {};
+		uint32_t draws[shadowPathCount] = {};
+		std::string results;
+	} shadowBenchmark;
+
+	// static shadow cache: the casters that don't move are drawn into shadow.static, a layer is only redrawn
+	// when its light matrix or its static casters change, the shadow pass starts from a copy of it every frame
+	// and only draws the dynamic casters (shadowCulling's lists are only those)
+	// the cascades only move in steps of CASCADE_SCROLL_TEXELS texels, see fitCascade()
+	// switched off, every layer is drawn again every frame and the cascades fit the camera tightly
+	struct {
+		bool enabled = true;
+
+		// the static casters, same layout as shadowCulling's lists
+		std::vector<DrawItem> draws[NUM_LIGHTS_TOTAL];
+		std::vector<uint32_t> modelFirstDraw[NUM_LIGHTS_TOTAL];
+		std::vector<DrawItem> anyLayer;
+		std::vector<uint32_t> anyLayerFirstDraw;
+		std::vector<uint8_t> visibleAny;
+
+		// what each cached layer was drawn with, 0 if it has to be drawn again
+		uint64_t layerSignature[NUM_LIGHTS_TOTAL] = {};
+		// layers the static pass draws this frame, and the path it draws them with
+		uint32_t dirtyLayers = 0;
+		int path = shadowPathGeometry;
+
+		// stats, layers drawn since the last overlay update
+		uint32_t layersDrawn = 0;
+	} shadowCache;
+
+	// per light shadow map resolution: every light gets a tile sized by how much of the screen its shadows
+	// can cover, the tile is baked into its light matrix (composition samples with the same matrix)
+	// tiles come out of shadowAtlas, a light's tile is in its own layer, that's where composition looks for it
+	vkx::ShadowAtlas shadowAtlas;
+	struct {
+		bool enabled = true;
+		vkx::ShadowAtlas::Tile tiles[NUM_LIGHTS_TOTAL];
+		// scales the wanted size, set to 1 when the atlas is made
+		float importance[NUM_LIGHTS_TOTAL];
+		// the matrices without the tile, for culling
+		glm::mat4 lightMatrices[NUM_LIGHTS_TOTAL];
+	} shadowTiles;
+
+	// directional light cascades, see vulkanCascades.h
+	// with sdsm (sample distribution shadow maps) the splits only cover the depth range the camera actually sees:
+	// depth.reduce reduces the g-buffer depth to its min and max on the gpu, they're read back frames later
+	struct {
+		// 0 uniform splits, 1 logarithmic
+		float lambda = 0.8f;
+		bool sdsm = true;
+		float splits[NUM_DIR_LIGHTS + 1];
+
+		// the visible view depth range of the last reduction that was read back, the camera's if there's none
+		float depthMin = 0.0f;
+		float depthMax = 0.0f;
+
+		// null if the shader isn't there
+		vk::Pipeline reducePipeline;
+		// per frame in flight, the min and max depth as uints (the bits of positive floats sort like them)
+		vkx::CreateBufferResult reduceResults[MAX_FRAMES_IN_FLIGHT];
+	} cascades;
+
+
+
+
+
+	// a pass' secondary command buffer and a hash of everything that was baked into it
+	struct PassCmdBuffer {
+		vk::CommandBuffer cmdBuffer;
+		// pool of the thread that records it
+		vk::CommandPool pool;
+		uint64_t signature = 0;
+		bool recorded = false;
+	};
+
+	// per frame in flight command buffers, only recorded once the frame's fence has been waited on
+	// the primaries are recorded every frame, the passes are secondaries that are reused until their signature changes
+	struct FrameCmdBuffers {
+		vk::CommandBuffer offscreen;
+		vk::CommandBuffer composition;
+
+		// static meshes, GEOMETRY_CHUNK_SIZE models per chunk
+		std::vector<PassCmdBuffer> shadow;
+		std::vector<PassCmdBuffer> geometry;
+		// the static shadow cache's layers that are drawn again, cleared first
+		std::vector<PassCmdBuffer> shadowStatic;
+		PassCmdBuffer shadowStaticClear;
+		PassCmdBuffer skinnedMeshes;
+		// the occlusion candidates, indirect
+		PassCmdBuffer geometryLate;
+		// the gpu driven draws of the static meshes, both phases
+		PassCmdBuffer gpuGeometry;
+		PassCmdBuffer gpuGeometryLate;
+		PassCmdBuffer feedback;
+		PassCmdBuffer ssaoGenerate;
+		PassCmdBuffer ssaoBlur;
+		// composition quad
+		PassCmdBuffer deferred;
+		// recorded every frame
+		PassCmdBuffer gui;
+
+		// re-record every pass
+		bool offscreenDirty = true;
+	} frameCmdBuffers[MAX_FRAMES_IN_FLIGHT];
+
+	struct {
+		std::atomic<uint32_t> passesRecorded{ 0 };// secondaries recorded since the last overlay update
+		float recordMSAccum = 0.0f;// time spent recording secondaries since the last overlay update
+		uint32_t frames = 0;
+	} recordingStats;
+
+	float pipelineCacheSaveTimer = 0.0f;// ms since the pipeline cache was last written
 
+	// records the shadow / g-buffer chunks, each thread has its own thread_local command pool
+	vkx::ThreadPool recordingThreads;
 
+	// what the lighting and ssao shaders are specialized on, can be changed at runtime
+	// the variants are compiled in the background the first time a combination is used
+	struct {
+		int pointLights = NUM_POINT_LIGHTS;
+		int spotLights = NUM_SPOT_LIGHTS;
+		int dirLights = NUM_DIR_LIGHTS;
+		int ssaoKernelSize = SSAO_KERNEL_SIZE;
+		float ssaoRadius = SSAO_RADIUS;
+		float ssaoPower = 1.5f;
+	} shaderQuality;
+
+	vkx::PipelineVariants pipelineVariants;
+
+	// composition shaders: constant_id 0 point lights, 1 spot lights, 2 directional lights, 3 shadows on/off
+	std::vector<uint32_t> lightingConstants() const {
+		return {
+			(uint32_t)shaderQuality.pointLights,
+			(uint32_t)shaderQuality.spotLights,
+			(uint32_t)shaderQuality.dirLights,
+			(uint32_t)settings.shadows,
+		};
+	}
 
+	// ssao generate shader: constant_id 0 kernel size, 1 radius, 2 power
+	std::vector<uint32_t> ssaoConstants() const {
+		return {
+			(uint32_t)shaderQuality.ssaoKernelSize,
+			vkx::specializationFloat(shaderQuality.ssaoRadius),
+			vkx::specializationFloat(shaderQuality.ssaoPower),
+		};
+	}
 
-	vk::CommandBuffer offscreenCmdBuffer;
+	vk::Pipeline compositionPipeline() {
+		return pipelineVariants.get(settings.SSAO ? "deferred.composition.ssao" : "deferred.composition", lightingConstants());
+	}
 
 
-	uint32_t lastMaterialIndex = -1;
-	std::string lastMaterialName;
 
 	// todo: move this:
 	bool rayPicking = false;
@@ -437,19 +880,46 @@ class VulkanExample : public vkx::vulkanApp {
 
 	vkx::Offscreen offscreen;
 
-	vk::Fence renderFence;
+	vkx::VirtualTextureCache virtualTextures;
+	vkx::HiZ hiZ;
+	vkx::GpuScene gpuScene;
 
 
 
 
 
-	VulkanExample() : vkx::vulkanApp(ENABLE_VALIDATION), offscreen(context) {
+	VulkanExample() : vkx::vulkanApp(ENABLE_VALIDATION), uniformRing(context), pipelineVariants(context), offscreen(context), virtualTextures(context), hiZ(context), gpuScene(context) {
 
 
 
 
 		rscs.pipelineLayouts = new vkx::PipelineLayoutList(context.device);
 		rscs.pipelines = new vkx::PipelineList(context.device);
+		rscs.pipelines->reserve({
+			"shadow",
+			"offscreen.meshes",
+			"offscreen.meshes.ssao",
+			"offscreen.skinnedMeshes",
+			"offscreen.skinnedMeshes.ssao",
+			"offscreen.feedback",
+			"ssao.generate",
+			"ssao.blur",
+			"deferred.composition",
+			"deferred.composition.ssao",
+			"deferred.debug",
+			"deferred.debug.ssao",
+			"shadow.layer",
+			"shadow.multiview",
+			"shadow.vertexLayer",
+			"offscreen.meshes.indirect",
+			"offscreen.meshes.ssao.indirect",
+			"offscreen.meshes.instanced",
+			"offscreen.meshes.ssao.instanced",
+			"shadow.instanced",
+			"shadow.layer.instanced",
+			"shadow.multiview.instanced",
+			"shadow.vertexLayer.instanced",
+		});
 
 		rscs.descriptorPools = new vkx::DescriptorPoolList(context.device);
 		rscs.descriptorSetLayouts = new vkx::DescriptorSetLayoutList(context.device);
@@ -469,7 +939,7 @@ class VulkanExample : public vkx::vulkanApp {
 		camera.setProjection(80.0f, (float)settings.windowSize.width / (float)settings.windowSize.height, 0.1f, 256.0f);
 
 
-		matrixNodes.resize(1000);
+		// matrixNodes is sized to the object count in updateWorld()
 		materialNodes.resize(1000);
 
 
@@ -482,7 +952,6 @@ class VulkanExample : public vkx::vulkanApp {
 
 		title = "Vulkan test";
 
-		renderFence = context.device.createFence(vk::FenceCreateInfo(), nullptr);// temporary
 
 
 	}
@@ -496,6 +965,9 @@ class VulkanExample : public vkx::vulkanApp {
 		// todo: fix this all up
 
 		offscreen.destroy();
+		virtualTextures.destroy();
+		hiZ.destroy();
+		gpuScene.destroy();
 		imGui->destroy();
 
 
@@ -507,21 +979,23 @@ class VulkanExample : public vkx::vulkanApp {
 
 		// destroy uniform buffers
 		uniformData.sceneVS.destroy();
-		uniformData.matrixVS.destroy();
 		uniformData.materialVS.destroy();
-		uniformData.bonesVS.destroy();
+		uniformRing.destroy();
 
 
 
 
 		// destroy offscreen uniform buffers
-		uniformDataDeferred.vsOffscreen.destroy();
-		uniformDataDeferred.vsFullScreen.destroy();
-		uniformDataDeferred.fsLights.destroy();
+		for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+			uniformDataDeferred.vsOffscreen[i].destroy();
+			uniformDataDeferred.vsFullScreen[i].destroy();
+			uniformDataDeferred.fsLights[i].destroy();
+			uniformDataDeferred.ssaoParams[i].destroy();
+			uniformDataDeferred.gsShadow[i].destroy();
+			cascades.reduceResults[i].destroy();
+		}
 
-		uniformDataDeferred.matrixVS.destroy();
 		uniformDataDeferred.ssaoKernel.destroy();
-		uniformDataDeferred.ssaoParams.destroy();
 
 		// destroy textures:
 		// todo: move / clean this up
@@ -529,10 +1003,40 @@ class VulkanExample : public vkx::vulkanApp {
 		textures.colorMap.destroy();
 
 
-		// destroy offscreen command buffer
-		context.device.freeCommandBuffers(cmdPool, offscreenCmdBuffer);
+		// destroy per frame command buffers
+		for (auto &cmdBuffers : frameCmdBuffers) {
+			if (cmdBuffers.offscreen) {
+				context.device.freeCommandBuffers(cmdPool, cmdBuffers.offscreen);
+			}
+			if (cmdBuffers.composition) {
+				context.device.freeCommandBuffers(cmdPool, cmdBuffers.composition);
+			}
+			for (auto &chunk : cmdBuffers.shadow) {
+				freePass(chunk);
+			}
+			for (auto &chunk : cmdBuffers.geometry) {
+				freePass(chunk);
+			}
+			for (auto &chunk : cmdBuffers.shadowStatic) {
+				freePass(chunk);
+			}
+			freePass(cmdBuffers.shadowStaticClear);
+			freePass(cmdBuffers.skinnedMeshes);
+			freePass(cmdBuffers.geometryLate);
+			freePass(cmdBuffers.gpuGeometry);
+			freePass(cmdBuffers.gpuGeometryLate);
+			freePass(cmdBuffers.feedback);
+			freePass(cmdBuffers.ssaoGenerate);
+			freePass(cmdBuffers.ssaoBlur);
+			freePass(cmdBuffers.deferred);
+			freePass(cmdBuffers.gui);
+		}
 
-		context.device.destroyFence(renderFence, nullptr);// temp
+		// the recording threads' command pools are thread_local, destroy them on their own threads
+		for (auto &thread : recordingThreads.threads) {
+			thread->addJob([this] { context.destroyCommandPool(); });
+		}
+		recordingThreads.wait();
 
 
 		for (auto &mesh : meshes) {
@@ -580,6 +1084,7 @@ class VulkanExample : public vkx::vulkanApp {
 		assetManager.destroy();
 
 
+		pipelineVariants.destroy();
 		rscs.pipelines->destroy();
 
 		rscs.pipelineLayouts->destroy();
@@ -671,6 +1176,25 @@ class VulkanExample : public vkx::vulkanApp {
 
 		vertices.inputState.vertexAttributeDescriptionCount = vertices.attributeDescriptions.size();
 		vertices.inputState.pVertexAttributeDescriptions = vertices.attributeDescriptions.data();
+
+
+		// instanced static meshes, one InstanceData per instance
+		vertices.instancedBindingDescriptions = vertices.bindingDescriptions;
+		vertices.instancedBindingDescriptions.push_back(vkx::vertexInputBindingDescription(INSTANCE_BUFFER_BIND_ID, sizeof(InstanceData), vk::VertexInputRate::eInstance));
+
+		vertices.instancedAttributeDescriptions = vertices.attributeDescriptions;
+		for (uint32_t column = 0; column < 4; ++column) {
+			// Location 7 - 10 : Model matrix
+			vertices.instancedAttributeDescriptions.push_back(vkx::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 7 + column, vk::Format::eR32G32B32A32Sfloat, sizeof(glm::vec4) * column));
+		}
+		// Location 11 : Shadow layer, material
+		vertices.instancedAttributeDescriptions.push_back(vkx::vertexInputAttributeDescription(INSTANCE_BUFFER_BIND_ID, 11, vk::Format::eR32G32B32A32Uint, sizeof(glm::mat4)));
+
+		vertices.instancedInputState = vertices.inputState;
+		vertices.instancedInputState.vertexBindingDescriptionCount = vertices.instancedBindingDescriptions.size();
+		vertices.instancedInputState.pVertexBindingDescriptions = vertices.instancedBindingDescriptions.data();
+		vertices.instancedInputState.vertexAttributeDescriptionCount = vertices.instancedAttributeDescriptions.size();
+		vertices.instancedInputState.pVertexAttributeDescriptions = vertices.instancedAttributeDescriptions.data();
 	}
 
 
@@ -729,16 +1253,16 @@ class VulkanExample : public vkx::vulkanApp {
 		// deferred:
 		// scene data
 		std::vector<vk::DescriptorPoolSize> descriptorPoolSizes5 = {
-			vkx::descriptorPoolSize(vk::DescriptorType::eUniformBuffer, 2),// mostly static data
+			vkx::descriptorPoolSize(vk::DescriptorType::eUniformBuffer, 2 * MAX_FRAMES_IN_FLIGHT),// mostly static data
 		};
-		rscs.descriptorPools->add("offscreen.scene", descriptorPoolSizes5, 1);
+		rscs.descriptorPools->add("offscreen.scene", descriptorPoolSizes5, MAX_FRAMES_IN_FLIGHT);
 
 
 		// matrix data
 		std::vector<vk::DescriptorPoolSize> descriptorPoolSizes6 = {
-			vkx::descriptorPoolSize(vk::DescriptorType::eUniformBufferDynamic, 2),// non-static data
+			vkx::descriptorPoolSize(vk::DescriptorType::eUniformBufferDynamic, 2 * MAX_FRAMES_IN_FLIGHT),// non-static data
 		};
-		rscs.descriptorPools->add("offscreen.matrix", descriptorPoolSizes6, 2);
+		rscs.descriptorPools->add("offscreen.matrix", descriptorPoolSizes6, 2 * MAX_FRAMES_IN_FLIGHT);
 
 
 
@@ -750,11 +1274,19 @@ class VulkanExample : public vkx::vulkanApp {
 
 
 
+		// deferred, ssao generate and shadow scene sets are per frame in flight
 		std::vector<vk::DescriptorPoolSize> descriptorPoolSizesDeferred = {
-			vkx::descriptorPoolSize(vk::DescriptorType::eUniformBuffer, 16),
-			vkx::descriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 16)
+			vkx::descriptorPoolSize(vk::DescriptorType::eUniformBuffer, 16 * MAX_FRAMES_IN_FLIGHT),
+			vkx::descriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 16 * MAX_FRAMES_IN_FLIGHT)
+		};
+		rscs.descriptorPools->add("deferred", descriptorPoolSizesDeferred, 4 * MAX_FRAMES_IN_FLIGHT);
+
+		// depth reduction: the g-buffer depth and the frame's result buffer
+		std::vector<vk::DescriptorPoolSize> descriptorPoolSizesDepthReduce = {
+			vkx::descriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, MAX_FRAMES_IN_FLIGHT),
+			vkx::descriptorPoolSize(vk::DescriptorType::eStorageBuffer, MAX_FRAMES_IN_FLIGHT)
 		};
-		rscs.descriptorPools->add("deferred", descriptorPoolSizesDeferred, 4);
+		rscs.descriptorPools->add("depth.reduce", descriptorPoolSizesDepthReduce, MAX_FRAMES_IN_FLIGHT);
 
 	}
 
@@ -1051,15 +1583,43 @@ class VulkanExample : public vkx::vulkanApp {
 
 		vk::PipelineLayoutCreateInfo pPipelineLayoutCreateInfoDeferred = vkx::pipelineLayoutCreateInfo(descriptorSetLayoutsDeferred.data(), descriptorSetLayoutsDeferred.size());
 
-
+		// the g-buffer shaders sample a material's diffuse through the virtual texture cache when it has one, set 4
+		std::vector<vk::DescriptorSetLayout> descriptorSetLayoutsOffscreen = descriptorSetLayoutsDeferred;
+		if (settings.virtualTexturing) {
+			descriptorSetLayoutsOffscreen.push_back(virtualTextures.descriptorSetLayout);
+		}
+		vk::PipelineLayoutCreateInfo pPipelineLayoutCreateInfoOffscreen = vkx::pipelineLayoutCreateInfo(descriptorSetLayoutsOffscreen.data(), descriptorSetLayoutsOffscreen.size());
 
 		
 		// Offscreen (scene) rendering pipeline layout
-		rscs.pipelineLayouts->add("offscreen", pPipelineLayoutCreateInfoDeferred);
+		rscs.pipelineLayouts->add("offscreen", pPipelineLayoutCreateInfoOffscreen);
 
 		rscs.pipelineLayouts->add("deferred", pPipelineLayoutCreateInfoDeferred);
 
 
+		// gpu driven g-buffer pass, the matrices come from the instance buffer instead of the dynamic uniform buffer
+		std::vector<vk::DescriptorSetLayoutBinding> descriptorSetLayoutBindingsInstances = {
+			// Set 1: Binding 0: Vertex shader storage buffer, vkx::GpuScene::InstanceData[]
+			vkx::descriptorSetLayoutBinding(
+				vk::DescriptorType::eStorageBuffer,
+				vk::ShaderStageFlagBits::eVertex,
+				0),
+		};
+		rscs.descriptorSetLayouts->add("offscreen.instances", descriptorSetLayoutBindingsInstances);
+
+		std::vector<vk::DescriptorSetLayout> descriptorSetLayoutsIndirect{
+			rscs.descriptorSetLayouts->get("offscreen.scene"),
+			rscs.descriptorSetLayouts->get("offscreen.instances"),
+			rscs.descriptorSetLayouts->get("offscreen.textures"),
+			rscs.descriptorSetLayouts->get("deferred"),
+		};
+		if (settings.virtualTexturing) {
+			descriptorSetLayoutsIndirect.push_back(virtualTextures.descriptorSetLayout);
+		}
+		vk::PipelineLayoutCreateInfo pPipelineLayoutCreateInfoIndirect = vkx::pipelineLayoutCreateInfo(descriptorSetLayoutsIndirect.data(), descriptorSetLayoutsIndirect.size());
+		rscs.pipelineLayouts->add("offscreen.indirect", pPipelineLayoutCreateInfoIndirect);
+
+
 
 		//std::vector<vk::DescriptorSetLayout> descriptorSetLayoutsOffscreen{
 		//	rscs.descriptorSetLayouts->get("offscreen.scene"),
@@ -1208,11 +1768,89 @@ class VulkanExample : public vkx::vulkanApp {
 			rscs.descriptorSetLayouts->get("shadow.matrix"),// descriptor set layout
 		};
 
+		// layer the shadow.layer geometry shader draws into, the layered one ignores it
+		vk::PushConstantRange pushConstantRangeShadow = vkx::pushConstantRange(vk::ShaderStageFlagBits::eGeometry, sizeof(uint32_t), 0);
+
 		// create pipelineLayout from descriptorSetLayouts
 		vk::PipelineLayoutCreateInfo pPipelineLayoutCreateInfoShadow = vkx::pipelineLayoutCreateInfo(descriptorSetLayoutsShadow.data(), descriptorSetLayoutsShadow.size());
+		pPipelineLayoutCreateInfoShadow.pushConstantRangeCount = 1;
+		pPipelineLayoutCreateInfoShadow.pPushConstantRanges = &pushConstantRangeShadow;
 		rscs.pipelineLayouts->add("offscreen.shadow", pPipelineLayoutCreateInfoShadow);
 
 
+
+		// ---------------------------------------------------------------------------------------
+		// depth reduction (sdsm):
+
+		std::vector<vk::DescriptorSetLayoutBinding> descriptorSetLayoutBindingsDepthReduce = {
+			// Set 0: Binding 0: g-buffer depth
+			vkx::descriptorSetLayoutBinding(
+				vk::DescriptorType::eCombinedImageSampler,
+				vk::ShaderStageFlagBits::eCompute,
+				0),
+			// Set 0: Binding 1: min and max depth
+			vkx::descriptorSetLayoutBinding(
+				vk::DescriptorType::eStorageBuffer,
+				vk::ShaderStageFlagBits::eCompute,
+				1),
+		};
+		rscs.descriptorSetLayouts->add("depth.reduce", descriptorSetLayoutBindingsDepthReduce);
+
+		vk::PipelineLayoutCreateInfo pPipelineLayoutCreateInfoDepthReduce = vkx::pipelineLayoutCreateInfo(&rscs.descriptorSetLayouts->get("depth.reduce"), 1);
+		rscs.pipelineLayouts->add("depth.reduce", pPipelineLayoutCreateInfoDepthReduce);
+
+
+
+		// ---------------------------------------------------------------------------------------
+		// virtual texture feedback:
+
+		if (settings.virtualTexturing) {
+			std::vector<vk::DescriptorSetLayout> descriptorSetLayoutsFeedback{
+				rscs.descriptorSetLayouts->get("offscreen.scene"),
+				rscs.descriptorSetLayouts->get("offscreen.matrix"),
+				rscs.descriptorSetLayouts->get("offscreen.textures"),// unused, keeps the set numbers the same as the g-buffer pass
+				virtualTextures.descriptorSetLayout,
+			};
+
+			// virtual texture id + 1 of the mesh being drawn
+			vk::PushConstantRange pushConstantRange = vkx::pushConstantRange(vk::ShaderStageFlagBits::eFragment, sizeof(uint32_t), 0);
+
+			vk::PipelineLayoutCreateInfo pPipelineLayoutCreateInfoFeedback = vkx::pipelineLayoutCreateInfo(descriptorSetLayoutsFeedback.data(), descriptorSetLayoutsFeedback.size());
+			pPipelineLayoutCreateInfoFeedback.pushConstantRangeCount = 1;
+			pPipelineLayoutCreateInfoFeedback.pPushConstantRanges = &pushConstantRange;
+			rscs.pipelineLayouts->add("offscreen.feedback", pPipelineLayoutCreateInfoFeedback);
+		}
+
+
+	}
+
+	// per frame descriptor sets are registered as "<name>.<frame>"
+	std::string perFrame(const std::string &name, uint32_t frame) {
+		return name + "." + std::to_string(frame);
+	}
+
+	void resolveHandles() {
+		handles.offscreenLayout = rscs.pipelineLayouts->handle("offscreen");
+		handles.offscreenIndirectLayout = rscs.pipelineLayouts->handle("offscreen.indirect");
+		handles.shadowLayout = rscs.pipelineLayouts->handle("offscreen.shadow");
+		handles.ssaoGenerateLayout = rscs.pipelineLayouts->handle("offscreen.ssaoGenerate");
+		handles.ssaoBlurLayout = rscs.pipelineLayouts->handle("offscreen.ssaoBlur");
+		handles.deferredLayout = rscs.pipelineLayouts->handle("deferred");
+		handles.depthReduceLayout = rscs.pipelineLayouts->handle("depth.reduce");
+		if (settings.virtualTexturing) {
+			handles.feedbackLayout = rscs.pipelineLayouts->handle("offscreen.feedback");
+		}
+
+		for (uint32_t frame = 0; frame < settings.framesInFlight; ++frame) {
+			handles.offscreenScene[frame] = rscs.descriptorSets->handle(perFrame("offscreen.scene", frame));
+			handles.offscreenMatrix[frame] = rscs.descriptorSets->handle(perFrame("offscreen.matrix", frame));
+			handles.shadowScene[frame] = rscs.descriptorSets->handle(perFrame("shadow.scene", frame));
+			handles.shadowMatrix[frame] = rscs.descriptorSets->handle(perFrame("shadow.matrix", frame));
+			handles.ssaoGenerate[frame] = rscs.descriptorSets->handle(perFrame("offscreen.ssao.generate", frame));
+			handles.deferred[frame] = rscs.descriptorSets->handle(perFrame("deferred", frame));
+			handles.depthReduce[frame] = rscs.descriptorSets->handle(perFrame("depth.reduce", frame));
+		}
+		handles.ssaoBlur = rscs.descriptorSets->handle("offscreen.ssao.blur");
 	}
 
 	void prepareDescriptorSets() {
@@ -1220,6 +1858,54 @@ class VulkanExample : public vkx::vulkanApp {
 
 		// create descriptor sets with descriptor pools and set layouts
 
+		// sets that reference a per frame uniform buffer get one copy per frame in flight
+		for (uint32_t frame = 0; frame < settings.framesInFlight; ++frame) {
+			prepareFrameDescriptorSets(frame);
+		}
+
+
+
+		// descriptor set 2
+		// textures data
+		vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo7 =
+			vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("offscreen.textures"), &rscs.descriptorSetLayouts->get("offscreen.textures"), 1);
+		rscs.descriptorSets->add("offscreen.textures", descriptorSetAllocateInfo7);
+
+
+		// ------------------------------------------------------------------------------------------
+		// ------------------------------------------------------------------------------------------
+		// ------------------------------------------------------------------------------------------
+		// SSAO Blur
+
+
+		// descriptor set 
+		vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo10 =
+			vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("deferred"), &rscs.descriptorSetLayouts->get("offscreen.ssao.blur"), 1);
+		rscs.descriptorSets->add("offscreen.ssao.blur", descriptorSetAllocateInfo10);
+
+		vk::DescriptorImageInfo texDescriptorSSAOBlur =
+			offscreen.graph.descriptor("ssao.generate", offscreen.colorSampler);
+
+
+
+		std::vector<vk::WriteDescriptorSet> ssaoBlurWriteDescriptorSets =
+		{
+			// Set 0: Binding 0: Fragment shader image sampler
+			vkx::writeDescriptorSet(
+				rscs.descriptorSets->get("offscreen.ssao.blur"),
+				vk::DescriptorType::eCombinedImageSampler,
+				0,
+				&texDescriptorSSAOBlur),
+		};
+		context.device.updateDescriptorSets(ssaoBlurWriteDescriptorSets, nullptr);
+
+
+
+
+	}
+
+	void prepareFrameDescriptorSets(uint32_t frame) {
+
 
 
 
@@ -1229,26 +1915,19 @@ class VulkanExample : public vkx::vulkanApp {
 		// scene data
 		vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo5 =
 			vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("offscreen.scene"), &rscs.descriptorSetLayouts->get("offscreen.scene"), 1);
-		rscs.descriptorSets->add("offscreen.scene", descriptorSetAllocateInfo5);
+		rscs.descriptorSets->add(perFrame("offscreen.scene", frame), descriptorSetAllocateInfo5);
 
 		// descriptor set 1
 		// matrix data
 		vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo6 =
 			vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("offscreen.matrix"), &rscs.descriptorSetLayouts->get("offscreen.matrix"), 1);
-		rscs.descriptorSets->add("offscreen.matrix", descriptorSetAllocateInfo6);
-
-		// descriptor set 2
-		// textures data
-		vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo7 =
-			vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("offscreen.textures"), &rscs.descriptorSetLayouts->get("offscreen.textures"), 1);
-		rscs.descriptorSets->add("offscreen.textures", descriptorSetAllocateInfo7);
-
+		rscs.descriptorSets->add(perFrame("offscreen.matrix", frame), descriptorSetAllocateInfo6);
 
 		// descriptor set 3
 		// offscreen textures data
 		vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo8 =
 			vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("deferred"), &rscs.descriptorSetLayouts->get("deferred"), 1);
-		rscs.descriptorSets->add("deferred", descriptorSetAllocateInfo8);
+		rscs.descriptorSets->add(perFrame("deferred", frame), descriptorSetAllocateInfo8);
 
 
 
@@ -1258,25 +1937,24 @@ class VulkanExample : public vkx::vulkanApp {
 
 		// vk::Image descriptor for the offscreen texture targets
 		vk::DescriptorImageInfo texDescriptorPosition =
-			vkx::descriptorImageInfo(offscreen.framebuffers[0].attachments[0].sampler, offscreen.framebuffers[0].attachments[0].view, vk::ImageLayout::eShaderReadOnlyOptimal);
+			offscreen.graph.descriptor("gbuffer.position", offscreen.colorSampler);
 
 		vk::DescriptorImageInfo texDescriptorNormal =
-			vkx::descriptorImageInfo(offscreen.framebuffers[0].attachments[0].sampler, offscreen.framebuffers[0].attachments[1].view, vk::ImageLayout::eShaderReadOnlyOptimal);
+			offscreen.graph.descriptor("gbuffer.normal", offscreen.colorSampler);
 
 		vk::DescriptorImageInfo texDescriptorAlbedo =
-			vkx::descriptorImageInfo(offscreen.framebuffers[0].attachments[0].sampler, offscreen.framebuffers[0].attachments[2].view, vk::ImageLayout::eShaderReadOnlyOptimal);
+			offscreen.graph.descriptor("gbuffer.albedo", offscreen.colorSampler);
 
 
 		vk::DescriptorImageInfo texDescriptorSSAOBlurred =
-			vkx::descriptorImageInfo(offscreen.framebuffers[0].attachments[0].sampler, offscreen.framebuffers[2].attachments[0].view, vk::ImageLayout::eShaderReadOnlyOptimal);
+			offscreen.graph.descriptor("ssao.blur", offscreen.colorSampler);
 
 		vk::DescriptorImageInfo texDescriptorShadowMap =
-			vkx::descriptorImageInfo(offscreen.framebuffers[3].attachments[0].sampler, offscreen.framebuffers[3].attachments[0].view, vk::ImageLayout::eShaderReadOnlyOptimal);
-		//vkx::descriptorImageInfo(offscreen.framebuffers[0].attachments[0].sampler, offscreen.framebuffers[3].attachments[0].view, vk::ImageLayout::eShaderReadOnlyOptimal);
+			offscreen.graph.descriptor("shadow.map", offscreen.shadowSampler);
 
 		// depth attachment:
 		vk::DescriptorImageInfo texDescriptorDepthStencil =
-			vkx::descriptorImageInfo(offscreen.framebuffers[0].attachments[0].sampler, offscreen.framebuffers[0].attachments[3].view, vk::ImageLayout::eShaderReadOnlyOptimal);
+			offscreen.graph.descriptor("gbuffer.depth", offscreen.colorSampler);
 
 
 
@@ -1286,51 +1964,51 @@ class VulkanExample : public vkx::vulkanApp {
 
 			// set 3: Binding 0: Vertex shader uniform buffer
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("deferred"),
+				rscs.descriptorSets->get(perFrame("deferred", frame)),
 				vk::DescriptorType::eUniformBuffer,
 				0,
-				&uniformDataDeferred.vsFullScreen.descriptor),
+				&uniformDataDeferred.vsFullScreen[frame].descriptor),
 			// set 3: Binding 1: Position texture target
 			// replaced with depth
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("deferred"),
+				rscs.descriptorSets->get(perFrame("deferred", frame)),
 				vk::DescriptorType::eCombinedImageSampler,
 				1,
 				//&texDescriptorPosition),
 				&texDescriptorPosition),
 			// set 3: Binding 2: Normals texture target
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("deferred"),
+				rscs.descriptorSets->get(perFrame("deferred", frame)),
 				vk::DescriptorType::eCombinedImageSampler,
 				2,
 				&texDescriptorNormal),
 			// set 3: Binding 3: Albedo texture target
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("deferred"),
+				rscs.descriptorSets->get(perFrame("deferred", frame)),
 				vk::DescriptorType::eCombinedImageSampler,
 				3,
 				&texDescriptorAlbedo),
 
 			// set 3: Binding 4: SSAO Blurred
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("deferred"),
+				rscs.descriptorSets->get(perFrame("deferred", frame)),
 				vk::DescriptorType::eCombinedImageSampler,
 				4,
 				&texDescriptorSSAOBlurred),
 
 			// set 3: Binding 5: Shadow Map
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("deferred"),
+				rscs.descriptorSets->get(perFrame("deferred", frame)),
 				vk::DescriptorType::eCombinedImageSampler,
 				5,
 				&texDescriptorShadowMap),
 
 			// set 3: Binding 6: Fragment shader uniform buffer// lights
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("deferred"),
+				rscs.descriptorSets->get(perFrame("deferred", frame)),
 				vk::DescriptorType::eUniformBuffer,
 				6,
-				&uniformDataDeferred.fsLights.descriptor),
+				&uniformDataDeferred.fsLights[frame].descriptor),
 
 
 
@@ -1351,28 +2029,32 @@ class VulkanExample : public vkx::vulkanApp {
 		// todo: combine with above
 		// or dont
 
+		// bones sit at the start of the frame's ring region, matrices are addressed by dynamic offsets
+		vk::DescriptorBufferInfo bonesDescriptor = uniformRing.descriptor(frame, sizeof(uboBoneData));
+		vk::DescriptorBufferInfo matrixDescriptor = uniformRing.descriptor(frame, alignedMatrixSize);
+
 		std::vector<vk::WriteDescriptorSet> offscreenWriteDescriptorSets = {
 			// Set 0: Binding 0: Vertex shader uniform buffer
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("offscreen.scene"),
+				rscs.descriptorSets->get(perFrame("offscreen.scene", frame)),
 				vk::DescriptorType::eUniformBuffer,
 				0,
-				&uniformDataDeferred.vsOffscreen.descriptor),
+				&uniformDataDeferred.vsOffscreen[frame].descriptor),
 
 			// Set 0: Binding 1: bones uniform buffer
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("offscreen.scene"),// descriptor set 0
+				rscs.descriptorSets->get(perFrame("offscreen.scene", frame)),// descriptor set 0
 				vk::DescriptorType::eUniformBuffer,
 				1,// binding 1
-				&uniformData.bonesVS.descriptor),// bind to forward descriptor since it's the same
+				&bonesDescriptor),
 
 
 			// Set 1: Binding 0: Vertex shader uniform buffer
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("offscreen.matrix"),
+				rscs.descriptorSets->get(perFrame("offscreen.matrix", frame)),
 				vk::DescriptorType::eUniformBufferDynamic,
 				0,
-				&uniformData.matrixVS.descriptor),// bind to forward descriptor since it's the same
+				&matrixDescriptor),
 
 			//// Set 2: Binding 0: Scene color map
 			// replaced with materials write descriptor sets
@@ -1397,14 +2079,14 @@ class VulkanExample : public vkx::vulkanApp {
 			// descriptor set
 			vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo9 =
 				vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("deferred"), &rscs.descriptorSetLayouts->get("offscreen.ssao.generate"), 1);
-			rscs.descriptorSets->add("offscreen.ssao.generate", descriptorSetAllocateInfo9);
+			rscs.descriptorSets->add(perFrame("offscreen.ssao.generate", frame), descriptorSetAllocateInfo9);
 
 
 			vk::DescriptorImageInfo texDescriptorPosDepth =
-				vkx::descriptorImageInfo(offscreen.framebuffers[0].attachments[0].sampler, offscreen.framebuffers[0].attachments[0].view, vk::ImageLayout::eShaderReadOnlyOptimal);
+				offscreen.graph.descriptor("gbuffer.position", offscreen.colorSampler);
 
 			vk::DescriptorImageInfo texDescriptorNorm =
-				vkx::descriptorImageInfo(offscreen.framebuffers[0].attachments[0].sampler, offscreen.framebuffers[0].attachments[1].view, vk::ImageLayout::eShaderReadOnlyOptimal);
+				offscreen.graph.descriptor("gbuffer.normal", offscreen.colorSampler);
 
 
 			std::vector<vk::WriteDescriptorSet> ssaoGenerateWriteDescriptorSets = {
@@ -1412,69 +2094,39 @@ class VulkanExample : public vkx::vulkanApp {
 				// Set 0: Binding 0: Fragment shader image sampler// FS Position+Depth
 				// replaced with just depth
 				vkx::writeDescriptorSet(
-					rscs.descriptorSets->get("offscreen.ssao.generate"),
+					rscs.descriptorSets->get(perFrame("offscreen.ssao.generate", frame)),
 					vk::DescriptorType::eCombinedImageSampler,
 					0,
 					//&texDescriptorPosDepth),
 					&texDescriptorPosition),
 				// Set 0: Binding 1: Fragment shader image sampler// FS Normals
 				vkx::writeDescriptorSet(
-					rscs.descriptorSets->get("offscreen.ssao.generate"),
+					rscs.descriptorSets->get(perFrame("offscreen.ssao.generate", frame)),
 					vk::DescriptorType::eCombinedImageSampler,
 					1,
 					&texDescriptorNorm),
 				// Set 0: Binding 2: Fragment shader image sampler// FS SSAO Noise
 				vkx::writeDescriptorSet(
-					rscs.descriptorSets->get("offscreen.ssao.generate"),
+					rscs.descriptorSets->get(perFrame("offscreen.ssao.generate", frame)),
 					vk::DescriptorType::eCombinedImageSampler,
 					2,
 					&textures.ssaoNoise.descriptor),
 				// Set 0: Binding 3: Fragment shader uniform buffer// FS SSAO Kernel UBO
 				vkx::writeDescriptorSet(
-					rscs.descriptorSets->get("offscreen.ssao.generate"),
+					rscs.descriptorSets->get(perFrame("offscreen.ssao.generate", frame)),
 					vk::DescriptorType::eUniformBuffer,
 					3,
 					&uniformDataDeferred.ssaoKernel.descriptor),
 				// Set 0: Binding 4: Fragment shader uniform buffer// FS SSAO Params UBO
 				vkx::writeDescriptorSet(
-					rscs.descriptorSets->get("offscreen.ssao.generate"),
+					rscs.descriptorSets->get(perFrame("offscreen.ssao.generate", frame)),
 					vk::DescriptorType::eUniformBuffer,
 					4,
-					&uniformDataDeferred.ssaoParams.descriptor),
+					&uniformDataDeferred.ssaoParams[frame].descriptor),
 			};
 			context.device.updateDescriptorSets(ssaoGenerateWriteDescriptorSets, nullptr);
 		}
 
-		// ------------------------------------------------------------------------------------------
-		// ------------------------------------------------------------------------------------------
-		// ------------------------------------------------------------------------------------------
-		// SSAO Blur
-
-
-		// descriptor set 
-		vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo10 =
-			vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("deferred"), &rscs.descriptorSetLayouts->get("offscreen.ssao.blur"), 1);
-		rscs.descriptorSets->add("offscreen.ssao.blur", descriptorSetAllocateInfo10);
-
-		vk::DescriptorImageInfo texDescriptorSSAOBlur =
-			vkx::descriptorImageInfo(offscreen.framebuffers[0].attachments[0].sampler, offscreen.framebuffers[1].attachments[0].view, vk::ImageLayout::eShaderReadOnlyOptimal);
-
-
-
-		std::vector<vk::WriteDescriptorSet> ssaoBlurWriteDescriptorSets =
-		{
-			// Set 0: Binding 0: Fragment shader image sampler
-			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("offscreen.ssao.blur"),
-				vk::DescriptorType::eCombinedImageSampler,
-				0,
-				&texDescriptorSSAOBlur),
-		};
-		context.device.updateDescriptorSets(ssaoBlurWriteDescriptorSets, nullptr);
-
-
-
-
 		// ------------------------------------------------------------------------------------------
 		// ------------------------------------------------------------------------------------------
 		// ------------------------------------------------------------------------------------------
@@ -1484,333 +2136,333 @@ class VulkanExample : public vkx::vulkanApp {
 		// descriptor set 0
 		vk::DescriptorSetAllocateInfo descriptorSetAllocateInfoShadow =
 			vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("deferred"), &rscs.descriptorSetLayouts->get("shadow.scene"), 1);
-		rscs.descriptorSets->add("shadow.scene", descriptorSetAllocateInfoShadow);// todo: actually make a descriptor pool for this set
+		rscs.descriptorSets->add(perFrame("shadow.scene", frame), descriptorSetAllocateInfoShadow);// todo: actually make a descriptor pool for this set
 
 
 		// descriptor set 1
 		// matrix data
 		vk::DescriptorSetAllocateInfo descriptorSetAllocateInfoShadowMatrix =
 			vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("offscreen.matrix"), &rscs.descriptorSetLayouts->get("shadow.matrix"), 1);
-		rscs.descriptorSets->add("shadow.matrix", descriptorSetAllocateInfoShadowMatrix);
+		rscs.descriptorSets->add(perFrame("shadow.matrix", frame), descriptorSetAllocateInfoShadowMatrix);
 
 		std::vector<vk::WriteDescriptorSet> writeDescriptorSetsShadow =
 		{
 			// Set 0: Binding 0: geometry shader uniform buffer
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("shadow.scene"),
+				rscs.descriptorSets->get(perFrame("shadow.scene", frame)),
 				vk::DescriptorType::eUniformBuffer,
 				0,
-				&uniformDataDeferred.gsShadow.descriptor),
+				&uniformDataDeferred.gsShadow[frame].descriptor),
 
 			// Set 1: Binding 0: Vertex shader uniform buffer
 			vkx::writeDescriptorSet(
-				rscs.descriptorSets->get("shadow.matrix"),
+				rscs.descriptorSets->get(perFrame("shadow.matrix", frame)),
 				vk::DescriptorType::eUniformBufferDynamic,
 				0,
-				&uniformData.matrixVS.descriptor),// bind to forward descriptor since it's the same
+				&matrixDescriptor),
 		};
 		context.device.updateDescriptorSets(writeDescriptorSetsShadow, nullptr);
 
+		// ------------------------------------------------------------------------------------------
+		// depth reduction:
 
-	}
-
-
-
-
+		vk::DescriptorSetAllocateInfo descriptorSetAllocateInfoDepthReduce =
+			vkx::descriptorSetAllocateInfo(rscs.descriptorPools->get("depth.reduce"), &rscs.descriptorSetLayouts->get("depth.reduce"), 1);
+		rscs.descriptorSets->add(perFrame("depth.reduce", frame), descriptorSetAllocateInfoDepthReduce);
 
+		vk::DescriptorImageInfo texDescriptorDepth = offscreen.graph.descriptor("gbuffer.depth", offscreen.colorSampler);
+		std::vector<vk::WriteDescriptorSet> writeDescriptorSetsDepthReduce =
+		{
+			// Set 0: Binding 0: g-buffer depth
+			vkx::writeDescriptorSet(
+				rscs.descriptorSets->get(perFrame("depth.reduce", frame)),
+				vk::DescriptorType::eCombinedImageSampler,
+				0,
+				&texDescriptorDepth),
+			// Set 0: Binding 1: min and max depth
+			vkx::writeDescriptorSet(
+				rscs.descriptorSets->get(perFrame("depth.reduce", frame)),
+				vk::DescriptorType::eStorageBuffer,
+				1,
+				&cascades.reduceResults[frame].descriptor),
+		};
+		context.device.updateDescriptorSets(writeDescriptorSetsDepthReduce, nullptr);
 
 
+	}
 
 
 
 
 
 
-	void preparePipelines() {
 
-		vk::PipelineInputAssemblyStateCreateInfo inputAssemblyState;
-		inputAssemblyState.topology = vk::PrimitiveTopology::eTriangleList;
 
-		vk::PipelineRasterizationStateCreateInfo rasterizationState =
-			vkx::pipelineRasterizationStateCreateInfo(
-				vk::PolygonMode::eFill,
-				vk::CullModeFlagBits::eBack,
-				vk::FrontFace::eClockwise);
 
-		vk::PipelineColorBlendAttachmentState blendAttachmentState;
-		blendAttachmentState.colorWriteMask = vkx::fullColorWriteMask();
 
-		vk::PipelineColorBlendStateCreateInfo colorBlendState;
-		colorBlendState.attachmentCount = 1;
-		colorBlendState.pAttachments = &blendAttachmentState;
 
-		vk::PipelineDepthStencilStateCreateInfo depthStencilState;
-		depthStencilState.depthTestEnable = VK_TRUE;
-		depthStencilState.depthWriteEnable = VK_TRUE;
-		depthStencilState.depthCompareOp = vk::CompareOp::eLessOrEqual;
 
-		vk::PipelineViewportStateCreateInfo viewportState;
-		viewportState.scissorCount = 1;
-		viewportState.viewportCount = 1;
 
-		vk::PipelineMultisampleStateCreateInfo multisampleState = vkx::pipelineMultisampleStateCreateInfo(vk::SampleCountFlagBits::e1);// added 1/20/17
+	void preparePipelines() {
 
-		std::vector<vk::DynamicState> dynamicStateEnables = {
-			vk::DynamicState::eViewport,
-			vk::DynamicState::eScissor
+		std::vector<vkx::GraphicsPipelineDesc> descs;
+
+		auto add = [&](const std::string &name, const std::string &vert, const std::string &frag, vk::PipelineLayout layout, vk::RenderPass renderPass) -> vkx::GraphicsPipelineDesc& {
+			vkx::GraphicsPipelineDesc desc;
+			desc.name = name;
+			desc.shaders.push_back({ getAssetPath() + "shaders/vulkanscene/" + vert, vk::ShaderStageFlagBits::eVertex });
+			desc.shaders.push_back({ getAssetPath() + "shaders/vulkanscene/" + frag, vk::ShaderStageFlagBits::eFragment });
+			desc.layout = layout;
+			desc.renderPass = renderPass;
+			desc.vertexInput = vertices.inputState;
+			descs.push_back(desc);
+			return descs.back();
 		};
-		vk::PipelineDynamicStateCreateInfo dynamicState;
-		dynamicState.dynamicStateCount = dynamicStateEnables.size();
-		dynamicState.pDynamicStates = dynamicStateEnables.data();
-
-
-		// Load shaders
-		std::array<vk::PipelineShaderStageCreateInfo, 2> shaderStages;
-
-
-		vk::GraphicsPipelineCreateInfo pipelineCreateInfo;
-		// set pipeline layout
-		//pipelineCreateInfo.layout = rscs.pipelineLayouts->get("forward.basic");
-		// set render pass
-		pipelineCreateInfo.renderPass = renderPass;
-
-		pipelineCreateInfo.pVertexInputState = &vertices.inputState;
-		pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
-		pipelineCreateInfo.pRasterizationState = &rasterizationState;
-		pipelineCreateInfo.pColorBlendState = &colorBlendState;
-		pipelineCreateInfo.pMultisampleState = &multisampleState;
-		pipelineCreateInfo.pViewportState = &viewportState;
-		pipelineCreateInfo.pDepthStencilState = &depthStencilState;
-		pipelineCreateInfo.pDynamicState = &dynamicState;
-		pipelineCreateInfo.stageCount = shaderStages.size();
-		pipelineCreateInfo.pStages = shaderStages.data();
-		
-
 
-		//// meshes:
-		//shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/forward/mesh.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		//shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/forward/mesh.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		//vk::Pipeline meshPipeline = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		//rscs.pipelines->add("forward.meshes", meshPipeline);
 
-
-
-		//// skinned meshes:
-		//shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/forward/skinnedMesh.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		//shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/forward/skinnedMesh.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		//vk::Pipeline skinnedMeshPipeline = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		//rscs.pipelines->add("forward.skinnedMeshes", skinnedMeshPipeline);
-
-
-
-		// ----------------------------------------------------------------------------------------------------------
 		// ----------------------------------------------------------------------------------------------------------
 		// deferred:
 
 		// todo: fix
 		// this doesn't need to be a seperate pipeline layout:
+		vk::PipelineLayout deferredLayout = rscs.pipelineLayouts->get("deferred");
 
-		// Separate layout
-		pipelineCreateInfo.layout = rscs.pipelineLayouts->get("deferred");
+		// fullscreen quads, not offscreen
+		// the composition pipelines are the base variants, specialized on the current quality settings
+		add("deferred.composition", "deferred/composition.vert.spv", "deferred/composition.frag.spv", deferredLayout, renderPass).cullMode = vk::CullModeFlagBits::eNone;
+		descs.back().specialization = lightingConstants();
+		add("deferred.composition.ssao", "ssao/composition.vert.spv", "ssao/composition.frag.spv", deferredLayout, renderPass).cullMode = vk::CullModeFlagBits::eNone;
+		descs.back().specialization = lightingConstants();
 
-		rasterizationState.cullMode = vk::CullModeFlagBits::eNone;
+		// Debug display pipelines
+		add("deferred.debug", "deferred/debug.vert.spv", "deferred/debug.frag.spv", deferredLayout, renderPass).cullMode = vk::CullModeFlagBits::eNone;
+		add("deferred.debug.ssao", "ssao/debug.vert.spv", "ssao/debug.frag.spv", deferredLayout, renderPass).cullMode = vk::CullModeFlagBits::eNone;
 
 
+		// -----------------------------------------------------------------------------------------------------------------------------------------
+		// OFFSCREEN PIPELINES:
 
-		// deferred quad that is blitted to:
-		// not offscreen
-		// fullscreen quad
-		shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/deferred/composition.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/deferred/composition.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		vk::Pipeline deferredPipeline = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		rscs.pipelines->add("deferred.composition", deferredPipeline);
+		// g-buffer, one blend attachment state per color attachment
+		vk::PipelineLayout offscreenLayout = rscs.pipelineLayouts->get("offscreen");
+		vk::RenderPass gbufferPass = offscreen.graph.pass("gbuffer").renderPass;
 
+		add("offscreen.meshes", "deferred/mrtMesh.vert.spv", "deferred/mrtMesh.frag.spv", offscreenLayout, gbufferPass).colorAttachments = 3;
+		add("offscreen.skinnedMeshes", "deferred/mrtSkinnedMesh.vert.spv", "deferred/mrtSkinnedMesh.frag.spv", offscreenLayout, gbufferPass).colorAttachments = 3;
 
-		// fullscreen quad
-		shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/composition.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/composition.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		vk::Pipeline deferredSSAOQuadPipeline = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		rscs.pipelines->add("deferred.composition.ssao", deferredSSAOQuadPipeline);
+		// ssao:
+		add("offscreen.meshes.ssao", "ssao/mrtMesh.vert.spv", "ssao/mrtMesh.frag.spv", offscreenLayout, gbufferPass).colorAttachments = 3;
+		add("offscreen.skinnedMeshes.ssao", "ssao/mrtSkinnedMesh.vert.spv", "ssao/mrtSkinnedMesh.frag.spv", offscreenLayout, gbufferPass).colorAttachments = 3;
+
+		// gpu driven, same fragment shaders, the vertex shaders take the instance from gl_InstanceIndex
+		// optional, without them the static meshes are drawn one by one
+		if (gpuScene.ready()) {
+			vk::PipelineLayout indirectLayout = rscs.pipelineLayouts->get("offscreen.indirect");
+			auto addIndirect = [&](const std::string &name, const std::string &vert, const std::string &frag) {
+				if (!shaderAvailable(getAssetPath() + "shaders/vulkanscene/" + vert, vk::ShaderStageFlagBits::eVertex)) {
+					std::cout << "no " << vert << ", no " << name << std::endl;
+					return;
+				}
+				add(name, vert, frag, indirectLayout, gbufferPass).colorAttachments = 3;
+			};
+			addIndirect("offscreen.meshes.indirect", "deferred/mrtMeshIndirect.vert.spv", "deferred/mrtMesh.frag.spv");
+			addIndirect("offscreen.meshes.ssao.indirect", "ssao/mrtMeshIndirect.vert.spv", "ssao/mrtMesh.frag.spv");
+		}
 
+		// instanced, same fragment shaders, the vertex shaders take the matrix from the instance stream
+		// optional too, without them the static meshes are drawn one by one
+		{
+			auto addInstanced = [&](const std::string &name, const std::string &vert, const std::string &frag) {
+				if (!shaderAvailable(getAssetPath() + "shaders/vulkanscene/" + vert, vk::ShaderStageFlagBits::eVertex)) {
+					std::cout << "no " << vert << ", no " << name << std::endl;
+					return;
+				}
+				vkx::GraphicsPipelineDesc &desc = add(name, vert, frag, offscreenLayout, gbufferPass);
+				desc.colorAttachments = 3;
+				desc.vertexInput = vertices.instancedInputState;
+			};
+			addInstanced("offscreen.meshes.instanced", "deferred/mrtMeshInstanced.vert.spv", "deferred/mrtMesh.frag.spv");
+			addInstanced("offscreen.meshes.ssao.instanced", "ssao/mrtMeshInstanced.vert.spv", "ssao/mrtMesh.frag.spv");
+		}
 
-		// Debug display pipeline
-		shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/deferred/debug.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/deferred/debug.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		vk::Pipeline debugPipeline = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		rscs.pipelines->add("deferred.debug", debugPipeline);
 
+		// virtual texture feedback:
+		// writes the page each pixel wants (see vkx::encodeVirtualPage) to a low res R32_UINT target
+		if (settings.virtualTexturing) {
+			add("offscreen.feedback", "vt/feedback.vert.spv", "vt/feedback.frag.spv", rscs.pipelineLayouts->get("offscreen.feedback"), virtualTextures.feedbackRenderPass);
+		}
 
-		// Debug display pipeline
-		shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/debug.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/debug.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		vk::Pipeline debugPipelineSSAO = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		rscs.pipelines->add("deferred.debug.ssao", debugPipelineSSAO);
 
+		// -----------------------------------------------------------------------------------------------------------------------------------
+		// SSAO
+		// full screen triangles, no vertex input
 
+		add("ssao.generate", "ssao/fullscreen.vert.spv", "ssao/ssao.frag.spv", rscs.pipelineLayouts->get("offscreen.ssaoGenerate"), offscreen.graph.pass("ssao.generate").renderPass).vertexInput = vk::PipelineVertexInputStateCreateInfo();
+		descs.back().specialization = ssaoConstants();
+		add("ssao.blur", "ssao/fullscreen.vert.spv", "ssao/blur.frag.spv", rscs.pipelineLayouts->get("offscreen.ssaoBlur"), offscreen.graph.pass("ssao.blur").renderPass).vertexInput = vk::PipelineVertexInputStateCreateInfo();
 
 
+		// Shadow mapping pipeline
+		// The shadow mapping pipeline uses geometry shader instancing (invocations layout modifier) to output 
+		// shadow maps for multiple lights sources into the different shadow map layers in one single render pass
+		{
+			vkx::GraphicsPipelineDesc &shadow = add("shadow", "ssao/shadow.vert.spv", "ssao/shadow.frag.spv", rscs.pipelineLayouts->get("offscreen.shadow"), offscreen.graph.pass("shadow").renderPass);
+			shadow.shaders.push_back({ getAssetPath() + "shaders/vulkanscene/ssao/shadow.geom.spv", vk::ShaderStageFlagBits::eGeometry });
 
+			// Shadow pass doesn't use any color attachments
+			shadow.colorAttachments = 0;
+			// Cull front faces
+			shadow.cullMode = vk::CullModeFlagBits::eFront;
+			// depth bias is dynamic, so it can be changed at runtime
+			shadow.depthBias = true;
+		}
 
+		// the other shadow paths, same state as the one above, only the shaders (and render pass) differ
+		// all optional, without the extension or the shader that path just isn't available
+		{
+			vkx::GraphicsPipelineDesc shadow = descs.back();
+			std::string shaderPath = getAssetPath() + "shaders/vulkanscene/ssao/";
 
+			auto addShadowPath = [&](const std::string &name, const std::string &vert, const std::string &geom, vk::RenderPass renderPass, bool instanced) {
+				std::vector<std::pair<std::string, vk::ShaderStageFlagBits>> shaders = { { shaderPath + vert, vk::ShaderStageFlagBits::eVertex }, { shaderPath + "shadow.frag.spv", vk::ShaderStageFlagBits::eFragment } };
+				if (!geom.empty()) {
+					shaders.push_back({ shaderPath + geom, vk::ShaderStageFlagBits::eGeometry });
+				}
+				for (auto &shader : shaders) {
+					if (!shaderAvailable(shader.first, shader.second)) {
+						std::cout << "no " << shader.first << ", no " << name << " shadow path" << std::endl;
+						return;
+					}
+				}
+				vkx::GraphicsPipelineDesc desc = shadow;
+				desc.name = name;
+				desc.shaders = shaders;
+				desc.renderPass = renderPass;
+				if (instanced) {
+					desc.vertexInput = vertices.instancedInputState;
+				}
+				descs.push_back(desc);
+			};
 
+			// the geometry shader only passes triangles through to the pushed layer
+			addShadowPath("shadow.layer", "shadow.vert.spv", "shadowLayer.geom.spv", shadow.renderPass, false);
+			if (context.multiviewSupported) {
+				addShadowPath("shadow.multiview", "shadowMultiview.vert.spv", "", offscreen.graph.pass("shadow").multiviewRenderPass, false);
+			}
+			if (context.vertexLayerSupported) {
+				addShadowPath("shadow.vertexLayer", "shadowLayer.vert.spv", "", shadow.renderPass, false);
+			}
 
+			// instanced variants of every path, the vertex shaders take the matrix from the instance stream,
+			// shadowLayerInstanced.vert takes the layer from it too
+			addShadowPath("shadow.instanced", "shadowInstanced.vert.spv", "shadow.geom.spv", shadow.renderPass, true);
+			addShadowPath("shadow.layer.instanced", "shadowInstanced.vert.spv", "shadowLayer.geom.spv", shadow.renderPass, true);
+			if (context.multiviewSupported) {
+				addShadowPath("shadow.multiview.instanced", "shadowMultiviewInstanced.vert.spv", "", offscreen.graph.pass("shadow").multiviewRenderPass, true);
+			}
+			if (context.vertexLayerSupported) {
+				addShadowPath("shadow.vertexLayer.instanced", "shadowLayerInstanced.vert.spv", "", shadow.renderPass, true);
+			}
+		}
 
 
-		// -----------------------------------------------------------------------------------------------------------------------------------------
-		// -----------------------------------------------------------------------------------------------------------------------------------------
-		// OFFSCREEN PIPELINES:
+		// depth reduction for the cascades, optional too, without it they split the camera's whole depth range
+		{
+			std::string reduceShader = getAssetPath() + "shaders/vulkanscene/ssao/depthReduce.comp.spv";
+			if (shaderAvailable(reduceShader, vk::ShaderStageFlagBits::eCompute)) {
+				vk::ComputePipelineCreateInfo computePipelineInfo;
+				computePipelineInfo.layout = rscs.pipelineLayouts->get("depth.reduce");
+				computePipelineInfo.stage.stage = vk::ShaderStageFlagBits::eCompute;
+				computePipelineInfo.stage.module = context.shaderCache->load(reduceShader, vk::ShaderStageFlagBits::eCompute).module;
+				computePipelineInfo.stage.pName = "main";
+				cascades.reducePipeline = context.device.createComputePipeline(context.pipelineCache, computePipelineInfo);
+				rscs.pipelines->add("depth.reduce", cascades.reducePipeline);
+			} else {
+				std::cout << "no " << reduceShader << ", the cascades split the camera's whole depth range" << std::endl;
+			}
+		}
 
-		// Separate render pass
-		pipelineCreateInfo.renderPass = offscreen.framebuffers[0].renderPass;
 
-		// Separate layout
-		pipelineCreateInfo.layout = rscs.pipelineLayouts->get("offscreen");
+		// compiled on the recording threads, they're idle until the first frame
+		std::vector<vk::Pipeline> pipelines = vkx::createGraphicsPipelines(context, recordingThreads, descs);
+		for (size_t i = 0; i < descs.size(); ++i) {
+			rscs.pipelines->add(descs[i].name, pipelines[i]);
+			if (!descs[i].specialization.empty()) {
+				pipelineVariants.addBase(descs[i], pipelines[i]);
+			}
+		}
 
-		// Blend attachment states required for all color attachments
-		// This is important, as color write mask will otherwise be 0x0 and you
-		// won't see anything rendered to the attachment
-		std::array<vk::PipelineColorBlendAttachmentState, 3> blendAttachmentStates = {
-			vkx::pipelineColorBlendAttachmentState(),
-			vkx::pipelineColorBlendAttachmentState(),
-			vkx::pipelineColorBlendAttachmentState()
-		};
+		validatePipelineLayouts(descs);
+	}
 
-		colorBlendState.attachmentCount = blendAttachmentStates.size();
-		colorBlendState.pAttachments = blendAttachmentStates.data();
 
-		rasterizationState.cullMode = vk::CullModeFlagBits::eBack;// added
+	vk::Pipeline shadowPathPipeline(int path) const {
+		static const BuiltinPipeline pipelines[shadowPathCount] = { pipelineShadow, pipelineShadowLayer, pipelineShadowMultiview, pipelineShadowVertexLayer };
+		return pipeline(pipelines[path]);
+	}
 
-		// Offscreen pipeline
-		shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/deferred/mrtMesh.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/deferred/mrtMesh.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		vk::Pipeline deferredMeshPipeline = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		rscs.pipelines->add("offscreen.meshes", deferredMeshPipeline);
+	// null without the instanced shaders, or with instancing off
+	vk::Pipeline shadowPathInstancedPipeline(int path) const {
+		static const BuiltinPipeline pipelines[shadowPathCount] = { pipelineShadowInstanced, pipelineShadowLayerInstanced, pipelineShadowMultiviewInstanced, pipelineShadowVertexLayerInstanced };
+		return instancing.enabled ? pipeline(pipelines[path]) : vk::Pipeline();
+	}
 
-		// Offscreen pipeline
-		shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/deferred/mrtSkinnedMesh.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/deferred/mrtSkinnedMesh.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		vk::Pipeline deferredSkinnedMeshPipeline = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		rscs.pipelines->add("offscreen.skinnedMeshes", deferredSkinnedMeshPipeline);
+	vk::Pipeline geometryInstancedPipeline() const {
+		return instancing.enabled ? pipeline(settings.SSAO ? pipelineMeshesInstancedSSAO : pipelineMeshesInstanced) : vk::Pipeline();
+	}
 
-		// ssao:
-
-		// Offscreen pipeline
-		shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/mrtMesh.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/mrtMesh.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		vk::Pipeline deferredMeshSSAOPipeline = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		rscs.pipelines->add("offscreen.meshes.ssao", deferredMeshSSAOPipeline);
-
-		// Offscreen pipeline
-		shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/mrtSkinnedMesh.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/mrtSkinnedMesh.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		vk::Pipeline deferredSkinnedMeshSSAOPipeline = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		rscs.pipelines->add("offscreen.skinnedMeshes.ssao", deferredSkinnedMeshSSAOPipeline);
-
-
-
-		// -----------------------------------------------------------------------------------------------------------------------------------
-		// SSAO
-
-
-		colorBlendState.attachmentCount = 1;
-
-		vk::PipelineVertexInputStateCreateInfo emptyInputState;
-		emptyInputState.vertexAttributeDescriptionCount = 0;
-		emptyInputState.pVertexAttributeDescriptions = nullptr;
-		emptyInputState.vertexBindingDescriptionCount = 0;
-		emptyInputState.pVertexBindingDescriptions = nullptr;
-		pipelineCreateInfo.pVertexInputState = &emptyInputState;
-
-		// SSAO Generate pass
-		shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/fullscreen.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/ssao.frag.spv", vk::ShaderStageFlagBits::eFragment);
-		{
-			//// Set constant parameters via specialization constants
-			//struct SpecializationData {
-			//	uint32_t kernelSize = SSAO_KERNEL_SIZE;
-			//	float radius = SSAO_RADIUS;
-			//	float power = 1.5f;
-			//} specializationData;
-
-			//std::vector<VkSpecializationMapEntry> specializationMapEntries;
-			//specializationMapEntries = {
-			//	vkTools::initializers::specializationMapEntry(0, offsetof(SpecializationData, kernelSize), sizeof(uint32_t)),	// SSAO Kernel size
-			//	vkTools::initializers::specializationMapEntry(1, offsetof(SpecializationData, radius), sizeof(float)),			// SSAO radius
-			//	vkTools::initializers::specializationMapEntry(2, offsetof(SpecializationData, power), sizeof(float)),			// SSAO power
-			//};
-
-			//VkSpecializationInfo specializationInfo = vkTools::initializers::specializationInfo(specializationMapEntries.size(), specializationMapEntries.data(), sizeof(specializationData), &specializationData);
-			//shaderStages[1].pSpecializationInfo = &specializationInfo;
+	bool shadowPathAvailable(int path) const {
+		return (bool)shadowPathPipeline(path);
+	}
 
-			pipelineCreateInfo.renderPass = offscreen.framebuffers[1].renderPass;// SSAO Generate render pass
-			pipelineCreateInfo.layout = rscs.pipelineLayouts->get("offscreen.ssaoGenerate");
+	// each layer's casters on their own, or every caster of any layer into all of them
+	bool shadowPathPerLayer(int path) const {
+		return path == shadowPathGeometryLayer || path == shadowPathVertexLayer;
+	}
 
-			vk::Pipeline ssaoGenerate = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-			rscs.pipelines->add("ssao.generate", ssaoGenerate);
+	// multiview where the device has it, then the paths that cull per layer, then the plain geometry shader
+	void pickShadowPath() {
+		const int preferred[] = { shadowPathMultiview, shadowPathVertexLayer, shadowPathGeometryLayer, shadowPathGeometry };
+		for (int path : preferred) {
+			if (shadowPathAvailable(path)) {
+				shadowPath = path;
+				break;
+			}
 		}
+		std::cout << "shadow path: " << shadowPathNames[shadowPath] << std::endl;
+	}
 
-		// SSAO blur pass
-		shaderStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/fullscreen.vert.spv", vk::ShaderStageFlagBits::eVertex);
-		shaderStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/blur.frag.spv", vk::ShaderStageFlagBits::eFragment);
-
-		pipelineCreateInfo.renderPass = offscreen.framebuffers[2].renderPass;// SSAO Blur render pass
-		pipelineCreateInfo.layout = rscs.pipelineLayouts->get("offscreen.ssaoBlur");
-
-		vk::Pipeline ssaoBlur = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-		rscs.pipelines->add("ssao.blur", ssaoBlur);
-
-
-
-
-
-
-		// change vertex input state back to what it was:
-		pipelineCreateInfo.pVertexInputState = &vertices.inputState;// important
-
-		// seperate pipeline layout:
-		pipelineCreateInfo.layout = rscs.pipelineLayouts->get("offscreen.shadow");
-
-
-		{
-
-			// Shadow mapping pipeline
-			// The shadow mapping pipeline uses geometry shader instancing (invocations layout modifier) to output 
-			// shadow maps for multiple lights sources into the different shadow map layers in one single render pass
-			std::array<vk::PipelineShaderStageCreateInfo, 3> shadowStages;
-			shadowStages[0] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/shadow.vert.spv", vk::ShaderStageFlagBits::eVertex);
-			shadowStages[1] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/shadow.frag.spv", vk::ShaderStageFlagBits::eFragment);
-			shadowStages[2] = context.loadShader(getAssetPath() + "shaders/vulkanscene/ssao/shadow.geom.spv", vk::ShaderStageFlagBits::eGeometry);
-
-			pipelineCreateInfo.pStages = shadowStages.data();
-			pipelineCreateInfo.stageCount = static_cast<uint32_t>(shadowStages.size());
-
-			// Shadow pass doesn't use any color attachments
-			colorBlendState.attachmentCount = 0;
-			colorBlendState.pAttachments = nullptr;
-
-			// Cull front faces
-			rasterizationState.cullMode = vk::CullModeFlagBits::eFront;
-			//rasterizationState.cullMode = vk::CullModeFlagBits::eNone;
-			depthStencilState.depthCompareOp = vk::CompareOp::eLessOrEqual;
-
-			// Enable depth bias
-			rasterizationState.depthBiasEnable = VK_TRUE;
-			// Add depth bias to dynamic state, so we can change it at runtime
-			dynamicStateEnables.push_back(vk::DynamicState::eDepthBias);
-			dynamicState = vkx::pipelineDynamicStateCreateInfo(
-				dynamicStateEnables.data(),
-				static_cast<uint32_t>(dynamicStateEnables.size()));
-
-			// Reset blend attachment state
-			pipelineCreateInfo.renderPass = offscreen.framebuffers[3].renderPass;
-
-			vk::Pipeline shadowPipeline = context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
-			rscs.pipelines->add("shadow", shadowPipeline);
-
+	// loads it into the shader cache, false if it can't be
+	bool shaderAvailable(const std::string &path, vk::ShaderStageFlagBits stage) {
+		try {
+			context.shaderCache->load(path, stage);
+		} catch (std::exception &) {
+			return false;
 		}
+		return true;
+	}
 
-
-
+	// checks every pipeline's shaders (their reflection comes from the shader cache) against its layout
+	// mismatches are only printed, the validation layers have the final say
+	void validatePipelineLayouts(const std::vector<vkx::GraphicsPipelineDesc> &descs) {
+		for (auto &desc : descs) {
+			const vkx::PipelineLayoutList::LayoutInfo *info = rscs.pipelineLayouts->info(desc.layout);
+			if (!info) {
+				continue;
+			}
+			std::vector<const std::vector<vk::DescriptorSetLayoutBinding>*> setLayouts;
+			for (auto &setLayout : info->setLayouts) {
+				setLayouts.push_back(rscs.descriptorSetLayouts->bindings(setLayout));
+			}
+			for (auto &shader : desc.shaders) {
+				const vkx::CachedShader *cached = context.shaderCache->find(shader.first);
+				if (!cached) {
+					continue;
+				}
+				for (auto &problem : cached->reflection.validate(shader.second, setLayouts, info->pushConstantRanges)) {
+					std::cout << "warning: pipeline " << desc.name << ", " << shader.first << ": " << problem << std::endl;
+				}
+			}
+		}
 	}
 
 
@@ -1826,9 +2478,8 @@ class VulkanExample : public vkx::vulkanApp {
 	void prepareUniformBuffers() {
 		// Vertex shader uniform buffer block
 		uniformData.sceneVS = context.createUniformBuffer(uboScene);
-		uniformData.matrixVS = context.createDynamicUniformBuffer(matrixNodes);
 		uniformData.materialVS = context.createDynamicUniformBuffer(materialNodes);
-		uniformData.bonesVS = context.createUniformBuffer(uboBoneData);
+		uniformRing.prepare(TRANSIENT_UNIFORM_FRAME_SIZE, settings.framesInFlight);
 
 		//uniformData.matrixVS = context.createDynamicUniformBufferManual(modelMatrices, 100);
 
@@ -1838,10 +2489,8 @@ class VulkanExample : public vkx::vulkanApp {
 		//uniformData.matrixVS = context.createDynamicUniformBuffer(matrixNodes);
 
 		updateSceneBuffer();// update scene ubo
-		updateMatrixBuffer();// update matrix ubo
+		updateTransientBuffers();// bone and matrix data
 		updateMaterialBuffer();// update material ubo
-		updateBoneBuffer();
-		// todo: update bonedata ubo
 
 	}
 
@@ -1856,9 +2505,23 @@ class VulkanExample : public vkx::vulkanApp {
 		uniformData.sceneVS.copy(uboScene);
 	}
 
+	// bone and matrix data change every frame, they're rewritten into the frame's region of the ring
+	void updateTransientBuffers() {
+		uniformRing.beginFrame(currentFrame);
+		// bones first, they're bound as a plain uniform buffer at the start of the region
+		updateBoneBuffer();
+		updateMatrixBuffer();
+	}
+
 	void updateMatrixBuffer() {
-		// todo:
-		uniformData.matrixVS.copy(matrixNodes);
+
+		vkx::UniformRing::Allocation matrices = uniformRing.allocate(matrixNodes.size() * alignedMatrixSize);
+		for (size_t i = 0; i < matrixNodes.size(); ++i) {
+			memcpy((uint8_t*)matrices.data + i * alignedMatrixSize, &matrixNodes[i], sizeof(MatrixNode));
+		}
+
+		// part of the pass signatures, passes with the old base baked into their dynamic offsets get re-recorded
+		matrixBase[currentFrame] = matrices.offset;
 		//uniformData.matrixVS.copy(modelMatrices);
 
 		//memcpy(uniformData.matrixVS.mapped, modelMatrices, uniformData.matrixVS.size);
@@ -1873,64 +2536,74 @@ class VulkanExample : public vkx::vulkanApp {
 
 	void updateMaterialBuffer() {
 
-		if (materialNodes.size() != this->assetManager.materials.resources.size()) {
-			if (this->assetManager.materials.resources.size() == 0) {
-				vkx::MaterialProperties p;
-				p.ambient = glm::vec4();
-				p.diffuse = glm::vec4();
-				p.specular = glm::vec4();
-				p.opacity = 1.0f;
-				materialNodes[0] = p;
-			} else {
-				materialNodes.resize(this->assetManager.materials.resources.size());
-			}
-		}
-
-
+		vkx::MaterialList &materials = this->assetManager.materials;
 
-		for (auto &iterator : this->assetManager.materials.resources) {
-			uint32_t index = iterator.second.index;
-			materialNodes[index] = iterator.second.properties;
+		if (materials.size() == 0) {
+			return;
 		}
 
+		// the buffer was created with materialNodes' initial size, don't write past it
+		if (materials.size() > materialNodes.size()) {
+			throw std::runtime_error("Too many materials: " + std::to_string(materials.size()) + ", the material buffer holds " + std::to_string(materialNodes.size()));
+		}
 
-		// todo: don't update the whole buffer each time
-		// use map memory range and flush
-		// uniform data must not set local host coherent bit?
-		// makes changes visible to host
-		uniformData.materialVS.copy(materialNodes);
+		// only upload materials whose properties changed
+		for (uint32_t id = 0; id < materials.size(); ++id) {
+			if (!materials.dirty[id]) {
+				continue;
+			}
+			materialNodes[id] = materials.get(id).properties;
+			uniformData.materialVS.copy(materialNodes[id], id * sizeof(vkx::MaterialProperties));
+			materials.dirty[id] = false;
+		}
 	}
 
 
 	void updateBoneBuffer() {
-		uniformData.bonesVS.copy(uboBoneData);
+		// the shader sees the whole array, but only the bones of existing skinned meshes need copying
+		vkx::UniformRing::Allocation bones = uniformRing.allocate(sizeof(uboBoneData));
+		assert(bones.offset == 0);
+		size_t skinnedCount = std::min(skinnedMeshes.size() + skinnedMeshesDeferred.size(), (size_t)MAX_SKINNED_MESHES);
+		memcpy(bones.data, uboBoneData.bones, skinnedCount * MAX_BONES * sizeof(glm::mat4));
+	}
+
+	// dynamic offset of a matrix node in the frame's ring region
+	uint32_t matrixOffset(uint32_t frame, uint32_t matrixIndex) {
+		return matrixBase[frame] + matrixIndex * alignedMatrixSize;
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
 	void prepareUniformBuffersDeferred() {
-		// Fullscreen quad vertex shader
-		uniformDataDeferred.vsFullScreen = context.createUniformBuffer(uboVS);
+		for (uint32_t i = 0; i < settings.framesInFlight; ++i) {
+			// Fullscreen quad vertex shader
+			uniformDataDeferred.vsFullScreen[i] = context.createUniformBuffer(uboVS);
 
-		// Offscreen vertex shader
-		uniformDataDeferred.vsOffscreen = context.createUniformBuffer(uboOffscreenVS);
+			// Offscreen vertex shader
+			uniformDataDeferred.vsOffscreen[i] = context.createUniformBuffer(uboOffscreenVS);
 
-		// Deferred fragment shader
-		uniformDataDeferred.fsLights = context.createUniformBuffer(uboFSLights);
-
-		uniformDataDeferred.matrixVS = context.createDynamicUniformBuffer(matrixNodes);
+			// Deferred fragment shader
+			uniformDataDeferred.fsLights[i] = context.createUniformBuffer(uboFSLights);
 
+			// ssao
+			uniformDataDeferred.ssaoParams[i] = context.createUniformBuffer(uboSSAOParams);
 
+			// shadow mapping
+			uniformDataDeferred.gsShadow[i] = context.createUniformBuffer(uboShadowGS);
 
+			// cascades, read back by the cpu
+			vk::MemoryPropertyFlags hostFlags = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+			cascades.reduceResults[i] = context.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst, hostFlags, 2 * sizeof(uint32_t));
+			cascades.reduceResults[i].map();
+			memset(cascades.reduceResults[i].mapped, 0, 2 * sizeof(uint32_t));
+		}
 
-		// ssao
-		uniformDataDeferred.ssaoParams = context.createUniformBuffer(uboSSAOParams);
-		uniformDataDeferred.ssaoKernel = context.createUniformBuffer(uboSSAOKernel);
+		// deferred matrix data is read from the uniform ring, same as forward
 
 
 
 
-		// shadow mapping
-		uniformDataDeferred.gsShadow = context.createUniformBuffer(uboShadowGS);
+		// ssao
+		uniformDataDeferred.ssaoKernel = context.createUniformBuffer(uboSSAOKernel);
 
 
 
@@ -1939,7 +2612,6 @@ class VulkanExample : public vkx::vulkanApp {
 		// offscreen:
 		updateUniformBuffersScreen();
 		updateSceneBufferDeferred();
-		updateMatrixBufferDeferred();
 
 		initLights();
 		updateUniformBufferDeferredLights();
@@ -1962,18 +2634,14 @@ class VulkanExample : public vkx::vulkanApp {
 		uboVS.model = glm::mat4();
 		//uboVS.camPos = glm::vec4(camera.transform.translation, 1.0);// added
 
-		uniformDataDeferred.vsFullScreen.copy(uboVS);
+		uniformDataDeferred.vsFullScreen[currentFrame].copy(uboVS);
 	}
 
 	void updateSceneBufferDeferred() {
 		//camera.updateViewMatrix();
 		uboOffscreenVS.projection = camera.matrices.projection;
 		uboOffscreenVS.view = camera.matrices.view;
-		uniformDataDeferred.vsOffscreen.copy(uboOffscreenVS);
-	}
-
-	void updateMatrixBufferDeferred() {
-		uniformDataDeferred.matrixVS.copy(matrixNodes);
+		uniformDataDeferred.vsOffscreen[currentFrame].copy(uboOffscreenVS);
 	}
 
 
@@ -2001,114 +2669,159 @@ class VulkanExample : public vkx::vulkanApp {
 	}
 
 
-	glm::mat4 calculateFrustum(glm::vec3 lightDir, float zMin, float zMax, float mainNear, float mainFar) {
-		float projWidth = settings.windowSize.width;
-		float projHeight = settings.windowSize.height;
-		float projFov = 80.0f;
-
-		//float mainNear = 0.1f;
-		//float mainFar = 256.0f;
-
-		//float minZ = 25.0f;
-		//float maxZ = 90.0f;
+	// light space x/y extents of the receivers the camera (at eye, looking along forward) sees between zMin and zMax,
+	// false if there aren't any
+	bool receiverBounds(const glm::mat4 &lightView, glm::vec3 eye, glm::vec3 forward, float zMin, float zMax, glm::vec2 &min, glm::vec2 &max) {
 
+		min = glm::vec2(std::numeric_limits<float>::max());
+		max = glm::vec2(-std::numeric_limits<float>::max());
+		bool found = false;
 
+		glm::vec3 absForward = glm::abs(forward);
 
-		// Get the inverse of the view transform
-		//p.SetCamera(m_pGameCamera->GetPos(), m_pGameCamera->GetTarget(), m_pGameCamera->GetUp());
-		//glm::mat4 Cam = p.GetViewTrans();
-		//glm::mat4 CamInv = Cam.Inverse();
-
-		glm::vec3 dir2 = glm::normalize(camera.transform.orientation*glm::vec3(0.0, 0.0, -1.0));
-		glm::mat4 test = glm::lookAt(
-			camera.transform.translation, // camera position
-			camera.transform.translation - dir2, // point to look at
-			glm::vec3(0, 0, 1)  // up vector
-		);
-
-
-		//glm::mat4 CamInv = glm::inverse(camera.matrices.view);
-		//glm::mat4 CamInv = camera.matrices.view;
-
-		//glm::mat4 CamInv = test;
-		glm::mat4 CamInv = glm::inverse(test);
-
-		// Get the light space tranform
-		//p.SetCamera(glm::vec3(0.0f, 0.0f, 0.0f), m_dirLight.Direction, glm::vec3(0.0f, 1.0f, 0.0f));
-		//glm::mat4 LightM = p.GetViewTrans();
-
-		glm::mat4 LightM = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), lightDir, glm::vec3(0.0f, 0.0f, 1.0f));
-		//glm::mat4 LightM = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f)-lightDir, glm::vec3(0.0f, 0.0f, 1.0f));
-
-		float ar = projHeight / projWidth;
-		float tanHalfHFOV = tanf(glm::radians(projFov / 2.0f));
-		float tanHalfVFOV = tanf(glm::radians((projFov * ar) / 2.0f));
-
-
-		float xn = zMin * tanHalfHFOV;
-		float xf = zMax * tanHalfHFOV;
-		float yn = zMin * tanHalfVFOV;
-		float yf = zMax * tanHalfVFOV;
+		auto addReceivers = [&](const vkx::BoundsList &bounds, const std::vector<uint8_t> &visible) {
+			for (size_t i = 0; i < bounds.size(); ++i) {
+				if (!visible[i]) {
+					continue;
+				}
+				glm::vec3 boxMin, boxMax;
+				bounds.get(i, boxMin, boxMax);
 
-		glm::vec4 frustumCorners[/*NUM_FRUSTUM_CORNERS*/8] = {
-			// near face
-			glm::vec4(xn, yn, zMin, 1.0),
-			glm::vec4(-xn, yn, zMin, 1.0),
-			glm::vec4(xn, -yn, zMin, 1.0),
-			glm::vec4(-xn, -yn, zMin, 1.0),
+				float depth = glm::dot((boxMin + boxMax) * 0.5f - eye, forward);
+				float extent = glm::dot((boxMax - boxMin) * 0.5f, absForward);
+				if (depth + extent < zMin || depth - extent > zMax) {
+					continue;
+				}
 
-			// far face
-			glm::vec4(xf, yf, zMax, 1.0),
-			glm::vec4(-xf, yf, zMax, 1.0),
-			glm::vec4(xf, -yf, zMax, 1.0),
-			glm::vec4(-xf, -yf, zMax, 1.0)
+				glm::vec3 lightMin, lightMax;
+				vkx::transformBounds(lightView, boxMin, boxMax, lightMin, lightMax);
+				min = glm::min(min, glm::vec2(lightMin));
+				max = glm::max(max, glm::vec2(lightMax));
+				found = true;
+			}
 		};
+		addReceivers(culling.meshBounds, culling.meshVisible);
+		addReceivers(culling.skinnedBounds, culling.skinnedVisible);
 
+		return found;
+	}
 
+	// the view depth range the cascades split, the reduced one with sdsm
+	void updateCascadeSplits() {
+		float zNear = camera.znear;
+		float zFar = camera.zfar;
+		if (cascades.sdsm && cascades.reducePipeline && cascades.depthMax > cascades.depthMin) {
+			zNear = std::max(zNear, cascades.depthMin);
+			zFar = std::min(zFar, cascades.depthMax);
+		}
+		vkx::practicalSplits(zNear, zFar, cascades.lambda, NUM_DIR_LIGHTS, cascades.splits);
+	}
 
+	// fits directional light i's cascade to its split, its depth range to the casters
+	// empty is set if shadow culling found no receivers in the split
+	vkx::CascadeFit fitCascade(uint32_t i, bool &empty) {
+		DirectionalLight &light = uboFSLights.directionalLights[i];
+		float splitNear = cascades.splits[i];
+		float splitFar = cascades.splits[i + 1];
+
+		// a cached cascade would be drawn again every time it moved, it only moves in bigger steps
+		uint32_t snapTexels = shadowCache.enabled ? CASCADE_SCROLL_TEXELS : 1;
+		vkx::CascadeFit fit = vkx::fitCascade(camera.matrices.view, glm::radians(camera.fov), camera.aspect, splitNear, splitFar, glm::vec3(light.direction), SHADOW_MAP_DIM, snapTexels);
+		vkx::fitCasterDepth(fit, culling.meshBounds, CASCADE_DEPTH_STEP);
+
+		// only the receivers the camera sees need shadows, a cascade without any doesn't need casters either
+		empty = false;
+		if (shadowCulling.enabled) {
+			glm::mat4 cameraWorld = glm::inverse(camera.matrices.view);
+			glm::vec3 eye = glm::vec3(cameraWorld[3]);
+			glm::vec3 forward = -glm::normalize(glm::vec3(cameraWorld[2]));
+
+			glm::vec2 receiverMin, receiverMax;
+			bool found = receiverBounds(fit.view, eye, forward, splitNear, splitFar, receiverMin, receiverMax);
+			glm::vec2 min = glm::vec2(fit.center) - fit.halfSize;
+			glm::vec2 max = glm::vec2(fit.center) + fit.halfSize;
+			empty = !found || glm::any(glm::greaterThanEqual(glm::max(min, receiverMin), glm::min(max, receiverMax)));
+		}
+		return fit;
+	}
 
-		glm::vec4 frustumCornersL[/*NUM_FRUSTUM_CORNERS*/8];
-
-		float minX = 999.0f;//std::numeric_limits::max();
-		float maxX = -999.0f;//std::numeric_limits::min();
-		float minY = 999.0f;//std::numeric_limits::max();
-		float maxY = -999.0f;//std::numeric_limits::min();
-		float minZ = 999.0f;//std::numeric_limits::max();
-		float maxZ = -999.0f;//std::numeric_limits::min();
+	// how big a layer's shadow map tile should be
+	// spot lights: the projected size of the sphere around their shadow frustum, nothing if it's off screen
+	// cascades cover the view, they always get a whole layer
+	uint32_t shadowTileSize(uint32_t layer, uint32_t current) {
+		if (!shadowTiles.enabled || layer >= NUM_SPOT_LIGHTS) {
+			return SHADOW_MAP_DIM;
+		}
 
-		for (int j = 0; j < /*NUM_FRUSTUM_CORNERS*/8; j++) {
+		SpotLight &light = uboFSLights.spotlights[layer];
+		glm::vec3 direction = glm::normalize(glm::vec3(light.target) - glm::vec3(light.position));
+		float tanHalfAngle = tanf(glm::radians(light.innerAngle) * 0.5f);
+		glm::vec3 center = glm::vec3(light.position) + direction * light.zFar * 0.5f;
+		float radius = glm::length(glm::vec2(light.zFar * 0.5f, light.zFar * tanHalfAngle));
 
-			// Transform the frustum coordinate from view to world space
-			glm::vec4 vW = CamInv * frustumCorners[j];
+		float coverage = 1.0f;
+		for (auto &plane : culling.frustum.planes) {
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+				coverage = 0.0f;
+			}
+		}
+		float distance = glm::length(center - camera.transform.translation);
+		if (coverage > 0.0f && distance > radius) {
+			float tanProjected = radius / sqrtf(distance * distance - radius * radius);
+			coverage = std::min(tanProjected / tanf(glm::radians(camera.fov) * 0.5f), 1.0f);
+		}
 
-			// Transform the frustum coordinate from world to light space
-			frustumCornersL[j] = LightM * vW;
+		float wanted = coverage * shadowTiles.importance[layer] * SHADOW_MAP_DIM;
+		uint32_t size = current;
+		if (current == 0 || wanted > current) {
+			for (size = SHADOW_ATLAS_MIN_TILE; size < wanted && size < SHADOW_MAP_DIM; size *= 2) {}
+		} else if (wanted < current * SHADOW_ATLAS_SHRINK) {
+			// one step at a time, so a light that's moving away doesn't skip sizes
+			size = current / 2;
+		}
+		return std::min(std::max(size, (uint32_t)SHADOW_ATLAS_MIN_TILE), (uint32_t)SHADOW_MAP_DIM);
+	}
 
-			minX = std::min(minX, frustumCornersL[j].x);
-			maxX = std::max(maxX, frustumCornersL[j].x);
-			minY = std::min(minY, frustumCornersL[j].y);
-			maxY = std::max(maxY, frustumCornersL[j].y);
-			minZ = std::min(minZ, frustumCornersL[j].z);
-			maxZ = std::max(maxZ, frustumCornersL[j].z);
+	// gives every layer its tile, keeps the light matrices for culling and bakes the tiles into the ones
+	// the shadow pass and composition use: clip space x/y are scaled and moved into the tile
+	void updateShadowTiles() {
+		if (shadowAtlas.pageCount() == 0) {
+			shadowAtlas.init(SHADOW_MAP_DIM, NUM_LIGHTS_TOTAL, SHADOW_ATLAS_MIN_TILE);
+			for (auto &importance : shadowTiles.importance) {
+				importance = 1.0f;
+			}
 		}
 
-		//m_shadowOrthoProjInfo[i].r = maxX;
-		//m_shadowOrthoProjInfo[i].l = minX;
-		//m_shadowOrthoProjInfo[i].b = minY;
-		//m_shadowOrthoProjInfo[i].t = maxY;
-		//m_shadowOrthoProjInfo[i].f = maxZ;
-		//m_shadowOrthoProjInfo[i].n = minZ;
-		
-		// offset since the bounding box isn't perfect?
-		float offsetScale = 1.1f;
-		//glm::mat4 proj = glm::ortho(-size, size, -size, size, -30.0f, 30.0f);
+		for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+			glm::mat4 &matrix = layer < NUM_SPOT_LIGHTS ? uboShadowGS.spotlightMVP[layer] : uboShadowGS.dirlightMVP[layer - NUM_SPOT_LIGHTS];
+			shadowTiles.lightMatrices[layer] = matrix;
+
+			vkx::ShadowAtlas::Tile &tile = shadowTiles.tiles[layer];
+			uint32_t size = shadowTileSize(layer, tile.size);
+			if (size != tile.size) {
+				shadowAtlas.release(tile);
+				// the layer is its own page, there's always room
+				shadowAtlas.allocate(size, layer, tile);
+			}
 
-		//glm::mat4 proj = glm::ortho(minX, maxX, minY, maxY, minZ, maxZ);
-		//glm::mat4 proj = glm::ortho(minX, maxX, minY, maxY, -maxZ, -minZ);
-		glm::mat4 proj = glm::ortho(minX*offsetScale, maxX*offsetScale, minY*offsetScale, maxY*offsetScale, -30.0f, 30.0f);
+			float scale = (float)tile.size / SHADOW_MAP_DIM;
+			glm::vec2 offset = (glm::vec2(tile.offset) * 2.0f + glm::vec2((float)tile.size)) / (float)SHADOW_MAP_DIM - 1.0f;
+			glm::mat4 tileMatrix = glm::translate(glm::mat4(), glm::vec3(offset, 0.0f)) * glm::scale(glm::mat4(), glm::vec3(scale, scale, 1.0f));
+			matrix = tileMatrix * matrix;
+		}
 
-		return proj;
+		for (uint32_t i = 0; i < NUM_SPOT_LIGHTS; i++) {
+			uboFSLights.spotlights[i].viewMatrix = uboShadowGS.spotlightMVP[i];
+		}
+		for (uint32_t i = 0; i < NUM_DIR_LIGHTS; i++) {
+			uboFSLights.directionalLights[i].viewMatrix = uboShadowGS.dirlightMVP[i];
+		}
+	}
 
+	// where a layer's tile is, for scissoring the shadow pass
+	vk::Rect2D shadowTileRect(uint32_t layer) const {
+		const vkx::ShadowAtlas::Tile &tile = shadowTiles.tiles[layer];
+		return vk::Rect2D(vk::Offset2D(tile.offset.x, tile.offset.y), vk::Extent2D(tile.size, tile.size));
 	}
 
 	// Update fragment shader light position uniform block
@@ -2213,44 +2926,24 @@ class VulkanExample : public vkx::vulkanApp {
 
 
 
-		float numOfSplits = 3;
-		
-
-		float mainNear = 0.1f;
-		float mainFar = 256.0f;
-
-
-		//const float splitConstant = 0.95f;
-		//for (int i = 1; i < numOfSplits; i++) {
-		//	splitDepths[i] = splitConstant * mainNear * (float)pow(mainFar / mainNear, i / numOfSplits) + (1.0f - splitConstant) * ((mainNear + (i / numOfSplits)) * (mainFar - mainNear));
-		//}
-
+		updateCascadeSplits();
 
 		// directional lights:
 		for (uint32_t i = 0; i < NUM_DIR_LIGHTS; i++) {
 
 			DirectionalLight &light = uboFSLights.directionalLights[i];
 
-			//glm::mat4 shadowProj = glm::ortho(-light.size, light.size, -light.size, light.size, light.zNear, light.zFar);
-			glm::mat4 shadowProj = calculateFrustum(glm::vec3(light.direction), temporary.splitDepths[i], temporary.splitDepths[i+1], mainNear, mainFar);
-			shadowProj[1][1] *= -1;// because glm produces matrix for opengl and this is vulkan
-
-			glm::mat4 shadowView = glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(light.direction), glm::vec3(0.0f, 0.0f, 1.0f));
-
-
-			glm::mat4 shadowModel = glm::mat4();
-
-			//uboShadowGS.csmlightMVP[i] = shadowProj * shadowView * shadowModel;
-			//light.viewMatrix = uboShadowGS.csmlightMVP[i];
+			vkx::CascadeFit fit = fitCascade(i, shadowCulling.cascadeEmpty[i]);
 
-			uboShadowGS.dirlightMVP[i] = shadowProj * shadowView * shadowModel;
+			uboShadowGS.dirlightMVP[i] = fit.projection() * fit.view;
 			light.viewMatrix = uboShadowGS.dirlightMVP[i];
 
-			light.cascadeNear = temporary.splitDepths[i];
-			light.cascadeFar = temporary.splitDepths[i + 1];
-
+			light.cascadeNear = cascades.splits[i];
+			light.cascadeFar = cascades.splits[i + 1];
 		}
 
+		updateShadowTiles();
+
 
 
 
@@ -2302,13 +2995,13 @@ class VulkanExample : public vkx::vulkanApp {
 		uboFSLights.invViewProj = glm::inverse(camera.matrices.projection * camera.matrices.view);// new
 
 
-		uniformDataDeferred.fsLights.copy(uboFSLights);
+		uniformDataDeferred.fsLights[currentFrame].copy(uboFSLights);
 	}
 
 	void updateUniformBufferSSAOParams() {
 		uboSSAOParams.projection = camera.matrices.projection;
 		uboSSAOParams.view = camera.matrices.view;
-		uniformDataDeferred.ssaoParams.copy(uboSSAOParams);
+		uniformDataDeferred.ssaoParams[currentFrame].copy(uboSSAOParams);
 	}
 
 	inline float lerp(float a, float b, float f) {
@@ -2375,7 +3068,7 @@ class VulkanExample : public vkx::vulkanApp {
 
 
 	void updateUniformBufferShadow() {
-		uniformDataDeferred.gsShadow.copy(uboShadowGS);
+		uniformDataDeferred.gsShadow[currentFrame].copy(uboShadowGS);
 	}
 
 
@@ -2384,8 +3077,6 @@ class VulkanExample : public vkx::vulkanApp {
 
 		if (TEST_DEFINE) {
 			updateDrawCommandBuffers();
-		} else {
-			buildDrawCommandBuffers();
 		}
 
 		buildOffscreenCommandBuffer();
@@ -3062,6 +3753,12 @@ class VulkanExample : public vkx::vulkanApp {
 			for (int i = 0; i < skinnedMeshesDeferred.size(); ++i) {
 				skinnedMeshesDeferred[i]->boneIndex = skinnedMeshes.size() + i;
 			}
+
+			// the matrix data lives in the uniform ring, so it can grow with the object count
+			matrixNodes.resize(models.size() + skinnedMeshes.size() + modelsDeferred.size() + skinnedMeshesDeferred.size() + 2);
+
+			// bones are still limited by the size of the array in the skinning shader
+			assert(skinnedMeshes.size() + skinnedMeshesDeferred.size() <= MAX_SKINNED_MESHES);
 		}
 
 
@@ -3137,16 +3834,21 @@ class VulkanExample : public vkx::vulkanApp {
 
 
 		updateSceneBuffer();
-		updateMatrixBuffer();
+		updateTransientBuffers();
 		updateMaterialBuffer();
-		updateBoneBuffer();
 
 
 
+		// the cascades are fitted to what the camera sees, so this goes before the lights
+		cullScene();
+
 		updateUniformBuffersScreen();
 		updateSceneBufferDeferred();
-		updateMatrixBufferDeferred();
 		updateUniformBufferDeferredLights();
+		updateUniformBufferSSAOParams();
+
+		// needs the light matrices
+		cullShadowCasters();
 
 
 		// change to whenever camera moves
@@ -3220,18 +3922,17 @@ class VulkanExample : public vkx::vulkanApp {
 
 	void updateCommandBuffers() {
 
+		// the composition command buffer is recorded every frame in draw()
 		if (updateDraw) {
 			// record / update draw command buffers
 			if (TEST_DEFINE) {
 				updateDrawCommandBuffers();
-			} else {
-				buildDrawCommandBuffers();
 			}
 		}
 
-		if (updateOffscreen) {
-			buildOffscreenCommandBuffer();
-		}
+		// draw list changes (updateOffscreen) don't need a full rebuild anymore,
+		// recordOffscreenCommandBuffer() re-records the passes / geometry chunks whose signature changed
+
 
 	}
 
@@ -3278,9 +3979,54 @@ class VulkanExample : public vkx::vulkanApp {
 		ImGui::Checkbox("Update Offscreen Command Buffers", &updateOffscreen);
 		ImGui::Checkbox("SSAO", &settings.SSAO);
 		ImGui::Checkbox("Shadows", &settings.shadows);
+		ImGui::Checkbox("Frustum Culling", &culling.enabled);
+		ImGui::Checkbox("Software Occlusion Culling", &softwareOcclusion.enabled);
+		if (ImGui::Button("Benchmark Occlusion Rasterizer")) {
+			runOcclusionBenchmark();
+		}
+		if (!softwareOcclusion.benchmark.empty()) {
+			ImGui::Text("%s", softwareOcclusion.benchmark.c_str());
+		}
+		if (hiZ.ready()) {
+			ImGui::Checkbox("Hi-Z Occlusion Culling", &occlusion.enabled);
+		}
+		if (gpuScene.ready()) {
+			ImGui::Checkbox("GPU Driven Geometry", &gpuDriven.enabled);
+		}
+		ImGui::Checkbox("Instancing", &instancing.enabled);
+		ImGui::Checkbox("Sort Draws", &drawQueue.enabled);
+		ImGui::Checkbox("Shadow Caster Culling", &shadowCulling.enabled);
+		ImGui::Checkbox("Cache Static Shadows", &shadowCache.enabled);
+		ImGui::Checkbox("Shadow Atlas", &shadowTiles.enabled);
+		for (int path = 0; path < shadowPathCount; ++path) {
+			if (shadowPathAvailable(path)) {
+				ImGui::RadioButton(shadowPathNames[path], &shadowPath, path);
+			}
+		}
+		if (!shadowBenchmark.running && offscreen.graph.timingsEnabled() && ImGui::Button("Benchmark Shadow Paths")) {
+			startShadowBenchmark();
+		}
+		if (shadowBenchmark.running) {
+			ImGui::Text("benchmarking %s...", shadowPathNames[shadowBenchmark.path]);
+		} else if (!shadowBenchmark.results.empty()) {
+			ImGui::Text("%s", shadowBenchmark.results.c_str());
+		}
 		ImGui::Checkbox("Add Boxes", &keyStates.b);
 		ImGui::SliderFloat("FPS Cap", &settings.fpsCap, 5.0f, 500.0f);
 
+		// shader variants, compiled in the background when a new combination is picked
+		ImGui::SliderInt("Point Lights", &shaderQuality.pointLights, 0, NUM_POINT_LIGHTS);
+		ImGui::SliderInt("Spot Lights", &shaderQuality.spotLights, 0, NUM_SPOT_LIGHTS);
+		ImGui::SliderInt("Dir Lights", &shaderQuality.dirLights, 0, NUM_DIR_LIGHTS);
+		// every value is its own variant, so these snap to a handful of steps
+		if (ImGui::SliderInt("SSAO Kernel", &shaderQuality.ssaoKernelSize, 4, SSAO_KERNEL_SIZE)) {
+			shaderQuality.ssaoKernelSize = shaderQuality.ssaoKernelSize / 4 * 4;
+		}
+		if (ImGui::SliderFloat("SSAO Radius", &shaderQuality.ssaoRadius, 0.5f, 4.0f, "%.1f")) {
+			shaderQuality.ssaoRadius = roundf(shaderQuality.ssaoRadius * 2.0f) / 2.0f;
+		}
+		ImGui::Text("pipeline variants: %u compiled, %u compiling", pipelineVariants.compiledCount(), pipelineVariants.pendingCount());
+
 
 
 
@@ -3310,7 +4056,10 @@ class VulkanExample : public vkx::vulkanApp {
 		ImGui::DragFloat("Directional Light Far", &uboFSLights.directionalLights[0].zFar, 0.05f);
 		ImGui::DragFloat("Directional Light size", &uboFSLights.directionalLights[0].size, 0.05f);
 
-		ImGui::DragFloat4("Split Depths", &temporary.splitDepths[0], 0.1f);
+		ImGui::SliderFloat("Cascade Split Lambda", &cascades.lambda, 0.0f, 1.0f, "%.2f");
+		if (cascades.reducePipeline) {
+			ImGui::Checkbox("Fit Cascades To Visible Depth", &cascades.sdsm);
+		}
 
 		//ImGui::DragFloat3("CSM Light Dir", &uboFSLights.csmlights[0].direction.x, 0.05f);
 
@@ -3339,10 +4088,6 @@ class VulkanExample : public vkx::vulkanApp {
 
 	void updateDrawCommandBuffer(const vk::CommandBuffer &cmdBuffer) {
 
-		// todo: definitely remove thise:
-		updateUniformBufferDeferredLights();
-		updateUniformBufferSSAOParams();
-
 		{
 			/* DEFERRED QUAD */
 
@@ -3356,12 +4101,12 @@ class VulkanExample : public vkx::vulkanApp {
 			// renders quad
 			uint32_t setNum = 3;// important!
 			//uint32_t setNum = 0;// important!
-			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("deferred"), setNum, rscs.descriptorSets->get("deferred"), nullptr);
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get(handles.deferredLayout), setNum, rscs.descriptorSets->get(handles.deferred[currentFrame]), nullptr);
 			if (debugDisplay) {
 				if (settings.SSAO) {
-					cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("deferred.debug.ssao"));
+					cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline(pipelineDebugSSAO));
 				} else {
-					cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("deferred.debug"));
+					cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline(pipelineDebug));
 				}
 				cmdBuffer.bindVertexBuffers(VERTEX_BUFFER_BIND_ID, meshBuffers.quad.vertices.buffer, { 0 });
 				cmdBuffer.bindIndexBuffer(meshBuffers.quad.indices.buffer, 0, vk::IndexType::eUint32);
@@ -3380,11 +4125,7 @@ class VulkanExample : public vkx::vulkanApp {
 
 			cmdBuffer.setViewport(0, viewport);
 			// Final composition as full screen quad
-			if (settings.SSAO) {
-				cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("deferred.composition.ssao"));
-			} else {
-				cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("deferred.composition"));
-			}
+			cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, compositionPipeline());
 			cmdBuffer.bindVertexBuffers(VERTEX_BUFFER_BIND_ID, meshBuffers.quad.vertices.buffer, { 0 });
 			cmdBuffer.bindIndexBuffer(meshBuffers.quad.indices.buffer, 0, vk::IndexType::eUint32);
 			cmdBuffer.drawIndexed(6, 1, 0, 0, 1);
@@ -3397,27 +4138,48 @@ class VulkanExample : public vkx::vulkanApp {
 
 	void buildDrawCommandBuffers() {
 
-		// todo: remove this:
-		updateUniformBufferDeferredLights();
-
 		{
 
 
 			// start new imgui frame
 			if (GUIOpen) {
 				updateGUI();
-				imGui->updateBuffers();
+				imGui->updateBuffers(currentFrame);
 			}
 
 			//context.trashCommandBuffers(drawCmdBuffers);
 
-			vk::CommandBufferBeginInfo cmdBufInfo{ vk::CommandBufferUsageFlagBits::eSimultaneousUse };
+			FrameCmdBuffers &cmdBuffers = frameCmdBuffers[currentFrame];
+
+			// the composition quad is reused until the debug display / ssao settings change
+			// it doesn't depend on the swap chain image, so it doesn't inherit a framebuffer
+			uint64_t deferredSignature = compositionSignature();
+			if (needsRecording(cmdBuffers.deferred, deferredSignature)) {
+				vk::CommandBuffer secondary = beginPass(cmdBuffers.deferred, deferredSignature, renderPass, vk::Framebuffer());
+				updateDrawCommandBuffer(secondary);
+				secondary.end();
+			}
+
+			// the gui changes every frame
+			if (GUIOpen) {
+				vk::CommandBuffer secondary = beginPass(cmdBuffers.gui, 0, renderPass, vk::Framebuffer());
+				imGui->drawFrame(secondary, currentFrame);
+				secondary.end();
+			}
+
+			// only the current frame's primary is recorded, for the swap chain image that was just acquired
+			// the frame's fence has been waited on in beginFrame(), so it isn't in use anymore
+			vk::CommandBufferBeginInfo cmdBufInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit };
+
+			if (!cmdBuffers.composition) {
+				vk::CommandBufferAllocateInfo cmd = vkx::commandBufferAllocateInfo(cmdPool, vk::CommandBufferLevel::ePrimary, 1);
+				cmdBuffers.composition = context.device.allocateCommandBuffers(cmd)[0];
+			}
 
-			for (uint32_t i = 0; i < drawCmdBuffers.size(); ++i) {
-				//for (uint32_t i = 0; i < swapChain.imageCount; ++i) {
+			{
 
 
-				vk::CommandBuffer &cmdBuffer = drawCmdBuffers[i];
+				vk::CommandBuffer &cmdBuffer = cmdBuffers.composition;
 
 				cmdBuffer.reset(vk::CommandBufferResetFlagBits::eReleaseResources);
 
@@ -3426,20 +4188,17 @@ class VulkanExample : public vkx::vulkanApp {
 
 
 				// set target framebuffer
-				renderPassBeginInfo.framebuffer = framebuffers[i];
+				renderPassBeginInfo.framebuffer = framebuffers[currentBuffer];
 
 				// begin renderpass
-				//cmdBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers);
-				cmdBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
-
-
-
-				updateDrawCommandBuffer(cmdBuffer);
+				cmdBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers);
 
+				std::vector<vk::CommandBuffer> secondaries = { cmdBuffers.deferred.cmdBuffer };
 				// render gui
 				if (GUIOpen) {
-					imGui->drawFrame(cmdBuffer);
+					secondaries.push_back(cmdBuffers.gui.cmdBuffer);
 				}
+				cmdBuffer.executeCommands(secondaries);
 
 
 				// end render pass
@@ -3457,438 +4216,1755 @@ class VulkanExample : public vkx::vulkanApp {
 
 
 
-	// Build command buffer for rendering the scene to the offscreen frame buffer 
-	// and blitting it to the different texture targets
+	// force every pass to be re-recorded
+	// draw list changes don't need this, they're picked up by the pass signatures
 	void buildOffscreenCommandBuffer() {
-
-		// Create separate command buffer for offscreen 
-		// rendering
-		if (!offscreenCmdBuffer) {
-			vk::CommandBufferAllocateInfo cmd = vkx::commandBufferAllocateInfo(cmdPool, vk::CommandBufferLevel::ePrimary, 1);
-			offscreenCmdBuffer = context.device.allocateCommandBuffers(cmd)[0];
+		for (auto &cmdBuffers : frameCmdBuffers) {
+			cmdBuffers.offscreenDirty = true;
 		}
-
-		// todo: create semaphore here?:
-
-		vk::CommandBufferBeginInfo commandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eSimultaneousUse };
-
-		// begin offscreen command buffer
-		offscreenCmdBuffer.begin(commandBufferBeginInfo);
+	}
 
 
+	bool needsRecording(const PassCmdBuffer &pass, uint64_t signature) {
+		return !pass.recorded || pass.signature != signature;
+	}
 
+	// (re)start recording a pass' secondary command buffer inside the given render pass
+	// allocated from the calling thread's command pool, a pass has to keep being recorded on the same thread
+	vk::CommandBuffer beginPass(PassCmdBuffer &pass, uint64_t signature, vk::RenderPass renderPass, vk::Framebuffer framebuffer) {
 
+		if (!pass.cmdBuffer) {
+			pass.pool = context.getCommandPool();
+			vk::CommandBufferAllocateInfo cmd = vkx::commandBufferAllocateInfo(pass.pool, vk::CommandBufferLevel::eSecondary, 1);
+			pass.cmdBuffer = context.device.allocateCommandBuffers(cmd)[0];
+		}
+		assert(pass.pool == context.getCommandPool());
+		pass.signature = signature;
+		pass.recorded = true;
+		recordingStats.passesRecorded++;
+
+		vk::CommandBufferInheritanceInfo inheritanceInfo;
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = framebuffer;
+
+		vk::CommandBufferBeginInfo beginInfo{ vk::CommandBufferUsageFlagBits::eRenderPassContinue };
+		beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+		pass.cmdBuffer.reset(vk::CommandBufferResetFlags());
+		pass.cmdBuffer.begin(beginInfo);
+		return pass.cmdBuffer;
+	}
 
+	vk::CommandBuffer beginPass(PassCmdBuffer &pass, uint64_t signature, const vkx::RenderGraph::Pass &graphPass) {
+		return beginPass(pass, signature, graphPass.currentRenderPass(), graphPass.currentFramebuffer());
+	}
 
+	// only while the recording threads are idle
+	void freePass(PassCmdBuffer &pass) {
+		if (pass.cmdBuffer) {
+			context.device.freeCommandBuffers(pass.pool, pass.cmdBuffer);
+			pass.cmdBuffer = vk::CommandBuffer();
+		}
+		pass.recorded = false;
+	}
 
+	// everything a range of modelsDeferred bakes into a pass' command buffer
+	uint64_t modelsSignature(uint32_t frame, size_t first, size_t last) {
+		std::vector<uint64_t> state;
+		state.reserve(2 + (last - first) * 4);
+		state.push_back(matrixBase[frame]);
+		state.push_back(settings.SSAO);
+		for (size_t i = first; i < last; ++i) {
+			auto &model = modelsDeferred[i];
+			state.push_back(model->id);
+			state.push_back(model->buffersReady);
+			state.push_back(model->matrixIndex);
+			state.push_back(model->meshBuffers.size());
+		}
+		return vkx::hash64(state);
+	}
 
+	uint64_t skinnedMeshesSignature(uint32_t frame) {
+		std::vector<uint64_t> state;
+		state.reserve(2 + skinnedMeshesDeferred.size() * 2);
+		state.push_back(matrixBase[frame]);
+		state.push_back(settings.SSAO);
+		for (auto &skinnedMesh : skinnedMeshesDeferred) {
+			state.push_back(skinnedMesh->id);
+			state.push_back(skinnedMesh->matrixIndex);
+		}
+		return vkx::hash64(culling.skinnedVisible, vkx::hash64(state));
+	}
 
-		if (settings.shadows) {
-			// shadow pass:
-			{
+	uint64_t compositionSignature() {
+		std::vector<uint64_t> state = {
+			(uint64_t)debugDisplay,
+			(uint64_t)(fullDeferred != 0.0f),
+			(uint64_t)settings.SSAO,
+			settings.windowSize.width,
+			settings.windowSize.height,
+			// changes when a new variant finishes compiling
+			(uint64_t)(VkPipeline)compositionPipeline(),
+		};
+		return vkx::hash64(state);
+	}
 
-				// Clear values for all attachments written in the fragment shader
-				std::array<vk::ClearValue, 1> clearValues;
-				clearValues[0].depthStencil = { 1.0f, 0 };
 
-				vk::RenderPassBeginInfo renderPassBeginInfo;
-				renderPassBeginInfo.renderPass = offscreen.framebuffers[3].renderPass;
-				renderPassBeginInfo.framebuffer = offscreen.framebuffers[3].framebuffer;
-				renderPassBeginInfo.renderArea.extent.width = offscreen.framebuffers[3].width;
-				renderPassBeginInfo.renderArea.extent.height = offscreen.framebuffers[3].height;
-				renderPassBeginInfo.clearValueCount = clearValues.size();
-				renderPassBeginInfo.pClearValues = clearValues.data();
 
+	// handles a draw list pass binds, looked up on the main thread so the recording threads
+	// don't touch the resource lists
+	struct PassBindings {
+		vk::Pipeline pipeline;
+		vk::PipelineLayout layout;
+		vk::DescriptorSet sceneSet;
+		vk::DescriptorSet matrixSet;
+		// the instance stream, null if the pass draws mesh by mesh
+		vk::Buffer instanceBuffer;
+		vk::DeviceSize instanceOffset = 0;
+		// the virtual texture cache (set 4 of the g-buffer layouts), null without virtual texturing
+		vk::DescriptorSet virtualTextureSet;
+	};
 
-				// begin offscreen render pass
-				offscreenCmdBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+	void bindVirtualTextures(vk::CommandBuffer cmdBuffer, const PassBindings &bindings) {
+		if (bindings.virtualTextureSet) {
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 4, bindings.virtualTextureSet, nullptr);
+		}
+	}
 
-				// set viewport and scissor
-				vk::Viewport viewport = vkx::viewport(glm::uvec2(offscreen.framebuffers[3].width, offscreen.framebuffers[3].height));
-				offscreenCmdBuffer.setViewport(0, viewport);
-				vk::Rect2D scissor = vkx::rect2D(glm::uvec2(offscreen.framebuffers[3].width, offscreen.framebuffers[3].height));
-				offscreenCmdBuffer.setScissor(0, scissor);
 
+	// shadow pass, one chunk of static meshes: modelsDeferred[first, last)
+	// how the casters get to their layers depends on the path, see ShadowPath
+	// cached draws the static casters of the layers in layerMask into shadow.static (the path has to be
+	// per layer, or layerMask all of them), otherwise it's the dynamic casters into shadow.map
+	// called from the recording threads
+	void recordShadowChunk(uint32_t frame, uint32_t chunk, size_t first, size_t last, uint64_t signature, const PassBindings &bindings, int path, bool cached, uint32_t layerMask) {
+
+		const vkx::RenderGraph::Pass &graphPass = offscreen.graph.pass(cached ? "shadow.static" : "shadow");
+		PassCmdBuffer &pass = cached ? frameCmdBuffers[frame].shadowStatic[chunk] : frameCmdBuffers[frame].shadow[chunk];
+		const std::vector<DrawItem> *layerDraws = cached ? shadowCache.draws : shadowCulling.draws;
+		const std::vector<uint32_t> *layerFirstDraw = cached ? shadowCache.modelFirstDraw : shadowCulling.modelFirstDraw;
+
+		vk::CommandBuffer cmdBuffer = beginPass(pass, signature, graphPass);
+
+		// set viewport and scissor
+		// the tiles are baked into the light matrices, the scissor keeps the casters inside them,
+		// the layers' own when they're drawn one at a time, all of them together otherwise
+		vk::Viewport viewport = vkx::viewport(graphPass.size);
+		cmdBuffer.setViewport(0, viewport);
+		glm::uvec2 tilesMin(SHADOW_MAP_DIM), tilesMax(0);
+		for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+			const vkx::ShadowAtlas::Tile &tile = shadowTiles.tiles[layer];
+			tilesMin = glm::min(tilesMin, tile.offset);
+			tilesMax = glm::max(tilesMax, tile.offset + glm::uvec2(tile.size));
+		}
+		vk::Rect2D scissor(vk::Offset2D(tilesMin.x, tilesMin.y), vk::Extent2D(tilesMax.x - tilesMin.x, tilesMax.y - tilesMin.y));
+		cmdBuffer.setScissor(0, scissor);
 
-				// Set depth bias (aka "Polygon offset")
-				offscreenCmdBuffer.setDepthBias(settings.depthBiasConstant, 0.0f, settings.depthBiasSlope);
 
+		// Set depth bias (aka "Polygon offset")
+		cmdBuffer.setDepthBias(settings.depthBiasConstant, 0.0f, settings.depthBiasSlope);
 
 
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, bindings.pipeline);
 
+		// layout: offscreen.shadow, set index = 0
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 0, bindings.sceneSet, nullptr);
 
+		// todo: add skinned / animated model support
+		auto drawCasters = [&](const std::vector<DrawItem> &draws, const std::vector<uint32_t> &modelFirstDraw, uint32_t firstInstance) {
+			uint32_t lastModel = UINT32_MAX;
+			for (uint32_t d = modelFirstDraw[first]; d < modelFirstDraw[last]; ++d) {
 
+				const DrawItem &draw = draws[d];
+				auto &model = modelsDeferred[draw.model];
 
+				// dynamic uniform buffer to position objects
+				if (lastModel != draw.model) {
+					lastModel = draw.model;
+					uint32_t offset1 = matrixOffset(frame, model->matrixIndex);
+					cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 1, 1, &bindings.matrixSet, 1, &offset1);
+				}
 
-				//if (settings.SSAO) {
-				//	offscreenCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("offscreen.meshes.ssao"));
-				//} else {
-				//	offscreenCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("offscreen.meshes"));
-				//}
+				auto &meshBuffer = model->meshBuffers[draw.mesh];
 
-				offscreenCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("shadow"));
+				// bind vertex & index buffers
+				cmdBuffer.bindVertexBuffers(meshBuffer->vertexBufferBinding, meshBuffer->vertices.buffer, vk::DeviceSize());
+				cmdBuffer.bindIndexBuffer(meshBuffer->indices.buffer, 0, vk::IndexType::eUint32);
 
-				// for each model
-				// model = group of meshes
-				// todo: add skinned / animated model support
-				for (auto &model : modelsDeferred) {
+				// draw:
+				cmdBuffer.drawIndexed(meshBuffer->indexCount, 1, 0, 0, firstInstance);
+			}
+		};
 
-					// todo: fix
-					//model->checkIfReady();
-					if (!model->buffersReady) {
-						continue;
-					}
+		// instanced, the vertex shader takes the matrix (and the layer) from the stream
+		const InstancedList *instancedLists = cached ? instancing.cache : instancing.shadow;
+		if (bindings.instanceBuffer) {
+			cmdBuffer.bindVertexBuffers(INSTANCE_BUFFER_BIND_ID, bindings.instanceBuffer, bindings.instanceOffset);
+		}
+		auto drawLayer = [&](const std::vector<DrawItem> &draws, const std::vector<uint32_t> &modelFirstDraw, const InstancedList &instanced, uint32_t firstInstance) {
+			if (bindings.instanceBuffer) {
+				drawInstanced(cmdBuffer, instanced, chunk, bindings, false);
+			} else {
+				drawCasters(draws, modelFirstDraw, firstInstance);
+			}
+		};
 
-					// for each of the model's meshBuffers
-					for (auto &meshBuffer : model->meshBuffers) {
+		if (!shadowPathPerLayer(path)) {
+			if (cached) {
+				drawLayer(shadowCache.anyLayer, shadowCache.anyLayerFirstDraw, instancing.cacheAnyLayer, 0);
+			} else {
+				drawLayer(shadowCulling.anyLayer, shadowCulling.anyLayerFirstDraw, instancing.shadowAnyLayer, 0);
+			}
+		} else {
+			for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+				if (!(layerMask & (1 << layer)) || layerFirstDraw[layer][first] == layerFirstDraw[layer][last]) {
+					continue;
+				}
+				cmdBuffer.setScissor(0, shadowTileRect(layer));
+				// the geometry shader gets the layer pushed, the vertex shader from gl_InstanceIndex
+				if (path == shadowPathGeometryLayer) {
+					cmdBuffer.pushConstants(bindings.layout, vk::ShaderStageFlagBits::eGeometry, 0, sizeof(uint32_t), &layer);
+					drawLayer(layerDraws[layer], layerFirstDraw[layer], instancedLists[layer], 0);
+				} else {
+					drawLayer(layerDraws[layer], layerFirstDraw[layer], instancedLists[layer], layer);
+				}
+			}
+		}
 
+		cmdBuffer.end();
+	}
 
-						// bind vertex & index buffers
-						offscreenCmdBuffer.bindVertexBuffers(meshBuffer->vertexBufferBinding, meshBuffer->vertices.buffer, vk::DeviceSize());
-						offscreenCmdBuffer.bindIndexBuffer(meshBuffer->indices.buffer, 0, vk::IndexType::eUint32);
 
-						// descriptor set #
-						uint32_t setNum;
+	// the draws of an instanced list's chunk, the stream is bound already, materials only for the g-buffer
+	// called from the recording threads
+	void drawInstanced(vk::CommandBuffer cmdBuffer, const InstancedList &list, uint32_t chunk, const PassBindings &bindings, bool materials) {
 
-						// bind scene descriptor set
-						//setIndex = 0;
-						//offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen"), setIndex, rscs.descriptorSets->get("offscreen.scene"), nullptr);
+		uint32_t lastMaterialId = UINT32_MAX;
+		vk::DescriptorSet lastMaterialSet;
 
-						// bind shadow descriptor set?
-						// for vs uniform buffer?
-						// bind deferred descriptor set
-						// layout: offscreen, set index = 0
-						setNum = 0;
-						offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen.shadow"), setNum, rscs.descriptorSets->get("shadow.scene"), nullptr);
+		for (uint32_t d = list.chunkFirstDraw[chunk]; d < list.chunkFirstDraw[chunk + 1]; ++d) {
 
+			const InstancedDraw &draw = list.draws[d];
+			auto &meshBuffer = modelsDeferred[draw.model]->meshBuffers[draw.mesh];
 
-						// dynamic uniform buffer to position objects
-						uint32_t offset1 = model->matrixIndex * static_cast<uint32_t>(alignedMatrixSize);
-						setNum = 1;
-						offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen.shadow"), setNum, 1, &rscs.descriptorSets->get("shadow.matrix"), 1, &offset1);
+			cmdBuffer.bindVertexBuffers(meshBuffer->vertexBufferBinding, meshBuffer->vertices.buffer, vk::DeviceSize());
+			cmdBuffer.bindIndexBuffer(meshBuffer->indices.buffer, 0, vk::IndexType::eUint32);
 
+			if (materials && lastMaterialId != meshBuffer->materialId) {
+				lastMaterialId = meshBuffer->materialId;
+				const vkx::Material &m = this->assetManager.materials.get(meshBuffer->materialId);
+				if (lastMaterialSet != m.descriptorSet) {
+					lastMaterialSet = m.descriptorSet;
+					cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 2, m.descriptorSet, nullptr);
+				}
+			}
 
+			cmdBuffer.drawIndexed(meshBuffer->indexCount, draw.instanceCount, 0, 0, draw.firstInstance);
+		}
+	}
 
-						// draw:
-						offscreenCmdBuffer.drawIndexed(meshBuffer->indexCount, 1, 0, 0, 0);
-					}
 
-				}
+	// the static pass loads shadow.static, the layers it draws again are cleared first
+	void recordShadowStaticClear(uint32_t frame, uint32_t layerMask) {
 
+		const vkx::RenderGraph::Pass &graphPass = offscreen.graph.pass("shadow.static");
+		vk::CommandBuffer cmdBuffer = beginPass(frameCmdBuffers[frame].shadowStaticClear, layerMask, graphPass);
 
+		vk::ClearAttachment clear;
+		clear.aspectMask = vk::ImageAspectFlagBits::eDepth;
+		clear.clearValue.depthStencil = vk::ClearDepthStencilValue(1.0f, 0);
 
-				offscreenCmdBuffer.endRenderPass();
+		std::vector<vk::ClearRect> rects;
+		for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+			if (layerMask & (1 << layer)) {
+				rects.push_back(vk::ClearRect(vkx::rect2D(graphPass.size), layer, 1));
 			}
 		}
+		cmdBuffer.clearAttachments(clear, rects);
+
+		cmdBuffer.end();
+	}
 
 
+	// g-buffer pass, one chunk of static meshes: modelsDeferred[first, last)
+	// called from the recording threads
+	void recordGeometryChunk(uint32_t frame, uint32_t chunk, size_t first, size_t last, uint64_t signature, const PassBindings &bindings) {
 
+		vk::CommandBuffer cmdBuffer = beginPass(frameCmdBuffers[frame].geometry[chunk], signature, offscreen.graph.pass("gbuffer"));
 
+		// nothing is bound in a freshly recorded command buffer
+		uint32_t lastMaterialId = UINT32_MAX;
+		vk::DescriptorSet lastMaterialSet;
 
+		vk::Viewport viewport = vkx::viewport(offscreen.size);
+		cmdBuffer.setViewport(0, viewport);
+		vk::Rect2D scissor = vkx::rect2D(offscreen.size);
+		cmdBuffer.setScissor(0, scissor);
 
+		// bind mesh pipeline
+		// don't have to do this for every mesh
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, bindings.pipeline);
 
+		// bind scene descriptor set
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 0, bindings.sceneSet, nullptr);
+		bindVirtualTextures(cmdBuffer, bindings);
 
+		// instanced, one draw per mesh of the chunk, the matrices are in the stream
+		if (bindings.instanceBuffer) {
+			cmdBuffer.bindVertexBuffers(INSTANCE_BUFFER_BIND_ID, bindings.instanceBuffer, bindings.instanceOffset);
+			drawInstanced(cmdBuffer, instancing.geometry, chunk, bindings, true);
+			cmdBuffer.end();
+			return;
+		}
 
 
+		// only the meshes that survived culling, models that aren't ready have none, in drawQueue's order
+		uint32_t lastModel = UINT32_MAX;
+		const vkx::MeshBuffer *lastMesh = nullptr;
+		for (uint32_t d = culling.modelFirstDraw[first]; d < culling.modelFirstDraw[last]; ++d) {
 
+			const DrawItem &draw = culling.draws[drawQueue.order[d]];
+			auto &model = modelsDeferred[draw.model];
 
+			if (lastModel != draw.model) {
+				lastModel = draw.model;
+				uint32_t offset1 = matrixOffset(frame, model->matrixIndex);
+				cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 1, 1, &bindings.matrixSet, 1, &offset1);
+			}
 
+			auto &meshBuffer = model->meshBuffers[draw.mesh];
 
+			// bind vertex & index buffers, sorted draws of the same mesh follow each other
+			if (lastMesh != meshBuffer.get()) {
+				lastMesh = meshBuffer.get();
+				cmdBuffer.bindVertexBuffers(meshBuffer->vertexBufferBinding, meshBuffer->vertices.buffer, vk::DeviceSize());
+				cmdBuffer.bindIndexBuffer(meshBuffer->indices.buffer, 0, vk::IndexType::eUint32);
+			}
 
 
+			// if we just bound this texture don't bind it again (this could be further optimized by ordering by textures used)
+			if (lastMaterialId != meshBuffer->materialId) {
 
+				lastMaterialId = meshBuffer->materialId;
 
+				const vkx::Material &m = this->assetManager.materials.get(meshBuffer->materialId);
 
-		// Offscreen render pass:
-		{
-			// Clear values for all attachments written in the fragment shader
-			std::array<vk::ClearValue, 4> clearValues;
-			clearValues[0].color = vkx::clearColor({ 0.0f, 0.0f, 0.0f, 0.0f });
-			clearValues[1].color = vkx::clearColor({ 0.0f, 0.0f, 0.0f, 0.0f });
-			clearValues[2].color = vkx::clearColor({ 0.0f, 0.0f, 0.0f, 0.0f });
-			clearValues[3].depthStencil = { 1.0f, 0 };
+				// materials sharing textures share a descriptor set
+				if (lastMaterialSet != m.descriptorSet) {
+					lastMaterialSet = m.descriptorSet;
+					cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 2, m.descriptorSet, nullptr);
+				}
+			}
 
-			vk::RenderPassBeginInfo renderPassBeginInfo;
-			renderPassBeginInfo.renderPass = offscreen.framebuffers[0].renderPass;
-			renderPassBeginInfo.framebuffer = offscreen.framebuffers[0].framebuffer;
-			renderPassBeginInfo.renderArea.extent.width = offscreen.size.x;
-			renderPassBeginInfo.renderArea.extent.height = offscreen.size.y;
-			renderPassBeginInfo.clearValueCount = clearValues.size();
-			renderPassBeginInfo.pClearValues = clearValues.data();
 
+			// draw:
+			cmdBuffer.drawIndexed(meshBuffer->indexCount, 1, 0, 0, 0);
 
-			// begin offscreen render pass
-			offscreenCmdBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eInline);
+		}
 
+		cmdBuffer.end();
+	}
 
-			// start of render pass
-			vk::Viewport viewport = vkx::viewport(offscreen.size);
-			offscreenCmdBuffer.setViewport(0, viewport);
-			vk::Rect2D scissor = vkx::rect2D(offscreen.size);
-			offscreenCmdBuffer.setScissor(0, scissor);
 
+	// gbuffer.late, the occlusion candidates, one indirect draw each: the hi-z re-test sets their instance
+	// count, so only the ones that turned out visible are drawn
+	// called from a recording thread
+	void recordLateGeometry(uint32_t frame, uint64_t signature, const PassBindings &bindings) {
 
+		vk::CommandBuffer cmdBuffer = beginPass(frameCmdBuffers[frame].geometryLate, signature, offscreen.graph.pass("gbuffer.late"));
 
-			// todo: add matrix indices for deferred models
-			// for(int i = 0; i < deferredModels.size(); ++i) {
+		uint32_t lastMaterialId = UINT32_MAX;
+		vk::DescriptorSet lastMaterialSet;
 
+		vk::Viewport viewport = vkx::viewport(offscreen.size);
+		cmdBuffer.setViewport(0, viewport);
+		vk::Rect2D scissor = vkx::rect2D(offscreen.size);
+		cmdBuffer.setScissor(0, scissor);
 
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, bindings.pipeline);
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 0, bindings.sceneSet, nullptr);
+		bindVirtualTextures(cmdBuffer, bindings);
 
+		vk::Buffer indirect = hiZ.drawBuffer(frame);
+		uint32_t lastModel = UINT32_MAX;
+		for (uint32_t d = 0; d < occlusion.draws.size(); ++d) {
 
-			// MODELS:
+			const DrawItem &draw = occlusion.draws[d];
+			auto &model = modelsDeferred[draw.model];
 
-			// bind mesh pipeline
-			// don't have to do this for every mesh
-			// todo: create pipelinesDeferred.mesh
-			if (settings.SSAO) {
-				offscreenCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("offscreen.meshes.ssao"));
-			} else {
-				offscreenCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("offscreen.meshes"));
+			if (lastModel != draw.model) {
+				lastModel = draw.model;
+				uint32_t offset1 = matrixOffset(frame, model->matrixIndex);
+				cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 1, 1, &bindings.matrixSet, 1, &offset1);
 			}
 
+			auto &meshBuffer = model->meshBuffers[draw.mesh];
+			cmdBuffer.bindVertexBuffers(meshBuffer->vertexBufferBinding, meshBuffer->vertices.buffer, vk::DeviceSize());
+			cmdBuffer.bindIndexBuffer(meshBuffer->indices.buffer, 0, vk::IndexType::eUint32);
 
-			// for each model
-			// model = group of meshes
-			// todo: add skinned / animated model support
-			for (auto &model : modelsDeferred) {
-
-				// todo: fix
-				//model->checkIfReady();
-				if (!model->buffersReady) {
-					continue;
+			if (lastMaterialId != meshBuffer->materialId) {
+				lastMaterialId = meshBuffer->materialId;
+				const vkx::Material &m = this->assetManager.materials.get(meshBuffer->materialId);
+				if (lastMaterialSet != m.descriptorSet) {
+					lastMaterialSet = m.descriptorSet;
+					cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 2, m.descriptorSet, nullptr);
 				}
+			}
 
-				// for each of the model's meshes
-				for (auto &meshBuffer : model->meshBuffers) {
-
+			// one draw per call, multiDrawIndirect isn't needed and the buffers change between draws anyway
+			cmdBuffer.drawIndexedIndirect(indirect, d * sizeof(vk::DrawIndexedIndirectCommand), 1, sizeof(vk::DrawIndexedIndirectCommand));
+		}
 
-					// bind vertex & index buffers
-					offscreenCmdBuffer.bindVertexBuffers(meshBuffer->vertexBufferBinding, meshBuffer->vertices.buffer, vk::DeviceSize());
-					offscreenCmdBuffer.bindIndexBuffer(meshBuffer->indices.buffer, 0, vk::IndexType::eUint32);
+		cmdBuffer.end();
+	}
 
-					// descriptor set #
-					uint32_t setNum;
 
-					// bind scene descriptor set
-					setNum = 0;
-					offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen"), setNum, rscs.descriptorSets->get("offscreen.scene"), nullptr);
+	// the gpu driven draws of the static meshes, gbuffer (phase 0) or gbuffer.late (phase 1)
+	// one indirect draw per material, what they draw is up to gpu.cull
+	// called from a recording thread
+	void recordGpuGeometry(uint32_t frame, uint32_t phase, uint64_t signature, const PassBindings &bindings) {
 
+		PassCmdBuffer &pass = phase == 0 ? frameCmdBuffers[frame].gpuGeometry : frameCmdBuffers[frame].gpuGeometryLate;
+		vk::CommandBuffer cmdBuffer = beginPass(pass, signature, offscreen.graph.pass(phase == 0 ? "gbuffer" : "gbuffer.late"));
 
-					//uint32_t offset1 = model->matrixIndex * alignedMatrixSize;
-					uint32_t offset1 = model->matrixIndex * static_cast<uint32_t>(alignedMatrixSize);
-					setNum = 1;
-					offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen"), setNum, 1, &rscs.descriptorSets->get("offscreen.matrix"), 1, &offset1);
+		vk::Viewport viewport = vkx::viewport(offscreen.size);
+		cmdBuffer.setViewport(0, viewport);
+		vk::Rect2D scissor = vkx::rect2D(offscreen.size);
+		cmdBuffer.setScissor(0, scissor);
 
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, bindings.pipeline);
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 0, bindings.sceneSet, nullptr);
+		bindVirtualTextures(cmdBuffer, bindings);
+		gpuScene.bind(cmdBuffer, frame, VERTEX_BUFFER_BIND_ID, bindings.layout);
 
-					// if we just bound this texture don't bind it again (this could be further optimized by ordering by textures used)
-					if (lastMaterialName != meshBuffer->materialName) {
+		vk::DescriptorSet lastMaterialSet;
+		const std::vector<vkx::GpuScene::Segment> &segments = gpuScene.segments();
+		for (uint32_t segment = 0; segment < segments.size(); ++segment) {
+			const vkx::Material &m = this->assetManager.materials.get(segments[segment].materialId);
+			if (lastMaterialSet != m.descriptorSet) {
+				lastMaterialSet = m.descriptorSet;
+				cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 2, m.descriptorSet, nullptr);
+			}
+			gpuScene.draw(cmdBuffer, frame, phase, segment);
+		}
 
-						lastMaterialName = meshBuffer->materialName;
+		cmdBuffer.end();
+	}
 
-						vkx::Material m = this->assetManager.materials.get(meshBuffer->materialName);
-						//uint32_t materialIndex = this->assetManager.materials.get(mesh.meshBuffer.materialName).index;
+	// the material sets the gpu driven draws bind, along with gpuScene's own state
+	uint64_t gpuGeometrySignature(uint32_t frame, uint64_t seed) {
+		std::vector<uint64_t> state;
+		state.push_back(gpuScene.signature(frame));
+		state.push_back(settings.SSAO);
+		for (auto &segment : gpuScene.segments()) {
+			state.push_back((uint64_t)(VkDescriptorSet)this->assetManager.materials.get(segment.materialId).descriptorSet);
+		}
+		return vkx::hash64(state.data(), state.size() * sizeof(uint64_t), seed);
+	}
 
 
-						//uint32_t offset2 = m.index * static_cast<uint32_t>(alignedMaterialSize);
-						// the third param is the set number!
-						//setNum = 2;
-						//offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayouts.offscreen, setNum, 1, &descriptorSets[setNum], 1, &offset2);
+	// g-buffer pass, skinned meshes
+	// called from a recording thread
+	void recordSkinnedMeshes(uint32_t frame, uint64_t signature, const PassBindings &bindings) {
 
+		vk::CommandBuffer cmdBuffer = beginPass(frameCmdBuffers[frame].skinnedMeshes, signature, offscreen.graph.pass("gbuffer"));
 
-						// bind material descriptor set containing texture:
-						// todo: implement a better way to bind textures
+		uint32_t lastMaterialId = UINT32_MAX;
+		vk::DescriptorSet lastMaterialSet;
 
-						setNum = 2;
-						offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen"), setNum, m.descriptorSet, nullptr);
-					}
+		vk::Viewport viewport = vkx::viewport(offscreen.size);
+		cmdBuffer.setViewport(0, viewport);
+		vk::Rect2D scissor = vkx::rect2D(offscreen.size);
+		cmdBuffer.setScissor(0, scissor);
 
+		// bind skinned mesh pipeline
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, bindings.pipeline);
 
-					// draw:
-					offscreenCmdBuffer.drawIndexed(meshBuffer->indexCount, 1, 0, 0, 0);
-				}
+		// bind scene descriptor set
+		// Set 0: Binding 0:
+		// there is a bone uniform, set: 0, binding: 1
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 0, bindings.sceneSet, nullptr);
+		bindVirtualTextures(cmdBuffer, bindings);
 
+		for (size_t i = 0; i < skinnedMeshesDeferred.size(); ++i) {
+			if (!culling.skinnedVisible[i]) {
+				continue;
 			}
+			auto &skinnedMesh = skinnedMeshesDeferred[i];
 
+			// bind vertex & index buffers
+			cmdBuffer.bindVertexBuffers(skinnedMesh->vertexBufferBinding, skinnedMesh->meshBuffer->vertices.buffer, vk::DeviceSize());
+			cmdBuffer.bindIndexBuffer(skinnedMesh->meshBuffer->indices.buffer, 0, vk::IndexType::eUint32);
 
+			// Set 1: Binding 0:
+			uint32_t offset1 = matrixOffset(frame, skinnedMesh->matrixIndex);
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 1, 1, &bindings.matrixSet, 1, &offset1);
 
 
+			// if we just bound this texture don't bind it again (this could be further optimized by ordering by textures used)
+			if (lastMaterialId != skinnedMesh->meshBuffer->materialId) {
+				lastMaterialId = skinnedMesh->meshBuffer->materialId;
+				const vkx::Material &m = this->assetManager.materials.get(skinnedMesh->meshBuffer->materialId);
 
 
+				// bind texture:
+				// Set 2: Binding 0:
+				if (lastMaterialSet != m.descriptorSet) {
+					lastMaterialSet = m.descriptorSet;
+					cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, bindings.layout, 2, m.descriptorSet, nullptr);
+				}
+			}
+
+
+			// draw:
+			cmdBuffer.drawIndexed(skinnedMesh->meshBuffer->indexCount, 1, 0, 0, 0);
+		}
+
+		cmdBuffer.end();
+	}
+
+
+	// virtual texture feedback pass
+	// static meshes only, skinned meshes don't use virtual textures
+	void recordFeedbackPass(uint32_t frame, uint64_t signature) {
+
+		vk::CommandBuffer cmdBuffer = beginPass(frameCmdBuffers[frame].feedback, signature, virtualTextures.feedbackRenderPass, virtualTextures.feedbackFramebuffer);
+
+		vk::Viewport viewport = vkx::viewport(virtualTextures.feedbackSize);
+		cmdBuffer.setViewport(0, viewport);
+		vk::Rect2D scissor = vkx::rect2D(virtualTextures.feedbackSize);
+		cmdBuffer.setScissor(0, scissor);
+
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline(pipelineFeedback));
+
+		vk::PipelineLayout feedbackLayout = rscs.pipelineLayouts->get(handles.feedbackLayout);
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, feedbackLayout, 0, rscs.descriptorSets->get(handles.offscreenScene[frame]), nullptr);
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, feedbackLayout, 3, virtualTextures.descriptorSet, nullptr);
+
+		for (auto &model : modelsDeferred) {
+			if (!model->buffersReady) {
+				continue;
+			}
+
+			uint32_t offset1 = matrixOffset(frame, model->matrixIndex);
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, feedbackLayout, 1, 1, &rscs.descriptorSets->get(handles.offscreenMatrix[frame]), 1, &offset1);
+
+			for (auto &meshBuffer : model->meshBuffers) {
+				// meshes without a virtual texture still go through, so they occlude the ones behind them
+				uint32_t virtualTexture = this->assetManager.materials.get(meshBuffer->materialId).properties.virtualTexture;
+				cmdBuffer.pushConstants<uint32_t>(feedbackLayout, vk::ShaderStageFlagBits::eFragment, 0, virtualTexture);
+
+				cmdBuffer.bindVertexBuffers(meshBuffer->vertexBufferBinding, meshBuffer->vertices.buffer, vk::DeviceSize());
+				cmdBuffer.bindIndexBuffer(meshBuffer->indices.buffer, 0, vk::IndexType::eUint32);
+				cmdBuffer.drawIndexed(meshBuffer->indexCount, 1, 0, 0, 0);
+			}
+		}
+
+		cmdBuffer.end();
+	}
+
+
+	// ssao generation and blur, full screen passes that only change with the generate pipeline's variant
+	void recordSSAOPasses(uint32_t frame, vk::Pipeline generatePipeline) {
+
+		vk::Viewport viewport = vkx::viewport(offscreen.size);
+		vk::Rect2D scissor = vkx::rect2D(offscreen.size);
+
+		{
+			vk::CommandBuffer cmdBuffer = beginPass(frameCmdBuffers[frame].ssaoGenerate, (uint64_t)(VkPipeline)generatePipeline, offscreen.graph.pass("ssao.generate"));
+			cmdBuffer.setViewport(0, viewport);
+			cmdBuffer.setScissor(0, scissor);
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get(handles.ssaoGenerateLayout), 0, 1, rscs.descriptorSets->getPtr(handles.ssaoGenerate[frame]), 0, nullptr);
+			cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, generatePipeline);
+			cmdBuffer.draw(3, 1, 0, 0);
+			cmdBuffer.end();
+		}
+
+		{
+			vk::CommandBuffer cmdBuffer = beginPass(frameCmdBuffers[frame].ssaoBlur, 0, offscreen.graph.pass("ssao.blur"));
+			cmdBuffer.setViewport(0, viewport);
+			cmdBuffer.setScissor(0, scissor);
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get(handles.ssaoBlurLayout), 0, 1, rscs.descriptorSets->getPtr(handles.ssaoBlur), 0, nullptr);
+			cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline(pipelineSSAOBlur));
+			cmdBuffer.draw(3, 1, 0, 0);
+			cmdBuffer.end();
+		}
+	}
+
+
+
+	// times the shadow pass with every available path, SHADOW_BENCHMARK_FRAMES frames each, then goes back
+	// to the path that was in use, the results are printed and shown in the settings window
+	void startShadowBenchmark() {
+		if (!offscreen.graph.timingsEnabled()) {
+			std::cout << "shadow benchmark: the graphics queue can't write timestamps" << std::endl;
+			return;
+		}
+		shadowBenchmark.running = true;
+		shadowBenchmark.previousPath = shadowPath;
+		shadowBenchmark.path = -1;
+		for (int path = 0; path < shadowPathCount; ++path) {
+			shadowBenchmark.gpuMS[path] = 0.0f;
+			shadowBenchmark.draws[path] = 0;
+		}
+		nextShadowBenchmarkPath();
+	}
+
+	void nextShadowBenchmarkPath() {
+		do {
+			shadowBenchmark.path++;
+		} while (shadowBenchmark.path < shadowPathCount && !shadowPathAvailable(shadowBenchmark.path));
+		shadowBenchmark.frame = 0;
+
+		if (shadowBenchmark.path < shadowPathCount) {
+			shadowPath = shadowBenchmark.path;
+			return;
+		}
+
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(3);
+		for (int path = 0; path < shadowPathCount; ++path) {
+			if (shadowPathAvailable(path)) {
+				ss << shadowPathNames[path] << ": " << shadowBenchmark.gpuMS[path] << "ms, " << shadowBenchmark.draws[path] << " draws\n";
+			}
+		}
+		shadowBenchmark.results = ss.str();
+		std::cout << "shadow benchmark, " << context.deviceProperties.deviceName << ":\n" << shadowBenchmark.results << std::flush;
+
+		shadowBenchmark.running = false;
+		shadowPath = shadowBenchmark.previousPath;
+	}
+
+	// once a frame, with the timings of the frame that last used this frame slot
+	// the first frames after a switch were still recorded with the previous path, they're skipped
+	void runShadowBenchmark() {
+		if (!shadowBenchmark.running) {
+			return;
+		}
+
+		uint32_t warmup = SHADOW_BENCHMARK_WARMUP + settings.framesInFlight;
+		uint32_t frame = shadowBenchmark.frame++;
+		if (frame < warmup) {
+			return;
+		}
+
+		int path = shadowBenchmark.path;
+		shadowBenchmark.gpuMS[path] += offscreen.graph.pass("shadow").gpuMS / SHADOW_BENCHMARK_FRAMES;
+
+		// what the shadow pass draws itself, the static casters come from the cache
+		uint32_t draws = (uint32_t)shadowCulling.anyLayer.size();
+		if (shadowPathPerLayer(path)) {
+			draws = 0;
+			for (auto &layerDraws : shadowCulling.draws) {
+				draws += (uint32_t)layerDraws.size();
+			}
+		}
+		shadowBenchmark.draws[path] = draws;
+
+		if (frame + 1 == warmup + SHADOW_BENCHMARK_FRAMES) {
+			nextShadowBenchmarkPath();
+		}
+	}
+
+
+
+	// fills culling.draws and culling.skinnedVisible from the camera frustum
+	// models that aren't ready yet get no bounds and no draws
+	void cullScene() {
+
+		culling.frustum.extract(camera.matrices.projection * camera.matrices.view);
+
+		culling.meshBounds.clear();
+		culling.meshDynamic.clear();
+		for (auto &model : modelsDeferred) {
+			if (!model->buffersReady) {
+				continue;
+			}
+			for (auto &meshBuffer : model->meshBuffers) {
+				glm::vec3 min, max;
+				vkx::transformBounds(model->transfMatrix, meshBuffer->boundsMin, meshBuffer->boundsMax, min, max);
+				culling.meshBounds.add(min, max);
+				culling.meshDynamic.push_back(model->dynamic ? 1 : 0);
+			}
+		}
+		culling.meshBounds.cullBoxes(culling.frustum, culling.meshVisible);
+
+		// skinned meshes move, a sphere around their padded bind pose doesn't care which way
+		culling.skinnedBounds.clear();
+		for (auto &skinnedMesh : skinnedMeshesDeferred) {
+			glm::vec3 min, max;
+			vkx::transformBounds(skinnedMesh->transfMatrix, skinnedMesh->meshBuffer->boundsMin, skinnedMesh->meshBuffer->boundsMax, min, max);
+			culling.skinnedBounds.addSphere((min + max) * 0.5f, glm::length(max - min) * 0.5f * SKINNED_BOUNDS_PADDING);
+		}
+		culling.skinnedBounds.cullSpheres(culling.frustum, culling.skinnedVisible);
+
+		if (!culling.enabled) {
+			std::fill(culling.meshVisible.begin(), culling.meshVisible.end(), 1);
+			std::fill(culling.skinnedVisible.begin(), culling.skinnedVisible.end(), 1);
+		}
+
+		// the static meshes are culled on the gpu, nothing is drawn from the lists
+		softwareOcclusion.culled = 0;
+		if (gpuDrivenActive()) {
+			culling.draws.clear();
+			culling.modelFirstDraw.assign(modelsDeferred.size() + 1, 0);
+			drawQueue.order.clear();
+			occlusion.draws.clear();
+			occlusion.candidates.clear();
+			occlusion.commands.clear();
+			culling.visible = (uint32_t)std::count(culling.skinnedVisible.begin(), culling.skinnedVisible.end(), 1);
+			culling.culled = (uint32_t)culling.skinnedBounds.size() - culling.visible;
+			return;
+		}
+
+		// the g-buffer pass draws what's left of the frustum's meshes once what the software occlusion hides
+		// and the hi-z candidates are out
+		const std::vector<uint8_t> *visible = &culling.meshVisible;
+		if (softwareOcclusion.enabled && culling.enabled) {
+			cullSoftwareOccluded();
+			visible = &softwareOcclusion.visible;
+		}
+
+		occlusion.candidates.clear();
+		occlusion.commands.clear();
+		if (occlusionActive()) {
+			cullOccluded(*visible);
+			compactDraws(occlusion.firstPhase, culling.draws, culling.modelFirstDraw);
+		} else {
+			occlusion.draws.clear();
+			compactDraws(*visible, culling.draws, culling.modelFirstDraw);
+		}
+
+		sortDraws();
+
+		uint32_t skinnedVisible = (uint32_t)std::count(culling.skinnedVisible.begin(), culling.skinnedVisible.end(), 1);
+		culling.visible = (uint32_t)(culling.draws.size() + occlusion.draws.size()) + skinnedVisible;
+		culling.culled = (uint32_t)(culling.meshBounds.size() + culling.skinnedBounds.size()) - culling.visible;
+	}
+
+	bool occlusionActive() const {
+		return occlusion.enabled && culling.enabled && hiZ.ready();
+	}
 
+	// ranks the materials' descriptor sets and the static mesh buffers, again when the models, their meshes
+	// or the materials change
+	void rankDrawState() {
+		vkx::MaterialList &materials = this->assetManager.materials;
+		size_t sizes[3] = { modelsDeferred.size(), culling.meshBounds.size(), materials.size() };
+		if (std::equal(sizes, sizes + 3, drawQueue.rankedSizes)) {
+			return;
+		}
+		std::copy(sizes, sizes + 3, drawQueue.rankedSizes);
+
+		std::unordered_map<VkDescriptorSet, uint32_t> sets;
+		drawQueue.materialRank.resize(materials.size());
+		for (uint32_t id = 0; id < materials.size(); ++id) {
+			auto set = sets.emplace((VkDescriptorSet)materials.get(id).descriptorSet, (uint32_t)sets.size());
+			drawQueue.materialRank[id] = set.first->second;
+		}
+
+		drawQueue.meshRank.clear();
+		for (auto &model : modelsDeferred) {
+			if (!model->buffersReady) {
+				continue;
+			}
+			for (auto &meshBuffer : model->meshBuffers) {
+				drawQueue.meshRank.emplace(meshBuffer.get(), (uint32_t)drawQueue.meshRank.size());
+			}
+		}
+	}
+
+	// the binds the g-buffer pass needs for culling.draws[order[begin, end)]: the matrix set when the model
+	// changes, the vertex and index buffers when the mesh does, the material set when that does
+	uint32_t countBinds(const uint32_t *order, uint32_t begin, uint32_t end) {
+		uint32_t binds = 0;
+		uint32_t lastModel = UINT32_MAX;
+		const vkx::MeshBuffer *lastMesh = nullptr;
+		vk::DescriptorSet lastMaterialSet;
+		for (uint32_t i = begin; i < end; ++i) {
+			const DrawItem &draw = culling.draws[order[i]];
+			const vkx::MeshBuffer *meshBuffer = modelsDeferred[draw.model]->meshBuffers[draw.mesh].get();
+			if (draw.model != lastModel) {
+				lastModel = draw.model;
+				binds++;
+			}
+			if (meshBuffer != lastMesh) {
+				lastMesh = meshBuffer;
+				binds += 2;
+			}
+			vk::DescriptorSet materialSet = this->assetManager.materials.get(meshBuffer->materialId).descriptorSet;
+			if (materialSet != lastMaterialSet) {
+				lastMaterialSet = materialSet;
+				binds++;
+			}
+		}
+		return binds;
+	}
 
+	// sorts culling.draws[begin, end) (a chunk) into drawQueue.order by key, slot is the caller's scratch
+	void sortChunk(uint32_t chunk, uint32_t begin, uint32_t end, uint32_t slot) {
 
+		uint32_t *order = drawQueue.order.data();
+		for (uint32_t i = begin; i < end; ++i) {
+			order[i] = i;
+		}
+		drawQueue.chunkBinds[0][chunk] = countBinds(order, begin, end);
+
+		if (drawQueue.enabled) {
+			std::vector<vkx::DrawKey> &keys = drawQueue.keys[slot];
+			keys.resize(end - begin);
+			const glm::mat4 &view = camera.matrices.view;
+			for (uint32_t i = begin; i < end; ++i) {
+				const DrawItem &draw = culling.draws[i];
+				const vkx::MeshBuffer *meshBuffer = modelsDeferred[draw.model]->meshBuffers[draw.mesh].get();
+
+				glm::vec3 min, max;
+				culling.meshBounds.get(drawQueue.modelFirstBounds[draw.model] + draw.mesh, min, max);
+				float depth = -(view * glm::vec4((min + max) * 0.5f, 1.0f)).z;
+
+				auto mesh = drawQueue.meshRank.find(meshBuffer);
+				uint32_t meshRank = mesh != drawQueue.meshRank.end() ? mesh->second : UINT32_MAX;
+				keys[i - begin] = { vkx::packDrawKey(depth, drawQueue.materialRank[meshBuffer->materialId], meshRank), i };
+			}
+			vkx::radixSort(keys.data(), keys.size(), drawQueue.scratch[slot]);
+			for (uint32_t i = begin; i < end; ++i) {
+				order[i] = keys[i - begin].index;
+			}
+		}
 
+		drawQueue.chunkBinds[1][chunk] = countBinds(order, begin, end);
+	}
 
+	// the g-buffer draws of every chunk in key order, a chunk per job on the recording threads
+	// (they're idle here, see cullSoftwareOccluded()), on this thread when there are only a few draws
+	void sortDraws() {
 
+		rankDrawState();
 
+		drawQueue.modelFirstBounds.resize(modelsDeferred.size());
+		uint32_t bounds = 0;
+		for (uint32_t i = 0; i < modelsDeferred.size(); ++i) {
+			drawQueue.modelFirstBounds[i] = bounds;
+			if (modelsDeferred[i]->buffersReady) {
+				bounds += (uint32_t)modelsDeferred[i]->meshBuffers.size();
+			}
+		}
 
-			// SKINNED MESHES:
-
-			// bind skinned mesh pipeline
-			if (settings.SSAO) {
-				offscreenCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("offscreen.skinnedMeshes.ssao"));
+		uint32_t threadCount = (uint32_t)recordingThreads.threads.size();
+		drawQueue.keys.resize(threadCount + 1);
+		drawQueue.scratch.resize(threadCount + 1);
+
+		uint32_t chunkCount = (uint32_t)((modelsDeferred.size() + GEOMETRY_CHUNK_SIZE - 1) / GEOMETRY_CHUNK_SIZE);
+		drawQueue.order.resize(culling.draws.size());
+		drawQueue.chunkBinds[0].resize(chunkCount);
+		drawQueue.chunkBinds[1].resize(chunkCount);
+
+		bool parallel = threadCount > 0 && culling.draws.size() >= 4 * DRAW_KEY_RADIX_MIN;
+		for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+			size_t first = chunk * GEOMETRY_CHUNK_SIZE;
+			size_t last = std::min(first + GEOMETRY_CHUNK_SIZE, modelsDeferred.size());
+			uint32_t begin = culling.modelFirstDraw[first];
+			uint32_t end = culling.modelFirstDraw[last];
+			if (parallel) {
+				uint32_t slot = chunk % threadCount;
+				recordingThreads.threads[slot]->addJob([=] { sortChunk(chunk, begin, end, slot); });
 			} else {
-				offscreenCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("offscreen.skinnedMeshes"));
+				sortChunk(chunk, begin, end, threadCount);
 			}
-			for (auto &skinnedMesh : skinnedMeshesDeferred) {
-				// bind vertex & index buffers
-				offscreenCmdBuffer.bindVertexBuffers(skinnedMesh->vertexBufferBinding, skinnedMesh->meshBuffer->vertices.buffer, vk::DeviceSize());
-				offscreenCmdBuffer.bindIndexBuffer(skinnedMesh->meshBuffer->indices.buffer, 0, vk::IndexType::eUint32);
+		}
+		if (parallel) {
+			recordingThreads.wait();
+		}
+
+		drawQueue.bindsUnsorted = 0;
+		drawQueue.bindsSorted = 0;
+		for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+			drawQueue.bindsUnsorted += drawQueue.chunkBinds[0][chunk];
+			drawQueue.bindsSorted += drawQueue.chunkBinds[1][chunk];
+		}
+	}
 
-				// descriptor set #
-				uint32_t setNum;
+	// needs the pipeline of the current g-buffer shaders too
+	bool gpuDrivenActive() const {
+		return gpuDriven.enabled && gpuScene.ready() && pipeline(settings.SSAO ? pipelineMeshesIndirectSSAO : pipelineMeshesIndirect);
+	}
 
-				// bind scene descriptor set
-				// Set 0: Binding 0:
-				setNum = 0;
-				offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen"), setNum, rscs.descriptorSets->get("offscreen.scene"), nullptr);
+	// every static mesh of the models that are ready, once the frame's fence has been waited on
+	void updateGpuScene(uint32_t frame) {
+		gpuScene.begin(frame);
+		for (auto &model : modelsDeferred) {
+			if (!model->buffersReady) {
+				continue;
+			}
+			for (auto &meshBuffer : model->meshBuffers) {
+				gpuScene.add(model->transfMatrix, meshBuffer);
+			}
+		}
+		gpuScene.end();
+	}
 
-				// there is a bone uniform, set: 0, binding: 1
+	// the first phase of the occlusion culling: the visible meshes that are hidden in the last pyramid
+	// read back become candidates (at most HIZ_MAX_CANDIDATES), along with their bounds and indirect draws
+	void cullOccluded(const std::vector<uint8_t> &visible) {
+		occlusion.firstPhase = visible;
+		occlusion.hidden.assign(visible.size(), 0);
 
+		for (size_t i = 0; i < visible.size() && occlusion.candidates.size() < HIZ_MAX_CANDIDATES; ++i) {
+			if (!visible[i]) {
+				continue;
+			}
+			glm::vec3 min, max;
+			culling.meshBounds.get(i, min, max);
+			if (!hiZ.occluded(min, max)) {
+				continue;
+			}
+			occlusion.firstPhase[i] = 0;
+			occlusion.hidden[i] = 1;
+			occlusion.candidates.push_back({ glm::vec4(min, 1.0f), glm::vec4(max, 1.0f) });
+		}
 
-				// Set 1: Binding 0:
-				uint32_t offset1 = skinnedMesh->matrixIndex * static_cast<uint32_t>(alignedMatrixSize);
-				setNum = 1;
-				offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen"), setNum, 1, &rscs.descriptorSets->get("offscreen.matrix"), 1, &offset1);
+		// same order as the bounds, so the draws line up with the candidates
+		compactDraws(occlusion.hidden, occlusion.draws, occlusion.modelFirstDraw);
+		for (auto &draw : occlusion.draws) {
+			auto &meshBuffer = modelsDeferred[draw.model]->meshBuffers[draw.mesh];
+			occlusion.commands.push_back(vk::DrawIndexedIndirectCommand(meshBuffer->indexCount, 0, 0, 0, 0));
+		}
+	}
 
+	// the static meshes in view that have an occluder proxy, biggest on screen first
+	void gatherOccluders() {
+		softwareOcclusion.occluders.clear();
+		glm::vec3 eye = glm::vec3(glm::inverse(camera.matrices.view)[3]);
 
-				// if we just bound this texture don't bind it again (this could be further optimized by ordering by textures used)
-				if (lastMaterialName != skinnedMesh->meshBuffer->materialName) {
-					lastMaterialName = skinnedMesh->meshBuffer->materialName;
-					vkx::Material m = this->assetManager.materials.get(skinnedMesh->meshBuffer->materialName);
+		uint32_t bounds = 0;
+		for (uint32_t i = 0; i < modelsDeferred.size(); ++i) {
+			auto &model = modelsDeferred[i];
+			if (!model->buffersReady) {
+				continue;
+			}
+			for (uint32_t mesh = 0; mesh < model->meshBuffers.size(); ++mesh, ++bounds) {
+				if (model->dynamic || !culling.meshVisible[bounds] || model->meshBuffers[mesh]->occluder.empty()) {
+					continue;
+				}
+				glm::vec3 min, max;
+				culling.meshBounds.get(bounds, min, max);
+				float distance = std::max(glm::distance((min + max) * 0.5f, eye), camera.znear);
+				softwareOcclusion.occluders.push_back({ i, mesh, bounds, glm::length(max - min) * 0.5f / distance });
+			}
+		}
 
+		std::stable_sort(softwareOcclusion.occluders.begin(), softwareOcclusion.occluders.end(), [](const OccluderItem &a, const OccluderItem &b) {
+			return a.size > b.size;
+		});
+	}
 
-					// bind texture:
-					// Set 2: Binding 0:
-					setNum = 2;
-					offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen"), setNum, m.descriptorSet, nullptr);
+	// rasterizes the first count occluders, as many as fit in OCCLUSION_MAX_TRIANGLES
+	void drawOccluders(size_t count) {
+		vkx::OcclusionRasterizer &rasterizer = softwareOcclusion.rasterizer;
+		rasterizer.begin(camera.matrices.projection * camera.matrices.view);
+		count = std::min(count, softwareOcclusion.occluders.size());
+		for (size_t i = 0; i < count; ++i) {
+			const OccluderItem &occluder = softwareOcclusion.occluders[i];
+			auto &model = modelsDeferred[occluder.model];
+			if (!rasterizer.addOccluder(model->transfMatrix, model->meshBuffers[occluder.mesh]->occluder)) {
+				break;
+			}
+		}
+		rasterizer.rasterize(recordingThreads);
+	}
+
+	// softwareOcclusion.visible is what's left of culling.meshVisible behind the occluders, returns how many are hidden
+	uint32_t testOccludees() {
+		softwareOcclusion.visible = culling.meshVisible;
+		uint32_t culled = 0;
+		for (size_t i = 0; i < culling.meshVisible.size(); ++i) {
+			if (!culling.meshVisible[i]) {
+				continue;
+			}
+			glm::vec3 min, max;
+			culling.meshBounds.get(i, min, max);
+			if (softwareOcclusion.rasterizer.occluded(min, max)) {
+				softwareOcclusion.visible[i] = 0;
+				culled++;
+			}
+		}
+		return culled;
+	}
+
+	// the recording threads are idle here: updateWorld(), or recordOffscreenCommandBuffer() before it adds any jobs
+	void cullSoftwareOccluded() {
+		auto tStart = std::chrono::high_resolution_clock::now();
+		gatherOccluders();
+		drawOccluders(softwareOcclusion.occluders.size());
+		auto tRasterized = std::chrono::high_resolution_clock::now();
+		softwareOcclusion.culled = testOccludees();
+		auto tTested = std::chrono::high_resolution_clock::now();
+
+		softwareOcclusion.rasterizeMS = std::chrono::duration<float, std::milli>(tRasterized - tStart).count();
+		softwareOcclusion.testMS = std::chrono::duration<float, std::milli>(tTested - tRasterized).count();
+	}
+
+	// rasterize and test time against the number of occluders (doubling up to all of them) in the current view,
+	// each averaged over OCCLUSION_BENCHMARK_RUNS, on the main thread between frames
+	void runOcclusionBenchmark() {
+		gatherOccluders();
+		size_t available = softwareOcclusion.occluders.size();
+
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(3);
+		for (size_t count = 1; ; count = std::min(count * 2, available)) {
+			float rasterizeMS = 0.0f;
+			float testMS = 0.0f;
+			uint32_t culled = 0;
+			for (uint32_t run = 0; run < OCCLUSION_BENCHMARK_RUNS; ++run) {
+				auto tStart = std::chrono::high_resolution_clock::now();
+				drawOccluders(count);
+				auto tRasterized = std::chrono::high_resolution_clock::now();
+				culled = testOccludees();
+				auto tTested = std::chrono::high_resolution_clock::now();
+				rasterizeMS += std::chrono::duration<float, std::milli>(tRasterized - tStart).count() / OCCLUSION_BENCHMARK_RUNS;
+				testMS += std::chrono::duration<float, std::milli>(tTested - tRasterized).count() / OCCLUSION_BENCHMARK_RUNS;
+			}
+			ss << softwareOcclusion.rasterizer.occluders << " occluders, " << softwareOcclusion.rasterizer.triangles << " triangles: " << rasterizeMS << "ms rasterize, " << testMS << "ms test, " << culled << " culled\n";
+			if (count >= available) {
+				break;
+			}
+		}
+
+		softwareOcclusion.benchmark = ss.str();
+		std::cout << "occlusion rasterizer benchmark, " << recordingThreads.threads.size() << " threads:\n" << softwareOcclusion.benchmark << std::flush;
+	}
+
+	// the visible meshes (one flag per meshBounds entry) as a draw list, with the offsets of each model's draws
+	void compactDraws(const std::vector<uint8_t> &visible, std::vector<DrawItem> &draws, std::vector<uint32_t> &modelFirstDraw) {
+		draws.clear();
+		modelFirstDraw.resize(modelsDeferred.size() + 1);
+		uint32_t bounds = 0;
+		for (uint32_t i = 0; i < modelsDeferred.size(); ++i) {
+			modelFirstDraw[i] = (uint32_t)draws.size();
+			auto &model = modelsDeferred[i];
+			if (!model->buffersReady) {
+				continue;
+			}
+			for (uint32_t mesh = 0; mesh < model->meshBuffers.size(); ++mesh) {
+				if (visible[bounds++]) {
+					draws.push_back({ i, mesh });
 				}
+			}
+		}
+		modelFirstDraw[modelsDeferred.size()] = (uint32_t)draws.size();
+	}
 
+	// the light matrix of a shadow map layer (with its tile): the spot lights, then the cascades
+	const glm::mat4 &shadowLayerMatrix(uint32_t layer) const {
+		return layer < NUM_SPOT_LIGHTS ? uboShadowGS.spotlightMVP[layer] : uboShadowGS.dirlightMVP[layer - NUM_SPOT_LIGHTS];
+	}
 
-				// draw:
-				offscreenCmdBuffer.drawIndexed(skinnedMesh->meshBuffer->indexCount, 1, 0, 0, 0);
+	// fills shadowCulling's draw lists (dynamic casters) and shadowCache's (static casters),
+	// one per shadow map layer, from the light matrices in uboShadowGS
+	// uses cullScene()'s bounds, skinned meshes don't cast shadows yet
+	void cullShadowCasters() {
+
+		shadowCulling.visibleAny.assign(culling.meshBounds.size(), 0);
+		shadowCache.visibleAny.assign(culling.meshBounds.size(), 0);
+		shadowCulling.layerDraws = 0;
+
+		for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+
+			std::vector<uint8_t> &visible = shadowCulling.visible;
+			bool emptyCascade = layer >= NUM_SPOT_LIGHTS && shadowCulling.cascadeEmpty[layer - NUM_SPOT_LIGHTS];
+
+			if (!shadowCulling.enabled) {
+				visible.assign(culling.meshBounds.size(), 1);
+			} else if (emptyCascade) {
+				visible.assign(culling.meshBounds.size(), 0);
+			} else {
+				// anything outside the light's frustum would be clipped anyway, but not what's in front of its
+				// near plane: the shadow pipelines clamp depth, those casters still land in the map (at depth 0)
+				vkx::Frustum frustum;
+				frustum.extract(shadowTiles.lightMatrices[layer], false);
+				culling.meshBounds.cullBoxes(frustum, visible);
+			}
+
+			// the static casters go to the cache, visible is left with the dynamic ones
+			std::vector<uint8_t> &cached = shadowCulling.split;
+			cached.resize(visible.size());
+			for (size_t i = 0; i < visible.size(); ++i) {
+				cached[i] = visible[i] & (culling.meshDynamic[i] ^ 1);
+				visible[i] &= culling.meshDynamic[i];
+				shadowCache.visibleAny[i] |= cached[i];
+				shadowCulling.visibleAny[i] |= visible[i];
+			}
+
+			compactDraws(cached, shadowCache.draws[layer], shadowCache.modelFirstDraw[layer]);
+			compactDraws(visible, shadowCulling.draws[layer], shadowCulling.modelFirstDraw[layer]);
+			shadowCulling.layerDraws += (uint32_t)(shadowCulling.draws[layer].size() + shadowCache.draws[layer].size());
+		}
+
+		compactDraws(shadowCache.visibleAny, shadowCache.anyLayer, shadowCache.anyLayerFirstDraw);
+		compactDraws(shadowCulling.visibleAny, shadowCulling.anyLayer, shadowCulling.anyLayerFirstDraw);
+		shadowCulling.layerCulled = (uint32_t)culling.meshBounds.size() * NUM_LIGHTS_TOTAL - shadowCulling.layerDraws;
+	}
+
+	// hash of draws[modelFirstDraw[first], modelFirstDraw[last])
+	uint64_t drawsSignature(const std::vector<DrawItem> &draws, const std::vector<uint32_t> &modelFirstDraw, size_t first, size_t last, uint64_t seed) {
+		uint32_t begin = modelFirstDraw[first];
+		uint32_t end = modelFirstDraw[last];
+		return vkx::hash64(draws.data() + begin, (end - begin) * sizeof(DrawItem), seed);
+	}
+
+	// hash of the draws that survived culling in modelsDeferred[first, last)
+	uint64_t visibleSignature(size_t first, size_t last, uint64_t seed) {
+		uint32_t begin = culling.modelFirstDraw[first];
+		uint32_t end = culling.modelFirstDraw[last];
+		uint64_t signature = drawsSignature(culling.draws, culling.modelFirstDraw, first, last, seed);
+		// and the order they're drawn in
+		return vkx::hash64(drawQueue.order.data() + begin, (end - begin) * sizeof(uint32_t), signature);
+	}
+
+	// hash of the shadow casters in modelsDeferred[first, last), of every layer if the path draws them per layer
+	uint64_t casterSignature(size_t first, size_t last, int path, uint64_t seed) {
+		uint64_t signature = vkx::hash64(&path, sizeof(path), seed);
+		if (!shadowPathPerLayer(path)) {
+			return drawsSignature(shadowCulling.anyLayer, shadowCulling.anyLayerFirstDraw, first, last, signature);
+		}
+		for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+			signature = drawsSignature(shadowCulling.draws[layer], shadowCulling.modelFirstDraw[layer], first, last, signature);
+		}
+		return signature;
+	}
+
+	// same for the static casters the static pass draws into the layers in layerMask
+	uint64_t cachedCasterSignature(size_t first, size_t last, int path, uint32_t layerMask, uint64_t seed) {
+		uint64_t signature = vkx::hash64(&path, sizeof(path), vkx::hash64(&layerMask, sizeof(layerMask), seed));
+		if (!shadowPathPerLayer(path)) {
+			return drawsSignature(shadowCache.anyLayer, shadowCache.anyLayerFirstDraw, first, last, signature);
+		}
+		for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+			if (layerMask & (1 << layer)) {
+				signature = drawsSignature(shadowCache.draws[layer], shadowCache.modelFirstDraw[layer], first, last, signature);
+			}
+		}
+		return signature;
+	}
+
+	// the instanced draws of a chunk and where the stream is, the matrices themselves aren't baked into anything
+	uint64_t instancedSignature(const InstancedList &list, uint32_t chunk, vk::DeviceSize offset, uint64_t seed) {
+		uint32_t begin = list.chunkFirstDraw[chunk];
+		uint32_t end = list.chunkFirstDraw[chunk + 1];
+		uint64_t signature = vkx::hash64(&offset, sizeof(offset), seed);
+		return vkx::hash64(list.draws.data() + begin, (end - begin) * sizeof(InstancedDraw), signature);
+	}
+
+	// same for the lists a shadow chunk draws, the casters of any layer or those of the layers in layerMask
+	uint64_t instancedCasterSignature(uint32_t chunk, int path, bool cached, uint32_t layerMask, vk::DeviceSize offset, uint64_t seed) {
+		if (!shadowPathPerLayer(path)) {
+			return instancedSignature(cached ? instancing.cacheAnyLayer : instancing.shadowAnyLayer, chunk, offset, seed);
+		}
+		const InstancedList *lists = cached ? instancing.cache : instancing.shadow;
+		for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+			if (layerMask & (1 << layer)) {
+				seed = instancedSignature(lists[layer], chunk, offset, seed);
+			}
+		}
+		return seed;
+	}
+
+	// groups a draw list by mesh buffer, chunk by chunk, the meshes of a group in the order they first show up
+	// its instances start at base, see InstancedList
+	// order, if there is one, is the order to go through draws in (drawQueue's)
+	void batchDraws(const std::vector<DrawItem> &draws, const std::vector<uint32_t> &modelFirstDraw, const std::vector<uint32_t> *order, uint32_t base, uint32_t layer, InstancedList &list) {
+
+		list.draws.clear();
+		list.chunkFirstDraw.assign(1, 0);
+		list.instanceModels.resize(instancing.chunkFirstMesh.back());
+		list.base = base;
+		list.layer = layer;
+
+		std::unordered_map<const vkx::MeshBuffer*, uint32_t> groups;
+		uint32_t chunkCount = (uint32_t)instancing.chunkFirstMesh.size() - 1;
+		for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+			size_t first = chunk * GEOMETRY_CHUNK_SIZE;
+			size_t last = std::min(first + GEOMETRY_CHUNK_SIZE, modelsDeferred.size());
+
+			// the chunk's groups and their sizes
+			groups.clear();
+			uint32_t firstGroup = (uint32_t)list.draws.size();
+			for (uint32_t d = modelFirstDraw[first]; d < modelFirstDraw[last]; ++d) {
+				const DrawItem &draw = draws[order ? (*order)[d] : d];
+				auto group = groups.emplace(modelsDeferred[draw.model]->meshBuffers[draw.mesh].get(), (uint32_t)list.draws.size());
+				if (group.second) {
+					list.draws.push_back({ draw.model, draw.mesh, 0, 0 });
+				}
+				list.draws[group.first->second].instanceCount++;
+			}
+
+			// then their instances, one group after the other (a chunk has at most one draw per mesh)
+			uint32_t next = base + instancing.chunkFirstMesh[chunk];
+			for (uint32_t g = firstGroup; g < list.draws.size(); ++g) {
+				list.draws[g].firstInstance = next;
+				next += list.draws[g].instanceCount;
+				list.draws[g].instanceCount = 0;
 			}
+			for (uint32_t d = modelFirstDraw[first]; d < modelFirstDraw[last]; ++d) {
+				const DrawItem &draw = draws[order ? (*order)[d] : d];
+				InstancedDraw &group = list.draws[groups[modelsDeferred[draw.model]->meshBuffers[draw.mesh].get()]];
+				list.instanceModels[group.firstInstance + group.instanceCount++ - base] = draw.model;
+			}
+
+			list.chunkFirstDraw.push_back((uint32_t)list.draws.size());
+		}
+	}
+
+	// groups the draw lists of the passes that have an instanced pipeline and writes frame's instance stream
+	// with the current matrices, those passes' bindings get the pipeline and the stream
+	// the g-buffer pass only when it draws the static meshes itself (geometry), the static shadow pass only
+	// when it draws any layers
+	void prepareInstancing(uint32_t frame, bool geometry, uint32_t staticLayers, PassBindings &geometryBindings, PassBindings &shadowBindings, PassBindings &shadowStaticBindings) {
+
+		instancing.draws = 0;
+		instancing.instances = 0;
+
+		// every chunk gets room for all of its meshes in every list
+		uint32_t chunkCount = (uint32_t)((modelsDeferred.size() + GEOMETRY_CHUNK_SIZE - 1) / GEOMETRY_CHUNK_SIZE);
+		instancing.chunkFirstMesh.resize(chunkCount + 1);
+		uint32_t meshes = 0;
+		for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+			instancing.chunkFirstMesh[chunk] = meshes;
+			size_t last = std::min((chunk + 1) * (size_t)GEOMETRY_CHUNK_SIZE, modelsDeferred.size());
+			for (size_t i = chunk * GEOMETRY_CHUNK_SIZE; i < last; ++i) {
+				meshes += modelsDeferred[i]->buffersReady ? (uint32_t)modelsDeferred[i]->meshBuffers.size() : 0;
+			}
+		}
+		instancing.chunkFirstMesh[chunkCount] = meshes;
+
+		std::vector<InstancedList*> lists;
+		auto batch = [&](const std::vector<DrawItem> &draws, const std::vector<uint32_t> &modelFirstDraw, uint32_t layer, InstancedList &list, const std::vector<uint32_t> *order = nullptr) {
+			batchDraws(draws, modelFirstDraw, order, (uint32_t)lists.size() * meshes, layer, list);
+			lists.push_back(&list);
+		};
 
+		vk::Pipeline geometryPipeline = geometry ? geometryInstancedPipeline() : vk::Pipeline();
+		if (geometryPipeline) {
+			batch(culling.draws, culling.modelFirstDraw, 0, instancing.geometry, &drawQueue.order);
+		}
+
+		vk::Pipeline shadowPipeline = settings.shadows ? shadowPathInstancedPipeline(shadowPath) : vk::Pipeline();
+		if (shadowPipeline) {
+			if (!shadowPathPerLayer(shadowPath)) {
+				batch(shadowCulling.anyLayer, shadowCulling.anyLayerFirstDraw, 0, instancing.shadowAnyLayer);
+			} else {
+				for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+					batch(shadowCulling.draws[layer], shadowCulling.modelFirstDraw[layer], layer, instancing.shadow[layer]);
+				}
+			}
+		}
 
+		vk::Pipeline staticPipeline = staticLayers ? shadowPathInstancedPipeline(shadowCache.path) : vk::Pipeline();
+		if (staticPipeline) {
+			if (!shadowPathPerLayer(shadowCache.path)) {
+				batch(shadowCache.anyLayer, shadowCache.anyLayerFirstDraw, 0, instancing.cacheAnyLayer);
+			} else {
+				for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+					if (staticLayers & (1 << layer)) {
+						batch(shadowCache.draws[layer], shadowCache.modelFirstDraw[layer], layer, instancing.cache[layer]);
+					}
+				}
+			}
+		}
 
+		if (lists.empty() || meshes == 0) {
+			return;
+		}
 
-			// end offscreen render pass
+		// the ring's region is this frame's, updateTransientBuffers() started it
+		vkx::UniformRing::Allocation stream = uniformRing.allocate(lists.size() * meshes * sizeof(InstanceData));
+		InstanceData *instances = (InstanceData*)stream.data;
+		for (InstancedList *list : lists) {
+			for (auto &draw : list->draws) {
+				uint32_t materialId = modelsDeferred[draw.model]->meshBuffers[draw.mesh]->materialId;
+				for (uint32_t i = draw.firstInstance; i < draw.firstInstance + draw.instanceCount; ++i) {
+					instances[i].model = modelsDeferred[list->instanceModels[i - list->base]]->transfMatrix;
+					instances[i].params = glm::uvec4(list->layer, materialId, 0, 0);
+				}
+				instancing.instances += draw.instanceCount;
+			}
+			instancing.draws += (uint32_t)list->draws.size();
+		}
+		instancing.offset[frame] = frame * uniformRing.frameSize + stream.offset;
 
-			offscreenCmdBuffer.endRenderPass();
+		auto bindStream = [&](PassBindings &bindings, vk::Pipeline pipeline) {
+			if (pipeline) {
+				bindings.pipeline = pipeline;
+				bindings.instanceBuffer = uniformRing.buffer.buffer;
+				bindings.instanceOffset = instancing.offset[frame];
+			}
+		};
+		bindStream(geometryBindings, geometryPipeline);
+		bindStream(shadowBindings, shadowPipeline);
+		bindStream(shadowStaticBindings, staticPipeline);
+	}
 
+	// everything a cached layer's contents depend on: its light matrix, its static casters and where they are
+	uint64_t cacheLayerSignature(uint32_t layer, uint64_t seed) {
+		const std::vector<DrawItem> &draws = shadowCache.draws[layer];
+		uint64_t signature = vkx::hash64(&shadowLayerMatrix(layer), sizeof(glm::mat4), seed);
+		signature = vkx::hash64(draws.data(), draws.size() * sizeof(DrawItem), signature);
+		uint32_t lastModel = UINT32_MAX;
+		for (auto &draw : draws) {
+			if (draw.model != lastModel) {
+				lastModel = draw.model;
+				signature = vkx::hash64(&modelsDeferred[draw.model]->transfMatrix, sizeof(glm::mat4), signature);
+			}
+		}
+		return signature;
+	}
 
+	// picks the layers of the static shadow cache that have to be drawn again this frame (all of them with the
+	// cache off), and the path they're drawn with, the static pass only runs if there are any
+	// their signatures are updated here, the static pass is expected to run when the shadow map is used
+	void updateShadowCache(uint64_t seed) {
+
+		// per layer if possible, so only the layers that changed are drawn
+		// multiview would be all of them at once, the static pass doesn't have a multiview render pass anyway
+		const int preferred[] = { shadowPath, shadowPathVertexLayer, shadowPathGeometryLayer };
+		shadowCache.path = shadowPathGeometry;
+		for (int path : preferred) {
+			if (shadowPathPerLayer(path) && shadowPathAvailable(path)) {
+				shadowCache.path = path;
+				break;
+			}
 		}
 
+		uint64_t signatures[NUM_LIGHTS_TOTAL];
+		uint32_t dirty = 0;
+		for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+			signatures[layer] = cacheLayerSignature(layer, seed);
+			if (!shadowCache.enabled || signatures[layer] != shadowCache.layerSignature[layer]) {
+				dirty |= 1 << layer;
+			}
+		}
 
+		// the geometry shader copies every caster to every layer, it can't draw just one
+		if (dirty && !shadowPathPerLayer(shadowCache.path)) {
+			dirty = (1 << NUM_LIGHTS_TOTAL) - 1;
+		}
 
-		if (!settings.SSAO) {
-			// end early because we're not doing the SSAO passes
-			offscreenCmdBuffer.end();
+		for (uint32_t layer = 0; layer < NUM_LIGHTS_TOTAL; ++layer) {
+			if (dirty & (1 << layer)) {
+				shadowCache.layerSignature[layer] = signatures[layer];
+				shadowCache.layersDrawn++;
+			}
+		}
+
+		shadowCache.dirtyLayers = dirty;
+		offscreen.graph.setEnabled("shadow.static", dirty != 0);
+	}
+
+
+	// reduces the g-buffer depth to its min and max into the frame's result buffer, the host reads it once
+	// the frame's fence has been waited on, see readDepthRange()
+	void recordDepthReduce(vk::CommandBuffer cmdBuffer, uint32_t frame) {
+		vk::Buffer results = cascades.reduceResults[frame].buffer;
+
+		// min starts at the biggest uint, max at 0
+		cmdBuffer.fillBuffer(results, 0, sizeof(uint32_t), 0xffffffff);
+		cmdBuffer.fillBuffer(results, sizeof(uint32_t), sizeof(uint32_t), 0);
+
+		vk::BufferMemoryBarrier barrier;
+		barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+		barrier.buffer = results;
+		barrier.size = VK_WHOLE_SIZE;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), nullptr, barrier, nullptr);
+
+		// 16x16 invocations per group, one texel each
+		glm::uvec2 size = offscreen.graph.attachment("gbuffer.depth").size;
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cascades.reducePipeline);
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, rscs.pipelineLayouts->get(handles.depthReduceLayout), 0, 1, rscs.descriptorSets->getPtr(handles.depthReduce[frame]), 0, nullptr);
+		cmdBuffer.dispatch((size.x + 15) / 16, (size.y + 15) / 16, 1);
+
+		// make the result visible to the host
+		barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+		cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), nullptr, barrier, nullptr);
+	}
+
+	// the view depth range frame's last reduction found, rounded out to steps of 1 / CASCADE_RANGE_STEPS_PER_OCTAVE
+	// octaves, so the splits (and the cached cascades) only change when the visible range changes a lot
+	void readDepthRange(uint32_t frame) {
+		const uint32_t *bits = (const uint32_t*)cascades.reduceResults[frame].mapped;
+		float depth[2];
+		memcpy(depth, bits, sizeof(depth));
+
+		// nothing but sky (the shader skips depth 1), or it hasn't run yet
+		if (!(depth[0] < depth[1])) {
+			cascades.depthMin = cascades.depthMax = 0.0f;
 			return;
 		}
 
+		// the camera's projection is glm's (-1..1 from znear to zfar), vulkan keeps its 0..1 half in the depth buffer
+		// back to view depth
+		float n = camera.znear;
+		float f = camera.zfar;
+		auto linear = [&](float d) {
+			return 2.0f * n * f / ((f + n) - d * (f - n));
+		};
+		auto roundDown = [](float z) {
+			return exp2f(std::floor(log2f(z) * CASCADE_RANGE_STEPS_PER_OCTAVE) / CASCADE_RANGE_STEPS_PER_OCTAVE);
+		};
+		auto roundUp = [](float z) {
+			return exp2f(std::ceil(log2f(z) * CASCADE_RANGE_STEPS_PER_OCTAVE) / CASCADE_RANGE_STEPS_PER_OCTAVE);
+		};
+		cascades.depthMin = roundDown(linear(depth[0]));
+		cascades.depthMax = roundUp(linear(depth[1]));
+	}
 
 
+	// Record command buffer for rendering the scene to the offscreen frame buffer
+	// and blitting it to the different texture targets
+	// every pass is a secondary command buffer that is only re-recorded when its signature changes,
+	// the primary just begins the render passes and executes them
+	void recordOffscreenCommandBuffer(uint32_t frame) {
 
-		// SSAO Generation pass:
-		{
+		FrameCmdBuffers &cmdBuffers = frameCmdBuffers[frame];
 
-			// Clear values for all attachments written in the fragment shader
-			clearValues[0].color = vkx::clearColor({ 0.0f, 0.0f, 0.0f, 1.0f });
-			clearValues[1].depthStencil = { 1.0f, 0 };
+		// the frame's fence has been waited on, so the timestamps of its last use are in
+		offscreen.graph.readTimings(frame);
+		if (offscreen.graph.pass("depth.reduce").enabled) {
+			readDepthRange(frame);
+		}
+		// the next cullScene() tests against this frame's pyramid
+		if (hiZ.ready()) {
+			hiZ.readback(frame);
+		}
+		if (gpuScene.ready()) {
+			gpuScene.readback(frame);
+		}
+		runShadowBenchmark();
 
-			vk::RenderPassBeginInfo renderPassBeginInfo2;
-			renderPassBeginInfo2.renderPass = offscreen.framebuffers[1].renderPass;
-			renderPassBeginInfo2.framebuffer = offscreen.framebuffers[1].framebuffer;
-			renderPassBeginInfo2.renderArea.extent.width = offscreen.size.x;
-			renderPassBeginInfo2.renderArea.extent.height = offscreen.size.y;
-			renderPassBeginInfo2.clearValueCount = 1;//2;//clearValues.size();//2
-			renderPassBeginInfo2.pClearValues = clearValues.data();
+		// the shadow secondaries inherit whichever render pass this picks
+		if (offscreen.graph.pass("shadow").multiviewRenderPass) {
+			offscreen.graph.setMultiview("shadow", shadowPath == shadowPathMultiview);
+		}
 
-			// begin SSAO render pass
-			offscreenCmdBuffer.beginRenderPass(renderPassBeginInfo2, vk::SubpassContents::eInline);
+		if (cmdBuffers.offscreenDirty) {
+			for (auto &chunk : cmdBuffers.shadow) {
+				chunk.recorded = false;
+			}
+			for (auto &chunk : cmdBuffers.shadowStatic) {
+				chunk.recorded = false;
+			}
+			cmdBuffers.shadowStaticClear.recorded = false;
+			for (auto &chunk : cmdBuffers.geometry) {
+				chunk.recorded = false;
+			}
+			cmdBuffers.skinnedMeshes.recorded = false;
+			cmdBuffers.geometryLate.recorded = false;
+			cmdBuffers.gpuGeometry.recorded = false;
+			cmdBuffers.gpuGeometryLate.recorded = false;
+			cmdBuffers.feedback.recorded = false;
+			cmdBuffers.ssaoGenerate.recorded = false;
+			cmdBuffers.ssaoBlur.recorded = false;
+			cmdBuffers.deferred.recorded = false;
+			cmdBuffers.offscreenDirty = false;
+		}
 
 
-			vk::Viewport viewport = vkx::viewport(offscreen.size);
-			offscreenCmdBuffer.setViewport(0, viewport);
-			vk::Rect2D scissor = vkx::rect2D(offscreen.size);
-			offscreenCmdBuffer.setScissor(0, scissor);
-			vk::DeviceSize offsets = { 0 };
+		/* SECONDARIES */
 
+		auto tRecordStart = std::chrono::high_resolution_clock::now();
 
+		// the shadow and g-buffer chunks are recorded on the recording threads
+		// chunk i always goes to thread i % threadCount, so its command buffer is always
+		// reset and recorded from that thread's command pool
+		uint32_t threadCount = (uint32_t)recordingThreads.threads.size();
 
+		// culled in updateWorld(), the recording threads only read the results
+		// if the models changed since then the draw lists are stale, cull again
+		if (culling.modelFirstDraw.size() != modelsDeferred.size() + 1) {
+			cullScene();
+			cullShadowCasters();
+		}
 
-			offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen.ssaoGenerate"), 0, 1, rscs.descriptorSets->getPtr("offscreen.ssao.generate"), 0, nullptr);
-			offscreenCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("ssao.generate"));
-			offscreenCmdBuffer.draw(3, 1, 0, 0);
+		// the static meshes' instances go to the gpu as they are, however many there are
+		bool gpuDrivenFrame = gpuDrivenActive();
+		if (gpuDrivenFrame) {
+			updateGpuScene(frame);
+		}
+
+		// a spawn only touches the last chunk, a removal the chunks from the removed model on
+		uint32_t chunkCount = (uint32_t)((modelsDeferred.size() + GEOMETRY_CHUNK_SIZE - 1) / GEOMETRY_CHUNK_SIZE);
+		for (uint32_t chunk = chunkCount; chunk < cmdBuffers.geometry.size(); ++chunk) {
+			freePass(cmdBuffers.geometry[chunk]);
+		}
+		cmdBuffers.geometry.resize(chunkCount);
+		for (uint32_t chunk = chunkCount; chunk < cmdBuffers.shadow.size(); ++chunk) {
+			freePass(cmdBuffers.shadow[chunk]);
+		}
+		cmdBuffers.shadow.resize(chunkCount);
+		for (uint32_t chunk = chunkCount; chunk < cmdBuffers.shadowStatic.size(); ++chunk) {
+			freePass(cmdBuffers.shadowStatic[chunk]);
+		}
+		cmdBuffers.shadowStatic.resize(chunkCount);
 
+		uint64_t depthBias[2] = { glm::floatBitsToUint(settings.depthBiasConstant), glm::floatBitsToUint(settings.depthBiasSlope) };
 
-			offscreenCmdBuffer.endRenderPass();
+		// the static shadow cache's layers that changed are drawn again, along with the dynamic casters
+		uint32_t staticLayers = 0;
+		if (settings.shadows) {
+			updateShadowCache(vkx::hash64(depthBias, sizeof(depthBias)));
+			staticLayers = shadowCache.dirtyLayers;
+		} else {
+			offscreen.graph.setEnabled("shadow.static", false);
 		}
 
+		PassBindings shadowBindings;
+		shadowBindings.pipeline = shadowPathPipeline(shadowPath);
+		shadowBindings.layout = rscs.pipelineLayouts->get(handles.shadowLayout);
+		shadowBindings.sceneSet = rscs.descriptorSets->get(handles.shadowScene[frame]);
+		shadowBindings.matrixSet = rscs.descriptorSets->get(handles.shadowMatrix[frame]);
+
+		PassBindings shadowStaticBindings = shadowBindings;
+		shadowStaticBindings.pipeline = shadowPathPipeline(shadowCache.path);
+
+		PassBindings geometryBindings;
+		geometryBindings.pipeline = pipeline(settings.SSAO ? pipelineMeshesSSAO : pipelineMeshes);
+		geometryBindings.layout = rscs.pipelineLayouts->get(handles.offscreenLayout);
+		geometryBindings.sceneSet = rscs.descriptorSets->get(handles.offscreenScene[frame]);
+		geometryBindings.matrixSet = rscs.descriptorSets->get(handles.offscreenMatrix[frame]);
+		if (settings.virtualTexturing) {
+			geometryBindings.virtualTextureSet = virtualTextures.descriptorSet;
+		}
 
+		PassBindings skinnedBindings = geometryBindings;
+		skinnedBindings.pipeline = pipeline(settings.SSAO ? pipelineSkinnedMeshesSSAO : pipelineSkinnedMeshes);
 
-		// Third pass: SSAO blur
-		// -------------------------------------------------------------------------------------------------------
-		{
+		// the passes that can draw instanced get the instance stream
+		prepareInstancing(frame, !gpuDrivenFrame, staticLayers, geometryBindings, shadowBindings, shadowStaticBindings);
 
-			vk::RenderPassBeginInfo renderPassBeginInfo3;
-			renderPassBeginInfo3.renderPass = offscreen.framebuffers[2].renderPass;
-			renderPassBeginInfo3.framebuffer = offscreen.framebuffers[2].framebuffer;
-			renderPassBeginInfo3.renderArea.extent.width = offscreen.size.x;
-			renderPassBeginInfo3.renderArea.extent.height = offscreen.size.y;
-			renderPassBeginInfo3.clearValueCount = 1;//2;//clearValues.size();//2
-			renderPassBeginInfo3.pClearValues = clearValues.data();
+		for (uint32_t chunk = 0; chunk < chunkCount; ++chunk) {
+			size_t first = chunk * GEOMETRY_CHUNK_SIZE;
+			size_t last = std::min(first + GEOMETRY_CHUNK_SIZE, modelsDeferred.size());
+			uint64_t signature = modelsSignature(frame, first, last);
+			// the shadow passes are scissored to the tiles
+			uint64_t tilesSignature = vkx::hash64(shadowTiles.tiles, sizeof(shadowTiles.tiles), signature);
+			vkx::Thread *thread = recordingThreads.threads[chunk % threadCount].get();
 
-			//renderPassBeginInfo.framebuffer = frameBuffers.ssaoBlur.frameBuffer;
-			//renderPassBeginInfo.renderPass = frameBuffers.ssaoBlur.renderPass;
-			//renderPassBeginInfo.renderArea.extent.width = frameBuffers.ssaoBlur.width;
-			//renderPassBeginInfo.renderArea.extent.height = frameBuffers.ssaoBlur.height;
+			// a chunk is only re-recorded when what's visible in it changes
+			uint64_t geometrySignature = visibleSignature(first, last, signature);
+			if (geometryBindings.instanceBuffer) {
+				geometrySignature = instancedSignature(instancing.geometry, chunk, geometryBindings.instanceOffset, geometrySignature);
+			}
+			if (!gpuDrivenFrame && needsRecording(cmdBuffers.geometry[chunk], geometrySignature)) {
+				thread->addJob([=] { recordGeometryChunk(frame, chunk, first, last, geometrySignature, geometryBindings); });
+			}
 
-			offscreenCmdBuffer.beginRenderPass(renderPassBeginInfo3, vk::SubpassContents::eInline);
+			if (settings.shadows) {
+				int path = shadowPath;
+				uint64_t shadowSignature = casterSignature(first, last, path, vkx::hash64(depthBias, sizeof(depthBias), tilesSignature));
+				if (shadowBindings.instanceBuffer) {
+					shadowSignature = instancedCasterSignature(chunk, path, false, UINT32_MAX, shadowBindings.instanceOffset, shadowSignature);
+				}
+				if (needsRecording(cmdBuffers.shadow[chunk], shadowSignature)) {
+					thread->addJob([=] { recordShadowChunk(frame, chunk, first, last, shadowSignature, shadowBindings, path, false, UINT32_MAX); });
+				}
+			}
 
-			vk::Viewport viewport = vkx::viewport(offscreen.size);
-			offscreenCmdBuffer.setViewport(0, viewport);
-			vk::Rect2D scissor = vkx::rect2D(offscreen.size);
-			offscreenCmdBuffer.setScissor(0, scissor);
+			if (staticLayers) {
+				int path = shadowCache.path;
+				uint64_t staticSignature = cachedCasterSignature(first, last, path, staticLayers, vkx::hash64(depthBias, sizeof(depthBias), tilesSignature));
+				if (shadowStaticBindings.instanceBuffer) {
+					staticSignature = instancedCasterSignature(chunk, path, true, staticLayers, shadowStaticBindings.instanceOffset, staticSignature);
+				}
+				if (needsRecording(cmdBuffers.shadowStatic[chunk], staticSignature)) {
+					thread->addJob([=] { recordShadowChunk(frame, chunk, first, last, staticSignature, shadowStaticBindings, path, true, staticLayers); });
+				}
+			}
+		}
 
+		// skinned meshes always go on the last thread, like the late passes, so their command buffer stays in its pool
+		// whatever the chunk count is
+		{
+			uint64_t signature = skinnedMeshesSignature(frame);
+			if (needsRecording(cmdBuffers.skinnedMeshes, signature)) {
+				recordingThreads.threads[threadCount - 1]->addJob([=] { recordSkinnedMeshes(frame, signature, skinnedBindings); });
+			}
+		}
 
+		// the gpu driven draws go on the first thread, their late pass on the last one
+		bool gpuOcclusionLate = false;
+		if (gpuDrivenFrame) {
+			PassBindings indirectBindings = geometryBindings;
+			indirectBindings.pipeline = pipeline(settings.SSAO ? pipelineMeshesIndirectSSAO : pipelineMeshesIndirect);
+			indirectBindings.layout = rscs.pipelineLayouts->get(handles.offscreenIndirectLayout);
+
+			uint64_t signature = gpuGeometrySignature(frame, (uint64_t)(VkPipeline)indirectBindings.pipeline);
+			if (needsRecording(cmdBuffers.gpuGeometry, signature)) {
+				recordingThreads.threads[0]->addJob([=] { recordGpuGeometry(frame, 0, signature, indirectBindings); });
+			}
+			gpuOcclusionLate = occlusionActive();
+			if (gpuOcclusionLate && needsRecording(cmdBuffers.gpuGeometryLate, signature)) {
+				recordingThreads.threads[threadCount - 1]->addJob([=] { recordGpuGeometry(frame, 1, signature, indirectBindings); });
+			}
+		}
 
-			offscreenCmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, rscs.pipelineLayouts->get("offscreen.ssaoBlur"), 0, 1, rscs.descriptorSets->getPtr("offscreen.ssao.blur"), 0, nullptr);
-			offscreenCmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, rscs.pipelines->get("ssao.blur"));
-			offscreenCmdBuffer.draw(3, 1, 0, 0);
+		// the candidates always go on the last thread, so their command buffer stays in its pool
+		// what they draw is only known once the gpu has tested them
+		bool occlusionLate = occlusionActive() && !occlusion.draws.empty();
+		if (occlusionActive()) {
+			hiZ.setCandidates(frame, occlusion.candidates, occlusion.commands);
+		}
+		if (occlusionLate) {
+			uint64_t signature = drawsSignature(occlusion.draws, occlusion.modelFirstDraw, 0, modelsDeferred.size(), modelsSignature(frame, 0, modelsDeferred.size()));
+			if (needsRecording(cmdBuffers.geometryLate, signature)) {
+				recordingThreads.threads[threadCount - 1]->addJob([=] { recordLateGeometry(frame, signature, geometryBindings); });
+			}
+		}
 
-			offscreenCmdBuffer.endRenderPass();
+		// the main thread records the small passes from its own pool in the meantime
+		if (staticLayers && needsRecording(cmdBuffers.shadowStaticClear, staticLayers)) {
+			recordShadowStaticClear(frame, staticLayers);
+		}
 
+		uint64_t allModels = modelsSignature(frame, 0, modelsDeferred.size());
+		if (settings.virtualTexturing && needsRecording(cmdBuffers.feedback, allModels)) {
+			recordFeedbackPass(frame, allModels);
 		}
 
+		if (settings.SSAO) {
+			vk::Pipeline generatePipeline = pipelineVariants.get("ssao.generate", ssaoConstants());
+			if (needsRecording(cmdBuffers.ssaoGenerate, (uint64_t)(VkPipeline)generatePipeline) || !cmdBuffers.ssaoBlur.recorded) {
+				recordSSAOPasses(frame, generatePipeline);
+			}
+		}
 
+		recordingThreads.wait();
 
+		recordingStats.recordMSAccum += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - tRecordStart).count();
+		recordingStats.frames++;
 
 
+		/* PRIMARY */
 
+		// re-recorded every frame, it's only a handful of commands
+		vk::CommandBuffer &offscreenCmdBuffer = cmdBuffers.offscreen;
+		if (!offscreenCmdBuffer) {
+			vk::CommandBufferAllocateInfo cmd = vkx::commandBufferAllocateInfo(cmdPool, vk::CommandBufferLevel::ePrimary, 1);
+			offscreenCmdBuffer = context.device.allocateCommandBuffers(cmd)[0];
+		}
 
+		offscreenCmdBuffer.reset(vk::CommandBufferResetFlags());
+		offscreenCmdBuffer.begin(vk::CommandBufferBeginInfo{ vk::CommandBufferUsageFlagBits::eOneTimeSubmit });
 
 
+		// the graph begins the render passes and takes care of the barriers between them,
+		// each pass just executes its secondaries
+		vkx::RenderGraph &graph = offscreen.graph;
 
+		graph.setRecord("shadow.static", [&](vk::CommandBuffer cmdBuffer) {
+			std::vector<vk::CommandBuffer> secondaries = { cmdBuffers.shadowStaticClear.cmdBuffer };
+			for (auto &chunk : cmdBuffers.shadowStatic) {
+				secondaries.push_back(chunk.cmdBuffer);
+			}
+			cmdBuffer.executeCommands(secondaries);
+		});
 
+		graph.setRecord("shadow", [&](vk::CommandBuffer cmdBuffer) {
+			std::vector<vk::CommandBuffer> secondaries;
+			for (auto &chunk : cmdBuffers.shadow) {
+				secondaries.push_back(chunk.cmdBuffer);
+			}
+			if (!secondaries.empty()) {
+				cmdBuffer.executeCommands(secondaries);
+			}
+		});
 
+		graph.setRecord("gpu.cull", [&](vk::CommandBuffer cmdBuffer) {
+			gpuScene.record(cmdBuffer, frame, camera.matrices.projection * camera.matrices.view, culling.enabled, occlusionActive());
+		});
 
-		// end offscreen command buffer
-		offscreenCmdBuffer.end();
+		graph.setRecord("gbuffer", [&](vk::CommandBuffer cmdBuffer) {
+			std::vector<vk::CommandBuffer> secondaries;
+			if (gpuDrivenFrame) {
+				secondaries.push_back(cmdBuffers.gpuGeometry.cmdBuffer);
+			} else {
+				for (auto &chunk : cmdBuffers.geometry) {
+					secondaries.push_back(chunk.cmdBuffer);
+				}
+			}
+			secondaries.push_back(cmdBuffers.skinnedMeshes.cmdBuffer);
+			cmdBuffer.executeCommands(secondaries);
+		});
+
+		graph.setRecord("hiz", [&](vk::CommandBuffer cmdBuffer) {
+			hiZ.record(cmdBuffer, frame, camera.matrices.projection * camera.matrices.view);
+			if (gpuDrivenFrame) {
+				gpuScene.recordLate(cmdBuffer, frame);
+			}
+		});
 
+		graph.setRecord("gbuffer.late", [&](vk::CommandBuffer cmdBuffer) {
+			std::vector<vk::CommandBuffer> secondaries;
+			if (occlusionLate) {
+				secondaries.push_back(cmdBuffers.geometryLate.cmdBuffer);
+			}
+			if (gpuOcclusionLate) {
+				secondaries.push_back(cmdBuffers.gpuGeometryLate.cmdBuffer);
+			}
+			cmdBuffer.executeCommands(secondaries);
+		});
 
-	}
+		graph.setRecord("vt.feedback", [&](vk::CommandBuffer cmdBuffer) {
+			std::array<vk::ClearValue, 2> clearValues;
+			clearValues[0].color = vk::ClearColorValue(std::array<uint32_t, 4>{ 0, 0, 0, 0 });// no request
+			clearValues[1].depthStencil = { 1.0f, 0 };
 
+			vk::RenderPassBeginInfo renderPassBeginInfo;
+			renderPassBeginInfo.renderPass = virtualTextures.feedbackRenderPass;
+			renderPassBeginInfo.framebuffer = virtualTextures.feedbackFramebuffer;
+			renderPassBeginInfo.renderArea.extent.width = virtualTextures.feedbackSize.x;
+			renderPassBeginInfo.renderArea.extent.height = virtualTextures.feedbackSize.y;
+			renderPassBeginInfo.clearValueCount = clearValues.size();
+			renderPassBeginInfo.pClearValues = clearValues.data();
 
+			cmdBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+			cmdBuffer.executeCommands(cmdBuffers.feedback.cmdBuffer);
+			cmdBuffer.endRenderPass();
 
+			virtualTextures.recordFeedbackReadback(cmdBuffer);
+		});
 
+		graph.setRecord("depth.reduce", [&](vk::CommandBuffer cmdBuffer) {
+			recordDepthReduce(cmdBuffer, frame);
+		});
 
+		graph.setRecord("ssao.generate", [&](vk::CommandBuffer cmdBuffer) {
+			cmdBuffer.executeCommands(cmdBuffers.ssaoGenerate.cmdBuffer);
+		});
 
+		graph.setRecord("ssao.blur", [&](vk::CommandBuffer cmdBuffer) {
+			cmdBuffer.executeCommands(cmdBuffers.ssaoBlur.cmdBuffer);
+		});
 
+		// composition doesn't sample what's switched off, so the passes that only feed it get culled
+		graph.setOutputEnabled("shadow.map", settings.shadows);
+		graph.setOutputEnabled("ssao.blur", settings.SSAO);
+		graph.setEnabled("vt.feedback", settings.virtualTexturing);
+		graph.setEnabled("gpu.cull", gpuDrivenFrame);
+		graph.setEnabled("hiz", occlusionActive());
+		graph.setEnabled("gbuffer.late", occlusionLate || gpuOcclusionLate);
+		graph.setEnabled("depth.reduce", cascades.sdsm && cascades.reducePipeline && settings.shadows);
 
+		graph.execute(offscreenCmdBuffer, frame);
 
 
+		// end offscreen command buffer
+		offscreenCmdBuffer.end();
+	}
 	void windowResized() {
 		camera.updateViewMatrix();
 		updateUniformBufferSSAOParams();
@@ -3991,7 +6067,26 @@ class VulkanExample : public vkx::vulkanApp {
 		offscreen.size = glm::uvec2(settings.windowSize.width, settings.windowSize.height);
 
 		vulkanApp::prepare();
+		if (context.multiviewSupported) {
+			offscreen.shadowViewMask = (1 << NUM_LIGHTS_TOTAL) - 1;
+		}
 		offscreen.prepare();
+		offscreen.graph.enableTimings(settings.framesInFlight);
+
+		// optional, without the shaders every frustum visible mesh is drawn
+		{
+			const vkx::RenderGraph::Attachment &depth = offscreen.graph.attachment("gbuffer.depth");
+			std::string shaderPath = getAssetPath() + "shaders/vulkanscene/ssao/";
+			if (!hiZ.prepare(depth.view, depth.readLayout, depth.size, settings.framesInFlight, shaderPath)) {
+				std::cout << "no " << shaderPath << "hizBuild.comp.spv / hizTest.comp.spv, no occlusion culling" << std::endl;
+			}
+		}
+
+		// before anything is loaded, materials register their virtual textures as they load
+		if (settings.virtualTexturing) {
+			virtualTextures.prepare(offscreen.size);
+			assetManager.virtualTextures = &virtualTextures;
+		}
 
 		//offscreen.depthFinalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
 
@@ -4012,8 +6107,37 @@ class VulkanExample : public vkx::vulkanApp {
 		prepareDescriptorPools();
 		prepareDescriptorSets();
 
+		// optional too, needs its instance set layout, the pipelines that draw with it are made below
+		{
+			std::string shaderPath = getAssetPath() + "shaders/vulkanscene/ssao/";
+			if (!gpuScene.prepare(settings.framesInFlight, vkx::vertexSize(SSAOVertexLayout), rscs.descriptorSetLayouts->get("offscreen.instances"), hiZ, shaderPath)) {
+				std::cout << "no " << shaderPath << "gpuCull.comp.spv or no multiDrawIndirect / drawIndirectFirstInstance, no gpu driven g-buffer pass" << std::endl;
+			} else {
+				std::cout << "gpu driven g-buffer pass, " << (gpuScene.compact() ? "VK_AMD_draw_indirect_count" : "multiDrawIndirect over whole segments") << std::endl;
+			}
+		}
+
+		// one recording thread per core, the main thread records the small passes meanwhile
+		// created before the pipelines, which are compiled on them
+		uint32_t recordingThreadCount = settings.recordingThreads;
+		if (recordingThreadCount == 0) {
+			uint32_t cores = std::thread::hardware_concurrency();
+			recordingThreadCount = cores > 1 ? cores - 1 : 1;
+		}
+		recordingThreads.setThreadCount(recordingThreadCount);
+
+		// a warm cache skips shader compilation, so this is where it shows
+		auto tPipelinesStart = std::chrono::high_resolution_clock::now();
 		preparePipelines();
 		prepareDeferredPipelines();
+		float pipelinesMS = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - tPipelinesStart).count();
+		std::cout << "pipeline cache " << (context.pipelineCacheLoaded ? "hit" : "miss") << " (" << context.pipelineCacheStatus << "), pipelines created in " << pipelinesMS << "ms on " << recordingThreadCount << " threads" << std::endl;
+		std::cout << "shader cache: " << context.shaderCache->moduleCount() << " modules, " << context.shaderCache->pathHits << " path hits, " << context.shaderCache->contentHits << " content hits, " << context.shaderCache->bytesMapped / 1024 << "KB mapped" << std::endl;
+		resolveHandles();
+		pickShadowPath();
+		if (settings.shadowBenchmark) {
+			startShadowBenchmark();
+		}
 
 
 		{
@@ -4027,8 +6151,6 @@ class VulkanExample : public vkx::vulkanApp {
 		updateWorld();
 		if (TEST_DEFINE) {
 			updateDrawCommandBuffers();
-		} else {
-			buildDrawCommandBuffers();
 		}
 
 		buildOffscreenCommandBuffer();
@@ -4045,10 +6167,25 @@ class VulkanExample : public vkx::vulkanApp {
 			}
 		}
 
-		buildDrawCommandBuffers();
+		// beginFrame() already waited for this frame slot, so its command buffers and
+		// uniform buffers are free to be rewritten
+
+		// read back the feedback of the last finished frame and stream pages in
+		// (the feedback buffer is shared, with more than one frame in flight it may be
+		// a frame newer than that, which is fine for page requests)
+		// pages are uploaded through a queue flush, so the indirection tables can't be in use when they're rewritten
+		if (settings.virtualTexturing) {
+			virtualTextures.update();
+		}
+
+		// only re-records the passes whose contents changed
+		recordOffscreenCommandBuffer(currentFrame);
 
 		prepareFrame();
 
+		// the composition pass targets the swap chain image that was just acquired
+		buildDrawCommandBuffers();
+
 		// draw current command buffers
 		{
 			// render to offscreen, then onscreen, use signal and wait semaphores to
@@ -4069,11 +6206,11 @@ class VulkanExample : public vkx::vulkanApp {
 
 			// Submit work
 			submitInfo.commandBufferCount = 1;
-			submitInfo.pCommandBuffers = &offscreenCmdBuffer;
+			submitInfo.pCommandBuffers = &frameCmdBuffers[currentFrame].offscreen;
 
 			// Submit
 			//queue.submit(submitInfo, nullptr);
-			context.queue.submit(submitInfo, renderFence);// temporary
+			context.queue.submit(submitInfo, nullptr);
 
 
 
@@ -4095,11 +6232,12 @@ class VulkanExample : public vkx::vulkanApp {
 			// Submit work
 			submitInfo.commandBufferCount = 1;
 			//submitInfo.pCommandBuffers = &primaryCmdBuffers[currentBuffer];
-			submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
+			submitInfo.pCommandBuffers = &frameCmdBuffers[currentFrame].composition;
 
 			// Submit
+			// the frame's fence is signaled once both submits are done
 			//queue.submit(submitInfo, deferredFence);
-			context.queue.submit(submitInfo, nullptr);
+			context.queue.submit(submitInfo, getFrameFence());
 		}
 
 
@@ -4110,20 +6248,18 @@ class VulkanExample : public vkx::vulkanApp {
 
 
 
-		//// todo: fix / better solution
-		// Wait for fence to signal that all command buffers are ready
-		vk::Result fenceRes;
-		do {
-			fenceRes = context.device.waitForFences(renderFence, VK_TRUE, 100000000);
-		} while (fenceRes == vk::Result::eTimeout);
-
-		// reset fence for next submit
-		context.device.resetFences(renderFence);
+		// no wait here, the cpu moves on to the next frame while the gpu renders this one
 
 
 
 
 		submitFrame();
+
+		pipelineCacheSaveTimer += frameTimer;
+		if (pipelineCacheSaveTimer > PIPELINE_CACHE_SAVE_INTERVAL * 1000.0f) {
+			context.savePipelineCache();
+			pipelineCacheSaveTimer = 0.0f;
+		}
 	}
 
 
@@ -4162,6 +6298,88 @@ class VulkanExample : public vkx::vulkanApp {
 		textOverlay->addText(ss.str(), 5.0f, 85.0f, vkx::TextOverlay::alignLeft);
 		ss.str(""); ss.clear();
 
+		ss << std::fixed << std::setprecision(2) << "frames in flight: " << frames.size() << ", latency: " << frameStats.latencyMS << "ms, fence wait: " << frameStats.fenceWaitMS << "ms";
+		textOverlay->addText(ss.str(), 5.0f, 105.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+
+		ss << "passes recorded: " << recordingStats.passesRecorded << ", geometry chunks: " << frameCmdBuffers[currentFrame].geometry.size();
+		ss << ", recording: " << (recordingStats.frames ? recordingStats.recordMSAccum / recordingStats.frames : 0.0f) << "ms on " << recordingThreads.threads.size() << " threads";
+		textOverlay->addText(ss.str(), 5.0f, 125.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+		recordingStats.passesRecorded = 0;
+		recordingStats.recordMSAccum = 0.0f;
+		recordingStats.frames = 0;
+
+		ss << "graph: " << offscreen.graph.livePasses << " passes, " << offscreen.graph.culledPasses << " culled, attachments: " << (offscreen.graph.allocatedBytes >> 20) << "mb (" << (offscreen.graph.requiredBytes >> 20) << "mb unaliased)";
+		textOverlay->addText(ss.str(), 5.0f, 145.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+
+		ss << "culling: " << culling.visible << " meshes visible, " << culling.culled << " culled" << (culling.enabled ? "" : " (off)");
+		textOverlay->addText(ss.str(), 5.0f, 165.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+
+		ss << "shadow casters: " << shadowCulling.layerDraws << " layer draws, " << shadowCulling.layerCulled << " culled";
+		ss << (shadowCulling.enabled ? "" : " (off)") << ", " << shadowPathNames[shadowPath];
+		if (offscreen.graph.timingsEnabled()) {
+			ss << ", " << offscreen.graph.pass("shadow").gpuMS << "ms";
+		}
+		textOverlay->addText(ss.str(), 5.0f, 185.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+
+		ss << "shadow cache: " << shadowCache.layersDrawn << " layers drawn" << (shadowCache.enabled ? "" : " (off)");
+		if (offscreen.graph.timingsEnabled()) {
+			ss << ", static pass " << offscreen.graph.pass("shadow.static").gpuMS << "ms";
+		}
+		textOverlay->addText(ss.str(), 5.0f, 205.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+		shadowCache.layersDrawn = 0;
+
+		uint64_t atlasTexels = (uint64_t)shadowAtlas.pageCount() * shadowAtlas.pageSize() * shadowAtlas.pageSize();
+		ss << "shadow atlas: " << (atlasTexels ? shadowAtlas.usedTexels * 100 / atlasTexels : 0) << "% of the texels in use" << (shadowTiles.enabled ? "" : " (off)") << ", tiles:";
+		for (auto &tile : shadowTiles.tiles) {
+			ss << " " << tile.size;
+		}
+		textOverlay->addText(ss.str(), 5.0f, 225.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+
+		ss << std::fixed << std::setprecision(1) << "cascade splits:";
+		for (float split : cascades.splits) {
+			ss << " " << split;
+		}
+		ss << (cascades.sdsm && cascades.reducePipeline ? " (visible depth)" : "");
+		textOverlay->addText(ss.str(), 5.0f, 245.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+
+		ss << std::fixed << std::setprecision(2) << "software occlusion: " << softwareOcclusion.rasterizer.occluders << " occluders, " << softwareOcclusion.rasterizer.triangles << " triangles, " << softwareOcclusion.culled << " culled, " << softwareOcclusion.rasterizeMS << "ms rasterize, " << softwareOcclusion.testMS << "ms test" << (softwareOcclusion.enabled && culling.enabled ? "" : " (off)");
+		textOverlay->addText(ss.str(), 5.0f, 265.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+
+		if (hiZ.ready()) {
+			ss << "occlusion: " << (hiZ.candidates - hiZ.drawnLate) << " culled by hi-z, " << hiZ.candidates << " candidates, " << hiZ.drawnLate << " drawn late" << (occlusionActive() ? "" : " (off)");
+			textOverlay->addText(ss.str(), 5.0f, 285.0f, vkx::TextOverlay::alignLeft);
+			ss.str(""); ss.clear();
+		}
+
+		if (gpuScene.ready()) {
+			ss << "gpu driven: " << gpuScene.instances << " instances of " << gpuScene.uniqueMeshes << " meshes, " << gpuScene.drawn << " drawn, " << gpuScene.drawnLate << " drawn late, " << gpuScene.segments().size() << " materials" << (gpuDrivenActive() ? "" : " (off)");
+			textOverlay->addText(ss.str(), 5.0f, 325.0f, vkx::TextOverlay::alignLeft);
+			ss.str(""); ss.clear();
+		}
+
+		ss << "instancing: " << instancing.instances << " instances in " << instancing.draws << " draws" << (instancing.enabled ? "" : " (off)");
+		textOverlay->addText(ss.str(), 5.0f, 345.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+
+		ss << "draw queue: " << drawQueue.bindsUnsorted << " g-buffer binds in list order, " << drawQueue.bindsSorted << " sorted" << (drawQueue.enabled ? "" : " (off)");
+		textOverlay->addText(ss.str(), 5.0f, 365.0f, vkx::TextOverlay::alignLeft);
+		ss.str(""); ss.clear();
+
+		if (settings.virtualTexturing) {
+			ss << "vt pages: " << virtualTextures.residentPages << " resident, " << virtualTextures.requestedPages << " requested, " << virtualTextures.uploadedPages << " uploaded, " << virtualTextures.evictedPages << " evicted";
+			textOverlay->addText(ss.str(), 5.0f, 305.0f, vkx::TextOverlay::alignLeft);
+			ss.str(""); ss.clear();
+		}
+
 		//ss << "GPU: ";
 		//ss << context.deviceProperties.deviceName;
 		//textOverlay->addText(ss.str(), 5.0f, 65.0f, vkx::TextOverlay::alignLeft);
@@ -4183,6 +6401,22 @@ class VulkanExample : public vkx::vulkanApp {
 
 int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR pCmdLine, int nCmdShow) {
 
+	// -bakevt <image>: bakes a bc2 dds/ktx into <image>.vtex next to it, where the mesh loader looks for it, and exits
+	#if defined(_WIN32)
+	for (int32_t i = 1; i + 1 < __argc; i++) {
+		if (__argv[i] == std::string("-bakevt")) {
+			std::string src = __argv[i + 1];
+			std::string dst = src.substr(0, src.find_last_of('.')) + ".vtex";
+			if (!vkx::bakeVirtualTexture(src, dst)) {
+				std::cout << "couldn't bake " << src << ", it has to be a bc2 dds/ktx" << std::endl;
+				return 1;
+			}
+			std::cout << "baked " << dst << std::endl;
+			return 0;
+		}
+	}
+	#endif
+
 	VulkanExample* example = new VulkanExample();
 	example->run();
 	delete(example);
@@ -27,6 +27,16 @@ vulkanApp::vulkanApp(bool enableValidation) : swapChain(this->context) {
 			if (__argv[i] == std::string("-validation")) {
 				enableValidation = true;
 			}
+			if (__argv[i] == std::string("-shadowbenchmark")) {
+				settings.shadowBenchmark = true;
+			}
+			if (__argv[i] == std::string("-virtualtextures")) {
+				settings.virtualTexturing = true;
+			}
+			// clamped to 1 - MAX_FRAMES_IN_FLIGHT in prepare()
+			if (__argv[i] == std::string("-framesinflight") && i + 1 < __argc) {
+				settings.framesInFlight = (uint32_t)glm::max(atoi(__argv[i + 1]), 1);
+			}
 		}
 	#elif defined(__ANDROID__)
 		// Vulkan library is loaded dynamically on Android
@@ -83,6 +93,8 @@ vulkanApp::~vulkanApp() {
 		delete textOverlay;
 	}
 
+	destroyFrameSync();
+
 	context.device.destroySemaphore(semaphores.presentComplete);
 	context.device.destroySemaphore(semaphores.renderComplete);
 	context.device.destroySemaphore(semaphores.textOverlayComplete);
@@ -696,6 +708,8 @@ void vulkanApp::prepare() {
 		textOverlay = new TextOverlay(this->context, settings.windowSize.width, settings.windowSize.height, renderPass);
 		//updateTextOverlay();
 	}
+
+	createFrameSync();
 }
 
 //// todo: remove this
@@ -1055,6 +1069,17 @@ void vulkanApp::renderLoop() {
 			lastFPS = frameCounter / (tSinceUpdate.count() / 1000000.0);
 			frameCounter = 0;
 
+			if (frameStats.samples > 0) {
+				frameStats.latencyMS = frameStats.latencyAccumMS / frameStats.samples;
+			}
+			if (frameStats.waits > 0) {
+				frameStats.fenceWaitMS = frameStats.fenceWaitAccumMS / frameStats.waits;
+			}
+			frameStats.latencyAccumMS = 0.0f;
+			frameStats.fenceWaitAccumMS = 0.0f;
+			frameStats.samples = 0;
+			frameStats.waits = 0;
+
 			//updateTextOverlay();
 		}
 
@@ -1067,6 +1092,9 @@ void vulkanApp::renderLoop() {
 		// start of frame
 		tFrameStart = std::chrono::high_resolution_clock::now();
 
+		// wait for this frame slot's previous use to finish on the gpu
+		beginFrame();
+
 
 		// poll keyboard / mouse
 		updateInputInfo();
@@ -1153,6 +1181,96 @@ void vulkanApp::getOverlayText(vkx::TextOverlay *textOverlay) {
 	// Can be overriden in derived class
 }
 
+void vulkanApp::createFrameSync() {
+
+	destroyFrameSync();
+
+	// the semaphores created in initVulkan are replaced by the per frame ones
+	context.device.destroySemaphore(semaphores.presentComplete);
+	context.device.destroySemaphore(semaphores.renderComplete);
+
+	settings.framesInFlight = glm::clamp(settings.framesInFlight, 1u, (uint32_t)MAX_FRAMES_IN_FLIGHT);
+
+	frames.resize(settings.framesInFlight);
+	for (auto &frame : frames) {
+		frame.fence = context.device.createFence(vk::FenceCreateInfo());
+		frame.presentComplete = context.device.createSemaphore(vk::SemaphoreCreateInfo());
+		frame.renderComplete = context.device.createSemaphore(vk::SemaphoreCreateInfo());
+		frame.submitted = false;
+	}
+
+	currentFrame = 0;
+	semaphores.presentComplete = frames[currentFrame].presentComplete;
+	semaphores.renderComplete = frames[currentFrame].renderComplete;
+}
+
+void vulkanApp::destroyFrameSync() {
+	if (frames.empty()) {
+		return;
+	}
+	context.device.waitIdle();
+	for (auto &frame : frames) {
+		context.device.destroyFence(frame.fence);
+		context.device.destroySemaphore(frame.presentComplete);
+		context.device.destroySemaphore(frame.renderComplete);
+	}
+	frames.clear();
+	semaphores.presentComplete = vk::Semaphore();
+	semaphores.renderComplete = vk::Semaphore();
+}
+
+void vulkanApp::beginFrame() {
+
+	if (frames.empty()) {
+		return;
+	}
+
+	auto tNow = std::chrono::high_resolution_clock::now();
+
+	// latency of every frame that has finished since the last check
+	for (auto &frame : frames) {
+		if (frame.submitted && !frame.measured && context.device.getFenceStatus(frame.fence) == vk::Result::eSuccess) {
+			frameStats.latencyAccumMS += std::chrono::duration<float, std::milli>(tNow - frame.tInput).count();
+			frameStats.samples++;
+			frame.measured = true;
+		}
+	}
+
+	FrameSync &frame = frames[currentFrame];
+	if (frame.submitted) {
+		vk::Result fenceRes;
+		do {
+			fenceRes = context.device.waitForFences(frame.fence, VK_TRUE, 100000000);
+		} while (fenceRes == vk::Result::eTimeout);
+
+		auto tSignaled = std::chrono::high_resolution_clock::now();
+		frameStats.fenceWaitAccumMS += std::chrono::duration<float, std::milli>(tSignaled - tNow).count();
+		frameStats.waits++;
+		if (!frame.measured) {
+			frameStats.latencyAccumMS += std::chrono::duration<float, std::milli>(tSignaled - frame.tInput).count();
+			frameStats.samples++;
+		}
+
+		context.device.resetFences(frame.fence);
+		frame.submitted = false;
+	}
+
+	// input is polled right after this
+	frame.tInput = std::chrono::high_resolution_clock::now();
+
+	semaphores.presentComplete = frame.presentComplete;
+	semaphores.renderComplete = frame.renderComplete;
+}
+
+vk::Fence vulkanApp::getFrameFence() {
+	if (frames.empty()) {
+		return vk::Fence();
+	}
+	frames[currentFrame].submitted = true;
+	frames[currentFrame].measured = false;
+	return frames[currentFrame].fence;
+}
+
 void vulkanApp::prepareFrame() {
 	//if (primaryCmdBuffersDirty) {
 	//	buildPrimaryCommandBuffers();
@@ -1203,7 +1321,11 @@ void vulkanApp::submitFrame() {
 	// queue present
 	//swapChain.queuePresent(queue, semaphores.renderComplete);
 	swapChain.queuePresent(context.queue, currentBuffer, semaphores.renderComplete);// new
-	context.queue.waitIdle();// new
+
+	// no wait here, the frame's fence is waited on when its slot comes around again
+	if (!frames.empty()) {
+		currentFrame = (currentFrame + 1) % frames.size();
+	}
 }
 
 
@@ -0,0 +1,111 @@
+#include "vulkanCascades.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+
+namespace vkx {
+
+	void practicalSplits(float zNear, float zFar, float lambda, uint32_t count, float *splits) {
+		splits[0] = zNear;
+		for (uint32_t i = 1; i < count; ++i) {
+			float p = (float)i / (float)count;
+			float logSplit = zNear * powf(zFar / zNear, p);
+			float uniformSplit = zNear + (zFar - zNear) * p;
+			splits[i] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+		}
+		splits[count] = zFar;
+	}
+
+
+
+	glm::mat4 CascadeFit::projection() const {
+		glm::mat4 proj = glm::ortho(center.x - halfSize, center.x + halfSize, center.y - halfSize, center.y + halfSize, -zMax, -zMin);
+		proj[1][1] *= -1;// because glm produces matrix for opengl and this is vulkan
+		return proj;
+	}
+
+	CascadeFit fitCascade(const glm::mat4 &cameraView, float fovy, float aspect, float splitNear, float splitFar, const glm::vec3 &lightDir, uint32_t mapSize, uint32_t snapTexels) {
+		CascadeFit fit;
+
+		// any up vector that isn't (nearly) parallel to the light will do, it just has to stay the same
+		glm::vec3 direction = glm::normalize(lightDir);
+		glm::vec3 up = std::abs(direction.z) > 0.99f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 1.0f);
+		fit.view = glm::lookAt(glm::vec3(0.0f), direction, up);
+
+		// the split's corners, from view space (looking down -z) to light space
+		glm::mat4 viewToLight = fit.view * glm::inverse(cameraView);
+		float tanY = tanf(fovy * 0.5f);
+		float tanX = tanY * aspect;
+
+		glm::vec3 corners[8];
+		for (int j = 0; j < 8; ++j) {
+			float z = (j & 4) ? splitFar : splitNear;
+			float x = ((j & 1) ? 1.0f : -1.0f) * z * tanX;
+			float y = ((j & 2) ? 1.0f : -1.0f) * z * tanY;
+			corners[j] = glm::vec3(viewToLight * glm::vec4(x, y, -z, 1.0f));
+		}
+
+		glm::vec3 center(0.0f);
+		for (int j = 0; j < 8; ++j) {
+			center += corners[j] / 8.0f;
+		}
+		float radius = 0.0f;
+		for (int j = 0; j < 8; ++j) {
+			radius = std::max(radius, glm::length(corners[j] - center));
+		}
+		// rounded up, float noise mustn't change the size
+		radius = std::ceil(radius * 16.0f) / 16.0f;
+
+		// halfSize = radius + step, step = snapTexels * 2 * halfSize / mapSize
+		snapTexels = std::max(snapTexels, 1u);
+		float halfSize = radius * mapSize / (mapSize - 2.0f * snapTexels);
+		float step = snapTexels * 2.0f * halfSize / mapSize;
+		glm::vec2 snapped = glm::floor(glm::vec2(center) / step + 0.5f) * step;
+
+		fit.center = glm::vec3(snapped, center.z);
+		fit.radius = radius;
+		fit.halfSize = halfSize;
+		fit.zMin = center.z - radius;
+		fit.zMax = center.z + radius;
+		return fit;
+	}
+
+	bool fitCasterDepth(CascadeFit &fit, const BoundsList &bounds, float depthStep) {
+		float casterMin = std::numeric_limits<float>::max();
+		float casterMax = -std::numeric_limits<float>::max();
+		bool found = false;
+
+		glm::vec2 min = glm::vec2(fit.center) - fit.halfSize;
+		glm::vec2 max = glm::vec2(fit.center) + fit.halfSize;
+
+		for (size_t i = 0; i < bounds.size(); ++i) {
+			glm::vec3 boxMin, boxMax;
+			bounds.get(i, boxMin, boxMax);
+
+			glm::vec3 lightMin, lightMax;
+			transformBounds(fit.view, boxMin, boxMax, lightMin, lightMax);
+			if (lightMax.x < min.x || lightMin.x > max.x || lightMax.y < min.y || lightMin.y > max.y) {
+				continue;
+			}
+			casterMin = std::min(casterMin, lightMin.z);
+			casterMax = std::max(casterMax, lightMax.z);
+			found = true;
+		}
+
+		// the receivers are in the sphere, anything further from the light than that can't shadow them
+		float zMin = std::max(casterMin, fit.center.z - fit.radius);
+		float zMax = casterMax;
+		if (!found || zMax <= zMin) {
+			return false;
+		}
+
+		fit.zMin = std::floor(zMin / depthStep) * depthStep;
+		fit.zMax = std::ceil(zMax / depthStep) * depthStep;
+		return true;
+	}
+
+}
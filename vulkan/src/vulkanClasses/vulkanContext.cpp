@@ -55,6 +55,12 @@ void vkx::Context::createContext(bool enableValidation) {
 		enabledExtensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
 		#endif
 
+		// needed by VK_KHX_multiview
+		if (vkx::checkGlobalExtensionPresent(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)) {
+			enabledExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+			physicalDeviceProperties2 = true;
+		}
+
 
 		vk::InstanceCreateInfo instanceCreateInfo;
 		instanceCreateInfo.pApplicationInfo = &appInfo;
@@ -113,6 +119,23 @@ void vkx::Context::createContext(bool enableValidation) {
 			enabledExtensions.push_back(VK_EXT_DEBUG_MARKER_EXTENSION_NAME);
 			enableDebugMarkers = true;
 		}
+		// the shadow map layers can be rendered without a geometry shader with either of these
+		// devices that have the extension have to support the multiview feature
+		vk::PhysicalDeviceMultiviewFeaturesKHX multiviewFeatures;
+		if (physicalDeviceProperties2 && vkx::checkDeviceExtensionPresent(physicalDevice, VK_KHX_MULTIVIEW_EXTENSION_NAME)) {
+			enabledExtensions.push_back(VK_KHX_MULTIVIEW_EXTENSION_NAME);
+			multiviewFeatures.multiview = VK_TRUE;
+			deviceCreateInfo.pNext = &multiviewFeatures;
+			multiviewSupported = true;
+		}
+		if (vkx::checkDeviceExtensionPresent(physicalDevice, VKX_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME)) {
+			enabledExtensions.push_back(VKX_EXT_SHADER_VIEWPORT_INDEX_LAYER_EXTENSION_NAME);
+			vertexLayerSupported = true;
+		}
+		bool drawIndirectCount = vkx::checkDeviceExtensionPresent(physicalDevice, VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		if (drawIndirectCount) {
+			enabledExtensions.push_back(VK_AMD_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
 		if (enabledExtensions.size() > 0) {
 			deviceCreateInfo.enabledExtensionCount = (uint32_t)enabledExtensions.size();
 			deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions.data();
@@ -122,7 +145,12 @@ void vkx::Context::createContext(bool enableValidation) {
 			deviceCreateInfo.ppEnabledLayerNames = debug::validationLayerNames.data();
 		}
 		device = physicalDevice.createDevice(deviceCreateInfo);
+		// an extension command, the loader doesn't export it
+		if (drawIndirectCount) {
+			cmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountAMD)vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountAMD");
+		}
 	}
+	shaderCache->device = device;
 
 	if (enableValidation) {
 		debug::setupDebugging(instance, vk::DebugReportFlagBitsEXT::eError | vk::DebugReportFlagBitsEXT::eWarning);
@@ -131,7 +159,7 @@ void vkx::Context::createContext(bool enableValidation) {
 	if (enableDebugMarkers) {
 		debug::marker::setup(device);
 	}
-	pipelineCache = device.createPipelineCache(vk::PipelineCacheCreateInfo());
+	createPipelineCache();
 	// Find a queue that supports graphics operations
 	graphicsQueueIndex = findQueue(vk::QueueFlagBits::eGraphics);
 	// Get the graphics queue
@@ -139,6 +167,96 @@ void vkx::Context::createContext(bool enableValidation) {
 
 }
 
+namespace {
+	// VkPipelineCacheHeaderVersionOne, the start of every pipeline cache blob
+	struct PipelineCacheHeader {
+		uint32_t headerSize;
+		uint32_t headerVersion;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+	};
+}
+
+void vkx::Context::createPipelineCache() {
+
+	std::vector<uint8_t> data;
+	pipelineCacheLoaded = false;
+	pipelineCacheStatus = "disabled";
+
+	if (!pipelineCacheFile.empty()) {
+		std::ifstream file(pipelineCacheFile, std::ios::binary | std::ios::ate);
+		if (file.is_open()) {
+			data.resize((size_t)file.tellg());
+			file.seekg(0, std::ios::beg);
+			file.read((char*)data.data(), data.size());
+			if (!file) {
+				data.clear();
+			}
+		}
+		pipelineCacheStatus = "no cache file";
+	}
+
+	// the driver is supposed to reject a cache it didn't write, but not all of them do,
+	// so check the header before handing it over
+	if (!data.empty()) {
+		PipelineCacheHeader header;
+		if (data.size() < sizeof(header)) {
+			pipelineCacheStatus = "cache file too small";
+		} else {
+			memcpy(&header, data.data(), sizeof(header));
+			if (header.headerSize < sizeof(header) || header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+				pipelineCacheStatus = "unknown cache header version";
+			} else if (header.vendorID != deviceProperties.vendorID || header.deviceID != deviceProperties.deviceID) {
+				pipelineCacheStatus = "cache written by a different device";
+			} else if (memcmp(header.pipelineCacheUUID, &deviceProperties.pipelineCacheUUID[0], VK_UUID_SIZE) != 0) {
+				pipelineCacheStatus = "cache written by a different driver";
+			} else {
+				pipelineCacheLoaded = true;
+				pipelineCacheStatus = std::to_string(data.size()) + " bytes from " + pipelineCacheFile;
+			}
+		}
+		if (!pipelineCacheLoaded) {
+			data.clear();
+		}
+	}
+
+	vk::PipelineCacheCreateInfo pipelineCacheCreateInfo;
+	pipelineCacheCreateInfo.initialDataSize = data.size();
+	pipelineCacheCreateInfo.pInitialData = data.data();
+	pipelineCache = device.createPipelineCache(pipelineCacheCreateInfo);
+	pipelineCacheSavedSize = data.size();
+}
+
+void vkx::Context::savePipelineCache() {
+
+	if (pipelineCacheFile.empty() || !pipelineCache) {
+		return;
+	}
+
+	// drivers only ever add to the cache, same size means nothing new
+	std::vector<uint8_t> data = device.getPipelineCacheData(pipelineCache);
+	if (data.size() == pipelineCacheSavedSize) {
+		return;
+	}
+
+	// write it next to the old one and swap, so a crash halfway through doesn't leave a broken cache behind
+	std::string tempFile = pipelineCacheFile + ".tmp";
+	{
+		std::ofstream file(tempFile, std::ios::binary | std::ios::trunc);
+		file.write((const char*)data.data(), data.size());
+		if (!file) {
+			return;
+		}
+	}
+	std::remove(pipelineCacheFile.c_str());
+	if (std::rename(tempFile.c_str(), pipelineCacheFile.c_str()) != 0) {
+		return;
+	}
+
+	pipelineCacheSavedSize = data.size();
+}
+
 void vkx::Context::destroyContext() {
 	queue.waitIdle();
 	device.waitIdle();
@@ -152,6 +270,8 @@ void vkx::Context::destroyContext() {
 	}
 
 	destroyCommandPool();
+	shaderCache->destroy();
+	savePipelineCache();
 	device.destroyPipelineCache(pipelineCache);
 	device.destroy();
 
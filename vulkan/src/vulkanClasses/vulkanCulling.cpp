@@ -0,0 +1,211 @@
+#include "vulkanCulling.h"
+
+#include <cmath>
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define VKX_CULL_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define VKX_CULL_SSE
+#endif
+
+
+namespace vkx {
+
+	namespace {
+
+		// the arrays are padded to this, enough for the widest lanes
+		const size_t padding = 8;
+
+		// just enough of a vector type for the plane tests
+		#if defined(VKX_CULL_AVX)
+		const size_t lanes = 8;
+		typedef __m256 floatN;
+		inline floatN vload(const float *p) { return _mm256_loadu_ps(p); }
+		inline floatN vsplat(float v) { return _mm256_set1_ps(v); }
+		inline floatN vadd(floatN a, floatN b) { return _mm256_add_ps(a, b); }
+		inline floatN vmul(floatN a, floatN b) { return _mm256_mul_ps(a, b); }
+		inline floatN vnegative(floatN a) { return _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_LT_OQ); }
+		inline floatN veither(floatN a, floatN b) { return _mm256_or_ps(a, b); }
+		inline floatN vnone() { return _mm256_setzero_ps(); }
+		inline int vbits(floatN a) { return _mm256_movemask_ps(a); }
+		#elif defined(VKX_CULL_SSE)
+		const size_t lanes = 4;
+		typedef __m128 floatN;
+		inline floatN vload(const float *p) { return _mm_loadu_ps(p); }
+		inline floatN vsplat(float v) { return _mm_set1_ps(v); }
+		inline floatN vadd(floatN a, floatN b) { return _mm_add_ps(a, b); }
+		inline floatN vmul(floatN a, floatN b) { return _mm_mul_ps(a, b); }
+		inline floatN vnegative(floatN a) { return _mm_cmplt_ps(a, _mm_setzero_ps()); }
+		inline floatN veither(floatN a, floatN b) { return _mm_or_ps(a, b); }
+		inline floatN vnone() { return _mm_setzero_ps(); }
+		inline int vbits(floatN a) { return _mm_movemask_ps(a); }
+		#else
+		const size_t lanes = 1;
+		typedef float floatN;
+		inline floatN vload(const float *p) { return *p; }
+		inline floatN vsplat(float v) { return v; }
+		inline floatN vadd(floatN a, floatN b) { return a + b; }
+		inline floatN vmul(floatN a, floatN b) { return a * b; }
+		inline floatN vnegative(floatN a) { return a < 0.0f ? 1.0f : 0.0f; }
+		inline floatN veither(floatN a, floatN b) { return (a != 0.0f || b != 0.0f) ? 1.0f : 0.0f; }
+		inline floatN vnone() { return 0.0f; }
+		inline int vbits(floatN a) { return a != 0.0f ? 1 : 0; }
+		#endif
+
+		// distance of the centers to the plane
+		inline floatN planeDistance(const glm::vec4 &plane, floatN x, floatN y, floatN z) {
+			return vadd(vadd(vmul(vsplat(plane.x), x), vmul(vsplat(plane.y), y)), vadd(vmul(vsplat(plane.z), z), vsplat(plane.w)));
+		}
+
+		inline void writeVisible(int outside, size_t first, size_t count, std::vector<uint8_t> &visible) {
+			for (size_t lane = 0; lane < lanes && first + lane < count; ++lane) {
+				visible[first + lane] = ((outside >> lane) & 1) ? 0 : 1;
+			}
+		}
+
+	}
+
+
+
+	void Frustum::extract(const glm::mat4 &viewProjection, bool nearPlane) {
+		glm::vec4 rows[4];
+		for (int i = 0; i < 4; ++i) {
+			rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+		}
+
+		planes[0] = rows[3] + rows[0];// left
+		planes[1] = rows[3] - rows[0];// right
+		planes[2] = rows[3] + rows[1];// bottom
+		planes[3] = rows[3] - rows[1];// top
+		planes[4] = rows[3] + rows[2];// near, glm::ortho and glm::perspective here are -w..w
+		planes[5] = rows[3] - rows[2];// far
+
+		for (auto &plane : planes) {
+			plane /= glm::length(glm::vec3(plane));
+		}
+
+		// a plane everything is in front of
+		if (!nearPlane) {
+			planes[4] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+		}
+	}
+
+	void transformBounds(const glm::mat4 &matrix, const glm::vec3 &min, const glm::vec3 &max, glm::vec3 &worldMin, glm::vec3 &worldMax) {
+		// Arvo: transform the center, the extent goes through the absolute of the upper 3x3
+		glm::vec3 center = (min + max) * 0.5f;
+		glm::vec3 extent = (max - min) * 0.5f;
+
+		glm::vec3 worldCenter = glm::vec3(matrix * glm::vec4(center, 1.0f));
+		glm::vec3 worldExtent;
+		for (int i = 0; i < 3; ++i) {
+			worldExtent[i] = std::abs(matrix[0][i]) * extent.x + std::abs(matrix[1][i]) * extent.y + std::abs(matrix[2][i]) * extent.z;
+		}
+
+		worldMin = worldCenter - worldExtent;
+		worldMax = worldCenter + worldExtent;
+	}
+
+
+
+	void BoundsList::clear() {
+		centerX.clear();
+		centerY.clear();
+		centerZ.clear();
+		extentX.clear();
+		extentY.clear();
+		extentZ.clear();
+		radius.clear();
+		count = 0;
+	}
+
+	void BoundsList::push(const glm::vec3 &center, const glm::vec3 &extent, float sphereRadius) {
+		if (count % padding == 0) {
+			size_t size = count + padding;
+			centerX.resize(size, 0.0f);
+			centerY.resize(size, 0.0f);
+			centerZ.resize(size, 0.0f);
+			extentX.resize(size, 0.0f);
+			extentY.resize(size, 0.0f);
+			extentZ.resize(size, 0.0f);
+			radius.resize(size, 0.0f);
+		}
+		centerX[count] = center.x;
+		centerY[count] = center.y;
+		centerZ[count] = center.z;
+		extentX[count] = extent.x;
+		extentY[count] = extent.y;
+		extentZ[count] = extent.z;
+		radius[count] = sphereRadius;
+		++count;
+	}
+
+	uint32_t BoundsList::add(const glm::vec3 &min, const glm::vec3 &max) {
+		glm::vec3 extent = (max - min) * 0.5f;
+		push((min + max) * 0.5f, extent, glm::length(extent));
+		return (uint32_t)(count - 1);
+	}
+
+	uint32_t BoundsList::addSphere(const glm::vec3 &center, float sphereRadius) {
+		push(center, glm::vec3(sphereRadius), sphereRadius);
+		return (uint32_t)(count - 1);
+	}
+
+	void BoundsList::get(size_t i, glm::vec3 &min, glm::vec3 &max) const {
+		glm::vec3 center(centerX[i], centerY[i], centerZ[i]);
+		glm::vec3 extent(extentX[i], extentY[i], extentZ[i]);
+		min = center - extent;
+		max = center + extent;
+	}
+
+	void BoundsList::cullBoxes(const Frustum &frustum, std::vector<uint8_t> &visible) const {
+
+		visible.resize(count);
+
+		// the plane normals' absolutes, for projecting the extents onto them
+		glm::vec3 absNormals[6];
+		for (int p = 0; p < 6; ++p) {
+			absNormals[p] = glm::abs(glm::vec3(frustum.planes[p]));
+		}
+
+		for (size_t i = 0; i < count; i += lanes) {
+			floatN x = vload(&centerX[i]);
+			floatN y = vload(&centerY[i]);
+			floatN z = vload(&centerZ[i]);
+			floatN ex = vload(&extentX[i]);
+			floatN ey = vload(&extentY[i]);
+			floatN ez = vload(&extentZ[i]);
+
+			// outside if it's completely behind any plane
+			floatN outside = vnone();
+			for (int p = 0; p < 6; ++p) {
+				floatN distance = planeDistance(frustum.planes[p], x, y, z);
+				floatN projected = vadd(vadd(vmul(vsplat(absNormals[p].x), ex), vmul(vsplat(absNormals[p].y), ey)), vmul(vsplat(absNormals[p].z), ez));
+				outside = veither(outside, vnegative(vadd(distance, projected)));
+			}
+
+			writeVisible(vbits(outside), i, count, visible);
+		}
+	}
+
+	void BoundsList::cullSpheres(const Frustum &frustum, std::vector<uint8_t> &visible) const {
+
+		visible.resize(count);
+
+		for (size_t i = 0; i < count; i += lanes) {
+			floatN x = vload(&centerX[i]);
+			floatN y = vload(&centerY[i]);
+			floatN z = vload(&centerZ[i]);
+			floatN r = vload(&radius[i]);
+
+			floatN outside = vnone();
+			for (int p = 0; p < 6; ++p) {
+				outside = veither(outside, vnegative(vadd(planeDistance(frustum.planes[p], x, y, z), r)));
+			}
+
+			writeVisible(vbits(outside), i, count, visible);
+		}
+	}
+
+}
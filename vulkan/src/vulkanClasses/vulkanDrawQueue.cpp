@@ -0,0 +1,88 @@
+#include "vulkanDrawQueue.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace vkx {
+
+	uint64_t packDrawKey(float depth, uint32_t material, uint32_t mesh) {
+
+		const uint64_t fieldMax = (1ull << DRAW_KEY_FIELD_BITS) - 1;
+
+		// the band and where in it the depth is, [0, 1)
+		float d = std::max(depth, 0.0f);
+		uint32_t band = 0;
+		float fraction = d * 0.5f;
+		if (d >= 2.0f) {
+			int exponent;
+			float mantissa = std::frexp(d, &exponent);
+			band = (uint32_t)(exponent - 1);
+			fraction = mantissa * 2.0f - 1.0f;
+		}
+		if (band >= DRAW_KEY_DEPTH_BANDS) {
+			band = DRAW_KEY_DEPTH_BANDS - 1;
+			fraction = 1.0f;
+		}
+
+		uint64_t fine = std::min((uint64_t)(fraction * fieldMax), fieldMax);
+
+		return ((uint64_t)band << (3 * DRAW_KEY_FIELD_BITS))
+			| (std::min((uint64_t)material, fieldMax) << (2 * DRAW_KEY_FIELD_BITS))
+			| (std::min((uint64_t)mesh, fieldMax) << DRAW_KEY_FIELD_BITS)
+			| fine;
+	}
+
+	void radixSort(DrawKey *keys, size_t count, std::vector<DrawKey> &scratch) {
+
+		if (count < DRAW_KEY_RADIX_MIN) {
+			for (size_t i = 1; i < count; ++i) {
+				DrawKey key = keys[i];
+				size_t j = i;
+				for (; j > 0 && keys[j - 1].key > key.key; --j) {
+					keys[j] = keys[j - 1];
+				}
+				keys[j] = key;
+			}
+			return;
+		}
+
+		// every byte's histogram in one pass over the keys
+		uint32_t histograms[8][256] = {};
+		for (size_t i = 0; i < count; ++i) {
+			uint64_t key = keys[i].key;
+			for (uint32_t byte = 0; byte < 8; ++byte) {
+				histograms[byte][(key >> (byte * 8)) & 0xff]++;
+			}
+		}
+
+		scratch.resize(count);
+		DrawKey *from = keys;
+		DrawKey *to = scratch.data();
+		for (uint32_t byte = 0; byte < 8; ++byte) {
+			uint32_t *histogram = histograms[byte];
+			uint32_t shift = byte * 8;
+
+			// every key has the same byte, they'd stay where they are
+			if (histogram[(from[0].key >> shift) & 0xff] == count) {
+				continue;
+			}
+
+			uint32_t offset = 0;
+			for (uint32_t digit = 0; digit < 256; ++digit) {
+				uint32_t digitCount = histogram[digit];
+				histogram[digit] = offset;
+				offset += digitCount;
+			}
+			for (size_t i = 0; i < count; ++i) {
+				to[histogram[(from[i].key >> shift) & 0xff]++] = from[i];
+			}
+			std::swap(from, to);
+		}
+
+		if (from != keys) {
+			std::copy(from, from + count, keys);
+		}
+	}
+
+}
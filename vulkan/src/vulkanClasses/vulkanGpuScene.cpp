@@ -0,0 +1,517 @@
+#include "vulkanGpuScene.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "vulkanCulling.h"
+
+
+namespace vkx {
+
+	bool GpuScene::prepare(uint32_t frames, uint32_t vertexSize, vk::DescriptorSetLayout instanceSetLayout, const vkx::HiZ &hiZ, const std::string &shaderPath) {
+
+		// one draw per instance slot, the instance comes in through firstInstance
+		if (!context.deviceFeatures.multiDrawIndirect || !context.deviceFeatures.drawIndirectFirstInstance) {
+			return false;
+		}
+
+		vk::PipelineShaderStageCreateInfo cullStage;
+		try {
+			cullStage = context.loadShader(shaderPath + "gpuCull.comp.spv", vk::ShaderStageFlagBits::eCompute);
+		} catch (std::exception &) {
+			return false;
+		}
+
+		this->vertexSize = vertexSize;
+		this->instanceSetLayout = instanceSetLayout;
+		this->hiZ = &hiZ;
+
+		// the shader always has a pyramid bound, a 1x1 one when there's no hi-z (it's never tested then)
+		if (!hiZ.ready()) {
+			vk::ImageCreateInfo imageCreateInfo;
+			imageCreateInfo.imageType = vk::ImageType::e2D;
+			imageCreateInfo.format = vk::Format::eR32Sfloat;
+			imageCreateInfo.extent = vk::Extent3D{ 1, 1, 1 };
+			imageCreateInfo.mipLevels = 1;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+			imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+			imageCreateInfo.usage = vk::ImageUsageFlagBits::eSampled;
+			imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+			emptyPyramid = context.createImage(imageCreateInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+			vk::ImageViewCreateInfo view;
+			view.viewType = vk::ImageViewType::e2D;
+			view.format = imageCreateInfo.format;
+			view.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+			view.image = emptyPyramid.image;
+			emptyPyramid.view = context.device.createImageView(view);
+			emptyPyramid.sampler = context.device.createSampler(vk::SamplerCreateInfo());
+
+			context.withPrimaryCommandBuffer([&](const vk::CommandBuffer &cmdBuffer) {
+				setImageLayout(cmdBuffer, emptyPyramid.image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, view.subresourceRange);
+			});
+		}
+
+
+		// descriptor sets
+		{
+			std::vector<vk::DescriptorSetLayoutBinding> cullBindings = {
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eUniformBuffer, vk::ShaderStageFlagBits::eCompute, 0),
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 1),
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 2),
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 3),
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 4),
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eCompute, 5),
+			};
+			cullSetLayout = context.device.createDescriptorSetLayout(vkx::descriptorSetLayoutCreateInfo(cullBindings));
+
+			// per frame: the cull set, the instance set
+			std::vector<vk::DescriptorPoolSize> poolSizes = {
+				vkx::descriptorPoolSize(vk::DescriptorType::eUniformBuffer, frames),
+				vkx::descriptorPoolSize(vk::DescriptorType::eStorageBuffer, 5 * frames),
+				vkx::descriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, frames),
+			};
+			descriptorPool = context.device.createDescriptorPool(vkx::descriptorPoolCreateInfo(poolSizes, 2 * frames));
+		}
+
+
+		// pipeline
+		{
+			vk::PushConstantRange pushConstantRange = vkx::pushConstantRange(vk::ShaderStageFlagBits::eCompute, sizeof(uint32_t), 0);
+			vk::PipelineLayoutCreateInfo layoutInfo = vkx::pipelineLayoutCreateInfo(&cullSetLayout, 1);
+			layoutInfo.pushConstantRangeCount = 1;
+			layoutInfo.pPushConstantRanges = &pushConstantRange;
+			cullLayout = context.device.createPipelineLayout(layoutInfo);
+
+			vk::ComputePipelineCreateInfo pipelineInfo;
+			pipelineInfo.layout = cullLayout;
+			pipelineInfo.stage = cullStage;
+			cullPipeline = context.device.createComputePipeline(context.pipelineCache, pipelineInfo);
+		}
+
+
+		// per frame buffers, they grow with the scene
+		frameResources.resize(frames);
+		for (auto &resources : frameResources) {
+			resources.uniforms = context.createBuffer(vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent, sizeof(CullUniforms));
+			resources.uniforms.map();
+			resources.cullSet = context.device.allocateDescriptorSets(vkx::descriptorSetAllocateInfo(descriptorPool, &cullSetLayout, 1))[0];
+			resources.instanceSet = context.device.allocateDescriptorSets(vkx::descriptorSetAllocateInfo(descriptorPool, &this->instanceSetLayout, 1))[0];
+			reserveFrame(resources);
+		}
+
+		return true;
+	}
+
+	void GpuScene::destroy() {
+		if (!cullPipeline) {
+			return;
+		}
+		context.device.destroyPipeline(cullPipeline);
+		context.device.destroyPipelineLayout(cullLayout);
+		context.device.destroyDescriptorPool(descriptorPool);
+		context.device.destroyDescriptorSetLayout(cullSetLayout);
+		cullPipeline = vk::Pipeline();
+
+		for (auto &resources : frameResources) {
+			resources.instances.destroy();
+			resources.uniforms.destroy();
+			resources.commands.destroy();
+			resources.counts.destroy();
+			resources.flags.destroy();
+		}
+		frameResources.clear();
+
+		vertices.destroy();
+		indices.destroy();
+		if (emptyPyramid.image) {
+			emptyPyramid.destroy();
+		}
+		meshes.clear();
+	}
+
+
+
+	/* CPU */
+
+	void GpuScene::begin(uint32_t frame) {
+		this->frame = frame;
+		instanceData.clear();
+		pending.clear();
+		for (auto &segment : segmentList) {
+			segment.count = 0;
+		}
+		dropDeadMeshes();
+	}
+
+	void GpuScene::add(const glm::mat4 &matrix, const std::shared_ptr<vkx::MeshBuffer> &mesh) {
+		auto it = meshes.find(mesh.get());
+		const MeshRange &range = it != meshes.end() ? it->second : addMesh(mesh);
+
+		auto segmentIt = segmentIndices.find(mesh->materialId);
+		uint32_t segmentIndex;
+		if (segmentIt != segmentIndices.end()) {
+			segmentIndex = segmentIt->second;
+		} else {
+			segmentIndex = (uint32_t)segmentList.size();
+			segmentIndices[mesh->materialId] = segmentIndex;
+			segmentList.push_back({ mesh->materialId, 0, 0, 0 });
+		}
+		Segment &segment = segmentList[segmentIndex];
+
+		// the slot is relative to the segment until end() knows where the segments are
+		InstanceData instance;
+		instance.matrix = matrix;
+		instance.boundsMin = glm::vec4(mesh->boundsMin, 1.0f);
+		instance.boundsMax = glm::vec4(mesh->boundsMax, 1.0f);
+		instance.draw = glm::uvec4(range.indexCount, range.firstIndex, range.vertexOffset, segment.count++);
+		instance.segment = glm::uvec4(segmentIndex, 0, 0, 0);
+		instanceData.push_back(instance);
+	}
+
+	void GpuScene::end() {
+		FrameResources &resources = frameResources[frame];
+
+		// the meshes seen for the first time, from their own buffers into the shared ones
+		if (!pending.empty()) {
+			reserveGeometry(false);
+			context.withPrimaryCommandBuffer([&](const vk::CommandBuffer &cmdBuffer) {
+				for (const vkx::MeshBuffer *mesh : pending) {
+					const MeshRange &range = meshes[mesh];
+					if (range.vertexCount) {
+						cmdBuffer.copyBuffer(mesh->vertices.buffer, vertices.buffer, vk::BufferCopy(0, (vk::DeviceSize)range.vertexOffset * vertexSize, (vk::DeviceSize)range.vertexCount * vertexSize));
+					}
+					if (range.indexCount) {
+						cmdBuffer.copyBuffer(mesh->indices.buffer, indices.buffer, vk::BufferCopy(0, (vk::DeviceSize)range.firstIndex * sizeof(uint32_t), (vk::DeviceSize)range.indexCount * sizeof(uint32_t)));
+					}
+				}
+			});
+			pending.clear();
+		}
+
+		layoutSegments();
+
+		for (auto &instance : instanceData) {
+			const Segment &segment = segmentList[instance.segment.x];
+			instance.segment.y = segment.first;
+			instance.draw.w += segment.first;
+		}
+
+		resources.instanceCount = (uint32_t)instanceData.size();
+		resources.segmentCount = (uint32_t)segmentList.size();
+		reserveFrame(resources);
+		if (!instanceData.empty()) {
+			memcpy(resources.instances.mapped, instanceData.data(), instanceData.size() * sizeof(InstanceData));
+		}
+	}
+
+	void GpuScene::readback(uint32_t frame) {
+		FrameResources &resources = frameResources[frame];
+		if (!resources.culled) {
+			return;
+		}
+		resources.culled = false;
+
+		const uint32_t *counts = (const uint32_t*)resources.counts.mapped;
+		instances = resources.instanceCount;
+		drawn = counts[2 * resources.segmentCount];
+		drawnLate = counts[2 * resources.segmentCount + 1];
+		uniqueMeshes = (uint32_t)meshes.size();
+	}
+
+	uint64_t GpuScene::signature(uint32_t frame) const {
+		const FrameResources &resources = frameResources[frame];
+		// versions rather than buffer handles, a new buffer can get the handle of one destroyed before it
+		uint64_t state[] = {
+			layoutVersion,
+			resources.version,
+		};
+		return vkx::hash64(state, sizeof(state));
+	}
+
+	GpuScene::MeshRange &GpuScene::addMesh(const std::shared_ptr<vkx::MeshBuffer> &mesh) {
+		MeshRange &range = meshes[mesh.get()];
+		range.mesh = mesh;
+		range.indexCount = mesh->indexCount;
+		range.firstIndex = indicesUsed;
+		range.vertexOffset = verticesUsed;
+		range.vertexCount = (uint32_t)(mesh->vertices.size / vertexSize);
+		indicesUsed += range.indexCount;
+		verticesUsed += range.vertexCount;
+		verticesLive += range.vertexCount;
+		pending.push_back(mesh.get());
+		return range;
+	}
+
+	void GpuScene::dropDeadMeshes() {
+		for (auto it = meshes.begin(); it != meshes.end();) {
+			if (it->second.mesh.expired()) {
+				verticesLive -= it->second.vertexCount;
+				it = meshes.erase(it);
+			} else {
+				++it;
+			}
+		}
+		if (verticesUsed - verticesLive > verticesLive) {
+			reserveGeometry(true);
+		}
+	}
+
+	// grows the shared buffers until what's used fits, or moves the live meshes together into new ones
+	void GpuScene::reserveGeometry(bool compactDead) {
+		if (!compactDead && verticesUsed <= vertexCapacity && indicesUsed <= indexCapacity) {
+			return;
+		}
+
+		std::vector<vk::BufferCopy> vertexCopies;
+		std::vector<vk::BufferCopy> indexCopies;
+		uint32_t newVertexCapacity;
+		uint32_t newIndexCapacity;
+		if (compactDead) {
+			uint32_t vertexTotal = 0;
+			uint32_t indexTotal = 0;
+			for (auto &entry : meshes) {
+				MeshRange &range = entry.second;
+				if (range.vertexCount) {
+					vertexCopies.push_back(vk::BufferCopy((vk::DeviceSize)range.vertexOffset * vertexSize, (vk::DeviceSize)vertexTotal * vertexSize, (vk::DeviceSize)range.vertexCount * vertexSize));
+				}
+				if (range.indexCount) {
+					indexCopies.push_back(vk::BufferCopy((vk::DeviceSize)range.firstIndex * sizeof(uint32_t), (vk::DeviceSize)indexTotal * sizeof(uint32_t), (vk::DeviceSize)range.indexCount * sizeof(uint32_t)));
+				}
+				range.vertexOffset = vertexTotal;
+				range.firstIndex = indexTotal;
+				vertexTotal += range.vertexCount;
+				indexTotal += range.indexCount;
+			}
+			verticesUsed = vertexTotal;
+			indicesUsed = indexTotal;
+			newVertexCapacity = std::max<uint32_t>(GPU_SCENE_MIN_VERTICES, verticesUsed * 2);
+			newIndexCapacity = std::max<uint32_t>(GPU_SCENE_MIN_INDICES, indicesUsed * 2);
+		} else {
+			// everything the old buffers hold, the new meshes are copied in afterwards
+			if (vertexCapacity) {
+				vertexCopies.push_back(vk::BufferCopy(0, 0, (vk::DeviceSize)vertexCapacity * vertexSize));
+				indexCopies.push_back(vk::BufferCopy(0, 0, (vk::DeviceSize)indexCapacity * sizeof(uint32_t)));
+			}
+			newVertexCapacity = std::max<uint32_t>({ GPU_SCENE_MIN_VERTICES, vertexCapacity, verticesUsed * 2 });
+			newIndexCapacity = std::max<uint32_t>({ GPU_SCENE_MIN_INDICES, indexCapacity, indicesUsed * 2 });
+		}
+
+		vk::BufferUsageFlags transfer = vk::BufferUsageFlagBits::eTransferSrc | vk::BufferUsageFlagBits::eTransferDst;
+		vkx::CreateBufferResult newVertices = context.createBuffer(vk::BufferUsageFlagBits::eVertexBuffer | transfer, vk::MemoryPropertyFlagBits::eDeviceLocal, (vk::DeviceSize)newVertexCapacity * vertexSize);
+		vkx::CreateBufferResult newIndices = context.createBuffer(vk::BufferUsageFlagBits::eIndexBuffer | transfer, vk::MemoryPropertyFlagBits::eDeviceLocal, (vk::DeviceSize)newIndexCapacity * sizeof(uint32_t));
+
+		// waits for the device, the frames in flight are done with the old buffers after it
+		context.withPrimaryCommandBuffer([&](const vk::CommandBuffer &cmdBuffer) {
+			if (!vertexCopies.empty()) {
+				cmdBuffer.copyBuffer(vertices.buffer, newVertices.buffer, vertexCopies);
+			}
+			if (!indexCopies.empty()) {
+				cmdBuffer.copyBuffer(indices.buffer, newIndices.buffer, indexCopies);
+			}
+		});
+		vertices.destroy();
+		indices.destroy();
+		vertices = newVertices;
+		indices = newIndices;
+		vertexCapacity = newVertexCapacity;
+		indexCapacity = newIndexCapacity;
+		layoutVersion++;
+	}
+
+	// the segments that outgrew their room get twice what they need, everything is laid out again then
+	void GpuScene::layoutSegments() {
+		bool grown = false;
+		for (auto &segment : segmentList) {
+			if (segment.count > segment.capacity) {
+				uint32_t capacity = GPU_SCENE_MIN_SEGMENT;
+				while (capacity < segment.count) {
+					capacity *= 2;
+				}
+				segment.capacity = capacity;
+				grown = true;
+			}
+		}
+		if (!grown) {
+			return;
+		}
+
+		commandCapacity = 0;
+		for (auto &segment : segmentList) {
+			segment.first = commandCapacity;
+			commandCapacity += segment.capacity;
+		}
+		layoutVersion++;
+	}
+
+	void GpuScene::reserveFrame(FrameResources &resources) {
+		bool changed = false;
+		vk::MemoryPropertyFlags hostFlags = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+		vk::BufferUsageFlags indirect = vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst;
+
+		if (!resources.instances.buffer || resources.instanceCapacity < resources.instanceCount) {
+			uint32_t capacity = std::max<uint32_t>(GPU_SCENE_MIN_INSTANCES, resources.instanceCapacity);
+			while (capacity < resources.instanceCount) {
+				capacity *= 2;
+			}
+			resources.instances.destroy();
+			resources.flags.destroy();
+			resources.instances = context.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostFlags, capacity * sizeof(InstanceData));
+			resources.instances.map();
+			resources.flags = context.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, capacity * sizeof(uint32_t));
+			resources.instanceCapacity = capacity;
+			changed = true;
+		}
+
+		// both phases
+		if (!resources.commands.buffer || resources.commandCapacity < commandCapacity) {
+			resources.commands.destroy();
+			resources.commandCapacity = std::max<uint32_t>(GPU_SCENE_MIN_SEGMENT, commandCapacity);
+			resources.commands = context.createBuffer(indirect, vk::MemoryPropertyFlagBits::eDeviceLocal, 2 * resources.commandCapacity * sizeof(vk::DrawIndexedIndirectCommand));
+			changed = true;
+		}
+
+		// both phases, then the stats
+		uint32_t countsNeeded = 2 * (uint32_t)segmentList.size() + 2;
+		if (!resources.counts.buffer || resources.countCapacity < countsNeeded) {
+			resources.counts.destroy();
+			resources.countCapacity = std::max<uint32_t>(64, countsNeeded * 2);
+			resources.counts = context.createBuffer(indirect, hostFlags, resources.countCapacity * sizeof(uint32_t));
+			resources.counts.map();
+			changed = true;
+		}
+
+		if (changed) {
+			resources.version++;
+			updateDescriptorSets(resources);
+		}
+	}
+
+	void GpuScene::updateDescriptorSets(FrameResources &resources) {
+		vk::DescriptorImageInfo pyramid = hiZ->ready() ? hiZ->pyramidDescriptor() : vkx::descriptorImageInfo(emptyPyramid.sampler, emptyPyramid.view, vk::ImageLayout::eGeneral);
+
+		std::vector<vk::WriteDescriptorSet> writes = {
+			vkx::writeDescriptorSet(resources.cullSet, vk::DescriptorType::eUniformBuffer, 0, &resources.uniforms.descriptor),
+			vkx::writeDescriptorSet(resources.cullSet, vk::DescriptorType::eStorageBuffer, 1, &resources.instances.descriptor),
+			vkx::writeDescriptorSet(resources.cullSet, vk::DescriptorType::eStorageBuffer, 2, &resources.commands.descriptor),
+			vkx::writeDescriptorSet(resources.cullSet, vk::DescriptorType::eStorageBuffer, 3, &resources.counts.descriptor),
+			vkx::writeDescriptorSet(resources.cullSet, vk::DescriptorType::eStorageBuffer, 4, &resources.flags.descriptor),
+			vkx::writeDescriptorSet(resources.cullSet, vk::DescriptorType::eCombinedImageSampler, 5, &pyramid),
+			vkx::writeDescriptorSet(resources.instanceSet, vk::DescriptorType::eStorageBuffer, 0, &resources.instances.descriptor),
+		};
+		context.device.updateDescriptorSets(writes, {});
+	}
+
+
+
+	/* GPU */
+
+	void GpuScene::record(vk::CommandBuffer cmdBuffer, uint32_t frame, const glm::mat4 &viewProjection, bool frustum, bool occlusion) {
+		FrameResources &resources = frameResources[frame];
+		this->viewProjection = viewProjection;
+
+		CullUniforms uniforms;
+		if (frustum) {
+			vkx::Frustum planes;
+			planes.extract(viewProjection);
+			std::copy(planes.planes, planes.planes + 6, uniforms.planes);
+		} else {
+			std::fill(uniforms.planes, uniforms.planes + 6, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		}
+		uniforms.viewProjection = viewProjection;
+		uniforms.pyramidViewProjection = pyramidViewProjection;
+		uniforms.depthSize = hiZ->ready() ? hiZ->size() : glm::uvec2(1);
+		uniforms.levels = hiZ->ready() ? hiZ->levelCount() : 0;
+		uniforms.count = resources.instanceCount;
+		uniforms.commandCapacity = commandCapacity;
+		uniforms.segmentCount = resources.segmentCount;
+		uniforms.compact = compact() ? 1 : 0;
+		uniforms.testLastPyramid = (occlusion && pyramidValid && hiZ->ready()) ? 1 : 0;
+		memcpy(resources.uniforms.mapped, &uniforms, sizeof(uniforms));
+
+		// without a late pass this frame the next one has no pyramid to go by
+		if (!occlusion) {
+			pyramidValid = false;
+		}
+
+		// the frame's fence has been waited on, nothing reads the last draws anymore
+		cmdBuffer.fillBuffer(resources.counts.buffer, 0, VK_WHOLE_SIZE, 0);
+		if (!compact()) {
+			cmdBuffer.fillBuffer(resources.commands.buffer, 0, VK_WHOLE_SIZE, 0);
+		}
+		vk::MemoryBarrier barrier;
+		barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+		cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), barrier, nullptr, nullptr);
+
+		if (resources.instanceCount) {
+			uint32_t phase = 0;
+			cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline);
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullLayout, 0, resources.cullSet, nullptr);
+			cmdBuffer.pushConstants(cullLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(phase), &phase);
+			cmdBuffer.dispatch((resources.instanceCount + 63) / 64, 1, 1);
+		}
+
+		// drawn by the g-buffer pass, the flags are read by phase 1, the stats by readback()
+		barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eHostRead;
+		cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), barrier, nullptr, nullptr);
+
+		resources.culled = true;
+	}
+
+	void GpuScene::recordLate(vk::CommandBuffer cmdBuffer, uint32_t frame) {
+		FrameResources &resources = frameResources[frame];
+
+		// the next frame's phase 0 tests the pyramid that was just built
+		pyramidViewProjection = viewProjection;
+		pyramidValid = true;
+
+		if (!resources.instanceCount) {
+			return;
+		}
+
+		// the pyramid's build leaves it readable by compute shaders
+		uint32_t phase = 1;
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline);
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullLayout, 0, resources.cullSet, nullptr);
+		cmdBuffer.pushConstants(cullLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(phase), &phase);
+		cmdBuffer.dispatch((resources.instanceCount + 63) / 64, 1, 1);
+
+		vk::MemoryBarrier barrier;
+		barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eHostRead;
+		cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), barrier, nullptr, nullptr);
+	}
+
+	void GpuScene::bind(vk::CommandBuffer cmdBuffer, uint32_t frame, uint32_t vertexBufferBinding, vk::PipelineLayout layout) const {
+		if (!vertices.buffer) {
+			return;
+		}
+		cmdBuffer.bindVertexBuffers(vertexBufferBinding, vertices.buffer, vk::DeviceSize());
+		cmdBuffer.bindIndexBuffer(indices.buffer, 0, vk::IndexType::eUint32);
+		cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 1, frameResources[frame].instanceSet, nullptr);
+	}
+
+	void GpuScene::draw(vk::CommandBuffer cmdBuffer, uint32_t frame, uint32_t phase, uint32_t segment) const {
+		const FrameResources &resources = frameResources[frame];
+		const Segment &drawn = segmentList[segment];
+		uint32_t stride = sizeof(vk::DrawIndexedIndirectCommand);
+		vk::DeviceSize offset = ((vk::DeviceSize)phase * commandCapacity + drawn.first) * stride;
+
+		if (compact()) {
+			vk::DeviceSize countOffset = ((vk::DeviceSize)phase * resources.segmentCount + segment) * sizeof(uint32_t);
+			context.cmdDrawIndexedIndirectCount((VkCommandBuffer)cmdBuffer, (VkBuffer)resources.commands.buffer, offset, (VkBuffer)resources.counts.buffer, countOffset, drawn.capacity, stride);
+			return;
+		}
+
+		// the whole segment, the empty slots draw nothing
+		uint32_t maxDraws = context.deviceProperties.limits.maxDrawIndirectCount;
+		for (uint32_t first = 0; first < drawn.capacity; first += maxDraws) {
+			uint32_t count = std::min(maxDraws, drawn.capacity - first);
+			cmdBuffer.drawIndexedIndirect(resources.commands.buffer, offset + (vk::DeviceSize)first * stride, count, stride);
+		}
+	}
+
+}
@@ -0,0 +1,389 @@
+#include "vulkanHiZ.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+
+namespace vkx {
+
+	bool HiZ::prepare(vk::ImageView depth, vk::ImageLayout depthLayout, glm::uvec2 depthSize, uint32_t frames, const std::string &shaderPath) {
+
+		vk::PipelineShaderStageCreateInfo buildStage;
+		vk::PipelineShaderStageCreateInfo testStage;
+		try {
+			buildStage = context.loadShader(shaderPath + "hizBuild.comp.spv", vk::ShaderStageFlagBits::eCompute);
+			testStage = context.loadShader(shaderPath + "hizTest.comp.spv", vk::ShaderStageFlagBits::eCompute);
+		} catch (std::exception &) {
+			return false;
+		}
+
+		this->depthSize = depthSize;
+
+		// level 0 is half the depth's size (rounded up), down to 1x1
+		levelSizes.clear();
+		glm::uvec2 size = (depthSize + 1u) / 2u;
+		levelSizes.push_back(size);
+		while (size.x > 1 || size.y > 1) {
+			size = (size + 1u) / 2u;
+			levelSizes.push_back(size);
+		}
+		levels = (uint32_t)levelSizes.size();
+
+		firstReadbackLevel = 0;
+		while (firstReadbackLevel + 1 < levels && levelSizes[firstReadbackLevel].x > HIZ_READBACK_WIDTH) {
+			++firstReadbackLevel;
+		}
+		readbackOffsets.clear();
+		readbackFloats = 0;
+		for (uint32_t level = firstReadbackLevel; level < levels; ++level) {
+			readbackOffsets.push_back(readbackFloats);
+			readbackFloats += levelSizes[level].x * levelSizes[level].y;
+		}
+
+
+		// pyramid
+		{
+			vk::ImageCreateInfo imageCreateInfo;
+			imageCreateInfo.imageType = vk::ImageType::e2D;
+			imageCreateInfo.format = vk::Format::eR32Sfloat;
+			imageCreateInfo.extent = vk::Extent3D{ levelSizes[0].x, levelSizes[0].y, 1 };
+			imageCreateInfo.mipLevels = levels;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+			imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+			imageCreateInfo.usage = vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferSrc;
+			imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+			pyramid = context.createImage(imageCreateInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+			vk::ImageViewCreateInfo view;
+			view.viewType = vk::ImageViewType::e2D;
+			view.format = imageCreateInfo.format;
+			view.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1 };
+			view.image = pyramid.image;
+			pyramid.view = context.device.createImageView(view);
+
+			levelViews.clear();
+			for (uint32_t level = 0; level < levels; ++level) {
+				view.subresourceRange = { vk::ImageAspectFlagBits::eColor, level, 1, 0, 1 };
+				levelViews.push_back(context.device.createImageView(view));
+			}
+
+			// the shaders fetch texels, nothing is filtered
+			vk::SamplerCreateInfo samplerInfo;
+			samplerInfo.magFilter = vk::Filter::eNearest;
+			samplerInfo.minFilter = vk::Filter::eNearest;
+			samplerInfo.mipmapMode = vk::SamplerMipmapMode::eNearest;
+			samplerInfo.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+			samplerInfo.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+			samplerInfo.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+			samplerInfo.maxLod = (float)levels;
+			samplerInfo.borderColor = vk::BorderColor::eFloatOpaqueWhite;
+			sampler = context.device.createSampler(samplerInfo);
+
+			context.withPrimaryCommandBuffer([&](const vk::CommandBuffer &cmdBuffer) {
+				vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1);
+				setImageLayout(cmdBuffer, pyramid.image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined, vk::ImageLayout::eGeneral, range);
+			});
+		}
+
+
+		// per frame buffers, persistently mapped
+		vk::MemoryPropertyFlags hostFlags = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+		candidateBuffers.resize(frames);
+		drawBuffers.resize(frames);
+		readbacks.resize(frames);
+		for (uint32_t frame = 0; frame < frames; ++frame) {
+			candidateBuffers[frame] = context.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostFlags, HIZ_MAX_CANDIDATES * sizeof(Candidate));
+			candidateBuffers[frame].map();
+			drawBuffers[frame] = context.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer, hostFlags, HIZ_MAX_CANDIDATES * sizeof(vk::DrawIndexedIndirectCommand));
+			drawBuffers[frame].map();
+			readbacks[frame] = context.createBuffer(vk::BufferUsageFlagBits::eTransferDst, hostFlags, readbackFloats * sizeof(float));
+			readbacks[frame].map();
+		}
+		candidateCounts.assign(frames, 0);
+		viewProjections.assign(frames, glm::mat4());
+		built.assign(frames, 0);
+		cpuValid = false;
+
+
+		// descriptor sets
+		{
+			std::vector<vk::DescriptorSetLayoutBinding> buildBindings = {
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eCompute, 0),
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eStorageImage, vk::ShaderStageFlagBits::eCompute, 1),
+			};
+			buildSetLayout = context.device.createDescriptorSetLayout(vkx::descriptorSetLayoutCreateInfo(buildBindings));
+
+			std::vector<vk::DescriptorSetLayoutBinding> testBindings = {
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eCompute, 0),
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 1),
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eCompute, 2),
+			};
+			testSetLayout = context.device.createDescriptorSetLayout(vkx::descriptorSetLayoutCreateInfo(testBindings));
+
+			std::vector<vk::DescriptorPoolSize> poolSizes = {
+				vkx::descriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, levels + frames),
+				vkx::descriptorPoolSize(vk::DescriptorType::eStorageImage, levels),
+				vkx::descriptorPoolSize(vk::DescriptorType::eStorageBuffer, 2 * frames),
+			};
+			descriptorPool = context.device.createDescriptorPool(vkx::descriptorPoolCreateInfo(poolSizes, levels + frames));
+
+			std::vector<vk::WriteDescriptorSet> writes;
+			std::vector<vk::DescriptorImageInfo> imageInfos;
+			imageInfos.reserve(2 * levels + frames);
+
+			buildSets.clear();
+			for (uint32_t level = 0; level < levels; ++level) {
+				vk::DescriptorSet set = context.device.allocateDescriptorSets(vkx::descriptorSetAllocateInfo(descriptorPool, &buildSetLayout, 1))[0];
+				buildSets.push_back(set);
+
+				// level 0 is made from the depth, the others from the level before
+				if (level == 0) {
+					imageInfos.push_back(vkx::descriptorImageInfo(sampler, depth, depthLayout));
+				} else {
+					imageInfos.push_back(vkx::descriptorImageInfo(sampler, levelViews[level - 1], vk::ImageLayout::eGeneral));
+				}
+				writes.push_back(vkx::writeDescriptorSet(set, vk::DescriptorType::eCombinedImageSampler, 0, &imageInfos.back()));
+				imageInfos.push_back(vkx::descriptorImageInfo(vk::Sampler(), levelViews[level], vk::ImageLayout::eGeneral));
+				writes.push_back(vkx::writeDescriptorSet(set, vk::DescriptorType::eStorageImage, 1, &imageInfos.back()));
+			}
+
+			testSets.clear();
+			for (uint32_t frame = 0; frame < frames; ++frame) {
+				vk::DescriptorSet set = context.device.allocateDescriptorSets(vkx::descriptorSetAllocateInfo(descriptorPool, &testSetLayout, 1))[0];
+				testSets.push_back(set);
+
+				imageInfos.push_back(vkx::descriptorImageInfo(sampler, pyramid.view, vk::ImageLayout::eGeneral));
+				writes.push_back(vkx::writeDescriptorSet(set, vk::DescriptorType::eCombinedImageSampler, 0, &imageInfos.back()));
+				writes.push_back(vkx::writeDescriptorSet(set, vk::DescriptorType::eStorageBuffer, 1, &candidateBuffers[frame].descriptor));
+				writes.push_back(vkx::writeDescriptorSet(set, vk::DescriptorType::eStorageBuffer, 2, &drawBuffers[frame].descriptor));
+			}
+			context.device.updateDescriptorSets(writes, {});
+		}
+
+
+		// pipelines
+		{
+			buildLayout = context.device.createPipelineLayout(vkx::pipelineLayoutCreateInfo(&buildSetLayout, 1));
+
+			vk::PushConstantRange pushConstantRange = vkx::pushConstantRange(vk::ShaderStageFlagBits::eCompute, sizeof(RetestConstants), 0);
+			vk::PipelineLayoutCreateInfo testLayoutInfo = vkx::pipelineLayoutCreateInfo(&testSetLayout, 1);
+			testLayoutInfo.pushConstantRangeCount = 1;
+			testLayoutInfo.pPushConstantRanges = &pushConstantRange;
+			testLayout = context.device.createPipelineLayout(testLayoutInfo);
+
+			vk::ComputePipelineCreateInfo pipelineInfo;
+			pipelineInfo.layout = buildLayout;
+			pipelineInfo.stage = buildStage;
+			buildPipeline = context.device.createComputePipeline(context.pipelineCache, pipelineInfo);
+
+			pipelineInfo.layout = testLayout;
+			pipelineInfo.stage = testStage;
+			testPipeline = context.device.createComputePipeline(context.pipelineCache, pipelineInfo);
+		}
+
+		return true;
+	}
+
+	void HiZ::destroy() {
+		if (!buildPipeline) {
+			return;
+		}
+		context.device.destroyPipeline(buildPipeline);
+		context.device.destroyPipeline(testPipeline);
+		context.device.destroyPipelineLayout(buildLayout);
+		context.device.destroyPipelineLayout(testLayout);
+		context.device.destroyDescriptorPool(descriptorPool);
+		context.device.destroyDescriptorSetLayout(buildSetLayout);
+		context.device.destroyDescriptorSetLayout(testSetLayout);
+		buildPipeline = vk::Pipeline();
+
+		for (auto &view : levelViews) {
+			context.device.destroyImageView(view);
+		}
+		levelViews.clear();
+		context.device.destroySampler(sampler);
+		pyramid.destroy();
+
+		for (uint32_t frame = 0; frame < readbacks.size(); ++frame) {
+			candidateBuffers[frame].destroy();
+			drawBuffers[frame].destroy();
+			readbacks[frame].destroy();
+		}
+		candidateBuffers.clear();
+		drawBuffers.clear();
+		readbacks.clear();
+	}
+
+
+
+	/* CPU */
+
+	bool HiZ::occluded(const glm::vec3 &min, const glm::vec3 &max) const {
+		if (!cpuValid) {
+			return false;
+		}
+
+		glm::vec2 rectMin(std::numeric_limits<float>::max());
+		glm::vec2 rectMax(-std::numeric_limits<float>::max());
+		float nearest = 1.0f;
+		for (int j = 0; j < 8; ++j) {
+			glm::vec3 corner((j & 1) ? max.x : min.x, (j & 2) ? max.y : min.y, (j & 4) ? max.z : min.z);
+			glm::vec4 clip = cpuViewProjection * glm::vec4(corner, 1.0f);
+			// reaches behind the camera, its rect is unbounded
+			if (clip.w <= 0.0f) {
+				return false;
+			}
+			glm::vec3 ndc = glm::vec3(clip) / clip.w;
+			rectMin = glm::min(rectMin, glm::vec2(ndc));
+			rectMax = glm::max(rectMax, glm::vec2(ndc));
+			nearest = std::min(nearest, ndc.z);
+		}
+		// crosses the near plane
+		if (nearest <= 0.0f) {
+			return false;
+		}
+
+		// the pixels it covers, the projection is already flipped for vulkan, so ndc -1 is the top
+		glm::vec2 size = glm::vec2(depthSize);
+		glm::vec2 uvMin = glm::clamp(rectMin * 0.5f + 0.5f, 0.0f, 1.0f);
+		glm::vec2 uvMax = glm::clamp(rectMax * 0.5f + 0.5f, 0.0f, 1.0f);
+		glm::uvec2 pixelMin = glm::uvec2(glm::floor(uvMin * size));
+		glm::uvec2 pixelMax = glm::min(glm::uvec2(glm::ceil(uvMax * size)), depthSize - 1u);
+		pixelMin = glm::min(pixelMin, pixelMax);
+
+		// the first level where the rect is at most 4x4 texels
+		uint32_t level = firstReadbackLevel;
+		while (level + 1 < levels) {
+			glm::uvec2 span = (pixelMax >> (level + 1)) - (pixelMin >> (level + 1));
+			if (span.x < 4 && span.y < 4) {
+				break;
+			}
+			++level;
+		}
+
+		glm::uvec2 levelSize = levelSizes[level];
+		glm::uvec2 texelMin = glm::min(pixelMin >> (level + 1), levelSize - 1u);
+		glm::uvec2 texelMax = glm::min(pixelMax >> (level + 1), levelSize - 1u);
+		const float *texels = cpuLevels.data() + readbackOffsets[level - firstReadbackLevel];
+
+		float farthest = 0.0f;
+		for (uint32_t y = texelMin.y; y <= texelMax.y; ++y) {
+			for (uint32_t x = texelMin.x; x <= texelMax.x; ++x) {
+				farthest = std::max(farthest, texels[y * levelSize.x + x]);
+			}
+		}
+		return nearest > farthest;
+	}
+
+	void HiZ::setCandidates(uint32_t frame, const std::vector<Candidate> &candidates, const std::vector<vk::DrawIndexedIndirectCommand> &draws) {
+		uint32_t count = (uint32_t)std::min(candidates.size(), (size_t)HIZ_MAX_CANDIDATES);
+		memcpy(candidateBuffers[frame].mapped, candidates.data(), count * sizeof(Candidate));
+
+		vk::DrawIndexedIndirectCommand *commands = (vk::DrawIndexedIndirectCommand*)drawBuffers[frame].mapped;
+		for (uint32_t i = 0; i < count; ++i) {
+			commands[i] = draws[i];
+			commands[i].instanceCount = 0;
+			commands[i].vertexOffset = 0;
+			commands[i].firstInstance = 0;
+		}
+		candidateCounts[frame] = count;
+	}
+
+	void HiZ::readback(uint32_t frame) {
+		if (!built[frame]) {
+			return;
+		}
+		built[frame] = 0;
+
+		const float *mapped = (const float*)readbacks[frame].mapped;
+		cpuLevels.assign(mapped, mapped + readbackFloats);
+		cpuViewProjection = viewProjections[frame];
+		cpuValid = true;
+
+		const vk::DrawIndexedIndirectCommand *commands = (const vk::DrawIndexedIndirectCommand*)drawBuffers[frame].mapped;
+		candidates = candidateCounts[frame];
+		drawnLate = 0;
+		for (uint32_t i = 0; i < candidates; ++i) {
+			drawnLate += commands[i].instanceCount;
+		}
+	}
+
+
+
+	/* GPU */
+
+	void HiZ::record(vk::CommandBuffer cmdBuffer, uint32_t frame, const glm::mat4 &viewProjection) {
+		viewProjections[frame] = viewProjection;
+
+		vk::ImageMemoryBarrier imageBarrier;
+		imageBarrier.oldLayout = vk::ImageLayout::eGeneral;
+		imageBarrier.newLayout = vk::ImageLayout::eGeneral;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = pyramid.image;
+
+		// the last frame's test and readback are done with it
+		imageBarrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, levels, 0, 1);
+		imageBarrier.srcAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead;
+		imageBarrier.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+		cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, vk::DependencyFlags(), nullptr, nullptr, imageBarrier);
+
+		// each level from the one before, once it's written
+		cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, buildPipeline);
+		imageBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+		imageBarrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eTransferRead;
+		for (uint32_t level = 0; level < levels; ++level) {
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, buildLayout, 0, buildSets[level], nullptr);
+			cmdBuffer.dispatch((levelSizes[level].x + 15) / 16, (levelSizes[level].y + 15) / 16, 1);
+
+			imageBarrier.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, level, 1, 0, 1);
+			cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, imageBarrier);
+		}
+
+		// the coarse levels for the cpu
+		std::vector<vk::BufferImageCopy> regions;
+		for (uint32_t level = firstReadbackLevel; level < levels; ++level) {
+			vk::BufferImageCopy region;
+			region.bufferOffset = readbackOffsets[level - firstReadbackLevel] * sizeof(float);
+			region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+			region.imageExtent = vk::Extent3D{ levelSizes[level].x, levelSizes[level].y, 1 };
+			regions.push_back(region);
+		}
+		cmdBuffer.copyImageToBuffer(pyramid.image, vk::ImageLayout::eGeneral, readbacks[frame].buffer, regions);
+
+		vk::BufferMemoryBarrier bufferBarrier;
+		bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		bufferBarrier.size = VK_WHOLE_SIZE;
+		bufferBarrier.buffer = readbacks[frame].buffer;
+		bufferBarrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+		bufferBarrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+		cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), nullptr, bufferBarrier, nullptr);
+
+		// the second phase: the candidates against what was just drawn
+		uint32_t count = candidateCounts[frame];
+		if (count) {
+			RetestConstants constants;
+			constants.viewProjection = viewProjection;
+			constants.depthSize = depthSize;
+			constants.levels = levels;
+			constants.count = count;
+
+			cmdBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, testPipeline);
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, testLayout, 0, testSets[frame], nullptr);
+			cmdBuffer.pushConstants(testLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(constants), &constants);
+			cmdBuffer.dispatch((count + 63) / 64, 1, 1);
+
+			// drawn by the late pass, counted by readback()
+			bufferBarrier.buffer = drawBuffers[frame].buffer;
+			bufferBarrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+			bufferBarrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead | vk::AccessFlagBits::eHostRead;
+			cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect | vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), nullptr, bufferBarrier, nullptr);
+		}
+
+		built[frame] = 1;
+	}
+
+}
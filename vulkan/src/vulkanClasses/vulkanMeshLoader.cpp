@@ -82,6 +82,35 @@ namespace vkx {
 
 
 
+		// for reporting dedup savings of this scene
+		uint32_t texturesBefore = this->assetManager->textures.duplicateCount;
+		size_t bytesBefore = this->assetManager->textures.duplicateBytes;
+		uint32_t materialsBefore = this->assetManager->materials.duplicateCount;
+
+
+		// pack this scene's textures into arrays before the materials pick them up
+		if (this->assetManager->packTextures) {
+			std::string assetPath = getAssetPath() + "models/";
+			std::vector<std::pair<std::string, std::string>> files;
+			aiTextureType types[3] = { aiTextureType_DIFFUSE, aiTextureType_SPECULAR, aiTextureType_NORMALS };
+
+			for (size_t i = 0; i < pScene->mNumMaterials; i++) {
+				for (auto type : types) {
+					if (pScene->mMaterials[i]->GetTextureCount(type) == 0) {
+						continue;
+					}
+					aiString texturefile;
+					pScene->mMaterials[i]->GetTexture(type, 0, &texturefile);
+					std::string fileName = std::string(texturefile.C_Str());
+					std::replace(fileName.begin(), fileName.end(), '\\', '/');
+					files.push_back(std::make_pair(fileName, assetPath + fileName));
+				}
+			}
+
+			this->assetManager->textures.pack(files, textureLoader);
+		}
+
+
 		for (size_t i = 0; i < pScene->mNumMaterials; i++) {
 
 			Material material;
@@ -126,6 +155,11 @@ namespace vkx {
 			aiString texturefile;
 			std::string assetPath = getAssetPath() + "models/";
 
+			// names the textures are stored under
+			std::string diffuseName;
+			std::string specularName;
+			std::string bumpName;
+
 			// get diffuse texture
 			pScene->mMaterials[i]->GetTexture(aiTextureType_DIFFUSE, 0, &texturefile);
 			if (pScene->mMaterials[i]->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
@@ -139,19 +173,36 @@ namespace vkx {
 				std::string ls = "Info: Diffuse: \"" + std::string(texturefile.C_Str()) + "\"\n";
 				printf(ls.c_str());
 
-				// if the texture hasn't been loaded already, load it
-				if (!this->assetManager->textures.present(fileName)) {
-					// load from file
-					vkx::Texture tex = textureLoader->loadTexture(assetPath + fileName, vk::Format::eBc2UnormBlock);
-					this->assetManager->textures.add(fileName, tex);
+				// stream it through the virtual texture cache if a baked version sits next to it,
+				// the whole image is never loaded then, the material's own set gets the dummy
+				std::string vtFileName = assetPath + fileName.substr(0, fileName.find_last_of('.')) + ".vtex";
+				if (this->assetManager->virtualTextures != nullptr) {
+					auto vt = this->assetManager->virtualTextureIds.find(vtFileName);
+					if (vt != this->assetManager->virtualTextureIds.end()) {
+						material.properties.virtualTexture = vt->second + 1;
+					} else if (std::ifstream(vtFileName).good()) {
+						uint32_t id = this->assetManager->virtualTextures->add(vtFileName);
+						this->assetManager->virtualTextureIds[vtFileName] = id;
+						material.properties.virtualTexture = id + 1;
+					}
+				}
+
+				if (material.properties.virtualTexture != 0) {
+					diffuseName = assetPath + "dummy/dummy.dds";
+					material.diffuse = assetManager->textures.getOrLoad(diffuseName, textureLoader);
+				} else {
+					// if the texture hasn't been loaded already, load it
+					// (textures with the same contents share one resource)
+					material.diffuse = assetManager->textures.getOrLoad(fileName, assetPath + fileName, textureLoader);
+					diffuseName = fileName;
 				}
-				material.diffuse = assetManager->textures.getSharedPtr(fileName);
 			} else {
 				std::string fileName = std::string(texturefile.C_Str());
 				printf("Error: Material has no diffuse, using dummy texture!\n");
 				
 				//material.diffuse = textureLoader->loadTexture(assetPath + "dummy/dummy.dds", vk::Format::eBc2UnormBlock);
-				material.diffuse = assetManager->textures.getOrLoad(assetPath + "dummy/dummy.dds", textureLoader);
+				diffuseName = assetPath + "dummy/dummy.dds";
+				material.diffuse = assetManager->textures.getOrLoad(diffuseName, textureLoader);
 			}
 
 
@@ -169,18 +220,16 @@ namespace vkx {
 				printf(ls.c_str());
 
 				// if the texture hasn't been loaded already, load it
-				if (!this->assetManager->textures.present(fileName)) {
-					// load from file
-					vkx::Texture tex = textureLoader->loadTexture(assetPath + fileName, vk::Format::eBc2UnormBlock);
-					this->assetManager->textures.add(fileName, tex);
-				}
-				material.specular = assetManager->textures.getSharedPtr(fileName);
+				// (textures with the same contents share one resource)
+				material.specular = assetManager->textures.getOrLoad(fileName, assetPath + fileName, textureLoader);
+				specularName = fileName;
 			} else {
 				std::string fileName = std::string(texturefile.C_Str());
 				printf("Error: Material has no specular, using dummy texture!\n");
 
 				//material.specular = textureLoader->loadTexture(assetPath + "dummy/dummy_specular.dds", vk::Format::eBc2UnormBlock);
-				material.specular = assetManager->textures.getOrLoad(assetPath + "dummy/dummy_specular.dds", textureLoader);
+				specularName = assetPath + "dummy/dummy_specular.dds";
+				material.specular = assetManager->textures.getOrLoad(specularName, textureLoader);
 			}
 
 
@@ -198,18 +247,16 @@ namespace vkx {
 				printf(ls.c_str());
 
 				// if the texture hasn't been loaded already, load it
-				if (!this->assetManager->textures.present(fileName)) {
-					// load from file
-					vkx::Texture tex = textureLoader->loadTexture(assetPath + fileName, vk::Format::eBc2UnormBlock);
-					this->assetManager->textures.add(fileName, tex);
-				}
-				material.bump = assetManager->textures.getSharedPtr(fileName);
+				// (textures with the same contents share one resource)
+				material.bump = assetManager->textures.getOrLoad(fileName, assetPath + fileName, textureLoader);
+				bumpName = fileName;
 			} else {
 				std::string fileName = std::string(texturefile.C_Str());
 				printf("Error: Material has no bump, using dummy texture!\n");
 
 				//material.bump = textureLoader->loadTexture(assetPath + "dummy/dummy_ddn.dds", vk::Format::eBc2UnormBlock);
-				material.bump = assetManager->textures.getOrLoad(assetPath + "dummy/dummy_ddn.dds", textureLoader);
+				bumpName = assetPath + "dummy/dummy_ddn.dds";
+				material.bump = assetManager->textures.getOrLoad(bumpName, textureLoader);
 			}
 
 			// Mask
@@ -218,6 +265,29 @@ namespace vkx {
 				material.hasAlpha = true;
 			}
 
+			// layers of the maps in case they were packed into arrays
+			material.properties.diffuseLayer = this->assetManager->textures.getLayer(diffuseName);
+			material.properties.specularLayer = this->assetManager->textures.getLayer(specularName);
+			material.properties.bumpLayer = this->assetManager->textures.getLayer(bumpName);
+
+
+			// content hash of the resolved properties and textures
+			// if an identical material has already been loaded, reuse it under this name
+			uint64_t textureKey[4] = {
+				this->assetManager->textures.getHash(diffuseName),
+				this->assetManager->textures.getHash(specularName),
+				this->assetManager->textures.getHash(bumpName),
+				(uint64_t)material.hasAlpha
+			};
+			uint64_t materialHash = vkx::hash64(textureKey, sizeof(textureKey), material.properties.hash());
+
+			uint32_t existingId;
+			if (this->assetManager->materials.findHash(materialHash, existingId)) {
+				printf("Info: Material is a duplicate, sharing existing material\n");
+				this->assetManager->materials.addAlias(material.name, existingId);
+				continue;
+			}
+
 
 			if (this->assetManager->materialDescriptorPool == nullptr) {
 				return;
@@ -228,42 +298,64 @@ namespace vkx {
 			}
 
 
-			vk::DescriptorSetAllocateInfo allocInfo =
-				vkx::descriptorSetAllocateInfo(
-					*this->assetManager->materialDescriptorPool,
-					this->assetManager->materialDescriptorSetLayout,
-					1);
-
-			material.descriptorSet = context->device.allocateDescriptorSets(allocInfo)[0];
-
-
-			std::vector<vk::WriteDescriptorSet> writeDescriptorSets =
-			{
-				// image bindings
-				// binding 0: diffuse
-				vkx::writeDescriptorSet(
-					material.descriptorSet,
-					vk::DescriptorType::eCombinedImageSampler,
-					0,
-					&material.diffuse->descriptor),
-				// binding 1: specular
-				vkx::writeDescriptorSet(
-					material.descriptorSet,
-					vk::DescriptorType::eCombinedImageSampler,
-					1,
-					&material.specular->descriptor),
-				// binding 2: normal
-				vkx::writeDescriptorSet(
-					material.descriptorSet,
-					vk::DescriptorType::eCombinedImageSampler,
-					2,
-					&material.bump->descriptor)
+			// materials referencing the same images (e.g. layers of the same arrays) share a descriptor set
+			uint64_t views[3] = {
+				(uint64_t)(VkImageView)material.diffuse->view,
+				(uint64_t)(VkImageView)material.specular->view,
+				(uint64_t)(VkImageView)material.bump->view
 			};
+			uint64_t setKey = vkx::hash64(views, sizeof(views));
 
-			context->device.updateDescriptorSets(writeDescriptorSets, {});
+			auto textureSet = this->assetManager->textureSets.find(setKey);
+			if (textureSet != this->assetManager->textureSets.end()) {
+				material.descriptorSet = textureSet->second;
+			} else {
+				vk::DescriptorSetAllocateInfo allocInfo =
+					vkx::descriptorSetAllocateInfo(
+						*this->assetManager->materialDescriptorPool,
+						this->assetManager->materialDescriptorSetLayout,
+						1);
+
+				material.descriptorSet = context->device.allocateDescriptorSets(allocInfo)[0];
+
+
+				std::vector<vk::WriteDescriptorSet> writeDescriptorSets =
+				{
+					// image bindings
+					// binding 0: diffuse
+					vkx::writeDescriptorSet(
+						material.descriptorSet,
+						vk::DescriptorType::eCombinedImageSampler,
+						0,
+						&material.diffuse->descriptor),
+					// binding 1: specular
+					vkx::writeDescriptorSet(
+						material.descriptorSet,
+						vk::DescriptorType::eCombinedImageSampler,
+						1,
+						&material.specular->descriptor),
+					// binding 2: normal
+					vkx::writeDescriptorSet(
+						material.descriptorSet,
+						vk::DescriptorType::eCombinedImageSampler,
+						2,
+						&material.bump->descriptor)
+				};
+
+				context->device.updateDescriptorSets(writeDescriptorSets, {});
+
+				this->assetManager->textureSets[setKey] = material.descriptorSet;
+			}
 
-			this->assetManager->materials.add(material.name, material);
+			this->assetManager->materials.add(material.name, material, materialHash);
+
+		}
 
+		uint32_t duplicateTextures = this->assetManager->textures.duplicateCount - texturesBefore;
+		uint32_t duplicateMaterials = this->assetManager->materials.duplicateCount - materialsBefore;
+		if (duplicateTextures > 0 || duplicateMaterials > 0) {
+			size_t savedBytes = this->assetManager->textures.duplicateBytes - bytesBefore;
+			printf("Info: Dedup: %u textures (%.2f MB), %u materials shared\n", duplicateTextures, savedBytes / (1024.0 * 1024.0), duplicateMaterials);
 		}
 
 	}
@@ -291,7 +383,7 @@ namespace vkx {
 			aiString name;
 			pScene->mMaterials[pMesh->mMaterialIndex]->Get(AI_MATKEY_NAME, name);
 
-			m_Entries[index].materialName = name.C_Str();
+			m_Entries[index].materialId = this->assetManager->materials.getId(name.C_Str());
 
 
 			// get the color of this mesh's material
@@ -453,6 +545,8 @@ namespace vkx {
 		// Index buffer
 		meshBuffer->indices = context->stageToDeviceBuffer(vk::BufferUsageFlagBits::eIndexBuffer, indexBuffer);
 		meshBuffer->dim = dim.size;
+		meshBuffer->boundsMin = dim.min;
+		meshBuffer->boundsMax = dim.max;
 
 		this->combinedBuffer = meshBuffer;
 	}
@@ -1007,19 +1101,33 @@ namespace vkx {
 
 			meshBuffer->indexCount = (uint32_t)indexBuffer.size();
 			// Use staging buffer to move vertex and index buffer to device local memory
+			// (transfer source too, the gpu driven path copies them into its shared buffers)
 			// Vertex buffer
 			if (layout == defaultLayout) {
-				meshBuffer->vertices = this->context->stageToDeviceBuffer(vk::BufferUsageFlagBits::eVertexBuffer, verticesTest);
+				meshBuffer->vertices = this->context->stageToDeviceBuffer(vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferSrc, verticesTest);
 			} else {
-				meshBuffer->vertices = this->context->stageToDeviceBuffer(vk::BufferUsageFlagBits::eVertexBuffer, vertexBuffer);
+				meshBuffer->vertices = this->context->stageToDeviceBuffer(vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferSrc, vertexBuffer);
 			}
 			
 			// Index buffer
-			meshBuffer->indices = this->context->stageToDeviceBuffer(vk::BufferUsageFlagBits::eIndexBuffer, indexBuffer);
+			meshBuffer->indices = this->context->stageToDeviceBuffer(vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferSrc, indexBuffer);
 			meshBuffer->dim = dim.size;
 
-			meshBuffer->materialIndex = m_Entries[m].materialIndex;
-			meshBuffer->materialName = m_Entries[m].materialName;
+			// dim covers every mesh in the file, the bounds are just this one
+			std::vector<glm::vec3> positions;
+			positions.reserve(m_Entries[m].Vertices.size());
+			meshBuffer->boundsMin = glm::vec3(FLT_MAX);
+			meshBuffer->boundsMax = glm::vec3(-FLT_MAX);
+			for (auto &vertex : m_Entries[m].Vertices) {
+				positions.push_back(vertex.m_pos * scale);
+				meshBuffer->boundsMin = glm::min(meshBuffer->boundsMin, positions.back());
+				meshBuffer->boundsMax = glm::max(meshBuffer->boundsMax, positions.back());
+			}
+
+			// the big ones can hide other meshes
+			vkx::buildOccluderProxy(positions, indexBuffer, meshBuffer->boundsMin, meshBuffer->boundsMax, meshBuffer->occluder);
+
+			meshBuffer->materialId = m_Entries[m].materialId;
 
 
 			meshBuffers.push_back(meshBuffer);
@@ -1167,8 +1275,24 @@ namespace vkx {
 		this->combinedBuffer->vertices = context->stageToDeviceBuffer(vk::BufferUsageFlagBits::eVertexBuffer, vertexBuffer);
 		this->combinedBuffer->indices = context->stageToDeviceBuffer(vk::BufferUsageFlagBits::eIndexBuffer, indexBuffer);
 
-		this->combinedBuffer->materialIndex = m_Entries[0].materialIndex;
-		this->combinedBuffer->materialName = m_Entries[0].materialName;
+		this->combinedBuffer->materialId = m_Entries[0].materialId;
+
+		// bounds of the bind pose, in the space the bones put it in (root node inverse and scale)
+		// animation moves vertices outside of these, the culling pads them
+		// assimp is row major, glm takes columns
+		const aiMatrix4x4 &inverse = this->boneData.globalInverseTransform;
+		glm::mat4 restTransform(
+			inverse.a1, inverse.b1, inverse.c1, inverse.d1,
+			inverse.a2, inverse.b2, inverse.c2, inverse.d2,
+			inverse.a3, inverse.b3, inverse.c3, inverse.d3,
+			inverse.a4, inverse.b4, inverse.c4, inverse.d4);
+		this->combinedBuffer->boundsMin = glm::vec3(FLT_MAX);
+		this->combinedBuffer->boundsMax = glm::vec3(-FLT_MAX);
+		for (auto &vertex : vertexBuffer) {
+			glm::vec3 pos = glm::vec3(restTransform * glm::vec4(vertex.pos, 1.0f));
+			this->combinedBuffer->boundsMin = glm::min(this->combinedBuffer->boundsMin, pos);
+			this->combinedBuffer->boundsMax = glm::max(this->combinedBuffer->boundsMax, pos);
+		}
 	}
 
 
@@ -0,0 +1,481 @@
+#include "vulkanOcclusionRasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+	#define VKX_OCCLUSION_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define VKX_OCCLUSION_SSE
+#endif
+
+
+namespace vkx {
+
+	namespace {
+
+		const uint32_t binsX = OCCLUSION_WIDTH / OCCLUSION_BIN_WIDTH;
+		const uint32_t binsY = OCCLUSION_HEIGHT / OCCLUSION_BIN_HEIGHT;
+		const uint32_t tileSize = 8;
+		const uint32_t tilesX = OCCLUSION_WIDTH / tileSize;
+
+		static_assert(OCCLUSION_WIDTH % OCCLUSION_BIN_WIDTH == 0 && OCCLUSION_HEIGHT % OCCLUSION_BIN_HEIGHT == 0, "the bins have to tile the depth buffer");
+		static_assert(OCCLUSION_BIN_WIDTH % tileSize == 0 && OCCLUSION_BIN_HEIGHT % tileSize == 0, "the bins have to be made of whole tiles");
+
+		// a row of pixels, masks are all bits set (simd) or 1 (scalar)
+		#if defined(VKX_OCCLUSION_AVX)
+		const int32_t lanes = 8;
+		typedef __m256 floatN;
+		inline floatN vload(const float *p) { return _mm256_loadu_ps(p); }
+		inline void vstore(float *p, floatN a) { _mm256_storeu_ps(p, a); }
+		inline floatN vsplat(float v) { return _mm256_set1_ps(v); }
+		inline floatN vadd(floatN a, floatN b) { return _mm256_add_ps(a, b); }
+		inline floatN vmul(floatN a, floatN b) { return _mm256_mul_ps(a, b); }
+		inline floatN vmin(floatN a, floatN b) { return _mm256_min_ps(a, b); }
+		inline floatN vinside(floatN a) { return _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GE_OQ); }
+		inline floatN vboth(floatN a, floatN b) { return _mm256_and_ps(a, b); }
+		inline floatN vselect(floatN mask, floatN a, floatN b) { return _mm256_blendv_ps(b, a, mask); }
+		inline floatN vlanes() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+		inline int vbits(floatN a) { return _mm256_movemask_ps(a); }
+		#elif defined(VKX_OCCLUSION_SSE)
+		const int32_t lanes = 4;
+		typedef __m128 floatN;
+		inline floatN vload(const float *p) { return _mm_loadu_ps(p); }
+		inline void vstore(float *p, floatN a) { _mm_storeu_ps(p, a); }
+		inline floatN vsplat(float v) { return _mm_set1_ps(v); }
+		inline floatN vadd(floatN a, floatN b) { return _mm_add_ps(a, b); }
+		inline floatN vmul(floatN a, floatN b) { return _mm_mul_ps(a, b); }
+		inline floatN vmin(floatN a, floatN b) { return _mm_min_ps(a, b); }
+		inline floatN vinside(floatN a) { return _mm_cmpge_ps(a, _mm_setzero_ps()); }
+		inline floatN vboth(floatN a, floatN b) { return _mm_and_ps(a, b); }
+		inline floatN vselect(floatN mask, floatN a, floatN b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+		inline floatN vlanes() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+		inline int vbits(floatN a) { return _mm_movemask_ps(a); }
+		#else
+		const int32_t lanes = 1;
+		typedef float floatN;
+		inline floatN vload(const float *p) { return *p; }
+		inline void vstore(float *p, floatN a) { *p = a; }
+		inline floatN vsplat(float v) { return v; }
+		inline floatN vadd(floatN a, floatN b) { return a + b; }
+		inline floatN vmul(floatN a, floatN b) { return a * b; }
+		inline floatN vmin(floatN a, floatN b) { return std::min(a, b); }
+		inline floatN vinside(floatN a) { return a >= 0.0f ? 1.0f : 0.0f; }
+		inline floatN vboth(floatN a, floatN b) { return (a != 0.0f && b != 0.0f) ? 1.0f : 0.0f; }
+		inline floatN vselect(floatN mask, floatN a, floatN b) { return mask != 0.0f ? a : b; }
+		inline floatN vlanes() { return 0.0f; }
+		inline int vbits(floatN a) { return a != 0.0f ? 1 : 0; }
+		#endif
+
+		static_assert(OCCLUSION_BIN_WIDTH % lanes == 0, "a row of lanes can't cross a bin");
+
+		// the vertices' grid cells, packed 21 bits an axis
+		inline uint64_t cellKey(uint32_t x, uint32_t y, uint32_t z) {
+			return (uint64_t)x | ((uint64_t)y << 21) | ((uint64_t)z << 42);
+		}
+
+		// same triangle whichever vertex it starts at, and whichever way it winds (nothing is backface culled)
+		inline uint64_t triangleKey(uint32_t a, uint32_t b, uint32_t c) {
+			if (a > b) std::swap(a, b);
+			if (b > c) std::swap(b, c);
+			if (a > b) std::swap(a, b);
+			return cellKey(a, b, c);
+		}
+
+		// which cells of an OCCLUDER_PROXY_COVERAGE square the triangles cover (center inside) seen along an axis,
+		// the other two axes are stretched over the bounds
+		void coverageMask(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, int axis, std::vector<uint8_t> &mask) {
+			const int side = OCCLUDER_PROXY_COVERAGE;
+			int u = (axis + 1) % 3;
+			int v = (axis + 2) % 3;
+			glm::vec2 origin(boundsMin[u], boundsMin[v]);
+			glm::vec2 scale((float)side / std::max(boundsMax[u] - boundsMin[u], 1e-6f), (float)side / std::max(boundsMax[v] - boundsMin[v], 1e-6f));
+
+			mask.assign(side * side, 0);
+			for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+				glm::vec2 p[3];
+				for (int i = 0; i < 3; ++i) {
+					const glm::vec3 &position = positions[indices[t + i]];
+					p[i] = (glm::vec2(position[u], position[v]) - origin) * scale;
+				}
+				float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[1].y - p[0].y) * (p[2].x - p[0].x);
+				if (area < 0.0f) {
+					std::swap(p[1], p[2]);
+				} else if (!(area > 0.0f)) {
+					continue;
+				}
+
+				int minX = std::max(0, (int)std::ceil(std::min(p[0].x, std::min(p[1].x, p[2].x)) - 0.5f));
+				int minY = std::max(0, (int)std::ceil(std::min(p[0].y, std::min(p[1].y, p[2].y)) - 0.5f));
+				int maxX = std::min(side - 1, (int)std::floor(std::max(p[0].x, std::max(p[1].x, p[2].x)) - 0.5f));
+				int maxY = std::min(side - 1, (int)std::floor(std::max(p[0].y, std::max(p[1].y, p[2].y)) - 0.5f));
+				for (int y = minY; y <= maxY; ++y) {
+					for (int x = minX; x <= maxX; ++x) {
+						glm::vec2 center(x + 0.5f, y + 0.5f);
+						bool inside = true;
+						for (int i = 0; i < 3 && inside; ++i) {
+							const glm::vec2 &a = p[i];
+							const glm::vec2 &b = p[(i + 1) % 3];
+							inside = (b.x - a.x) * (center.y - a.y) - (b.y - a.y) * (center.x - a.x) >= 0.0f;
+						}
+						if (inside) {
+							mask[y * side + x] = 1;
+						}
+					}
+				}
+			}
+		}
+	}
+
+
+
+	/* PROXIES */
+
+	bool buildOccluderProxy(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax, OccluderProxy &proxy) {
+		proxy.vertices.clear();
+		proxy.indices.clear();
+
+		glm::vec3 size = boundsMax - boundsMin;
+		int bigAxes = (size.x >= OCCLUDER_MIN_SIZE) + (size.y >= OCCLUDER_MIN_SIZE) + (size.z >= OCCLUDER_MIN_SIZE);
+		if (bigAxes < 2 || indices.size() < 3) {
+			return false;
+		}
+
+		if (indices.size() / 3 <= OCCLUDER_PROXY_TRIANGLES) {
+			proxy.vertices = positions;
+			proxy.indices = indices;
+			return true;
+		}
+
+		float extent = std::max(size.x, std::max(size.y, size.z));
+		std::unordered_map<uint64_t, uint32_t> clusters;
+		std::unordered_set<uint64_t> seen;
+		std::vector<uint32_t> remap(positions.size());
+		std::vector<glm::vec3> sums;
+		std::vector<uint32_t> counts;
+		std::vector<glm::vec3> vertices;
+
+		// what the mesh covers along each axis, a proxy mustn't cover more
+		std::vector<uint8_t> meshCoverage[3];
+		std::vector<uint8_t> proxyCoverage;
+		for (int axis = 0; axis < 3; ++axis) {
+			coverageMask(positions, indices, boundsMin, boundsMax, axis, meshCoverage[axis]);
+		}
+
+		// halve the grid until it's few enough, coarser than 4x4x4 there's nothing left of most meshes' shape
+		for (uint32_t grid = 32; grid >= 4; grid /= 2) {
+			float cell = extent / grid;
+			clusters.clear();
+			sums.clear();
+			counts.clear();
+
+			for (size_t i = 0; i < positions.size(); ++i) {
+				glm::uvec3 c = glm::uvec3(glm::clamp((positions[i] - boundsMin) / cell, glm::vec3(0.0f), glm::vec3((float)(grid - 1))));
+				auto inserted = clusters.insert(std::make_pair(cellKey(c.x, c.y, c.z), (uint32_t)sums.size()));
+				if (inserted.second) {
+					sums.push_back(glm::vec3(0.0f));
+					counts.push_back(0);
+				}
+				remap[i] = inserted.first->second;
+				sums[remap[i]] += positions[i];
+				counts[remap[i]]++;
+			}
+
+			// what's left of the triangles, without the collapsed ones and the duplicates
+			seen.clear();
+			proxy.indices.clear();
+			for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+				uint32_t a = remap[indices[t]];
+				uint32_t b = remap[indices[t + 1]];
+				uint32_t c = remap[indices[t + 2]];
+				if (a == b || b == c || a == c || !seen.insert(triangleKey(a, b, c)).second) {
+					continue;
+				}
+				proxy.indices.push_back(a);
+				proxy.indices.push_back(b);
+				proxy.indices.push_back(c);
+			}
+
+			if (proxy.indices.size() / 3 > OCCLUDER_PROXY_TRIANGLES) {
+				continue;
+			}
+
+			vertices.resize(sums.size());
+			for (size_t i = 0; i < sums.size(); ++i) {
+				vertices[i] = sums[i] / (float)counts[i];
+			}
+
+			// spans a hole, or bulges out of the outline, somewhere
+			bool inside = true;
+			for (int axis = 0; axis < 3 && inside; ++axis) {
+				coverageMask(vertices, proxy.indices, boundsMin, boundsMax, axis, proxyCoverage);
+				for (size_t i = 0; i < proxyCoverage.size() && inside; ++i) {
+					inside = !proxyCoverage[i] || meshCoverage[axis][i];
+				}
+			}
+			if (inside && !proxy.indices.empty()) {
+				proxy.vertices.swap(vertices);
+				return true;
+			}
+		}
+
+		// nothing both small enough and inside the mesh
+		proxy.indices.clear();
+		return false;
+	}
+
+
+
+	/* RASTERIZER */
+
+	OcclusionRasterizer::OcclusionRasterizer() {
+		depth.assign(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f);
+		tileMax.assign(tilesX * (OCCLUSION_HEIGHT / tileSize), 1.0f);
+		bins.resize(binsX * binsY);
+	}
+
+	void OcclusionRasterizer::begin(const glm::mat4 &viewProjection) {
+		this->viewProjection = viewProjection;
+		setup.clear();
+		for (auto &bin : bins) {
+			bin.clear();
+		}
+		occluders = 0;
+		triangles = 0;
+	}
+
+	bool OcclusionRasterizer::addOccluder(const glm::mat4 &matrix, const OccluderProxy &proxy) {
+		if (setup.size() + proxy.indices.size() / 3 > OCCLUSION_MAX_TRIANGLES) {
+			return false;
+		}
+
+		glm::mat4 toClip = viewProjection * matrix;
+		clip.resize(proxy.vertices.size());
+		for (size_t i = 0; i < proxy.vertices.size(); ++i) {
+			clip[i] = toClip * glm::vec4(proxy.vertices[i], 1.0f);
+		}
+
+		for (size_t t = 0; t + 2 < proxy.indices.size(); t += 3) {
+			addTriangle(clip[proxy.indices[t]], clip[proxy.indices[t + 1]], clip[proxy.indices[t + 2]]);
+		}
+		occluders++;
+		return true;
+	}
+
+	// clip space, only the near plane is clipped against, the rest are handled by the pixel bounds
+	void OcclusionRasterizer::addTriangle(const glm::vec4 &a, const glm::vec4 &b, const glm::vec4 &c) {
+
+		// completely outside one of the planes
+		if ((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+			(a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w) ||
+			(a.z > a.w && b.z > b.w && c.z > c.w) || (a.z < 0.0f && b.z < 0.0f && c.z < 0.0f)) {
+			return;
+		}
+
+		// vulkan depth is 0..w, in front of the near plane w is positive
+		glm::vec4 in[3] = { a, b, c };
+		glm::vec4 out[4];
+		int count = 0;
+		for (int i = 0; i < 3; ++i) {
+			const glm::vec4 &current = in[i];
+			const glm::vec4 &next = in[(i + 1) % 3];
+			if (current.z >= 0.0f) {
+				out[count++] = current;
+			}
+			if ((current.z >= 0.0f) != (next.z >= 0.0f)) {
+				float t = current.z / (current.z - next.z);
+				out[count++] = current + (next - current) * t;
+			}
+		}
+
+		glm::vec3 screen[4];
+		for (int i = 0; i < count; ++i) {
+			glm::vec3 ndc = glm::vec3(out[i]) / out[i].w;
+			screen[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * OCCLUSION_WIDTH, (ndc.y * 0.5f + 0.5f) * OCCLUSION_HEIGHT, ndc.z);
+		}
+		for (int i = 2; i < count; ++i) {
+			addScreenTriangle(screen[0], screen[i - 1], screen[i]);
+		}
+	}
+
+	void OcclusionRasterizer::addScreenTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2) {
+		float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+		if (area < 0.0f) {
+			std::swap(v1, v2);
+			area = -area;
+		}
+		// also catches nans
+		if (!(area > 0.0f)) {
+			return;
+		}
+
+		// the pixels whose centers can be inside
+		Triangle t;
+		t.minX = std::max(0, (int32_t)std::ceil(std::min(v0.x, std::min(v1.x, v2.x)) - 0.5f));
+		t.minY = std::max(0, (int32_t)std::ceil(std::min(v0.y, std::min(v1.y, v2.y)) - 0.5f));
+		t.maxX = std::min(OCCLUSION_WIDTH - 1, (int32_t)std::floor(std::max(v0.x, std::max(v1.x, v2.x)) - 0.5f));
+		t.maxY = std::min(OCCLUSION_HEIGHT - 1, (int32_t)std::floor(std::max(v0.y, std::max(v1.y, v2.y)) - 0.5f));
+		if (t.minX > t.maxX || t.minY > t.maxY) {
+			return;
+		}
+
+		const glm::vec3 *v[3] = { &v0, &v1, &v2 };
+		for (int i = 0; i < 3; ++i) {
+			const glm::vec3 &from = *v[i];
+			const glm::vec3 &to = *v[(i + 1) % 3];
+			t.edges[i][0] = from.y - to.y;
+			t.edges[i][1] = to.x - from.x;
+			t.edges[i][2] = -(t.edges[i][0] * from.x + t.edges[i][1] * from.y);
+		}
+
+		// the plane through the vertices, pushed back by as much as it changes within half a pixel,
+		// so it's never nearer than the triangle anywhere in the pixel
+		float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+		float dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+		t.z[0] = dzdx;
+		t.z[1] = dzdy;
+		t.z[2] = v0.z - dzdx * v0.x - dzdy * v0.y + 0.5f * (std::abs(dzdx) + std::abs(dzdy));
+		t.zMax = std::max(v0.z, std::max(v1.z, v2.z));
+
+		uint32_t index = (uint32_t)setup.size();
+		setup.push_back(t);
+		for (int32_t by = t.minY / OCCLUSION_BIN_HEIGHT; by <= t.maxY / OCCLUSION_BIN_HEIGHT; ++by) {
+			for (int32_t bx = t.minX / OCCLUSION_BIN_WIDTH; bx <= t.maxX / OCCLUSION_BIN_WIDTH; ++bx) {
+				bins[by * binsX + bx].push_back(index);
+			}
+		}
+	}
+
+	void OcclusionRasterizer::rasterize(vkx::ThreadPool &threads) {
+		uint32_t threadCount = (uint32_t)threads.threads.size();
+		if (!threadCount) {
+			for (uint32_t bin = 0; bin < bins.size(); ++bin) {
+				rasterizeBin(bin);
+			}
+		} else {
+			for (uint32_t thread = 0; thread < threadCount; ++thread) {
+				threads.threads[thread]->addJob([this, thread, threadCount] {
+					for (uint32_t bin = thread; bin < bins.size(); bin += threadCount) {
+						rasterizeBin(bin);
+					}
+				});
+			}
+			threads.wait();
+		}
+		triangles = (uint32_t)setup.size();
+	}
+
+	// clears the bin, draws its triangles and updates its tiles
+	void OcclusionRasterizer::rasterizeBin(uint32_t bin) {
+		int32_t binMinX = (bin % binsX) * OCCLUSION_BIN_WIDTH;
+		int32_t binMinY = (bin / binsX) * OCCLUSION_BIN_HEIGHT;
+		int32_t binMaxX = binMinX + OCCLUSION_BIN_WIDTH - 1;
+		int32_t binMaxY = binMinY + OCCLUSION_BIN_HEIGHT - 1;
+
+		for (int32_t y = binMinY; y <= binMaxY; ++y) {
+			std::fill_n(&depth[y * OCCLUSION_WIDTH + binMinX], OCCLUSION_BIN_WIDTH, 1.0f);
+		}
+
+		const floatN laneOffsets = vlanes();
+		for (uint32_t index : bins[bin]) {
+			const Triangle &t = setup[index];
+
+			// whole rows of lanes, the lanes outside the triangle are masked off
+			int32_t minX = binMinX + (std::max(t.minX, binMinX) - binMinX) / lanes * lanes;
+			int32_t maxX = std::min(t.maxX, binMaxX);
+			int32_t minY = std::max(t.minY, binMinY);
+			int32_t maxY = std::min(t.maxY, binMaxY);
+
+			floatN a0 = vsplat(t.edges[0][0]), a1 = vsplat(t.edges[1][0]), a2 = vsplat(t.edges[2][0]);
+			floatN za = vsplat(t.z[0]);
+			floatN zMax = vsplat(t.zMax);
+
+			for (int32_t y = minY; y <= maxY; ++y) {
+				float py = (float)y + 0.5f;
+				floatN row0 = vsplat(t.edges[0][1] * py + t.edges[0][2]);
+				floatN row1 = vsplat(t.edges[1][1] * py + t.edges[1][2]);
+				floatN row2 = vsplat(t.edges[2][1] * py + t.edges[2][2]);
+				floatN rowZ = vsplat(t.z[1] * py + t.z[2]);
+				float *pixels = &depth[y * OCCLUSION_WIDTH];
+
+				for (int32_t x = minX; x <= maxX; x += lanes) {
+					floatN px = vadd(vsplat((float)x + 0.5f), laneOffsets);
+					floatN mask = vboth(vboth(vinside(vadd(vmul(a0, px), row0)), vinside(vadd(vmul(a1, px), row1))), vinside(vadd(vmul(a2, px), row2)));
+					if (!vbits(mask)) {
+						continue;
+					}
+					floatN z = vmin(vadd(vmul(za, px), rowZ), zMax);
+					floatN current = vload(pixels + x);
+					vstore(pixels + x, vselect(mask, vmin(current, z), current));
+				}
+			}
+		}
+
+		for (int32_t ty = binMinY / tileSize; ty <= binMaxY / (int32_t)tileSize; ++ty) {
+			for (int32_t tx = binMinX / tileSize; tx <= binMaxX / (int32_t)tileSize; ++tx) {
+				float farthest = 0.0f;
+				for (uint32_t y = ty * tileSize; y < (ty + 1) * tileSize; ++y) {
+					const float *pixels = &depth[y * OCCLUSION_WIDTH + tx * tileSize];
+					for (uint32_t x = 0; x < tileSize; ++x) {
+						farthest = std::max(farthest, pixels[x]);
+					}
+				}
+				tileMax[ty * tilesX + tx] = farthest;
+			}
+		}
+	}
+
+	bool OcclusionRasterizer::occluded(const glm::vec3 &min, const glm::vec3 &max) const {
+		glm::vec2 rectMin(std::numeric_limits<float>::max());
+		glm::vec2 rectMax(-std::numeric_limits<float>::max());
+		float nearest = 1.0f;
+		for (int j = 0; j < 8; ++j) {
+			glm::vec3 corner((j & 1) ? max.x : min.x, (j & 2) ? max.y : min.y, (j & 4) ? max.z : min.z);
+			glm::vec4 clipCorner = viewProjection * glm::vec4(corner, 1.0f);
+			// reaches behind the camera, its rect is unbounded
+			if (clipCorner.w <= 0.0f) {
+				return false;
+			}
+			glm::vec3 ndc = glm::vec3(clipCorner) / clipCorner.w;
+			rectMin = glm::min(rectMin, glm::vec2(ndc));
+			rectMax = glm::max(rectMax, glm::vec2(ndc));
+			nearest = std::min(nearest, ndc.z);
+		}
+		if (nearest <= 0.0f) {
+			return false;
+		}
+
+		// every pixel the rect touches
+		glm::vec2 size(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+		glm::ivec2 pixelMin = glm::ivec2(glm::floor(glm::clamp(rectMin * 0.5f + 0.5f, 0.0f, 1.0f) * size));
+		glm::ivec2 pixelMax = glm::ivec2(glm::floor(glm::clamp(rectMax * 0.5f + 0.5f, 0.0f, 1.0f) * size));
+		pixelMax = glm::min(pixelMax, glm::ivec2(OCCLUSION_WIDTH - 1, OCCLUSION_HEIGHT - 1));
+
+		// the tiles that are all in front of it hide their part, the others are checked pixel by pixel
+		for (int32_t ty = pixelMin.y / tileSize; ty <= pixelMax.y / (int32_t)tileSize; ++ty) {
+			for (int32_t tx = pixelMin.x / tileSize; tx <= pixelMax.x / (int32_t)tileSize; ++tx) {
+				if (tileMax[ty * tilesX + tx] < nearest) {
+					continue;
+				}
+				int32_t y0 = std::max(pixelMin.y, ty * (int32_t)tileSize);
+				int32_t y1 = std::min(pixelMax.y, (ty + 1) * (int32_t)tileSize - 1);
+				int32_t x0 = std::max(pixelMin.x, tx * (int32_t)tileSize);
+				int32_t x1 = std::min(pixelMax.x, (tx + 1) * (int32_t)tileSize - 1);
+				for (int32_t y = y0; y <= y1; ++y) {
+					for (int32_t x = x0; x <= x1; ++x) {
+						if (depth[y * OCCLUSION_WIDTH + x] >= nearest) {
+							return false;
+						}
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+}
@@ -0,0 +1,236 @@
+#include "vulkanPipelines.h"
+
+#include <atomic>
+#include <exception>
+#include <iostream>
+
+
+namespace vkx {
+
+	namespace {
+
+		vk::Pipeline createGraphicsPipeline(const vkx::Context &context, const GraphicsPipelineDesc &desc, const std::vector<vk::PipelineShaderStageCreateInfo> &stages) {
+
+			vk::PipelineInputAssemblyStateCreateInfo inputAssemblyState;
+			inputAssemblyState.topology = vk::PrimitiveTopology::eTriangleList;
+
+			vk::PipelineRasterizationStateCreateInfo rasterizationState =
+				vkx::pipelineRasterizationStateCreateInfo(
+					vk::PolygonMode::eFill,
+					desc.cullMode,
+					vk::FrontFace::eClockwise);
+			rasterizationState.depthBiasEnable = desc.depthBias;
+
+			std::vector<vk::PipelineColorBlendAttachmentState> blendAttachmentStates(desc.colorAttachments, vkx::pipelineColorBlendAttachmentState());
+			vk::PipelineColorBlendStateCreateInfo colorBlendState;
+			colorBlendState.attachmentCount = (uint32_t)blendAttachmentStates.size();
+			colorBlendState.pAttachments = blendAttachmentStates.data();
+
+			vk::PipelineDepthStencilStateCreateInfo depthStencilState;
+			depthStencilState.depthTestEnable = VK_TRUE;
+			depthStencilState.depthWriteEnable = VK_TRUE;
+			depthStencilState.depthCompareOp = vk::CompareOp::eLessOrEqual;
+
+			vk::PipelineViewportStateCreateInfo viewportState;
+			viewportState.scissorCount = 1;
+			viewportState.viewportCount = 1;
+
+			vk::PipelineMultisampleStateCreateInfo multisampleState = vkx::pipelineMultisampleStateCreateInfo(vk::SampleCountFlagBits::e1);
+
+			std::vector<vk::DynamicState> dynamicStateEnables = {
+				vk::DynamicState::eViewport,
+				vk::DynamicState::eScissor
+			};
+			if (desc.depthBias) {
+				dynamicStateEnables.push_back(vk::DynamicState::eDepthBias);
+			}
+			vk::PipelineDynamicStateCreateInfo dynamicState;
+			dynamicState.dynamicStateCount = (uint32_t)dynamicStateEnables.size();
+			dynamicState.pDynamicStates = dynamicStateEnables.data();
+
+			vk::GraphicsPipelineCreateInfo pipelineCreateInfo;
+			pipelineCreateInfo.layout = desc.layout;
+			pipelineCreateInfo.renderPass = desc.renderPass;
+			pipelineCreateInfo.pVertexInputState = &desc.vertexInput;
+			pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+			pipelineCreateInfo.pRasterizationState = &rasterizationState;
+			pipelineCreateInfo.pColorBlendState = &colorBlendState;
+			pipelineCreateInfo.pMultisampleState = &multisampleState;
+			pipelineCreateInfo.pViewportState = &viewportState;
+			pipelineCreateInfo.pDepthStencilState = &depthStencilState;
+			pipelineCreateInfo.pDynamicState = &dynamicState;
+
+			// same constants for every stage, a stage ignores the ids it doesn't declare
+			std::vector<vk::SpecializationMapEntry> specializationEntries;
+			for (uint32_t i = 0; i < desc.specialization.size(); ++i) {
+				specializationEntries.push_back(vk::SpecializationMapEntry(i, i * sizeof(uint32_t), sizeof(uint32_t)));
+			}
+			vk::SpecializationInfo specializationInfo(
+				(uint32_t)specializationEntries.size(),
+				specializationEntries.data(),
+				desc.specialization.size() * sizeof(uint32_t),
+				desc.specialization.data());
+
+			std::vector<vk::PipelineShaderStageCreateInfo> specializedStages = stages;
+			if (!desc.specialization.empty()) {
+				for (auto &stage : specializedStages) {
+					stage.pSpecializationInfo = &specializationInfo;
+				}
+			}
+
+			pipelineCreateInfo.stageCount = (uint32_t)specializedStages.size();
+			pipelineCreateInfo.pStages = specializedStages.data();
+
+			return context.device.createGraphicsPipeline(context.pipelineCache, pipelineCreateInfo, nullptr);
+		}
+
+	}
+
+
+
+	std::vector<vk::Pipeline> createGraphicsPipelines(const vkx::Context &context, vkx::ThreadPool &threads, const std::vector<GraphicsPipelineDesc> &descs) {
+
+		// shaders are loaded here first so a missing file throws before any thread starts
+		// the shader cache only makes one module per file
+		std::vector<std::vector<vk::PipelineShaderStageCreateInfo>> stages(descs.size());
+		for (size_t i = 0; i < descs.size(); ++i) {
+			for (auto &shader : descs[i].shaders) {
+				stages[i].push_back(context.loadShader(shader.first, shader.second));
+			}
+		}
+
+		std::vector<vk::Pipeline> pipelines(descs.size());
+		std::vector<std::exception_ptr> errors(descs.size());
+
+		// no threads, just do it here
+		if (threads.threads.empty()) {
+			for (size_t i = 0; i < descs.size(); ++i) {
+				pipelines[i] = createGraphicsPipeline(context, descs[i], stages[i]);
+			}
+			return pipelines;
+		}
+
+		// each thread keeps taking the next pipeline off the list, so one slow pipeline
+		// (the shadow one with its geometry shader) doesn't hold up the ones queued behind it
+		// every pipeline only writes its own slot
+		std::atomic<size_t> next{ 0 };
+		for (auto &thread : threads.threads) {
+			thread->addJob([&] {
+				size_t i;
+				while ((i = next++) < descs.size()) {
+					try {
+						pipelines[i] = createGraphicsPipeline(context, descs[i], stages[i]);
+					} catch (...) {
+						errors[i] = std::current_exception();
+					}
+				}
+			});
+		}
+		threads.wait();
+
+		for (size_t i = 0; i < descs.size(); ++i) {
+			if (errors[i]) {
+				// don't leak the ones that did get created
+				for (auto &pipeline : pipelines) {
+					if (pipeline) {
+						context.device.destroyPipeline(pipeline);
+					}
+				}
+				std::rethrow_exception(errors[i]);
+			}
+		}
+
+		return pipelines;
+	}
+
+
+
+
+	uint64_t PipelineVariants::key(const std::string &name, const std::vector<uint32_t> &specialization) {
+		return vkx::hash64(specialization, vkx::hash64(name.data(), name.size()));
+	}
+
+	void PipelineVariants::addBase(const GraphicsPipelineDesc &desc, vk::Pipeline pipeline) {
+		std::lock_guard<std::mutex> lock(mutex);
+		Base &base = bases[desc.name];
+		base.desc = desc;
+		base.current = pipeline;
+
+		Variant &variant = variants[key(desc.name, desc.specialization)];
+		variant.pipeline = pipeline;
+		variant.owned = false;
+	}
+
+	vk::Pipeline PipelineVariants::get(const std::string &name, const std::vector<uint32_t> &specialization) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto foundBase = bases.find(name);
+		if (foundBase == bases.end()) {
+			throw std::runtime_error("No pipeline variants for " + name);
+		}
+		Base &base = foundBase->second;
+
+		uint64_t variantKey = key(name, specialization);
+		auto found = variants.find(variantKey);
+		if (found != variants.end()) {
+			if (found->second.pipeline) {
+				base.current = found->second.pipeline;
+			}
+			return base.current;
+		}
+
+		// first time it's asked for, compile it in the background
+		variants[variantKey] = Variant();
+		++pending;
+
+		GraphicsPipelineDesc desc = base.desc;
+		desc.specialization = specialization;
+		compileThread.addJob([this, desc, variantKey] {
+			vk::Pipeline pipeline;
+			try {
+				std::vector<vk::PipelineShaderStageCreateInfo> stages;
+				for (auto &shader : desc.shaders) {
+					stages.push_back(context.loadShader(shader.first, shader.second));
+				}
+				pipeline = createGraphicsPipeline(context, desc, stages);
+			} catch (std::exception &e) {
+				// stays null, so it isn't tried again and the previous variant keeps being used
+				std::cout << "pipeline variant " << desc.name << " failed: " << e.what() << std::endl;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			variants[variantKey].pipeline = pipeline;
+			--pending;
+			if (pipeline) {
+				++compiled;
+			}
+		});
+
+		return base.current;
+	}
+
+	void PipelineVariants::destroy() {
+		compileThread.wait();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto &variant : variants) {
+			if (variant.second.owned && variant.second.pipeline) {
+				context.device.destroyPipeline(variant.second.pipeline);
+			}
+		}
+		variants.clear();
+		bases.clear();
+	}
+
+	uint32_t PipelineVariants::compiledCount() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return compiled;
+	}
+
+	uint32_t PipelineVariants::pendingCount() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return pending;
+	}
+
+}
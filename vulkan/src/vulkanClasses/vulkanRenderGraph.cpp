@@ -0,0 +1,705 @@
+#include "vulkanRenderGraph.h"
+
+
+namespace vkx {
+
+	namespace {
+		bool isDepthFormat(vk::Format format) {
+			switch (format) {
+				case vk::Format::eD16Unorm:
+				case vk::Format::eX8D24UnormPack32:
+				case vk::Format::eD32Sfloat:
+				case vk::Format::eD16UnormS8Uint:
+				case vk::Format::eD24UnormS8Uint:
+				case vk::Format::eD32SfloatS8Uint:
+					return true;
+				default:
+					return false;
+			}
+		}
+
+		// everything an earlier user of the attachment's memory could have done to it:
+		// sampled it (last frame, or an attachment it's aliased with), written it as an attachment or copied it
+		const vk::PipelineStageFlags previousUseStages = vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests | vk::PipelineStageFlagBits::eTransfer;
+		const vk::AccessFlags previousUseAccess = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite | vk::AccessFlagBits::eTransferRead | vk::AccessFlagBits::eTransferWrite;
+
+		// what the next user of an attachment could do to it first
+		const vk::PipelineStageFlags nextUseStages = vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+
+		vk::ImageMemoryBarrier layoutBarrier(const RenderGraph::Attachment &a, vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::AccessFlags srcAccess, vk::AccessFlags dstAccess) {
+			vk::ImageMemoryBarrier barrier;
+			barrier.srcAccessMask = srcAccess;
+			barrier.dstAccessMask = dstAccess;
+			barrier.oldLayout = oldLayout;
+			barrier.newLayout = newLayout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = a.image;
+			barrier.subresourceRange = a.subresourceRange;
+			return barrier;
+		}
+	}
+
+
+
+	uint32_t RenderGraph::attachmentIndex(const std::string &name) const {
+		auto it = attachmentIndices.find(name);
+		if (it == attachmentIndices.end()) {
+			throw std::runtime_error("Render graph: no attachment named " + name);
+		}
+		return it->second;
+	}
+
+	uint32_t RenderGraph::passIndex(const std::string &name) const {
+		auto it = passIndices.find(name);
+		if (it == passIndices.end()) {
+			throw std::runtime_error("Render graph: no pass named " + name);
+		}
+		return it->second;
+	}
+
+	const RenderGraph::Attachment &RenderGraph::attachment(const std::string &name) const {
+		return attachments[attachmentIndex(name)];
+	}
+
+	const RenderGraph::Pass &RenderGraph::pass(const std::string &name) const {
+		return passes[passIndex(name)];
+	}
+
+	vk::DescriptorImageInfo RenderGraph::descriptor(const std::string &name, vk::Sampler sampler) const {
+		const Attachment &a = attachment(name);
+		return vkx::descriptorImageInfo(sampler, a.view, a.readLayout);
+	}
+
+
+
+
+	/* DECLARATION */
+
+	void RenderGraph::addAttachment(const std::string &name, vk::Format format, glm::uvec2 size, uint32_t layers) {
+		if (attachmentIndices.count(name)) {
+			throw std::runtime_error("Render graph: attachment " + name + " added twice");
+		}
+		Attachment a;
+		a.name = name;
+		a.format = format;
+		a.size = size;
+		a.layers = layers;
+		a.depth = isDepthFormat(format);
+		attachmentIndices[name] = (uint32_t)attachments.size();
+		attachments.push_back(a);
+	}
+
+	void RenderGraph::addOutput(const std::string &name) {
+		attachments[attachmentIndex(name)].output = true;
+	}
+
+	void RenderGraph::addPass(const std::string &name) {
+		if (passIndices.count(name)) {
+			throw std::runtime_error("Render graph: pass " + name + " added twice");
+		}
+		Pass p;
+		p.name = name;
+		passIndices[name] = (uint32_t)passes.size();
+		passes.push_back(p);
+	}
+
+	void RenderGraph::writeColor(const std::string &passName, const std::string &name, vk::ClearColorValue clear) {
+		uint32_t p = passIndex(passName);
+		uint32_t a = attachmentIndex(name);
+		if (attachments[a].depth) {
+			throw std::runtime_error("Render graph: " + name + " is a depth attachment, written as color by " + passName);
+		}
+		if (attachments[a].writer != -1) {
+			throw std::runtime_error("Render graph: " + name + " is written by more than one pass");
+		}
+		attachments[a].writer = p;
+		attachments[a].clearValue.color = clear;
+		passes[p].colorWrites.push_back(a);
+	}
+
+	void RenderGraph::writeDepth(const std::string &passName, const std::string &name, vk::ClearDepthStencilValue clear) {
+		uint32_t p = passIndex(passName);
+		uint32_t a = attachmentIndex(name);
+		if (!attachments[a].depth) {
+			throw std::runtime_error("Render graph: " + name + " is a color attachment, written as depth by " + passName);
+		}
+		if (attachments[a].writer != -1) {
+			throw std::runtime_error("Render graph: " + name + " is written by more than one pass");
+		}
+		if (passes[p].depthWrite != -1) {
+			throw std::runtime_error("Render graph: pass " + passName + " writes more than one depth attachment");
+		}
+		attachments[a].writer = p;
+		attachments[a].clearValue.depthStencil = clear;
+		passes[p].depthWrite = a;
+	}
+
+	void RenderGraph::read(const std::string &passName, const std::string &name) {
+		uint32_t p = passIndex(passName);
+		uint32_t a = attachmentIndex(name);
+		passes[p].reads.push_back(a);
+		attachments[a].readers.push_back(p);
+	}
+
+	void RenderGraph::appendTo(const std::string &passName, const std::string &previous) {
+		uint32_t p = passIndex(passName);
+		uint32_t prev = passIndex(previous);
+		if (prev >= p) {
+			throw std::runtime_error("Render graph: pass " + passName + " appends to " + previous + ", which isn't before it");
+		}
+		if (!passes[p].colorWrites.empty() || passes[p].depthWrite != -1) {
+			throw std::runtime_error("Render graph: pass " + passName + " appends to " + previous + " and writes its own attachments");
+		}
+		passes[p].appendsTo = prev;
+		passes[p].colorWrites = passes[prev].colorWrites;
+		passes[p].depthWrite = passes[prev].depthWrite;
+
+		// reading them keeps previous alive for as long as the pass is, and the attachments alive until it's done
+		for (uint32_t a : passes[prev].colorWrites) {
+			read(passName, attachments[a].name);
+		}
+		if (passes[prev].depthWrite != -1) {
+			read(passName, attachments[passes[prev].depthWrite].name);
+		}
+	}
+
+	void RenderGraph::setViewMask(const std::string &passName, uint32_t viewMask) {
+		passes[passIndex(passName)].viewMask = viewMask;
+	}
+
+	void RenderGraph::setPersistent(const std::string &name) {
+		attachments[attachmentIndex(name)].persistent = true;
+	}
+
+	void RenderGraph::copy(const std::string &passName, const std::string &source, const std::string &destination) {
+		uint32_t p = passIndex(passName);
+		uint32_t src = attachmentIndex(source);
+		uint32_t dst = attachmentIndex(destination);
+		const Attachment &s = attachments[src];
+		const Attachment &d = attachments[dst];
+		if (d.writer != (int32_t)p) {
+			throw std::runtime_error("Render graph: pass " + passName + " copies into " + destination + ", which it doesn't write");
+		}
+		if (s.format != d.format || s.size != d.size || s.layers != d.layers) {
+			throw std::runtime_error("Render graph: " + source + " and " + destination + " don't match, can't copy");
+		}
+		if (passes[p].copySource != -1) {
+			throw std::runtime_error("Render graph: pass " + passName + " copies more than once");
+		}
+		passes[p].copySource = src;
+		passes[p].copyDestination = dst;
+		attachments[src].copySource = true;
+		attachments[dst].copyDestination = true;
+		read(passName, source);
+	}
+
+
+
+
+	/* COMPILE */
+
+	void RenderGraph::compile() {
+		computeLifetimes();
+		createImages();
+		for (auto &p : passes) {
+			createRenderPass(p);
+		}
+		clearPersistent();
+	}
+
+	void RenderGraph::computeLifetimes() {
+		for (auto &a : attachments) {
+			if (a.writer == -1) {
+				throw std::runtime_error("Render graph: nothing writes " + a.name);
+			}
+			a.firstUse = a.writer;
+			a.lastUse = a.writer;
+			for (uint32_t reader : a.readers) {
+				if (reader <= (uint32_t)a.writer) {
+					throw std::runtime_error("Render graph: pass " + passes[reader].name + " reads " + a.name + " before it's written");
+				}
+				a.lastUse = std::max(a.lastUse, reader);
+			}
+			// outputs are sampled after the last pass, persistent attachments by the next frame
+			if (a.output || a.persistent) {
+				a.lastUse = (uint32_t)passes.size();
+			}
+
+			a.readLayout = a.depth ? vk::ImageLayout::eDepthStencilReadOnlyOptimal : vk::ImageLayout::eShaderReadOnlyOptimal;
+		}
+	}
+
+	void RenderGraph::createImages() {
+
+		// create the images first, aliasing needs their memory requirements
+		std::vector<vk::MemoryRequirements> memReqs(attachments.size());
+		for (size_t i = 0; i < attachments.size(); ++i) {
+			Attachment &a = attachments[i];
+
+			vk::ImageCreateInfo imageInfo;
+			imageInfo.imageType = vk::ImageType::e2D;
+			imageInfo.format = a.format;
+			imageInfo.extent.width = a.size.x;
+			imageInfo.extent.height = a.size.y;
+			imageInfo.extent.depth = 1;
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = a.layers;
+			imageInfo.samples = vk::SampleCountFlagBits::e1;
+			imageInfo.tiling = vk::ImageTiling::eOptimal;
+			imageInfo.usage = a.depth ? vk::ImageUsageFlagBits::eDepthStencilAttachment : vk::ImageUsageFlagBits::eColorAttachment;
+			if (!a.readers.empty() || a.output) {
+				imageInfo.usage |= vk::ImageUsageFlagBits::eSampled;
+			}
+			if (a.copySource) {
+				imageInfo.usage |= vk::ImageUsageFlagBits::eTransferSrc;
+			}
+			// persistent attachments are cleared with a transfer
+			if (a.copyDestination || a.persistent) {
+				imageInfo.usage |= vk::ImageUsageFlagBits::eTransferDst;
+			}
+			a.image = context.device.createImage(imageInfo);
+			memReqs[i] = context.device.getImageMemoryRequirements(a.image);
+			requiredBytes += memReqs[i].size;
+		}
+
+
+		// greedy aliasing: in order of first use, put each transient attachment in the first block
+		// whose current owner is done with it before the attachment is first written
+		struct Block {
+			vk::DeviceSize size = 0;
+			uint32_t typeBits = 0;
+			uint32_t lastUse = 0;
+			bool shared = false;
+		};
+		std::vector<Block> blocks;
+
+		std::vector<uint32_t> order(attachments.size());
+		for (uint32_t i = 0; i < order.size(); ++i) {
+			order[i] = i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return attachments[a].firstUse < attachments[b].firstUse; });
+
+		for (uint32_t i : order) {
+			Attachment &a = attachments[i];
+
+			int32_t found = -1;
+			bool shared = !a.output && !a.persistent;
+			if (shared) {
+				for (size_t b = 0; b < blocks.size(); ++b) {
+					if (blocks[b].shared && blocks[b].lastUse < a.firstUse && (blocks[b].typeBits & memReqs[i].memoryTypeBits)) {
+						found = (int32_t)b;
+						break;
+					}
+				}
+			}
+
+			if (found == -1) {
+				Block block;
+				block.typeBits = memReqs[i].memoryTypeBits;
+				block.shared = shared;
+				found = (int32_t)blocks.size();
+				blocks.push_back(block);
+			}
+
+			// everything is bound at offset 0, so the block only has to be as big as its biggest image
+			Block &block = blocks[found];
+			block.size = std::max(block.size, memReqs[i].size);
+			block.typeBits &= memReqs[i].memoryTypeBits;
+			block.lastUse = a.lastUse;
+			a.memoryBlock = (uint32_t)found;
+		}
+
+		for (auto &block : blocks) {
+			vk::MemoryAllocateInfo memAllocInfo;
+			memAllocInfo.allocationSize = block.size;
+			memAllocInfo.memoryTypeIndex = context.getMemoryType(block.typeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+			memoryBlocks.push_back(context.device.allocateMemory(memAllocInfo));
+			allocatedBytes += block.size;
+		}
+
+
+		for (auto &a : attachments) {
+			context.device.bindImageMemory(a.image, memoryBlocks[a.memoryBlock], 0);
+
+			a.subresourceRange = vk::ImageSubresourceRange();
+			a.subresourceRange.aspectMask = a.depth ? vk::ImageAspectFlagBits::eDepth : vk::ImageAspectFlagBits::eColor;
+			a.subresourceRange.levelCount = 1;
+			a.subresourceRange.layerCount = a.layers;
+
+			vk::ImageViewCreateInfo imageViewInfo;
+			imageViewInfo.viewType = (a.layers == 1) ? vk::ImageViewType::e2D : vk::ImageViewType::e2DArray;
+			imageViewInfo.format = a.format;
+			imageViewInfo.subresourceRange = a.subresourceRange;
+			imageViewInfo.image = a.image;
+			a.view = context.device.createImageView(imageViewInfo);
+		}
+	}
+
+	void RenderGraph::createRenderPass(Pass &pass) {
+
+		// passes without attachments bring their own render pass, or don't need one
+		if (pass.colorWrites.empty() && pass.depthWrite == -1) {
+			return;
+		}
+
+		std::vector<uint32_t> writes = pass.colorWrites;
+		if (pass.depthWrite != -1) {
+			writes.push_back(pass.depthWrite);
+		}
+
+		pass.size = attachments[writes[0]].size;
+		uint32_t layers = 1;
+
+		std::vector<vk::AttachmentDescription> attachmentDescs;
+		std::vector<vk::AttachmentReference> colorReferences;
+		vk::AttachmentReference depthReference;
+		std::vector<vk::ImageView> views;
+		pass.clearValues.clear();
+
+		for (uint32_t index : writes) {
+			Attachment &a = attachments[index];
+			assert(a.size == pass.size);
+			layers = std::max(layers, a.layers);
+
+			// only keep the contents if somebody samples them, and leave them in the layout they're sampled in
+			bool keep = a.output || a.persistent || !a.readers.empty();
+			vk::ImageLayout attachmentLayout = a.depth ? vk::ImageLayout::eDepthStencilAttachmentOptimal : vk::ImageLayout::eColorAttachmentOptimal;
+
+			vk::AttachmentDescription desc;
+			desc.format = a.format;
+			desc.samples = vk::SampleCountFlagBits::e1;
+			// every attachment is cleared by its only writer, so whatever was in the memory before doesn't matter
+			desc.loadOp = vk::AttachmentLoadOp::eClear;
+			desc.storeOp = keep ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare;
+			desc.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+			desc.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+			desc.initialLayout = vk::ImageLayout::eUndefined;
+			desc.finalLayout = keep ? a.readLayout : attachmentLayout;
+
+			// except the ones that start out with something in them: last frame's contents, the copy,
+			// or what the pass appends to, which previous left in its read layout
+			if (a.persistent || pass.appendsTo != -1) {
+				desc.loadOp = vk::AttachmentLoadOp::eLoad;
+				desc.initialLayout = a.readLayout;
+			} else if ((int32_t)index == pass.copyDestination) {
+				desc.loadOp = vk::AttachmentLoadOp::eLoad;
+				desc.initialLayout = attachmentLayout;
+			}
+
+			uint32_t reference = (uint32_t)attachmentDescs.size();
+			if (a.depth) {
+				depthReference = vk::AttachmentReference(reference, attachmentLayout);
+			} else {
+				colorReferences.push_back(vk::AttachmentReference(reference, attachmentLayout));
+			}
+
+			attachmentDescs.push_back(desc);
+			views.push_back(a.view);
+			pass.clearValues.push_back(a.clearValue);
+		}
+
+		vk::SubpassDescription subpass;
+		subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+		subpass.colorAttachmentCount = (uint32_t)colorReferences.size();
+		subpass.pColorAttachments = colorReferences.data();
+		if (pass.depthWrite != -1) {
+			subpass.pDepthStencilAttachment = &depthReference;
+		}
+
+
+		// the dependencies are the barriers between passes:
+		// in: wait for whatever last used the memory (last frame's readers, or an attachment aliased with it)
+		// out: make the writes visible to the passes that sample them (and composition, for outputs)
+		vk::PipelineStageFlags writeStages;
+		vk::AccessFlags writeAccess;
+		if (!pass.colorWrites.empty()) {
+			writeStages |= vk::PipelineStageFlagBits::eColorAttachmentOutput;
+			writeAccess |= vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+		}
+		if (pass.depthWrite != -1) {
+			writeStages |= vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+			writeAccess |= vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+		}
+
+		std::array<vk::SubpassDependency, 2> dependencies;
+
+		dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[0].dstSubpass = 0;
+		dependencies[0].srcStageMask = previousUseStages;
+		dependencies[0].dstStageMask = writeStages;
+		dependencies[0].srcAccessMask = previousUseAccess;
+		dependencies[0].dstAccessMask = writeAccess;
+
+		// not by region, the readers sample around the pixel they're shading, or all of it (compute)
+		dependencies[1].srcSubpass = 0;
+		dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+		dependencies[1].srcStageMask = writeStages;
+		dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eComputeShader;
+		dependencies[1].srcAccessMask = writeAccess;
+		dependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+		vk::RenderPassCreateInfo renderPassInfo;
+		renderPassInfo.attachmentCount = (uint32_t)attachmentDescs.size();
+		renderPassInfo.pAttachments = attachmentDescs.data();
+		renderPassInfo.subpassCount = 1;
+		renderPassInfo.pSubpasses = &subpass;
+		renderPassInfo.dependencyCount = (uint32_t)dependencies.size();
+		renderPassInfo.pDependencies = dependencies.data();
+		pass.renderPass = context.device.createRenderPass(renderPassInfo);
+
+		vk::FramebufferCreateInfo framebufferInfo;
+		framebufferInfo.renderPass = pass.renderPass;
+		framebufferInfo.attachmentCount = (uint32_t)views.size();
+		framebufferInfo.pAttachments = views.data();
+		framebufferInfo.width = pass.size.x;
+		framebufferInfo.height = pass.size.y;
+		framebufferInfo.layers = layers;
+		pass.framebuffer = context.device.createFramebuffer(framebufferInfo);
+
+		// same attachments and dependencies, the views are the layers
+		// the views are all rendered together, so they're also marked as correlated
+		if (pass.viewMask) {
+			vk::RenderPassMultiviewCreateInfoKHX multiviewInfo(1, &pass.viewMask, 0, nullptr, 1, &pass.viewMask);
+			renderPassInfo.pNext = &multiviewInfo;
+			pass.multiviewRenderPass = context.device.createRenderPass(renderPassInfo);
+
+			// a multiview framebuffer has one layer, the views index the image view's layers
+			framebufferInfo.renderPass = pass.multiviewRenderPass;
+			framebufferInfo.layers = 1;
+			pass.multiviewFramebuffer = context.device.createFramebuffer(framebufferInfo);
+		}
+	}
+
+	// the writer of a persistent attachment loads it, so it has to be in its read layout with something in it
+	void RenderGraph::clearPersistent() {
+		for (auto &a : attachments) {
+			if (!a.persistent) {
+				continue;
+			}
+			context.withPrimaryCommandBuffer([&](vk::CommandBuffer cmdBuffer) {
+				vkx::setImageLayout(cmdBuffer, a.image, a.subresourceRange.aspectMask, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, a.subresourceRange);
+				if (a.depth) {
+					cmdBuffer.clearDepthStencilImage(a.image, vk::ImageLayout::eTransferDstOptimal, a.clearValue.depthStencil, a.subresourceRange);
+				} else {
+					cmdBuffer.clearColorImage(a.image, vk::ImageLayout::eTransferDstOptimal, a.clearValue.color, a.subresourceRange);
+				}
+				vkx::setImageLayout(cmdBuffer, a.image, a.subresourceRange.aspectMask, vk::ImageLayout::eTransferDstOptimal, a.readLayout, a.subresourceRange);
+			});
+		}
+	}
+
+	void RenderGraph::enableTimings(uint32_t frames) {
+		if (!context.deviceProperties.limits.timestampComputeAndGraphics) {
+			return;
+		}
+		vk::QueryPoolCreateInfo queryPoolInfo;
+		queryPoolInfo.queryType = vk::QueryType::eTimestamp;
+		queryPoolInfo.queryCount = frames * (uint32_t)passes.size() * 2;
+		queryPool = context.device.createQueryPool(queryPoolInfo);
+		timingFrames = frames;
+		timed.assign(frames * passes.size(), 0);
+	}
+
+	void RenderGraph::destroy() {
+		for (auto &p : passes) {
+			if (p.framebuffer) {
+				context.device.destroyFramebuffer(p.framebuffer);
+			}
+			if (p.renderPass) {
+				context.device.destroyRenderPass(p.renderPass);
+			}
+			if (p.multiviewFramebuffer) {
+				context.device.destroyFramebuffer(p.multiviewFramebuffer);
+			}
+			if (p.multiviewRenderPass) {
+				context.device.destroyRenderPass(p.multiviewRenderPass);
+			}
+		}
+		if (queryPool) {
+			context.device.destroyQueryPool(queryPool);
+			queryPool = vk::QueryPool();
+		}
+		timed.clear();
+		for (auto &a : attachments) {
+			if (a.view) {
+				context.device.destroyImageView(a.view);
+			}
+			if (a.image) {
+				context.device.destroyImage(a.image);
+			}
+		}
+		for (auto &memory : memoryBlocks) {
+			context.device.freeMemory(memory);
+		}
+
+		attachments.clear();
+		passes.clear();
+		attachmentIndices.clear();
+		passIndices.clear();
+		memoryBlocks.clear();
+		requiredBytes = 0;
+		allocatedBytes = 0;
+	}
+
+
+
+
+	/* RUNTIME */
+
+	void RenderGraph::setRecord(const std::string &name, std::function<void(vk::CommandBuffer)> record) {
+		passes[passIndex(name)].record = record;
+	}
+
+	void RenderGraph::setEnabled(const std::string &name, bool enabled) {
+		passes[passIndex(name)].enabled = enabled;
+	}
+
+	void RenderGraph::setOutputEnabled(const std::string &name, bool enabled) {
+		Attachment &a = attachments[attachmentIndex(name)];
+		assert(a.output);
+		a.outputEnabled = enabled;
+	}
+
+	void RenderGraph::setMultiview(const std::string &name, bool multiview) {
+		Pass &p = passes[passIndex(name)];
+		assert(!multiview || p.multiviewRenderPass);
+		p.multiview = multiview;
+	}
+
+	void RenderGraph::readTimings(uint32_t frame) {
+		if (!queryPool) {
+			return;
+		}
+		for (uint32_t i = 0; i < passes.size(); ++i) {
+			uint8_t &written = timed[frame * passes.size() + i];
+			if (!written) {
+				continue;
+			}
+			// the frame's fence has been waited on, so they should be there, don't stall if they aren't
+			uint64_t timestamps[2];
+			vk::Result result = context.device.getQueryPoolResults(queryPool, (frame * (uint32_t)passes.size() + i) * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), vk::QueryResultFlagBits::e64);
+			if (result == vk::Result::eSuccess) {
+				passes[i].gpuMS = (float)((timestamps[1] - timestamps[0]) * context.deviceProperties.limits.timestampPeriod / 1000000.0);
+			}
+			written = 0;
+		}
+	}
+
+	// walk backwards from the enabled outputs, a pass only runs if something
+	// that runs after it (or composition) samples what it writes
+	void RenderGraph::cull() {
+		needed.assign(attachments.size(), false);
+		for (size_t i = 0; i < attachments.size(); ++i) {
+			needed[i] = attachments[i].output && attachments[i].outputEnabled;
+		}
+
+		livePasses = 0;
+		culledPasses = 0;
+
+		for (size_t i = passes.size(); i-- > 0;) {
+			Pass &p = passes[i];
+
+			bool writesNeeded = p.colorWrites.empty() && p.depthWrite == -1;
+			for (uint32_t a : p.colorWrites) {
+				writesNeeded = writesNeeded || needed[a];
+			}
+			if (p.depthWrite != -1) {
+				writesNeeded = writesNeeded || needed[p.depthWrite];
+			}
+
+			p.live = p.enabled && writesNeeded;
+			if (!p.live) {
+				culledPasses++;
+				continue;
+			}
+
+			livePasses++;
+			for (uint32_t a : p.reads) {
+				needed[a] = true;
+			}
+		}
+	}
+
+	// the source goes to transfer src and back to its read layout, the destination ends up in its attachment layout
+	void RenderGraph::recordCopy(vk::CommandBuffer cmdBuffer, const Pass &pass) {
+		const Attachment &src = attachments[pass.copySource];
+		const Attachment &dst = attachments[pass.copyDestination];
+		vk::ImageLayout dstLayout = dst.depth ? vk::ImageLayout::eDepthStencilAttachmentOptimal : vk::ImageLayout::eColorAttachmentOptimal;
+		vk::AccessFlags dstAccess = dst.depth ?
+			vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite :
+			vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
+
+		std::array<vk::ImageMemoryBarrier, 2> before = {
+			layoutBarrier(src, src.readLayout, vk::ImageLayout::eTransferSrcOptimal, previousUseAccess, vk::AccessFlagBits::eTransferRead),
+			layoutBarrier(dst, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, previousUseAccess, vk::AccessFlagBits::eTransferWrite)
+		};
+		cmdBuffer.pipelineBarrier(previousUseStages, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlags(), nullptr, nullptr, before);
+
+		vk::ImageCopy region;
+		region.srcSubresource = vk::ImageSubresourceLayers(src.subresourceRange.aspectMask, 0, 0, src.layers);
+		region.dstSubresource = vk::ImageSubresourceLayers(dst.subresourceRange.aspectMask, 0, 0, dst.layers);
+		region.extent = vk::Extent3D(dst.size.x, dst.size.y, 1);
+		cmdBuffer.copyImage(src.image, vk::ImageLayout::eTransferSrcOptimal, dst.image, vk::ImageLayout::eTransferDstOptimal, region);
+
+		std::array<vk::ImageMemoryBarrier, 2> after = {
+			layoutBarrier(src, vk::ImageLayout::eTransferSrcOptimal, src.readLayout, vk::AccessFlagBits::eTransferRead, vk::AccessFlags()),
+			layoutBarrier(dst, vk::ImageLayout::eTransferDstOptimal, dstLayout, vk::AccessFlagBits::eTransferWrite, dstAccess)
+		};
+		cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, nextUseStages, vk::DependencyFlags(), nullptr, nullptr, after);
+	}
+
+	void RenderGraph::execute(vk::CommandBuffer cmdBuffer, uint32_t frame) {
+		cull();
+
+		// queries have to be reset before they're written again
+		uint32_t firstQuery = frame * (uint32_t)passes.size() * 2;
+		if (queryPool) {
+			assert(frame < timingFrames);
+			cmdBuffer.resetQueryPool(queryPool, firstQuery, (uint32_t)passes.size() * 2);
+		}
+
+		for (uint32_t i = 0; i < passes.size(); ++i) {
+			Pass &p = passes[i];
+			if (!p.live) {
+				continue;
+			}
+
+			if (!p.renderPass) {
+				if (p.record) {
+					p.record(cmdBuffer);
+				}
+				continue;
+			}
+
+			if (queryPool) {
+				cmdBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, queryPool, firstQuery + i * 2);
+			}
+
+			if (p.copySource != -1) {
+				recordCopy(cmdBuffer, p);
+			}
+
+			vk::RenderPassBeginInfo renderPassBeginInfo;
+			renderPassBeginInfo.renderPass = p.currentRenderPass();
+			renderPassBeginInfo.framebuffer = p.currentFramebuffer();
+			renderPassBeginInfo.renderArea.extent.width = p.size.x;
+			renderPassBeginInfo.renderArea.extent.height = p.size.y;
+			renderPassBeginInfo.clearValueCount = (uint32_t)p.clearValues.size();
+			renderPassBeginInfo.pClearValues = p.clearValues.data();
+
+			// a pass with nothing to record still clears its attachments
+			cmdBuffer.beginRenderPass(renderPassBeginInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+			if (p.record) {
+				p.record(cmdBuffer);
+			}
+			cmdBuffer.endRenderPass();
+
+			if (queryPool) {
+				cmdBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, firstQuery + i * 2 + 1);
+				timed[frame * passes.size() + i] = 1;
+			}
+		}
+	}
+
+}
@@ -0,0 +1,487 @@
+#include "vulkanShaderCache.h"
+
+#include "common.h"
+#include "vulkanTools.h"
+
+#if defined(_WIN32)
+	#include <windows.h>
+#elif !defined(__ANDROID__)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+
+namespace vkx {
+
+	namespace {
+
+		// read only view of a whole file
+		// android shaders are (compressed) assets in the apk, those are read into a buffer instead
+		class MappedFile {
+
+			public:
+
+				const uint8_t *data = nullptr;
+				size_t size = 0;
+
+				MappedFile(const std::string &path) {
+					#if defined(__ANDROID__)
+					AAsset *asset = AAssetManager_open(androidApp->activity->assetManager, path.c_str(), AASSET_MODE_STREAMING);
+					if (!asset) {
+						return;
+					}
+					buffer.resize(AAsset_getLength(asset));
+					AAsset_read(asset, buffer.data(), buffer.size());
+					AAsset_close(asset);
+					data = buffer.data();
+					size = buffer.size();
+					#elif defined(_WIN32)
+					file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+					if (file == INVALID_HANDLE_VALUE) {
+						return;
+					}
+					LARGE_INTEGER fileSize;
+					if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+						return;
+					}
+					mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+					if (!mapping) {
+						return;
+					}
+					data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+					size = data ? (size_t)fileSize.QuadPart : 0;
+					#else
+					fd = open(path.c_str(), O_RDONLY);
+					if (fd < 0) {
+						return;
+					}
+					struct stat fileStat;
+					if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+						return;
+					}
+					void *view = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+					if (view == MAP_FAILED) {
+						return;
+					}
+					data = (const uint8_t*)view;
+					size = fileStat.st_size;
+					#endif
+				}
+
+				~MappedFile() {
+					#if defined(_WIN32)
+					if (data) {
+						UnmapViewOfFile(data);
+					}
+					if (mapping) {
+						CloseHandle(mapping);
+					}
+					if (file != INVALID_HANDLE_VALUE) {
+						CloseHandle(file);
+					}
+					#elif !defined(__ANDROID__)
+					if (data) {
+						munmap((void*)data, size);
+					}
+					if (fd >= 0) {
+						close(fd);
+					}
+					#endif
+				}
+
+				MappedFile(const MappedFile&) = delete;
+				MappedFile &operator=(const MappedFile&) = delete;
+
+			private:
+
+				#if defined(__ANDROID__)
+				std::vector<uint8_t> buffer;
+				#elif defined(_WIN32)
+				HANDLE file = INVALID_HANDLE_VALUE;
+				HANDLE mapping = nullptr;
+				#else
+				int fd = -1;
+				#endif
+		};
+
+
+		// the bits of the SPIR-V spec reflection needs
+		namespace spv {
+			const uint32_t magic = 0x07230203;
+
+			const uint32_t opTypeInt = 21;
+			const uint32_t opTypeFloat = 22;
+			const uint32_t opTypeVector = 23;
+			const uint32_t opTypeMatrix = 24;
+			const uint32_t opTypeImage = 25;
+			const uint32_t opTypeSampler = 26;
+			const uint32_t opTypeSampledImage = 27;
+			const uint32_t opTypeArray = 28;
+			const uint32_t opTypeRuntimeArray = 29;
+			const uint32_t opTypeStruct = 30;
+			const uint32_t opTypePointer = 32;
+			const uint32_t opConstant = 43;
+			const uint32_t opVariable = 59;
+			const uint32_t opDecorate = 71;
+			const uint32_t opMemberDecorate = 72;
+
+			const uint32_t decorationBlock = 2;
+			const uint32_t decorationBufferBlock = 3;
+			const uint32_t decorationArrayStride = 6;
+			const uint32_t decorationBinding = 33;
+			const uint32_t decorationDescriptorSet = 34;
+			const uint32_t decorationOffset = 35;
+
+			const uint32_t storageUniformConstant = 0;
+			const uint32_t storageUniform = 2;
+			const uint32_t storagePushConstant = 9;
+			const uint32_t storageStorageBuffer = 12;
+
+			const uint32_t dimBuffer = 5;
+			const uint32_t dimSubpassData = 6;
+		}
+
+		struct SpirvId {
+			uint32_t opcode = 0;
+			const uint32_t *words = nullptr;
+
+			int64_t set = -1;
+			int64_t binding = -1;
+			bool bufferBlock = false;
+			uint32_t arrayStride = 0;
+			std::vector<uint32_t> memberOffsets;
+		};
+
+		// size of a type in bytes, as laid out by its offset/stride decorations
+		uint32_t typeSize(const std::vector<SpirvId> &ids, uint32_t id, uint32_t depth = 0) {
+			if (id >= ids.size() || depth > 16) {
+				return 0;
+			}
+			const SpirvId &type = ids[id];
+			switch (type.opcode) {
+				case spv::opTypeInt:
+				case spv::opTypeFloat:
+					return type.words[2] / 8;
+				case spv::opTypeVector:
+					return type.words[3] * typeSize(ids, type.words[2], depth + 1);
+				case spv::opTypeMatrix: {
+					// columns are 16 byte aligned (std140 and std430 agree for vec3/vec4 columns)
+					uint32_t column = typeSize(ids, type.words[2], depth + 1);
+					return type.words[3] * (column == 12 ? 16 : column);
+				}
+				case spv::opTypeArray: {
+					uint32_t length = type.words[3] < ids.size() && ids[type.words[3]].opcode == spv::opConstant ? ids[type.words[3]].words[3] : 0;
+					uint32_t stride = type.arrayStride ? type.arrayStride : typeSize(ids, type.words[2], depth + 1);
+					return length * stride;
+				}
+				case spv::opTypeStruct: {
+					uint32_t size = 0;
+					uint32_t memberCount = (type.words[0] >> 16) - 2;
+					for (uint32_t i = 0; i < memberCount; ++i) {
+						uint32_t memberSize = typeSize(ids, type.words[2 + i], depth + 1);
+						uint32_t offset = i < type.memberOffsets.size() ? type.memberOffsets[i] : size;
+						size = std::max(size, offset + memberSize);
+					}
+					return size;
+				}
+				default:
+					return 0;
+			}
+		}
+
+		bool compatible(vk::DescriptorType shader, vk::DescriptorType layout) {
+			if (shader == layout) {
+				return true;
+			}
+			// the shader can't tell dynamic offsets apart
+			if (shader == vk::DescriptorType::eUniformBuffer && layout == vk::DescriptorType::eUniformBufferDynamic) {
+				return true;
+			}
+			if (shader == vk::DescriptorType::eStorageBuffer && layout == vk::DescriptorType::eStorageBufferDynamic) {
+				return true;
+			}
+			return false;
+		}
+
+	}
+
+
+
+	bool reflectSpirv(const uint32_t *code, size_t wordCount, ShaderReflection &reflection) {
+
+		reflection = ShaderReflection();
+
+		if (wordCount < 5 || code[0] != spv::magic) {
+			return false;
+		}
+
+		// header: magic, version, generator, id bound, schema
+		std::vector<SpirvId> ids(code[3]);
+
+		for (size_t i = 5; i < wordCount;) {
+			uint32_t opcode = code[i] & 0xffff;
+			uint32_t count = code[i] >> 16;
+			if (count == 0 || i + count > wordCount) {
+				return false;
+			}
+			const uint32_t *words = code + i;
+
+			// where the result id is, if it's an instruction we care about
+			uint32_t resultWord = 0;
+			switch (opcode) {
+				case spv::opTypeInt:
+				case spv::opTypeFloat:
+				case spv::opTypeVector:
+				case spv::opTypeMatrix:
+				case spv::opTypeImage:
+				case spv::opTypeSampler:
+				case spv::opTypeSampledImage:
+				case spv::opTypeArray:
+				case spv::opTypeRuntimeArray:
+				case spv::opTypeStruct:
+				case spv::opTypePointer:
+					resultWord = 1;
+					break;
+				case spv::opConstant:
+				case spv::opVariable:
+					resultWord = 2;
+					break;
+
+				case spv::opDecorate:
+					if (count >= 3 && words[1] < ids.size()) {
+						SpirvId &target = ids[words[1]];
+						switch (words[2]) {
+							case spv::decorationDescriptorSet: target.set = count >= 4 ? words[3] : 0; break;
+							case spv::decorationBinding: target.binding = count >= 4 ? words[3] : 0; break;
+							case spv::decorationBufferBlock: target.bufferBlock = true; break;
+							case spv::decorationArrayStride: target.arrayStride = count >= 4 ? words[3] : 0; break;
+						}
+					}
+					break;
+
+				case spv::opMemberDecorate:
+					if (count >= 5 && words[1] < ids.size() && words[3] == spv::decorationOffset) {
+						std::vector<uint32_t> &offsets = ids[words[1]].memberOffsets;
+						if (offsets.size() <= words[2]) {
+							offsets.resize(words[2] + 1, 0);
+						}
+						offsets[words[2]] = words[4];
+					}
+					break;
+			}
+
+			if (resultWord && count > resultWord && words[resultWord] < ids.size()) {
+				ids[words[resultWord]].opcode = opcode;
+				ids[words[resultWord]].words = words;
+			}
+
+			i += count;
+		}
+
+		for (auto &variable : ids) {
+			if (variable.opcode != spv::opVariable) {
+				continue;
+			}
+			uint32_t storage = variable.words[3];
+			uint32_t pointer = variable.words[1];
+			if (pointer >= ids.size() || ids[pointer].opcode != spv::opTypePointer) {
+				continue;
+			}
+			uint32_t type = ids[pointer].words[3];
+
+			if (storage == spv::storagePushConstant) {
+				reflection.pushConstantSize = std::max(reflection.pushConstantSize, typeSize(ids, type));
+				continue;
+			}
+			if (storage != spv::storageUniformConstant && storage != spv::storageUniform && storage != spv::storageStorageBuffer) {
+				continue;
+			}
+			if (variable.set < 0 || variable.binding < 0) {
+				continue;
+			}
+
+			ShaderReflection::Binding binding;
+			binding.set = (uint32_t)variable.set;
+			binding.binding = (uint32_t)variable.binding;
+
+			// arrays of descriptors
+			while (type < ids.size() && (ids[type].opcode == spv::opTypeArray || ids[type].opcode == spv::opTypeRuntimeArray)) {
+				if (ids[type].opcode == spv::opTypeRuntimeArray) {
+					binding.count = 0;
+				} else {
+					uint32_t length = ids[type].words[3];
+					binding.count *= length < ids.size() && ids[length].opcode == spv::opConstant ? ids[length].words[3] : 1;
+				}
+				type = ids[type].words[2];
+			}
+			if (type >= ids.size()) {
+				continue;
+			}
+
+			const SpirvId &resource = ids[type];
+			switch (resource.opcode) {
+				case spv::opTypeSampledImage:
+					binding.type = vk::DescriptorType::eCombinedImageSampler;
+					break;
+				case spv::opTypeSampler:
+					binding.type = vk::DescriptorType::eSampler;
+					break;
+				case spv::opTypeImage: {
+					uint32_t dim = resource.words[3];
+					bool storageImage = resource.words[7] == 2;
+					if (dim == spv::dimBuffer) {
+						binding.type = storageImage ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+					} else if (dim == spv::dimSubpassData) {
+						binding.type = vk::DescriptorType::eInputAttachment;
+					} else {
+						binding.type = storageImage ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+					}
+					break;
+				}
+				case spv::opTypeStruct:
+					// old style storage buffers are uniform blocks decorated BufferBlock
+					binding.type = storage == spv::storageStorageBuffer || resource.bufferBlock ? vk::DescriptorType::eStorageBuffer : vk::DescriptorType::eUniformBuffer;
+					break;
+				default:
+					continue;
+			}
+			reflection.bindings.push_back(binding);
+		}
+
+		std::sort(reflection.bindings.begin(), reflection.bindings.end(), [](const ShaderReflection::Binding &a, const ShaderReflection::Binding &b) {
+			return a.set != b.set ? a.set < b.set : a.binding < b.binding;
+		});
+
+		return true;
+	}
+
+
+
+	std::vector<std::string> ShaderReflection::validate(
+		vk::ShaderStageFlagBits stage,
+		const std::vector<const std::vector<vk::DescriptorSetLayoutBinding>*> &setLayouts,
+		const std::vector<vk::PushConstantRange> &pushConstantRanges) const {
+
+		std::vector<std::string> problems;
+
+		for (auto &binding : bindings) {
+			std::string where = "set " + std::to_string(binding.set) + " binding " + std::to_string(binding.binding) + ": ";
+
+			if (binding.set >= setLayouts.size()) {
+				problems.push_back(where + "the pipeline layout only has " + std::to_string(setLayouts.size()) + " sets");
+				continue;
+			}
+			if (!setLayouts[binding.set]) {
+				continue;
+			}
+
+			const vk::DescriptorSetLayoutBinding *layoutBinding = nullptr;
+			for (auto &candidate : *setLayouts[binding.set]) {
+				if (candidate.binding == binding.binding) {
+					layoutBinding = &candidate;
+					break;
+				}
+			}
+			if (!layoutBinding) {
+				problems.push_back(where + "not in the set layout");
+				continue;
+			}
+
+			if (!compatible(binding.type, layoutBinding->descriptorType)) {
+				problems.push_back(where + "shader uses " + vk::to_string(binding.type) + ", layout has " + vk::to_string(layoutBinding->descriptorType));
+			}
+			if (binding.count > layoutBinding->descriptorCount) {
+				problems.push_back(where + "shader uses " + std::to_string(binding.count) + " descriptors, layout has " + std::to_string(layoutBinding->descriptorCount));
+			}
+			if (!(layoutBinding->stageFlags & stage)) {
+				problems.push_back(where + "not visible to the " + vk::to_string(stage) + " stage");
+			}
+		}
+
+		if (pushConstantSize > 0) {
+			uint32_t covered = 0;
+			for (auto &range : pushConstantRanges) {
+				if (range.stageFlags & stage) {
+					covered = std::max(covered, range.offset + range.size);
+				}
+			}
+			if (covered < pushConstantSize) {
+				problems.push_back("push constants: shader uses " + std::to_string(pushConstantSize) + " bytes, layout gives the " + vk::to_string(stage) + " stage " + std::to_string(covered));
+			}
+		}
+
+		return problems;
+	}
+
+
+
+	const CachedShader &ShaderCache::load(const std::string &path, vk::ShaderStageFlagBits stage) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto found = byPath.find(path);
+		if (found != byPath.end()) {
+			++pathHits;
+			return *found->second;
+		}
+
+		MappedFile file(path);
+		if (!file.data) {
+			throw std::runtime_error("Could not open shader " + path);
+		}
+		if (file.size % 4 != 0) {
+			throw std::runtime_error("Shader " + path + " isn't SPIR-V (size isn't a multiple of 4)");
+		}
+		bytesMapped += file.size;
+
+		uint64_t hash = vkx::hash64(file.data, file.size);
+		auto same = byHash.find(hash);
+		if (same != byHash.end() && same->second->size == file.size) {
+			++contentHits;
+			byPath[path] = same->second;
+			return *same->second;
+		}
+
+		// mappings are page aligned, so the code can go straight to the driver
+		const uint32_t *code = (const uint32_t*)file.data;
+
+		CachedShader shader;
+		shader.path = path;
+		shader.stage = stage;
+		shader.hash = hash;
+		shader.size = file.size;
+		if (!reflectSpirv(code, file.size / 4, shader.reflection)) {
+			throw std::runtime_error("Shader " + path + " isn't SPIR-V");
+		}
+
+		vk::ShaderModuleCreateInfo moduleCreateInfo;
+		moduleCreateInfo.codeSize = file.size;
+		moduleCreateInfo.pCode = code;
+		shader.module = device.createShaderModule(moduleCreateInfo);
+
+		shaders.push_back(std::move(shader));
+		CachedShader *cached = &shaders.back();
+		byPath[path] = cached;
+		byHash[hash] = cached;
+		return *cached;
+	}
+
+	const CachedShader *ShaderCache::find(const std::string &path) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = byPath.find(path);
+		return found != byPath.end() ? found->second : nullptr;
+	}
+
+	void ShaderCache::destroy() {
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto &shader : shaders) {
+			device.destroyShaderModule(shader.module);
+		}
+		shaders.clear();
+		byPath.clear();
+		byHash.clear();
+	}
+
+}
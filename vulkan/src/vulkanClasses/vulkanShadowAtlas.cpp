@@ -0,0 +1,135 @@
+#include "vulkanShadowAtlas.h"
+
+#include <algorithm>
+
+
+namespace vkx {
+
+	namespace {
+		uint32_t log2(uint32_t v) {
+			uint32_t l = 0;
+			while (v > 1) {
+				v >>= 1;
+				++l;
+			}
+			return l;
+		}
+
+		uint32_t nextPowerOfTwo(uint32_t v) {
+			uint32_t p = 1;
+			while (p < v) {
+				p <<= 1;
+			}
+			return p;
+		}
+	}
+
+
+
+	void ShadowAtlas::init(uint32_t pageSize, uint32_t pageCount, uint32_t minTileSize) {
+		rootSize = pageSize;
+		levels = log2(pageSize / minTileSize) + 1;
+
+		// 1 + 4 + 16 + ...
+		uint32_t nodeCount = 0;
+		for (uint32_t level = 0; level < levels; ++level) {
+			nodeCount += 1 << (2 * level);
+		}
+		pages.assign(pageCount, std::vector<NodeState>(nodeCount, nodeFree));
+		usedTexels = 0;
+	}
+
+	bool ShadowAtlas::allocate(uint32_t size, int32_t page, Tile &tile) {
+		uint32_t minTileSize = rootSize >> (levels - 1);
+		size = std::min(std::max(nextPowerOfTwo(size), minTileSize), rootSize);
+		uint32_t targetLevel = log2(rootSize / size);
+
+		uint32_t firstPage = page < 0 ? 0 : (uint32_t)page;
+		uint32_t lastPage = page < 0 ? (uint32_t)pages.size() : firstPage + 1;
+
+		// first only in nodes that are already split, so the big free ones stay whole for big tiles
+		for (int pass = 0; pass < 2; ++pass) {
+			for (uint32_t p = firstPage; p < lastPage; ++p) {
+				glm::uvec2 offset;
+				if (find(pages[p], 0, 0, targetLevel, glm::uvec2(0), pass == 1, offset) >= 0) {
+					tile.page = p;
+					tile.offset = offset;
+					tile.size = size;
+					usedTexels += (uint64_t)size * size;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	int32_t ShadowAtlas::find(std::vector<NodeState> &nodes, uint32_t node, uint32_t level, uint32_t targetLevel, glm::uvec2 offset, bool split, glm::uvec2 &found) {
+		NodeState state = nodes[node];
+
+		if (level == targetLevel) {
+			if (state != nodeFree) {
+				return -1;
+			}
+			nodes[node] = nodeUsed;
+			found = offset;
+			return (int32_t)node;
+		}
+
+		if (state == nodeUsed || (state == nodeFree && !split)) {
+			return -1;
+		}
+		// its children are all free
+		if (state == nodeFree) {
+			nodes[node] = nodeSplit;
+		}
+
+		uint32_t half = rootSize >> (level + 1);
+		for (uint32_t c = 0; c < 4; ++c) {
+			glm::uvec2 childOffset = offset + glm::uvec2(c & 1, c >> 1) * half;
+			int32_t result = find(nodes, 4 * node + 1 + c, level + 1, targetLevel, childOffset, split, found);
+			if (result >= 0) {
+				return result;
+			}
+		}
+		return -1;
+	}
+
+	void ShadowAtlas::release(Tile &tile) {
+		if (tile.size == 0) {
+			return;
+		}
+		std::vector<NodeState> &nodes = pages[tile.page];
+		uint32_t targetLevel = log2(rootSize / tile.size);
+
+		// walk down to the tile's node
+		uint32_t node = 0;
+		glm::uvec2 offset(0);
+		for (uint32_t level = 0; level < targetLevel; ++level) {
+			uint32_t half = rootSize >> (level + 1);
+			uint32_t cx = tile.offset.x >= offset.x + half ? 1 : 0;
+			uint32_t cy = tile.offset.y >= offset.y + half ? 1 : 0;
+			offset += glm::uvec2(cx, cy) * half;
+			node = 4 * node + 1 + cx + 2 * cy;
+		}
+		nodes[node] = nodeFree;
+
+		// merge back up while all four siblings are free
+		while (node > 0) {
+			uint32_t parent = (node - 1) / 4;
+			uint32_t firstChild = 4 * parent + 1;
+			bool allFree = true;
+			for (uint32_t c = 0; c < 4; ++c) {
+				allFree = allFree && nodes[firstChild + c] == nodeFree;
+			}
+			if (!allFree) {
+				break;
+			}
+			nodes[parent] = nodeFree;
+			node = parent;
+		}
+
+		usedTexels -= (uint64_t)tile.size * tile.size;
+		tile.size = 0;
+	}
+
+}
@@ -84,16 +84,23 @@ vkx::Texture vkx::TextureLoader::loadTexture(const std::string & filename, vk::F
 	free(textureData);
 	#else
 
+	gli::texture2d tex2D(gli::load(fileToLoad(filename).c_str()));
+
+	#endif
+	return loadTexture(tex2D, format, forceLinear, imageUsageFlags);
+}
+
+std::string vkx::TextureLoader::fileToLoad(const std::string & filename) {
 	std::string ext = filename.substr(filename.length()-3, 3);
 	std::string filenameKTX = filename;
 	if (ext == "png") {
 		filenameKTX = filename.substr(0, filename.length() - 3);
 		filenameKTX = filenameKTX + "ktx";
 	}
+	return filenameKTX;
+}
 
-	gli::texture2d tex2D(gli::load(filenameKTX.c_str()));
-
-	#endif
+vkx::Texture vkx::TextureLoader::loadTexture(const gli::texture2d & tex2D, vk::Format format, bool forceLinear, vk::ImageUsageFlags imageUsageFlags) {
 	assert(!tex2D.empty());
 
 	Texture texture;
@@ -462,7 +469,7 @@ vkx::Texture vkx::TextureLoader::loadTextureArray(const std::string & filename,
 	// Check if all array layers have the same dimesions
 	bool sameDims = true;
 	for (uint32_t layer = 0; layer < texture.layerCount; layer++) {
-		if (tex2DArray[layer].extent().x != texture.extent.width || tex2DArray[layer].extent().y != texture.extent.height) {
+		if ((uint32_t)tex2DArray[layer].extent().x != texture.extent.width || (uint32_t)tex2DArray[layer].extent().y != texture.extent.height) {
 			sameDims = false;
 			break;
 		}
@@ -583,7 +590,6 @@ vkx::Texture vkx::TextureLoader::loadTextureArray(const std::string & filename,
 
 	// Create image view
 	vk::ImageViewCreateInfo view;
-	view.image;
 	view.viewType = vk::ImageViewType::e2DArray;
 	view.format = format;
 	view.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
@@ -611,6 +617,151 @@ vkx::Texture vkx::TextureLoader::loadTextureArray(const std::string & filename,
 
 
 
+// Create an array texture from separate 2D textures
+
+vkx::Texture vkx::TextureLoader::loadTextureArray(const std::vector<gli::texture2d>& layers, vk::Format format) {
+	assert(!layers.empty());
+
+	Texture texture;
+	texture.device = this->context.device;
+	texture.extent.width = (uint32_t)layers[0][0].extent().x;
+	texture.extent.height = (uint32_t)layers[0][0].extent().y;
+	texture.mipLevels = (uint32_t)layers[0].levels();
+	texture.layerCount = (uint32_t)layers.size();
+
+	// Pack all layers into one staging buffer
+	vk::DeviceSize totalSize = 0;
+	for (auto &layer : layers) {
+		assert((uint32_t)layer[0].extent().x == texture.extent.width && (uint32_t)layer[0].extent().y == texture.extent.height);
+		assert(layer.levels() == texture.mipLevels);
+		totalSize += layer.size();
+	}
+
+	auto staging = context.createBuffer(vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eHostVisible, totalSize);
+	staging.map();
+
+	// Setup buffer copy regions for each mip level of each layer
+	std::vector<vk::BufferImageCopy> bufferCopyRegions;
+	vk::DeviceSize offset = 0;
+
+	for (uint32_t layer = 0; layer < texture.layerCount; layer++) {
+		staging.copy(layers[layer].size(), layers[layer].data(), offset);
+
+		for (uint32_t level = 0; level < texture.mipLevels; level++) {
+			vk::BufferImageCopy bufferCopyRegion;
+			bufferCopyRegion.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+			bufferCopyRegion.imageSubresource.mipLevel = level;
+			bufferCopyRegion.imageSubresource.baseArrayLayer = layer;
+			bufferCopyRegion.imageSubresource.layerCount = 1;
+			bufferCopyRegion.imageExtent.width = layers[layer][level].extent().x;
+			bufferCopyRegion.imageExtent.height = layers[layer][level].extent().y;
+			bufferCopyRegion.imageExtent.depth = 1;
+			bufferCopyRegion.bufferOffset = offset;
+			bufferCopyRegions.push_back(bufferCopyRegion);
+
+			offset += layers[layer][level].size();
+		}
+	}
+	staging.unmap();
+
+	// Create optimal tiled target image
+	vk::ImageCreateInfo imageCreateInfo;
+	imageCreateInfo.imageType = vk::ImageType::e2D;
+	imageCreateInfo.format = format;
+	imageCreateInfo.mipLevels = texture.mipLevels;
+	imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+	imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+	imageCreateInfo.sharingMode = vk::SharingMode::eExclusive;
+	imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+	imageCreateInfo.extent = texture.extent;
+	imageCreateInfo.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+	imageCreateInfo.arrayLayers = texture.layerCount;
+
+	texture = context.createImage(imageCreateInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+	vk::CommandBufferBeginInfo cmdBufInfo;
+	cmdBuffer.begin(cmdBufInfo);
+
+	vk::ImageSubresourceRange subresourceRange;
+	subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+	subresourceRange.baseMipLevel = 0;
+	subresourceRange.levelCount = texture.mipLevels;
+	subresourceRange.layerCount = texture.layerCount;
+
+	setImageLayout(
+		cmdBuffer,
+		texture.image,
+		vk::ImageAspectFlagBits::eColor,
+		vk::ImageLayout::eUndefined,
+		vk::ImageLayout::eTransferDstOptimal,
+		subresourceRange);
+
+	cmdBuffer.copyBufferToImage(staging.buffer, texture.image, vk::ImageLayout::eTransferDstOptimal, bufferCopyRegions);
+
+	texture.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+	setImageLayout(
+		cmdBuffer,
+		texture.image,
+		vk::ImageAspectFlagBits::eColor,
+		vk::ImageLayout::eTransferDstOptimal,
+		texture.imageLayout,
+		subresourceRange);
+
+	cmdBuffer.end();
+
+	// Create a fence to make sure that the copies have finished before continuing
+	vk::Fence copyFence;
+	copyFence = context.device.createFence(vk::FenceCreateInfo());
+
+	vk::SubmitInfo submitInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &cmdBuffer;
+
+	context.queue.submit(submitInfo, copyFence);
+	context.device.waitForFences(copyFence, VK_TRUE, DEFAULT_FENCE_TIMEOUT);
+	context.device.destroyFence(copyFence);
+	staging.destroy();
+
+	// Create sampler
+	// same settings as loadTexture(), each layer is sampled like a regular 2D texture
+	vk::SamplerCreateInfo sampler;
+	sampler.magFilter = vk::Filter::eLinear;
+	sampler.minFilter = vk::Filter::eLinear;
+	sampler.mipmapMode = vk::SamplerMipmapMode::eLinear;
+	sampler.maxLod = (float)texture.mipLevels;
+	sampler.maxAnisotropy = 8;
+	sampler.anisotropyEnable = VK_TRUE;
+	sampler.borderColor = vk::BorderColor::eFloatOpaqueWhite;
+	texture.sampler = context.device.createSampler(sampler);
+
+	// Create image view
+	vk::ImageViewCreateInfo view;
+	view.viewType = vk::ImageViewType::e2DArray;
+	view.format = format;
+	view.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, texture.mipLevels, 0, texture.layerCount };
+	view.image = texture.image;
+	texture.view = context.device.createImageView(view);
+
+	texture.descriptor.imageLayout = texture.imageLayout;
+	texture.descriptor.imageView = texture.view;
+	texture.descriptor.sampler = texture.sampler;
+	return texture;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
 uint32_t getMemoryType(vk::PhysicalDeviceMemoryProperties memoryProperties, uint32_t typeBits, vk::MemoryPropertyFlags properties, vk::Bool32 *memTypeFound = nullptr) {
 	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
 		if ((typeBits & 1) == 1) {
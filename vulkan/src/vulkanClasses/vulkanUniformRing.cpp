@@ -0,0 +1,75 @@
+#include "vulkanUniformRing.h"
+
+
+namespace vkx {
+
+	namespace {
+		vk::DeviceSize alignUp(vk::DeviceSize size, vk::DeviceSize alignment) {
+			return (size + alignment - 1) & ~(alignment - 1);
+		}
+	}
+
+
+
+	void UniformRing::prepare(vk::DeviceSize frameSize, uint32_t frameCount) {
+
+		this->alignment = context.deviceProperties.limits.minUniformBufferOffsetAlignment;
+		this->frameSize = alignUp(frameSize, alignment);
+		this->frameCount = frameCount;
+
+		// host coherent, so writes don't need to be flushed
+		// a vertex buffer too, for per instance data
+		buffer = context.createBuffer(
+			vk::BufferUsageFlagBits::eUniformBuffer | vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eVertexBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			this->frameSize * frameCount);
+
+		// stays mapped for the lifetime of the ring
+		buffer.map();
+
+		frame = 0;
+		head = 0;
+		used = 0;
+		peak = 0;
+	}
+
+	void UniformRing::destroy() {
+		buffer.destroy();
+		frameSize = 0;
+		frameCount = 0;
+	}
+
+	void UniformRing::beginFrame(uint32_t frame) {
+		assert(frame < frameCount);
+		this->frame = frame;
+		head = 0;
+		used = 0;
+	}
+
+	UniformRing::Allocation UniformRing::allocate(vk::DeviceSize size) {
+
+		vk::DeviceSize offset = alignUp(head, alignment);
+		if (offset + size > frameSize) {
+			throw std::runtime_error("Uniform ring out of space: " + std::to_string(offset + size) + " of " + std::to_string(frameSize) + " bytes per frame");
+		}
+		head = offset + size;
+
+		used = head;
+		if (used > peak) {
+			peak = used;
+		}
+
+		Allocation allocation;
+		allocation.data = (uint8_t*)buffer.mapped + frame * frameSize + offset;
+		allocation.offset = (uint32_t)offset;
+		allocation.size = size;
+		return allocation;
+	}
+
+	vk::DescriptorBufferInfo UniformRing::descriptor(uint32_t frame, vk::DeviceSize range, vk::DeviceSize offset) const {
+		assert(frame < frameCount);
+		assert(offset + range <= frameSize);
+		return vk::DescriptorBufferInfo(buffer.buffer, frame * frameSize + offset, range);
+	}
+
+}
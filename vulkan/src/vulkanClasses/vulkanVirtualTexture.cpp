@@ -0,0 +1,706 @@
+#include "vulkanVirtualTexture.h"
+
+#pragma warning(disable: 4996 4244 4267)
+#include <gli/gli.hpp>
+
+
+namespace vkx {
+
+	namespace {
+		// bc2: 4x4 texel blocks, 16 bytes each
+		const uint32_t BLOCK_DIM = 4;
+		const uint32_t BLOCK_BYTES = 16;
+
+		const uint32_t PAGE_TEXELS = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER;
+		const uint32_t PAGE_BLOCKS = PAGE_TEXELS / BLOCK_DIM;
+
+		static_assert(VT_PAGE_SIZE % BLOCK_DIM == 0 && VT_PAGE_BORDER % BLOCK_DIM == 0, "pages must be made of whole bc blocks");
+		static_assert(VT_CACHE_PAGES <= 256, "cache page coords are stored in 8 bits");
+	}
+
+
+
+	bool bakeVirtualTexture(const std::string &srcFileName, const std::string &dstFileName) {
+
+		gli::texture2d tex(gli::load(srcFileName.c_str()));
+		if (tex.empty()) {
+			return false;
+		}
+		if (tex.format() != gli::FORMAT_RGBA_DXT3_UNORM_BLOCK16 && tex.format() != gli::FORMAT_RGBA_DXT3_SRGB_BLOCK16) {
+			return false;
+		}
+
+		VirtualTextureHeader header;
+		header.width = (uint32_t)tex[0].extent().x;
+		header.height = (uint32_t)tex[0].extent().y;
+
+		// page counts per level, stop at the first level that fits into one page
+		std::vector<uint32_t> pagesX;
+		std::vector<uint32_t> pagesY;
+		for (uint32_t level = 0; level < (uint32_t)tex.levels(); ++level) {
+			uint32_t px = ((uint32_t)tex[level].extent().x + VT_PAGE_SIZE - 1) / VT_PAGE_SIZE;
+			uint32_t py = ((uint32_t)tex[level].extent().y + VT_PAGE_SIZE - 1) / VT_PAGE_SIZE;
+			pagesX.push_back(px);
+			pagesY.push_back(py);
+			header.pageCount += px * py;
+			if (px == 1 && py == 1) {
+				break;
+			}
+		}
+		header.mipLevels = (uint32_t)pagesX.size();
+
+		// every page has the same size, so the page table is just running offsets
+		uint32_t pageBytes = PAGE_BLOCKS * PAGE_BLOCKS * BLOCK_BYTES;
+		std::vector<VirtualTexturePageEntry> entries(header.pageCount);
+		uint64_t offset = sizeof(VirtualTextureHeader) + sizeof(VirtualTexturePageEntry) * header.pageCount;
+		for (auto &entry : entries) {
+			entry.offset = offset;
+			entry.size = pageBytes;
+			entry.reserved = 0;
+			offset += pageBytes;
+		}
+
+		std::ofstream file(dstFileName, std::ios::binary);
+		if (!file.is_open()) {
+			return false;
+		}
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)entries.data(), sizeof(VirtualTexturePageEntry) * entries.size());
+
+		const int32_t borderBlocks = VT_PAGE_BORDER / BLOCK_DIM;
+		const int32_t pageSizeBlocks = VT_PAGE_SIZE / BLOCK_DIM;
+
+		std::vector<uint8_t> page(pageBytes);
+
+		for (uint32_t level = 0; level < header.mipLevels; ++level) {
+			const uint8_t *src = (const uint8_t*)tex[level].data();
+			int32_t blocksW = std::max(1, ((int32_t)tex[level].extent().x + 3) / 4);
+			int32_t blocksH = std::max(1, ((int32_t)tex[level].extent().y + 3) / 4);
+
+			for (uint32_t py = 0; py < pagesY[level]; ++py) {
+				for (uint32_t px = 0; px < pagesX[level]; ++px) {
+
+					// copy the page plus its border, clamping at the edges of the level
+					for (int32_t by = 0; by < (int32_t)PAGE_BLOCKS; ++by) {
+						int32_t sy = glm::clamp((int32_t)py * pageSizeBlocks + by - borderBlocks, 0, blocksH - 1);
+						for (int32_t bx = 0; bx < (int32_t)PAGE_BLOCKS; ++bx) {
+							int32_t sx = glm::clamp((int32_t)px * pageSizeBlocks + bx - borderBlocks, 0, blocksW - 1);
+							memcpy(&page[(by * PAGE_BLOCKS + bx) * BLOCK_BYTES], src + (sy * blocksW + sx) * BLOCK_BYTES, BLOCK_BYTES);
+						}
+					}
+
+					file.write((const char*)page.data(), page.size());
+				}
+			}
+		}
+
+		return file.good();
+	}
+
+
+
+
+
+	void VirtualTextureCache::prepare(glm::uvec2 offscreenSize, uint32_t maxIndirectionEntries) {
+
+		pageBytes = PAGE_BLOCKS * PAGE_BLOCKS * BLOCK_BYTES;
+
+		// physical page cache
+		{
+			vk::ImageCreateInfo imageCreateInfo;
+			imageCreateInfo.imageType = vk::ImageType::e2D;
+			imageCreateInfo.format = vk::Format::eBc2UnormBlock;
+			imageCreateInfo.extent = vk::Extent3D{ VT_CACHE_PAGES * PAGE_TEXELS, VT_CACHE_PAGES * PAGE_TEXELS, 1 };
+			imageCreateInfo.mipLevels = 1;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+			imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+			imageCreateInfo.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+			imageCreateInfo.initialLayout = vk::ImageLayout::eUndefined;
+			cacheImage = context.createImage(imageCreateInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+			cacheImage.format = imageCreateInfo.format;
+
+			vk::ImageViewCreateInfo view;
+			view.viewType = vk::ImageViewType::e2D;
+			view.format = imageCreateInfo.format;
+			view.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+			view.image = cacheImage.image;
+			cacheImage.view = context.device.createImageView(view);
+
+			// pages are single level, so no mips and no anisotropy
+			vk::SamplerCreateInfo sampler;
+			sampler.magFilter = vk::Filter::eLinear;
+			sampler.minFilter = vk::Filter::eLinear;
+			sampler.mipmapMode = vk::SamplerMipmapMode::eNearest;
+			sampler.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+			sampler.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+			sampler.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+			sampler.maxLod = 0.0f;
+			sampler.borderColor = vk::BorderColor::eFloatOpaqueWhite;
+			cacheSampler = context.device.createSampler(sampler);
+
+			cacheDescriptor = vkx::descriptorImageInfo(cacheSampler, cacheImage.view, vk::ImageLayout::eShaderReadOnlyOptimal);
+
+			context.withPrimaryCommandBuffer([&](const vk::CommandBuffer &cmdBuffer) {
+				setImageLayout(cmdBuffer, cacheImage.image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eUndefined, vk::ImageLayout::eShaderReadOnlyOptimal);
+			});
+		}
+
+		slots.resize(VT_CACHE_PAGES * VT_CACHE_PAGES);
+		lruPositions.resize(slots.size());
+		for (uint32_t i = 0; i < slots.size(); ++i) {
+			lruPositions[i] = lru.insert(lru.end(), i);
+		}
+
+		// host visible buffers, persistently mapped
+		vk::MemoryPropertyFlags hostFlags = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+
+		indirectionCapacity = maxIndirectionEntries;
+		indirectionBuffer = context.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostFlags, indirectionCapacity * sizeof(uint32_t));
+		indirectionBuffer.map();
+		memset(indirectionBuffer.mapped, 0, indirectionCapacity * sizeof(uint32_t));
+
+		infoBuffer = context.createBuffer(vk::BufferUsageFlagBits::eStorageBuffer, hostFlags, VT_MAX_TEXTURES * sizeof(VirtualTextureInfo));
+		infoBuffer.map();
+		memset(infoBuffer.mapped, 0, VT_MAX_TEXTURES * sizeof(VirtualTextureInfo));
+
+		staging = context.createBuffer(vk::BufferUsageFlagBits::eTransferSrc, hostFlags, pageBytes * VT_MAX_UPLOADS_PER_FRAME);
+		staging.map();
+
+
+		// descriptor set
+		{
+			std::vector<vk::DescriptorSetLayoutBinding> bindings = {
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eFragment, 0),
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eStorageBuffer, vk::ShaderStageFlagBits::eFragment, 1),
+				vkx::descriptorSetLayoutBinding(vk::DescriptorType::eCombinedImageSampler, vk::ShaderStageFlagBits::eFragment, 2),
+			};
+			descriptorSetLayout = context.device.createDescriptorSetLayout(vkx::descriptorSetLayoutCreateInfo(bindings));
+
+			std::vector<vk::DescriptorPoolSize> poolSizes = {
+				vkx::descriptorPoolSize(vk::DescriptorType::eStorageBuffer, 2),
+				vkx::descriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 1),
+			};
+			descriptorPool = context.device.createDescriptorPool(vkx::descriptorPoolCreateInfo(poolSizes, 1));
+
+			descriptorSet = context.device.allocateDescriptorSets(vkx::descriptorSetAllocateInfo(descriptorPool, &descriptorSetLayout, 1))[0];
+
+			infoBuffer.setupDescriptor();
+			indirectionBuffer.setupDescriptor();
+
+			std::vector<vk::WriteDescriptorSet> writes = {
+				vkx::writeDescriptorSet(descriptorSet, vk::DescriptorType::eStorageBuffer, 0, &infoBuffer.descriptor),
+				vkx::writeDescriptorSet(descriptorSet, vk::DescriptorType::eStorageBuffer, 1, &indirectionBuffer.descriptor),
+				vkx::writeDescriptorSet(descriptorSet, vk::DescriptorType::eCombinedImageSampler, 2, &cacheDescriptor),
+			};
+			context.device.updateDescriptorSets(writes, {});
+		}
+
+
+		// feedback target
+		{
+			feedbackSize = glm::max(offscreenSize / glm::uvec2(VT_FEEDBACK_SCALE), glm::uvec2(1));
+
+			vk::ImageCreateInfo imageCreateInfo;
+			imageCreateInfo.imageType = vk::ImageType::e2D;
+			imageCreateInfo.extent = vk::Extent3D{ feedbackSize.x, feedbackSize.y, 1 };
+			imageCreateInfo.mipLevels = 1;
+			imageCreateInfo.arrayLayers = 1;
+			imageCreateInfo.samples = vk::SampleCountFlagBits::e1;
+			imageCreateInfo.tiling = vk::ImageTiling::eOptimal;
+
+			vk::ImageViewCreateInfo view;
+			view.viewType = vk::ImageViewType::e2D;
+			view.subresourceRange.levelCount = 1;
+			view.subresourceRange.layerCount = 1;
+
+			// requests
+			imageCreateInfo.format = vk::Format::eR32Uint;
+			imageCreateInfo.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+			feedbackImage = context.createImage(imageCreateInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+			feedbackImage.format = imageCreateInfo.format;
+			view.format = imageCreateInfo.format;
+			view.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eColor;
+			view.image = feedbackImage.image;
+			feedbackImage.view = context.device.createImageView(view);
+
+			// depth
+			imageCreateInfo.format = vkx::getSupportedDepthFormat(context.physicalDevice);
+			imageCreateInfo.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
+			feedbackDepth = context.createImage(imageCreateInfo, vk::MemoryPropertyFlagBits::eDeviceLocal);
+			feedbackDepth.format = imageCreateInfo.format;
+			view.format = imageCreateInfo.format;
+			view.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eDepth;
+			view.image = feedbackDepth.image;
+			feedbackDepth.view = context.device.createImageView(view);
+
+			std::array<vk::AttachmentDescription, 2> attachmentDescs;
+			attachmentDescs[0].format = feedbackImage.format;
+			attachmentDescs[0].samples = vk::SampleCountFlagBits::e1;
+			attachmentDescs[0].loadOp = vk::AttachmentLoadOp::eClear;
+			attachmentDescs[0].storeOp = vk::AttachmentStoreOp::eStore;
+			attachmentDescs[0].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+			attachmentDescs[0].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+			attachmentDescs[0].initialLayout = vk::ImageLayout::eUndefined;
+			// ready to be copied to the readback buffer
+			attachmentDescs[0].finalLayout = vk::ImageLayout::eTransferSrcOptimal;
+
+			attachmentDescs[1].format = feedbackDepth.format;
+			attachmentDescs[1].samples = vk::SampleCountFlagBits::e1;
+			attachmentDescs[1].loadOp = vk::AttachmentLoadOp::eClear;
+			attachmentDescs[1].storeOp = vk::AttachmentStoreOp::eDontCare;
+			attachmentDescs[1].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+			attachmentDescs[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+			attachmentDescs[1].initialLayout = vk::ImageLayout::eUndefined;
+			attachmentDescs[1].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+			vk::AttachmentReference colorReference{ 0, vk::ImageLayout::eColorAttachmentOptimal };
+			vk::AttachmentReference depthReference{ 1, vk::ImageLayout::eDepthStencilAttachmentOptimal };
+
+			vk::SubpassDescription subpass;
+			subpass.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+			subpass.colorAttachmentCount = 1;
+			subpass.pColorAttachments = &colorReference;
+			subpass.pDepthStencilAttachment = &depthReference;
+
+			std::array<vk::SubpassDependency, 2> dependencies;
+
+			dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+			dependencies[0].dstSubpass = 0;
+			dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eTransfer;
+			dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+			dependencies[0].srcAccessMask = vk::AccessFlagBits::eTransferRead;
+			dependencies[0].dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+
+			dependencies[1].srcSubpass = 0;
+			dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+			dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+			dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eTransfer;
+			dependencies[1].srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+			dependencies[1].dstAccessMask = vk::AccessFlagBits::eTransferRead;
+
+			vk::RenderPassCreateInfo renderPassInfo;
+			renderPassInfo.attachmentCount = static_cast<uint32_t>(attachmentDescs.size());
+			renderPassInfo.pAttachments = attachmentDescs.data();
+			renderPassInfo.subpassCount = 1;
+			renderPassInfo.pSubpasses = &subpass;
+			renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+			renderPassInfo.pDependencies = dependencies.data();
+			feedbackRenderPass = context.device.createRenderPass(renderPassInfo);
+
+			std::array<vk::ImageView, 2> attachments = { feedbackImage.view, feedbackDepth.view };
+
+			vk::FramebufferCreateInfo fbufCreateInfo;
+			fbufCreateInfo.renderPass = feedbackRenderPass;
+			fbufCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+			fbufCreateInfo.pAttachments = attachments.data();
+			fbufCreateInfo.width = feedbackSize.x;
+			fbufCreateInfo.height = feedbackSize.y;
+			fbufCreateInfo.layers = 1;
+			feedbackFramebuffer = context.device.createFramebuffer(fbufCreateInfo);
+
+			vk::DeviceSize readbackSize = feedbackSize.x * feedbackSize.y * sizeof(uint32_t);
+			feedbackReadback = context.createBuffer(vk::BufferUsageFlagBits::eTransferDst, hostFlags, readbackSize);
+			feedbackReadback.map();
+			memset(feedbackReadback.mapped, 0, readbackSize);
+		}
+
+
+		loaderRunning = true;
+		loader = std::thread(&VirtualTextureCache::loaderMain, this);
+	}
+
+
+
+	void VirtualTextureCache::destroy() {
+
+		if (loaderRunning) {
+			loaderRunning = false;
+			loaderCondition.notify_all();
+			loader.join();
+		}
+
+		if (!cacheImage.image) {
+			return;
+		}
+
+		context.device.destroyFramebuffer(feedbackFramebuffer);
+		context.device.destroyRenderPass(feedbackRenderPass);
+		feedbackImage.destroy();
+		feedbackDepth.destroy();
+		feedbackReadback.destroy();
+
+		context.device.destroyDescriptorPool(descriptorPool);
+		context.device.destroyDescriptorSetLayout(descriptorSetLayout);
+
+		staging.destroy();
+		infoBuffer.destroy();
+		indirectionBuffer.destroy();
+
+		context.device.destroySampler(cacheSampler);
+		cacheImage.destroy();
+
+		textures.clear();
+		resident.clear();
+		inFlight.clear();
+	}
+
+
+
+	uint32_t VirtualTextureCache::add(const std::string &fileName) {
+
+		std::ifstream file(fileName, std::ios::binary);
+		if (!file.is_open()) {
+			throw std::runtime_error("Unable to open virtual texture " + fileName);
+		}
+
+		VirtualTexture texture;
+		texture.fileName = fileName;
+
+		file.read((char*)&texture.header, sizeof(VirtualTextureHeader));
+		if (!file || texture.header.magic != VT_FILE_MAGIC || texture.header.version != VT_FILE_VERSION) {
+			throw std::runtime_error("Not a virtual texture: " + fileName);
+		}
+		if (texture.header.pageSize != VT_PAGE_SIZE || texture.header.pageBorder != VT_PAGE_BORDER) {
+			throw std::runtime_error("Virtual texture was baked with a different page size: " + fileName);
+		}
+		if (textures.size() >= VT_MAX_TEXTURES) {
+			throw std::runtime_error("Too many virtual textures");
+		}
+		if (indirectionEntries + texture.header.pageCount > indirectionCapacity) {
+			throw std::runtime_error("Virtual texture indirection buffer is full");
+		}
+
+		texture.pages.resize(texture.header.pageCount);
+		file.read((char*)texture.pages.data(), sizeof(VirtualTexturePageEntry) * texture.pages.size());
+
+		uint32_t offset = 0;
+		for (uint32_t mip = 0; mip < texture.header.mipLevels; ++mip) {
+			uint32_t width = std::max(1u, texture.header.width >> mip);
+			uint32_t height = std::max(1u, texture.header.height >> mip);
+			texture.mipOffsets.push_back(offset);
+			texture.mipPagesX.push_back((width + VT_PAGE_SIZE - 1) / VT_PAGE_SIZE);
+			texture.mipPagesY.push_back((height + VT_PAGE_SIZE - 1) / VT_PAGE_SIZE);
+			offset += texture.mipPagesX.back() * texture.mipPagesY.back();
+		}
+		assert(offset == texture.header.pageCount);
+
+		texture.indirectionOffset = indirectionEntries;
+		texture.indirection.assign(texture.header.pageCount, 0);
+		indirectionEntries += texture.header.pageCount;
+
+		{
+			// the loader thread reads textures
+			std::lock_guard<std::mutex> lock(loaderMutex);
+			texture.id = (uint32_t)textures.size();
+			textures.push_back(texture);
+		}
+
+		VirtualTexture &added = textures.back();
+
+		VirtualTextureInfo info;
+		info.indirectionOffset = added.indirectionOffset;
+		info.mipLevels = added.header.mipLevels;
+		info.width = added.header.width;
+		info.height = added.header.height;
+		infoBuffer.copy(info, added.id * sizeof(VirtualTextureInfo));
+
+		// load the coarsest level now and keep it resident
+		uint32_t lastMip = added.header.mipLevels - 1;
+		std::vector<LoadedPage> pages;
+		for (uint32_t y = 0; y < added.mipPagesY[lastMip]; ++y) {
+			for (uint32_t x = 0; x < added.mipPagesX[lastMip]; ++x) {
+				LoadedPage page;
+				page.key = pageKey(added.id, lastMip, x, y);
+				readPage(file, added.pages[added.pageIndex(lastMip, x, y)], page.data);
+				pages.push_back(std::move(page));
+			}
+		}
+		while (!pages.empty()) {
+			size_t count = std::min(pages.size(), (size_t)VT_MAX_UPLOADS_PER_FRAME);
+			std::vector<LoadedPage> batch(std::make_move_iterator(pages.begin()), std::make_move_iterator(pages.begin() + count));
+			pages.erase(pages.begin(), pages.begin() + count);
+			uploadPages(batch, true);
+		}
+
+		updateIndirection(added);
+
+		return added.id;
+	}
+
+
+
+	void VirtualTextureCache::recordFeedbackReadback(vk::CommandBuffer cmdBuffer) {
+		// the feedback render pass leaves the image in transfer src layout
+		vk::BufferImageCopy region;
+		region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = vk::Extent3D{ feedbackSize.x, feedbackSize.y, 1 };
+		cmdBuffer.copyImageToBuffer(feedbackImage.image, vk::ImageLayout::eTransferSrcOptimal, feedbackReadback.buffer, region);
+
+		// make the copy visible to the host
+		vk::BufferMemoryBarrier barrier;
+		barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+		barrier.buffer = feedbackReadback.buffer;
+		barrier.size = VK_WHOLE_SIZE;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		cmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, vk::DependencyFlags(), nullptr, barrier, nullptr);
+	}
+
+
+
+	void VirtualTextureCache::update() {
+
+		requestedPages = 0;
+		uploadedPages = 0;
+
+		// gather this frame's requests
+		const uint32_t *feedback = (const uint32_t*)feedbackReadback.mapped;
+		std::unordered_set<uint32_t> requests;
+		for (uint32_t i = 0; i < feedbackSize.x * feedbackSize.y; ++i) {
+			if (feedback[i] != 0) {
+				requests.insert(feedback[i]);
+			}
+		}
+		requestedPages = (uint32_t)requests.size();
+
+		std::vector<uint64_t> missing;
+		std::unordered_set<uint64_t> missingSet;
+
+		for (uint32_t request : requests) {
+			uint32_t id = (request >> 24) - 1;
+			uint32_t mip = (request >> 20) & 0xF;
+			uint32_t y = (request >> 10) & 0x3FF;
+			uint32_t x = request & 0x3FF;
+
+			if (id >= textures.size()) {
+				continue;
+			}
+			VirtualTexture &texture = textures[id];
+			if (mip >= texture.header.mipLevels) {
+				continue;
+			}
+			if (x >= texture.mipPagesX[mip] || y >= texture.mipPagesY[mip]) {
+				continue;
+			}
+
+			// the page and every coarser page it falls back to
+			for (uint32_t m = mip; m < texture.header.mipLevels; ++m) {
+				uint32_t px = std::min(x, texture.mipPagesX[m] - 1);
+				uint32_t py = std::min(y, texture.mipPagesY[m] - 1);
+				uint64_t key = pageKey(id, m, px, py);
+
+				auto it = resident.find(key);
+				if (it != resident.end()) {
+					touch(it->second);
+				} else if (inFlight.find(key) == inFlight.end() && missingSet.insert(key).second) {
+					missing.push_back(key);
+				}
+				x >>= 1;
+				y >>= 1;
+			}
+		}
+
+		// coarse pages first, so the fallback gets better quickly
+		std::sort(missing.begin(), missing.end(), [](uint64_t a, uint64_t b) {
+			return ((a >> 40) & 0xFF) > ((b >> 40) & 0xFF);
+		});
+		if (missing.size() > VT_MAX_REQUESTS_PER_FRAME) {
+			missing.resize(VT_MAX_REQUESTS_PER_FRAME);
+		}
+
+		std::vector<LoadedPage> pages;
+		{
+			std::lock_guard<std::mutex> lock(loaderMutex);
+			for (uint64_t key : missing) {
+				loadQueue.push_back(key);
+				inFlight.insert(key);
+			}
+
+			while (!loadedPages.empty() && pages.size() < VT_MAX_UPLOADS_PER_FRAME) {
+				pages.push_back(std::move(loadedPages.front()));
+				loadedPages.pop_front();
+			}
+		}
+		if (!missing.empty()) {
+			loaderCondition.notify_one();
+		}
+
+		for (auto &page : pages) {
+			inFlight.erase(page.key);
+		}
+		uploadPages(pages, false);
+
+		for (auto &texture : textures) {
+			if (texture.indirectionDirty) {
+				updateIndirection(texture);
+			}
+		}
+	}
+
+
+
+	void VirtualTextureCache::loaderMain() {
+
+		// one open file per texture
+		std::unordered_map<uint32_t, std::unique_ptr<std::ifstream>> files;
+
+		while (true) {
+
+			uint64_t key;
+			std::string fileName;
+			VirtualTexturePageEntry entry;
+			{
+				std::unique_lock<std::mutex> lock(loaderMutex);
+				loaderCondition.wait(lock, [this] { return !loadQueue.empty() || !loaderRunning; });
+				if (!loaderRunning) {
+					return;
+				}
+				key = loadQueue.front();
+				loadQueue.pop_front();
+
+				uint32_t id, mip, x, y;
+				decodeKey(key, id, mip, x, y);
+				const VirtualTexture &texture = textures[id];
+				fileName = texture.fileName;
+				entry = texture.pages[texture.pageIndex(mip, x, y)];
+			}
+
+			uint32_t id = (uint32_t)(key >> 48);
+			auto &file = files[id];
+			if (!file) {
+				file.reset(new std::ifstream(fileName, std::ios::binary));
+			}
+
+			LoadedPage page;
+			page.key = key;
+			readPage(*file, entry, page.data);
+
+			{
+				std::lock_guard<std::mutex> lock(loaderMutex);
+				loadedPages.push_back(std::move(page));
+			}
+		}
+	}
+
+
+
+	void VirtualTextureCache::touch(uint32_t slot) {
+		lru.splice(lru.begin(), lru, lruPositions[slot]);
+	}
+
+
+
+	uint32_t VirtualTextureCache::allocateSlot() {
+		// least recently used page that isn't pinned
+		for (auto it = lru.rbegin(); it != lru.rend(); ++it) {
+			uint32_t slot = *it;
+			if (slots[slot].pinned) {
+				continue;
+			}
+
+			if (slots[slot].key != UINT64_MAX) {
+				uint32_t id, mip, x, y;
+				decodeKey(slots[slot].key, id, mip, x, y);
+				resident.erase(slots[slot].key);
+				textures[id].indirectionDirty = true;
+				slots[slot].key = UINT64_MAX;
+				residentPages--;
+				evictedPages++;
+			}
+			return slot;
+		}
+		return UINT32_MAX;
+	}
+
+
+
+	void VirtualTextureCache::readPage(std::ifstream &file, const VirtualTexturePageEntry &entry, std::vector<uint8_t> &data) {
+		data.resize(entry.size);
+		file.seekg(entry.offset);
+		file.read((char*)data.data(), entry.size);
+	}
+
+
+
+	void VirtualTextureCache::uploadPages(std::vector<LoadedPage> &pages, bool pin) {
+
+		assert(pages.size() <= VT_MAX_UPLOADS_PER_FRAME);
+
+		std::vector<vk::BufferImageCopy> regions;
+
+		for (auto &page : pages) {
+			if (resident.find(page.key) != resident.end()) {
+				continue;
+			}
+
+			uint32_t slot = allocateSlot();
+			if (slot == UINT32_MAX) {
+				// every slot is pinned, the cache is too small for the number of textures
+				break;
+			}
+
+			vk::DeviceSize offset = regions.size() * pageBytes;
+			staging.copy(page.data.size(), page.data.data(), offset);
+
+			vk::BufferImageCopy region;
+			region.bufferOffset = offset;
+			region.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset = vk::Offset3D{ (int32_t)((slot % VT_CACHE_PAGES) * PAGE_TEXELS), (int32_t)((slot / VT_CACHE_PAGES) * PAGE_TEXELS), 0 };
+			region.imageExtent = vk::Extent3D{ PAGE_TEXELS, PAGE_TEXELS, 1 };
+			regions.push_back(region);
+
+			slots[slot].key = page.key;
+			slots[slot].pinned = pin;
+			resident[page.key] = slot;
+			touch(slot);
+			residentPages++;
+
+			textures[(uint32_t)(page.key >> 48)].indirectionDirty = true;
+		}
+
+		if (regions.empty()) {
+			return;
+		}
+
+		context.withPrimaryCommandBuffer([&](const vk::CommandBuffer &cmdBuffer) {
+			setImageLayout(cmdBuffer, cacheImage.image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageLayout::eTransferDstOptimal);
+			cmdBuffer.copyBufferToImage(staging.buffer, cacheImage.image, vk::ImageLayout::eTransferDstOptimal, regions);
+			setImageLayout(cmdBuffer, cacheImage.image, vk::ImageAspectFlagBits::eColor, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+		});
+
+		uploadedPages += (uint32_t)regions.size();
+	}
+
+
+
+	void VirtualTextureCache::updateIndirection(VirtualTexture &texture) {
+
+		// coarsest first, missing pages point at their parent's entry
+		for (int32_t mip = (int32_t)texture.header.mipLevels - 1; mip >= 0; --mip) {
+			for (uint32_t y = 0; y < texture.mipPagesY[mip]; ++y) {
+				for (uint32_t x = 0; x < texture.mipPagesX[mip]; ++x) {
+					uint32_t entry = 0;
+
+					auto it = resident.find(pageKey(texture.id, mip, x, y));
+					if (it != resident.end()) {
+						entry = encodeIndirection(it->second % VT_CACHE_PAGES, it->second / VT_CACHE_PAGES, mip);
+					} else if (mip + 1 < (int32_t)texture.header.mipLevels) {
+						uint32_t px = std::min(x / 2, texture.mipPagesX[mip + 1] - 1);
+						uint32_t py = std::min(y / 2, texture.mipPagesY[mip + 1] - 1);
+						entry = texture.indirection[texture.pageIndex(mip + 1, px, py)];
+					}
+
+					texture.indirection[texture.pageIndex(mip, x, y)] = entry;
+				}
+			}
+		}
+
+		indirectionBuffer.copy(texture.indirection, texture.indirectionOffset * sizeof(uint32_t));
+		texture.indirectionDirty = false;
+	}
+
+}
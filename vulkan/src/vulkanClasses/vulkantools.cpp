@@ -331,6 +331,96 @@ namespace vkx {
 		exit(1);
 	}
 
+	// xxHash64, see https://github.com/Cyan4973/xxHash
+	namespace {
+		const uint64_t XXH_PRIME64_1 = 11400714785074694791ULL;
+		const uint64_t XXH_PRIME64_2 = 14029467366897019727ULL;
+		const uint64_t XXH_PRIME64_3 = 1609587929392839161ULL;
+		const uint64_t XXH_PRIME64_4 = 9650029242287828579ULL;
+		const uint64_t XXH_PRIME64_5 = 2870177450012600261ULL;
+
+		inline uint64_t xxhRotl(uint64_t x, int r) {
+			return (x << r) | (x >> (64 - r));
+		}
+
+		inline uint64_t xxhRead64(const uint8_t* p) {
+			uint64_t v;
+			memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		inline uint32_t xxhRead32(const uint8_t* p) {
+			uint32_t v;
+			memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+			acc += input * XXH_PRIME64_2;
+			acc = xxhRotl(acc, 31);
+			return acc * XXH_PRIME64_1;
+		}
+
+		inline uint64_t xxhMergeRound(uint64_t acc, uint64_t val) {
+			acc ^= xxhRound(0, val);
+			return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+		}
+	}
+
+	uint64_t hash64(const void* data, size_t size, uint64_t seed) {
+		const uint8_t* p = (const uint8_t*)data;
+		const uint8_t* end = p + size;
+		uint64_t h;
+
+		if (size >= 32) {
+			const uint8_t* limit = end - 32;
+			uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+			uint64_t v2 = seed + XXH_PRIME64_2;
+			uint64_t v3 = seed;
+			uint64_t v4 = seed - XXH_PRIME64_1;
+			do {
+				v1 = xxhRound(v1, xxhRead64(p)); p += 8;
+				v2 = xxhRound(v2, xxhRead64(p)); p += 8;
+				v3 = xxhRound(v3, xxhRead64(p)); p += 8;
+				v4 = xxhRound(v4, xxhRead64(p)); p += 8;
+			} while (p <= limit);
+
+			h = xxhRotl(v1, 1) + xxhRotl(v2, 7) + xxhRotl(v3, 12) + xxhRotl(v4, 18);
+			h = xxhMergeRound(h, v1);
+			h = xxhMergeRound(h, v2);
+			h = xxhMergeRound(h, v3);
+			h = xxhMergeRound(h, v4);
+		} else {
+			h = seed + XXH_PRIME64_5;
+		}
+
+		h += (uint64_t)size;
+
+		while (p + 8 <= end) {
+			h ^= xxhRound(0, xxhRead64(p));
+			h = xxhRotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+			p += 8;
+		}
+		if (p + 4 <= end) {
+			h ^= (uint64_t)xxhRead32(p) * XXH_PRIME64_1;
+			h = xxhRotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+			p += 4;
+		}
+		while (p < end) {
+			h ^= (*p) * XXH_PRIME64_5;
+			h = xxhRotl(h, 11) * XXH_PRIME64_1;
+			p++;
+		}
+
+		// avalanche
+		h ^= h >> 33;
+		h *= XXH_PRIME64_2;
+		h ^= h >> 29;
+		h *= XXH_PRIME64_3;
+		h ^= h >> 32;
+		return h;
+	}
+
 	std::vector<uint8_t> readBinaryFile(const std::string& filename) {
 		// open the file:
 		std::ifstream file(filename, std::ios::binary);